@@ -231,6 +231,23 @@ blob_overwrite_intptr (struct blob *blob,
    return blob_overwrite_bytes(blob, offset, &value, sizeof(value));
 }
 
+bool
+blob_write_uleb128(struct blob *blob, uint32_t value)
+{
+   uint8_t bytes[5];
+   unsigned size = 0;
+
+   do {
+      bytes[size] = value & 0x7f;
+      value >>= 7;
+      if (value)
+         bytes[size] |= 0x80;
+      size++;
+   } while (value);
+
+   return blob_write_bytes(blob, bytes, size);
+}
+
 bool
 blob_write_string(struct blob *blob, const char *str)
 {
@@ -356,6 +373,28 @@ blob_read_intptr(struct blob_reader *blob)
    return ret;
 }
 
+uint32_t
+blob_read_uleb128(struct blob_reader *blob)
+{
+   uint32_t ret = 0;
+
+   for (unsigned shift = 0; shift < 35; shift += 7) {
+      if (! ensure_can_read(blob, 1))
+         return 0;
+
+      uint8_t byte = *blob->current++;
+      ret |= (uint32_t) (byte & 0x7f) << shift;
+
+      if (!(byte & 0x80))
+         return ret;
+   }
+
+   /* More than five bytes can't come from a uint32_t */
+   blob->overrun = true;
+
+   return 0;
+}
+
 char *
 blob_read_string(struct blob_reader *blob)
 {
@@ -252,6 +252,17 @@ blob_overwrite_intptr(struct blob *blob,
                       size_t offset,
                       intptr_t value);
 
+/**
+ * Add a uint32_t to a blob as an unsigned LEB128 variable-length integer.
+ *
+ * Values below 128 take a single byte and no value takes more than five.
+ * No alignment padding is added before the value.
+ *
+ * \return True unless allocation failed.
+ */
+bool
+blob_write_uleb128(struct blob *blob, uint32_t value);
+
 /**
  * Add a NULL-terminated string to a blob, (including the NULL terminator).
  *
@@ -336,6 +347,16 @@ blob_read_uint64(struct blob_reader *blob);
 intptr_t
 blob_read_intptr(struct blob_reader *blob);
 
+/**
+ * Read a uint32_t written by blob_write_uleb128 from the current location,
+ * (and update the current location to just past it).
+ *
+ * \return The uint32_t read, or 0 (with overrun set) if the data is
+ * truncated or isn't a valid encoding.
+ */
+uint32_t
+blob_read_uleb128(struct blob_reader *blob);
+
 /**
  * Read a NULL-terminated string from the current location, (and update the
  * current location to just past this string).
@@ -267,6 +267,50 @@ test_overrun(void)
    blob_finish(&blob);
 }
 
+/* Test the variable-length encoding at its size boundaries, and that
+ * truncated or overlong encodings are reported as overruns.
+ */
+static void
+test_uleb128(void)
+{
+   static const uint32_t values[] = {
+      0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0x1fffff, 0x200000,
+      0xfffffff, 0x10000000, 0xffffffff,
+   };
+   static const unsigned sizes[] = { 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5 };
+   struct blob blob;
+   struct blob_reader reader;
+
+   blob_init(&blob);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(values); i++) {
+      size_t size = blob.size;
+      blob_write_uleb128(&blob, values[i]);
+      expect_equal(sizes[i], blob.size - size, "blob_write_uleb128 size");
+   }
+
+   blob_reader_init(&reader, blob.data, blob.size);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(values); i++) {
+      expect_equal(values[i], blob_read_uleb128(&reader),
+                   "blob_write/read_uleb128");
+   }
+   expect_equal(false, reader.overrun, "uleb128 read does not overrun");
+
+   /* Drop the last byte of the final value */
+   blob_reader_init(&reader, blob.data, blob.size - 1);
+   reader.current = reader.end - 4;
+   expect_equal(0, blob_read_uleb128(&reader), "truncated uleb128");
+   expect_equal(true, reader.overrun, "truncated uleb128 overruns");
+
+   blob_finish(&blob);
+
+   static const uint8_t overlong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+   blob_reader_init(&reader, overlong, sizeof(overlong));
+   expect_equal(0, blob_read_uleb128(&reader), "overlong uleb128");
+   expect_equal(true, reader.overrun, "overlong uleb128 overruns");
+}
+
 /* Test that we can read and write some large objects, (exercising the code in
  * the blob_write functions to realloc blob->data.
  */
@@ -318,6 +362,7 @@ main (void)
    test_write_and_read_functions ();
    test_alignment ();
    test_overrun ();
+   test_uleb128 ();
    test_big_objects ();
 
    return error ? 1 : 0;
@@ -34,9 +34,13 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
+#include "util/disk_cache_archive.h"
+#include "util/disk_cache_codec.h"
+#include "util/u_queue.h"
 
 bool error = false;
 
@@ -493,6 +497,294 @@ test_put_key_and_get_key(void)
 
    disk_cache_destroy(cache);
 }
+
+/* Fill \data with incompressible bytes, so that the size of the items in the
+ * cache is predictable.
+ */
+static void
+fill_random(uint8_t *data, size_t size, uint32_t seed)
+{
+   uint32_t x = seed * 2654435761u + 1;
+
+   for (size_t i = 0; i < size; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      data[i] = x;
+   }
+}
+
+static bool
+cache_item_matches(struct disk_cache *cache, const cache_key key,
+                   const uint8_t *data, size_t size)
+{
+   size_t result_size;
+   uint8_t *result = disk_cache_get(cache, key, &result_size);
+   bool match = result && result_size == size &&
+                memcmp(result, data, size) == 0;
+
+   free(result);
+   return match;
+}
+
+#define DB_ITEM_SIZE (8 * 1024)
+#define DB_ITEMS 8
+
+static void
+test_database(void)
+{
+   struct disk_cache *cache;
+   uint8_t data[DB_ITEMS][DB_ITEM_SIZE];
+   uint8_t keys[DB_ITEMS][20];
+   uint8_t churn[DB_ITEM_SIZE];
+   uint8_t churn_key[20];
+   struct stat sb;
+   unsigned i;
+   int err;
+
+   setenv("MESA_DISK_CACHE_DATABASE", "true", 1);
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/database", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "64K", 1);
+
+   mkdir(CACHE_TEST_TMP, 0755);
+   cache = disk_cache_create("test", "make_check", 0);
+   expect_non_null(cache, "disk_cache_create with MESA_DISK_CACHE_DATABASE");
+
+   for (i = 0; i < DB_ITEMS; i++) {
+      fill_random(data[i], DB_ITEM_SIZE, i);
+      disk_cache_compute_key(cache, data[i], DB_ITEM_SIZE, keys[i]);
+   }
+
+   /* Six items fit in 64K. */
+   for (i = 0; i < 6; i++)
+      disk_cache_put(cache, keys[i], data[i], DB_ITEM_SIZE, NULL);
+   disk_cache_wait_for_idle(cache);
+
+   for (i = 0; i < 6; i++) {
+      expect_true(cache_item_matches(cache, keys[i], data[i], DB_ITEM_SIZE),
+                  "database get of stored item");
+   }
+
+   /* Using item 0 makes item 1 the least recently used one. */
+   expect_true(cache_item_matches(cache, keys[0], data[0], DB_ITEM_SIZE),
+               "database get of first item");
+   disk_cache_put(cache, keys[6], data[6], DB_ITEM_SIZE, NULL);
+   disk_cache_put(cache, keys[7], data[7], DB_ITEM_SIZE, NULL);
+   disk_cache_wait_for_idle(cache);
+
+   expect_true(does_cache_contain(cache, keys[0]),
+               "database keeps recently used item");
+   expect_true(!does_cache_contain(cache, keys[1]),
+               "database evicts least recently used item");
+   expect_true(does_cache_contain(cache, keys[2]),
+               "database only evicts as much as needed");
+   expect_true(cache_item_matches(cache, keys[7], data[7], DB_ITEM_SIZE),
+               "database get of item added after eviction");
+
+   disk_cache_remove(cache, keys[2]);
+   expect_true(!does_cache_contain(cache, keys[2]),
+               "database get of removed item");
+
+   /* Everything is persistent. */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   expect_true(cache_item_matches(cache, keys[0], data[0], DB_ITEM_SIZE),
+               "database get after reopening");
+   expect_true(cache_item_matches(cache, keys[7], data[7], DB_ITEM_SIZE),
+               "2nd database get after reopening");
+
+   /* Keep evicting, the data file must be compacted along the way. */
+   for (i = 0; i < 64; i++) {
+      fill_random(churn, DB_ITEM_SIZE, 1000 + i);
+      disk_cache_compute_key(cache, churn, DB_ITEM_SIZE, churn_key);
+      disk_cache_put(cache, churn_key, churn, DB_ITEM_SIZE, NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+
+   expect_true(cache_item_matches(cache, churn_key, churn, DB_ITEM_SIZE),
+               "database get after compaction");
+   expect_true(!does_cache_contain(cache, keys[7]),
+               "database evicts old items");
+
+   err = stat(CACHE_TEST_TMP "/database/" CACHE_DIR_NAME "/packed.data", &sb);
+   expect_equal(err, 0, "database data file exists");
+   expect_true(sb.st_size <= 3 * 64 * 1024,
+               "database data file is compacted");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_DATABASE");
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+#define CODEC_ITEM_SIZE 4096
+
+static void
+test_codecs_and_batch(void)
+{
+   struct disk_cache *cache;
+   struct disk_cache_batch_entry entries[DISK_CACHE_CODEC_COUNT + 1];
+   struct util_queue_fence fence;
+   uint8_t data[DISK_CACHE_CODEC_COUNT][CODEC_ITEM_SIZE];
+   unsigned i;
+
+   memset(entries, 0, sizeof(entries));
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/codecs", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+
+   /* Write one item with each codec. */
+   for (i = 0; i < DISK_CACHE_CODEC_COUNT; i++) {
+      if (!disk_cache_codec_supported(i))
+         continue;
+
+      setenv("MESA_DISK_CACHE_CODEC", disk_cache_codec_name(i), 1);
+      cache = disk_cache_create("test", "make_check", 0);
+
+      /* Half random, half zeroes, so that there is something to compress. */
+      memset(data[i], 0, CODEC_ITEM_SIZE);
+      fill_random(data[i], CODEC_ITEM_SIZE / 2, 100 + i);
+      disk_cache_compute_key(cache, data[i], CODEC_ITEM_SIZE, entries[i].key);
+      disk_cache_put(cache, entries[i].key, data[i], CODEC_ITEM_SIZE, NULL);
+      disk_cache_wait_for_idle(cache);
+      disk_cache_destroy(cache);
+   }
+
+   /* All of them can be read back, whatever codec is currently selected. */
+   setenv("MESA_DISK_CACHE_CODEC", "none", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   memset(entries[DISK_CACHE_CODEC_COUNT].key, 0xff, sizeof(cache_key));
+
+   util_queue_fence_init(&fence);
+   disk_cache_get_batch(cache, entries, ARRAY_SIZE(entries), &fence);
+   util_queue_fence_wait(&fence);
+
+   for (i = 0; i < DISK_CACHE_CODEC_COUNT; i++) {
+      if (!disk_cache_codec_supported(i))
+         continue;
+
+      expect_true(entries[i].data && entries[i].size == CODEC_ITEM_SIZE &&
+                  memcmp(entries[i].data, data[i], CODEC_ITEM_SIZE) == 0,
+                  disk_cache_codec_name(i));
+      free(entries[i].data);
+   }
+   expect_null(entries[DISK_CACHE_CODEC_COUNT].data,
+               "disk_cache_get_batch of missing item");
+
+   util_queue_fence_destroy(&fence);
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_CODEC");
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+/* Read the file the one file per item cache stores \key in. */
+static void *
+read_cache_item_file(const char *cache_dir, const cache_key key, size_t *size)
+{
+   char hex[CACHE_KEY_SIZE * 2 + 1], *filename;
+   struct stat sb;
+   void *data;
+   FILE *f;
+
+   disk_cache_format_hex_id(hex, key, CACHE_KEY_SIZE * 2);
+   if (asprintf(&filename, "%s/" CACHE_DIR_NAME "/%c%c/%s",
+                cache_dir, hex[0], hex[1], hex + 2) == -1)
+      return NULL;
+
+   f = fopen(filename, "rb");
+   free(filename);
+   if (!f)
+      return NULL;
+
+   data = NULL;
+   if (fstat(fileno(f), &sb) == 0) {
+      data = malloc(sb.st_size);
+      if (data && fread(data, 1, sb.st_size, f) != sb.st_size) {
+         free(data);
+         data = NULL;
+      }
+      *size = sb.st_size;
+   }
+   fclose(f);
+
+   return data;
+}
+
+static void
+test_archive(void)
+{
+   struct disk_cache *cache;
+   struct disk_cache_archive_item items[2];
+   char blob[] = "This is a blob of thirty-seven bytes";
+   char string[] = "While this string has thirty-four";
+   cache_key blob_key, string_key, missing_key;
+   char hex[CACHE_KEY_SIZE * 2 + 1];
+   char *result, *filename;
+   size_t size;
+   bool ok;
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/archive-src", 1);
+   setenv("MESA_DISK_CACHE_CODEC", "zlib", 1);
+
+   /* Build an archive out of the files of a regular cache. */
+   cache = disk_cache_create("test", "make_check", 0);
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+   disk_cache_wait_for_idle(cache);
+   disk_cache_destroy(cache);
+
+   memcpy(items[0].key, string_key, sizeof(cache_key));
+   items[0].data = read_cache_item_file(CACHE_TEST_TMP "/archive-src",
+                                        string_key, &items[0].size);
+   memcpy(items[1].key, blob_key, sizeof(cache_key));
+   items[1].data = read_cache_item_file(CACHE_TEST_TMP "/archive-src",
+                                        blob_key, &items[1].size);
+   expect_true(items[0].data && items[1].data, "read cache item files");
+
+   ok = disk_cache_archive_write(CACHE_TEST_TMP "/test.archive", items, 2);
+   expect_true(ok, "disk_cache_archive_write");
+   free((void *) items[0].data);
+   free((void *) items[1].data);
+
+   /* Use it with an empty cache. */
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/archive-dst", 1);
+   setenv("MESA_DISK_CACHE_ARCHIVE", CACHE_TEST_TMP "/test.archive", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "disk_cache_get of archived blob");
+   expect_equal(size, sizeof(blob), "size of archived blob");
+   free(result);
+
+   result = disk_cache_get(cache, string_key, &size);
+   expect_equal_str(string, result, "disk_cache_get of archived string");
+   free(result);
+
+   memset(missing_key, 0x42, sizeof(missing_key));
+   expect_null(disk_cache_get(cache, missing_key, NULL),
+               "disk_cache_get of item missing from archive");
+
+   /* Archived items aren't copied to the user's cache. */
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+   disk_cache_format_hex_id(hex, blob_key, CACHE_KEY_SIZE * 2);
+   if (asprintf(&filename, CACHE_TEST_TMP "/archive-dst/" CACHE_DIR_NAME
+                "/%c%c/%s", hex[0], hex[1], hex + 2) != -1) {
+      expect_true(access(filename, F_OK) == -1,
+                  "disk_cache_put of archived item");
+      free(filename);
+   }
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_ARCHIVE");
+   unsetenv("MESA_DISK_CACHE_CODEC");
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 int
@@ -507,6 +799,12 @@ main(void)
 
    test_put_key_and_get_key();
 
+   test_database();
+
+   test_codecs_and_batch();
+
+   test_archive();
+
    err = rmrf_local(CACHE_TEST_TMP);
    expect_equal(err, 0, "Removing " CACHE_TEST_TMP " again");
 #endif /* ENABLE_SHADER_CACHE */
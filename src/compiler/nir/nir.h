@@ -2282,6 +2282,9 @@ typedef struct nir_shader {
     */
    void *constant_data;
    unsigned constant_data_size;
+
+   /** Per-shader pass statistics, see nir_pass_stats_enable() */
+   struct nir_shader_pass_stats *pass_stats;
 } nir_shader;
 
 #define nir_foreach_function(func, shader) \
@@ -2831,6 +2834,49 @@ static inline bool should_serialize_deserialize_nir(void) { return false; }
 static inline bool should_print_nir(void) { return false; }
 #endif /* NDEBUG */
 
+/** Pass statistics
+ *
+ * When enabled, NIR_PASS and NIR_PASS_V record the time spent in each pass,
+ * how often it made progress and the instruction count before and after,
+ * summed per pass for the whole process and, with NIR_PASS_STATS_SHADERS,
+ * for each shader.  This is enabled by setting NIR_PASS_STATS to a comma
+ * separated list of the flags below ("table", "json", "shaders"), or with
+ * nir_pass_stats_enable().  The statistics are dumped at exit, to stderr or
+ * to NIR_PASS_STATS_FILE, if "table" or "json" is set.
+ */
+enum nir_pass_stats_flags {
+   NIR_PASS_STATS_RECORD  = (1 << 0),
+   NIR_PASS_STATS_TABLE   = (1 << 1),
+   NIR_PASS_STATS_JSON    = (1 << 2),
+   NIR_PASS_STATS_SHADERS = (1 << 3),
+};
+
+typedef struct {
+   uint64_t start;
+   unsigned num_instrs;
+} nir_pass_stats_sample;
+
+/* -1 until NIR_PASS_STATS is read, then a nir_pass_stats_flags mask */
+extern int nir_pass_stats_mode;
+
+void nir_pass_stats_init(void);
+void nir_pass_stats_enable(unsigned flags);
+void nir_pass_stats_begin(nir_shader *shader, nir_pass_stats_sample *sample);
+void nir_pass_stats_end(nir_shader *shader, const char *pass,
+                        const nir_pass_stats_sample *sample, int progress);
+void nir_pass_stats_dump(FILE *fp, bool json);
+void nir_pass_stats_reset(void);
+void nir_shader_pass_stats_move(nir_shader *dst, nir_shader *src);
+
+static inline bool
+should_record_nir_pass_stats(void)
+{
+   if (unlikely(nir_pass_stats_mode < 0))
+      nir_pass_stats_init();
+
+   return unlikely(nir_pass_stats_mode != 0);
+}
+
 #define _PASS(pass, nir, do_pass) do {                               \
    if (should_skip_nir(#pass)) {                                     \
       printf("skipping %s\n", #pass);                                \
@@ -2840,6 +2886,7 @@ static inline bool should_print_nir(void) { return false; }
    nir_validate_shader(nir, "after " #pass);                         \
    if (should_clone_nir()) {                                         \
       nir_shader *clone = nir_shader_clone(ralloc_parent(nir), nir); \
+      nir_shader_pass_stats_move(clone, nir);                        \
       ralloc_free(nir);                                              \
       nir = clone;                                                   \
    }                                                                 \
@@ -2850,10 +2897,17 @@ static inline bool should_print_nir(void) { return false; }
 } while (0)
 
 #define NIR_PASS(progress, nir, pass, ...) _PASS(pass, nir,          \
+   nir_pass_stats_sample _pass_stats;                                \
+   const bool _record_stats = should_record_nir_pass_stats();        \
    nir_metadata_set_validation_flag(nir);                            \
    if (should_print_nir())                                           \
       printf("%s\n", #pass);                                         \
-   if (pass(nir, ##__VA_ARGS__)) {                                   \
+   if (_record_stats)                                                \
+      nir_pass_stats_begin(nir, &_pass_stats);                       \
+   const bool _pass_progress = pass(nir, ##__VA_ARGS__);             \
+   if (_record_stats)                                                \
+      nir_pass_stats_end(nir, #pass, &_pass_stats, _pass_progress);  \
+   if (_pass_progress) {                                             \
       progress = true;                                               \
       if (should_print_nir())                                        \
          nir_print_shader(nir, stdout);                              \
@@ -2862,9 +2916,15 @@ static inline bool should_print_nir(void) { return false; }
 )
 
 #define NIR_PASS_V(nir, pass, ...) _PASS(pass, nir,                  \
+   nir_pass_stats_sample _pass_stats;                                \
+   const bool _record_stats = should_record_nir_pass_stats();        \
    if (should_print_nir())                                           \
       printf("%s\n", #pass);                                         \
+   if (_record_stats)                                                \
+      nir_pass_stats_begin(nir, &_pass_stats);                       \
    pass(nir, ##__VA_ARGS__);                                         \
+   if (_record_stats)                                                \
+      nir_pass_stats_end(nir, #pass, &_pass_stats, -1);              \
    if (should_print_nir())                                           \
       nir_print_shader(nir, stdout);                                 \
 )
@@ -3309,6 +3369,16 @@ bool nir_opt_large_constants(nir_shader *shader,
                              glsl_type_size_align_func size_align,
                              unsigned threshold);
 
+bool nir_opt_licm(nir_shader *shader, unsigned max_live);
+
+typedef bool (*nir_should_vectorize_mem_func)(unsigned align, unsigned bit_size,
+                                              unsigned num_components,
+                                              nir_intrinsic_instr *low,
+                                              nir_intrinsic_instr *high);
+
+bool nir_opt_load_store_vectorize(nir_shader *shader, nir_variable_mode modes,
+                                  nir_should_vectorize_mem_func callback);
+
 bool nir_opt_loop_unroll(nir_shader *shader, nir_variable_mode indirect_mask);
 
 bool nir_opt_move_comparisons(nir_shader *shader);
@@ -51,6 +51,22 @@ conv_opcode_types = {
     'f2b' : 'bool',
 }
 
+# The sizes of the NIR opcodes each of the conversion opcodes above matches.
+# This must agree with nir_search_op_for_nir_op().
+conv_opcode_sizes = {
+    'i2f' : (16, 32, 64),
+    'u2f' : (16, 32, 64),
+    'f2f' : (16, 32, 64),
+    'f2u' : (8, 16, 32, 64),
+    'f2i' : (8, 16, 32, 64),
+    'u2u' : (8, 16, 32, 64),
+    'i2i' : (8, 16, 32, 64),
+    'b2f' : (16, 32, 64),
+    'b2i' : (8, 16, 32, 64),
+    'i2b' : (1, 32),
+    'f2b' : (1, 32),
+}
+
 if sys.version_info < (3, 0):
     integer_types = (int, long)
     string_type = unicode
@@ -654,6 +670,226 @@ class SearchAndReplace(object):
 
       BitSizeValidator(varset).validate(self.search, self.replace)
 
+def search_opcode(opcode):
+   """Returns the opcode the automaton tables are indexed by for a given
+   opcode of a search expression.  Sized conversion opcodes like f2b32 are
+   folded into their generic search opcode, the same way
+   nir_search_op_for_nir_op() does at run time.
+   """
+   stripped = opcode.rstrip('0123456789')
+   if stripped in conv_opcode_types and stripped != opcode and \
+      int(opcode[len(stripped):]) in conv_opcode_sizes[stripped]:
+      return stripped
+   return opcode
+
+class TreeAutomaton(object):
+   """A bottom-up tree automaton matching the search expressions of a pass.
+
+   Every SSA value gets a state, computed from the opcode of the instruction
+   that defines it and the states of its sources with one table lookup per
+   source.  A state is the set of subexpressions of the search patterns that
+   the value may match, so the transforms that can possibly apply to an
+   instruction are known from its state alone, and nir_replace_instr() is
+   only called for those.
+
+   The automaton only looks at opcodes and at whether a value is a constant.
+   Everything else (constant values, bit sizes, swizzles, variables that
+   appear more than once, conditions) is still checked by nir_replace_instr(),
+   so the set of transforms of a state is a superset of the ones that match.
+
+   This is the frontier-to-root deterministic automaton with symbol filtering
+   from "Tree Algorithms: Two Taxonomies and a Toolkit" (Cleophas, 2008).
+   Filtering maps each state to the subset of it that can be a source of a
+   given opcode before doing the transition, which keeps both the time spent
+   here and the size of the tables reasonable.
+   """
+   def __init__(self, transforms):
+      self.patterns = [t.search for t in transforms]
+      self._compute_items()
+      self._build_table()
+
+   class IndexMap(object):
+      """A list of unique objects with a constant time index()."""
+      def __init__(self, iterable=()):
+         self.objects = []
+         self.map = {}
+         for obj in iterable:
+            self.add(obj)
+
+      def __getitem__(self, i):
+         return self.objects[i]
+
+      def __contains__(self, obj):
+         return obj in self.map
+
+      def __len__(self):
+         return len(self.objects)
+
+      def __iter__(self):
+         return iter(self.objects)
+
+      def clear(self):
+         self.objects = []
+         self.map.clear()
+
+      def index(self, obj):
+         return self.map[obj]
+
+      def add(self, obj):
+         if obj in self.map:
+            return self.map[obj]
+         else:
+            index = len(self.objects)
+            self.objects.append(obj)
+            self.map[obj] = index
+            return index
+
+   class Item(object):
+      """A subexpression of one or more search patterns, keeping only the
+      opcodes.  Identical subexpressions are shared between patterns.
+      """
+      def __init__(self, opcode, children):
+         self.opcode = opcode
+         self.children = children
+         # Indices of the patterns this item is the root of.
+         self.patterns = []
+         # Opcodes of the expressions this item is a source of.
+         self.parent_ops = set()
+
+      def __str__(self):
+         return '(' + ', '.join([self.opcode] + [str(c) for c in self.children]) + ')'
+
+   def _compute_items(self):
+      # Map from (opcode, children) to item.  Commutative expressions are
+      # entered with their sources in both orders.
+      self.items = {}
+
+      # The opcodes used by the patterns, in a stable order.  There are only
+      # tables for these.
+      self.opcodes = self.IndexMap()
+
+      def get_item(opcode, children, pattern=None):
+         item = self.items.setdefault((opcode, children),
+                                      self.Item(opcode, children))
+         if len(children) == 2 and opcode in opcodes and \
+            "commutative" in opcodes[opcode].algebraic_properties:
+            self.items[opcode, (children[1], children[0])] = item
+         if pattern is not None:
+            item.patterns.append(pattern)
+         return item
+
+      # Matches anything, like a variable.
+      self.wildcard = get_item("__wildcard", ())
+      # Matches load_const instructions, like constants and #variables.
+      self.const = get_item("__const", ())
+
+      def process_subpattern(src, pattern=None):
+         if isinstance(src, Constant):
+            return self.const
+         elif isinstance(src, Variable):
+            return self.const if src.is_constant else self.wildcard
+         else:
+            assert isinstance(src, Expression)
+            opcode = search_opcode(src.opcode)
+            self.opcodes.add(opcode)
+            children = tuple(process_subpattern(c) for c in src.sources)
+            item = get_item(opcode, children, pattern)
+            for child in children:
+               child.parent_ops.add(opcode)
+            return item
+
+      for i, pattern in enumerate(self.patterns):
+         process_subpattern(pattern, i)
+
+   def num_srcs(self, opcode):
+      if opcode in conv_opcode_types:
+         return 1
+      return opcodes[opcode].num_inputs
+
+   def _build_table(self):
+      """Builds the states and the transition tables, following the
+      reachability-based tabulation of the filtered automaton (algorithm
+      5.7.38 in the reference above): starting from the two initial states,
+      keep computing transitions for every combination of filtered source
+      states that involves a filtered state not seen before, until no new
+      state shows up.
+      """
+      # For each opcode, map from the tuple of filtered source states to the
+      # resulting state.
+      self.table = defaultdict(dict)
+      # All the states, as frozensets of items.
+      self.states = self.IndexMap()
+      # The patterns to try for each state, in the order of the transforms.
+      self.state_patterns = []
+      # For each opcode, map from state to filtered state.
+      self.filter = defaultdict(list)
+      # For each opcode, the filtered states, which are the subsets of states
+      # that can be sources of that opcode.
+      self.rep = defaultdict(self.IndexMap)
+
+      # States and filtered states at or after these indices haven't been
+      # processed yet.
+      worklist_index = [0]
+      rep_worklist_index = defaultdict(int)
+
+      # Opcodes with new filtered states.
+      new_opcodes = self.IndexMap()
+
+      def process_new_states():
+         while worklist_index[0] < len(self.states):
+            state = self.states[worklist_index[0]]
+
+            self.state_patterns.append(
+               sorted(p for item in state for p in item.patterns))
+
+            for op in self.opcodes:
+               rep = self.rep[op]
+               filtered = frozenset(item for item in state
+                                    if op in item.parent_ops)
+               if filtered not in rep:
+                  new_opcodes.add(op)
+               self.filter[op].append(rep.add(filtered))
+
+            worklist_index[0] += 1
+
+      # The initial states of values not defined by an ALU instruction: one
+      # for load_const instructions, and one for everything else.  These have
+      # to match the state numbers in the generated code.
+      self.states.add(frozenset((self.wildcard,)))
+      self.states.add(frozenset((self.const, self.wildcard)))
+      process_new_states()
+
+      while len(new_opcodes) > 0:
+         for op in new_opcodes:
+            rep = self.rep[op]
+            table = self.table[op]
+            first_new = rep_worklist_index[op]
+
+            for src_indices in itertools.product(range(len(rep)),
+                                                 repeat=self.num_srcs(op)):
+               if all(i < first_new for i in src_indices):
+                  continue
+
+               srcs = tuple(rep[i] for i in src_indices)
+
+               # Every way of matching an expression with this opcode whose
+               # sources match the given items, plus the wildcard, which
+               # matches any value.
+               parent = set(self.items[op, item_srcs]
+                            for item_srcs in itertools.product(*srcs)
+                            if (op, item_srcs) in self.items)
+               parent.add(self.wildcard)
+
+               table[src_indices] = self.states.add(frozenset(parent))
+
+            rep_worklist_index[op] = len(rep)
+
+         new_opcodes.clear()
+         process_new_states()
+
+      assert len(self.states) <= 0xffff, \
+         'Too many automaton states for a uint16_t'
+
 _algebraic_pass_template = mako.template.Template("""
 #include "nir.h"
 #include "nir_builder.h"
@@ -669,6 +905,26 @@ struct transform {
    unsigned condition_offset;
 };
 
+struct state_transforms {
+   const struct transform *xforms;
+   unsigned num_xforms;
+};
+
+struct per_op_table {
+   /* Maps each state to the filtered state used for this opcode */
+   const uint16_t *filter;
+   unsigned num_filtered_states;
+   /* Transitions, indexed by the filtered states of the sources */
+   const uint16_t *table;
+};
+
+/* These must match the initial states of TreeAutomaton._build_table().
+ * Values that aren't defined by an ALU instruction or a load_const are in
+ * WILDCARD_STATE, which is 0 so that a zeroed state array is initialized.
+ */
+#define WILDCARD_STATE 0
+#define CONST_STATE 1
+
 #endif
 
 % for xform in xforms:
@@ -676,17 +932,93 @@ struct transform {
    ${xform.replace.render()}
 % endfor
 
-% for (opcode, xform_list) in sorted(opcode_xforms.items()):
-static const struct transform ${pass_name}_${opcode}_xforms[] = {
-% for xform in xform_list:
-   { &${xform.search.name}, ${xform.replace.c_ptr}, ${xform.condition_index} },
+% for state_id, state_xforms in enumerate(automaton.state_patterns):
+% if state_xforms:
+static const struct transform ${pass_name}_state${state_id}_xforms[] = {
+% for i in state_xforms:
+   { &${xforms[i].search.name}, ${xforms[i].replace.c_ptr}, ${xforms[i].condition_index} },
+% endfor
+};
+% endif
+% endfor
+
+static const struct state_transforms ${pass_name}_state_xforms[] = {
+% for state_id, state_xforms in enumerate(automaton.state_patterns):
+% if state_xforms:
+   { ${pass_name}_state${state_id}_xforms, ARRAY_SIZE(${pass_name}_state${state_id}_xforms) },
+% else:
+   { NULL, 0 },
+% endif
+% endfor
+};
+
+% for op in automaton.opcodes:
+static const uint16_t ${pass_name}_${op}_filter[] = {
+% for chunk in chunks(automaton.filter[op]):
+   ${', '.join(str(e) for e in chunk)},
+% endfor
+};
+
+static const uint16_t ${pass_name}_${op}_table[] = {
+% for chunk in chunks([automaton.table[op][indices] for indices in itertools.product(range(len(automaton.rep[op])), repeat=automaton.num_srcs(op))]):
+   ${', '.join(str(e) for e in chunk)},
 % endfor
 };
+
 % endfor
+static const struct per_op_table ${pass_name}_table[nir_num_search_ops] = {
+% for op in automaton.opcodes:
+   [${c_opcode(op)}] = {
+      ${pass_name}_${op}_filter,
+      ${len(automaton.rep[op])},
+      ${pass_name}_${op}_table,
+   },
+% endfor
+};
+
+static void
+${pass_name}_pre_block(nir_block *block, uint16_t *states)
+{
+   nir_foreach_instr(instr, block) {
+      switch (instr->type) {
+      case nir_instr_type_alu: {
+         nir_alu_instr *alu = nir_instr_as_alu(instr);
+         if (!alu->dest.dest.is_ssa)
+            break;
+
+         const struct per_op_table *tbl =
+            &${pass_name}_table[nir_search_op_for_nir_op(alu->op)];
+         if (tbl->num_filtered_states == 0)
+            break;
+
+         /* The table is laid out like Python's itertools.product(), with
+          * the last source varying fastest.
+          */
+         unsigned index = 0;
+         for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+            uint16_t src_state = alu->src[i].src.is_ssa ?
+               states[alu->src[i].src.ssa->index] : WILDCARD_STATE;
+            index = index * tbl->num_filtered_states + tbl->filter[src_state];
+         }
+         states[alu->dest.dest.ssa.index] = tbl->table[index];
+         break;
+      }
+
+      case nir_instr_type_load_const: {
+         nir_load_const_instr *load_const = nir_instr_as_load_const(instr);
+         states[load_const->def.index] = CONST_STATE;
+         break;
+      }
+
+      default:
+         break;
+      }
+   }
+}
 
 static bool
 ${pass_name}_block(nir_builder *build, nir_block *block,
-                   const bool *condition_flags)
+                   const uint16_t *states, const bool *condition_flags)
 {
    bool progress = false;
 
@@ -698,21 +1030,19 @@ ${pass_name}_block(nir_builder *build, nir_block *block,
       if (!alu->dest.dest.is_ssa)
          continue;
 
-      switch (alu->op) {
-      % for opcode in sorted(opcode_xforms.keys()):
-      case nir_op_${opcode}:
-         for (unsigned i = 0; i < ARRAY_SIZE(${pass_name}_${opcode}_xforms); i++) {
-            const struct transform *xform = &${pass_name}_${opcode}_xforms[i];
-            if (condition_flags[xform->condition_offset] &&
-                nir_replace_instr(build, alu, xform->search, xform->replace)) {
-               progress = true;
-               break;
-            }
+      /* Instructions added by earlier replacements are never visited, so
+       * every instruction seen here had its state computed by the pre-pass.
+       */
+      const struct state_transforms *st =
+         &${pass_name}_state_xforms[states[alu->dest.dest.ssa.index]];
+
+      for (unsigned i = 0; i < st->num_xforms; i++) {
+         const struct transform *xform = &st->xforms[i];
+         if (condition_flags[xform->condition_offset] &&
+             nir_replace_instr(build, alu, xform->search, xform->replace)) {
+            progress = true;
+            break;
          }
-         break;
-      % endfor
-      default:
-         break;
       }
    }
 
@@ -727,10 +1057,21 @@ ${pass_name}_impl(nir_function_impl *impl, const bool *condition_flags)
    nir_builder build;
    nir_builder_init(&build, impl);
 
+   /* Values whose state isn't set by the pre-pass are in WILDCARD_STATE,
+    * which is 0.
+    */
+   uint16_t *states = calloc(impl->ssa_alloc, sizeof(*states));
+
+   nir_foreach_block(block, impl) {
+      ${pass_name}_pre_block(block, states);
+   }
+
    nir_foreach_block_reverse(block, impl) {
-      progress |= ${pass_name}_block(&build, block, condition_flags);
+      progress |= ${pass_name}_block(&build, block, states, condition_flags);
    }
 
+   free(states);
+
    if (progress) {
       nir_metadata_preserve(impl, nir_metadata_block_index |
                                   nir_metadata_dominance);
@@ -768,7 +1109,6 @@ ${pass_name}(nir_shader *shader)
 class AlgebraicPass(object):
    def __init__(self, pass_name, transforms):
       self.xforms = []
-      self.opcode_xforms = defaultdict(lambda : [])
       self.pass_name = pass_name
 
       error = False
@@ -786,20 +1126,26 @@ class AlgebraicPass(object):
                continue
 
          self.xforms.append(xform)
-         if xform.search.opcode in conv_opcode_types:
-            dst_type = conv_opcode_types[xform.search.opcode]
-            for size in type_sizes(dst_type):
-               sized_opcode = xform.search.opcode + str(size)
-               self.opcode_xforms[sized_opcode].append(xform)
-         else:
-            self.opcode_xforms[xform.search.opcode].append(xform)
 
       if error:
          sys.exit(1)
 
+      self.automaton = TreeAutomaton(self.xforms)
 
    def render(self):
+      def c_opcode(opcode):
+         if opcode in conv_opcode_types:
+            return 'nir_search_op_' + opcode
+         else:
+            return 'nir_op_' + opcode
+
+      def chunks(values, n=16):
+         return [values[i:i + n] for i in range(0, len(values), n)]
+
       return _algebraic_pass_template.render(pass_name=self.pass_name,
                                              xforms=self.xforms,
-                                             opcode_xforms=self.opcode_xforms,
-                                             condition_list=condition_list)
+                                             automaton=self.automaton,
+                                             condition_list=condition_list,
+                                             c_opcode=c_opcode,
+                                             chunks=chunks,
+                                             itertools=itertools)
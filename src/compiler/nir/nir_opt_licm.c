@@ -0,0 +1,571 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "util/bitset.h"
+#include "util/u_dynarray.h"
+
+/**
+ * \file nir_opt_licm.c
+ *
+ * Loop-invariant code motion.
+ *
+ * Instructions inside a loop whose sources are all defined outside of it
+ * (or by other instructions being hoisted) are moved to the end of the block
+ * preceding the loop.  Loops are processed innermost first, so an expression
+ * invariant in a whole loop nest climbs all the way out in a single run.
+ *
+ * Only instructions without side effects are moved.  Blocks that dominate
+ * the block following the loop, or that are directly in the loop body when
+ * nir_loop_analyze knows the loop makes at least one full iteration, run
+ * before the loop is left, so anything in them can be hoisted.  The other
+ * blocks directly in the loop body, typically the ones after the break at the
+ * top of a for loop, may not run at all; from those only instructions that are
+ * safe to execute speculatively are hoisted, the same ones
+ * nir_opt_peephole_select moves out of ifs.  Loops that run at most once,
+ * that are never left, or that contain a return are skipped.
+ *
+ * Every hoisted value is live across the entire loop.  If max_live is
+ * non-zero, the pass estimates the register pressure in the loop from the
+ * live_in sets of its blocks, and hoists only as much as keeps that estimate
+ * within max_live 32-bit registers.  Constants and undefs are considered
+ * free since backends turn them into immediates.  Liveness is only computed
+ * once; what hoisting out of nested loops adds to the pressure is tracked on
+ * the side.
+ */
+
+/* Flags used in the instr->pass_flags field */
+enum {
+   LICM_CANDIDATE = (1 << 0),
+   LICM_COUNTED =   (1 << 1),
+};
+
+struct licm_state {
+   nir_function_impl *impl;
+   gl_shader_stage stage;
+
+   unsigned max_live;
+
+   /* Index of the first block of the loop being processed */
+   unsigned first_block;
+
+   /* Whether every block directly in the loop body runs at least once */
+   bool body_runs;
+
+   /* Instructions that can be hoisted out of the current loop, in program
+    * order, so every candidate comes after the candidates it depends on.
+    */
+   struct util_dynarray candidates;
+
+   /* Values from outside the loop whose parents hoist_cost() marked
+    * LICM_COUNTED
+    */
+   struct util_dynarray counted;
+
+   /* nir_ssa_def::live_index -> nir_ssa_def, once liveness is computed */
+   nir_ssa_def **live_defs;
+   unsigned num_live_defs;
+};
+
+static nir_ssa_def *
+instr_def(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu:
+      return &nir_instr_as_alu(instr)->dest.dest.ssa;
+   case nir_instr_type_intrinsic:
+      return &nir_instr_as_intrinsic(instr)->dest.ssa;
+   case nir_instr_type_tex:
+      return &nir_instr_as_tex(instr)->dest.ssa;
+   case nir_instr_type_load_const:
+      return &nir_instr_as_load_const(instr)->def;
+   case nir_instr_type_ssa_undef:
+      return &nir_instr_as_ssa_undef(instr)->def;
+   default:
+      unreachable("not a hoistable instruction");
+   }
+}
+
+/* Number of 32-bit registers needed to keep def live */
+static unsigned
+def_weight(nir_ssa_def *def)
+{
+   if (def->parent_instr->type == nir_instr_type_load_const ||
+       def->parent_instr->type == nir_instr_type_ssa_undef)
+      return 0;
+
+   return def->num_components * DIV_ROUND_UP(def->bit_size, 32);
+}
+
+static bool
+src_is_invariant(nir_src *src, void *void_state)
+{
+   struct licm_state *state = void_state;
+
+   if (!src->is_ssa)
+      return false;
+
+   nir_instr *parent = src->ssa->parent_instr;
+   return parent->block->index < state->first_block ||
+          (parent->pass_flags & LICM_CANDIDATE);
+}
+
+static bool
+can_hoist(struct licm_state *state, nir_instr *instr, bool speculate)
+{
+   switch (instr->type) {
+   case nir_instr_type_load_const:
+   case nir_instr_type_ssa_undef:
+      return true;
+
+   case nir_instr_type_alu:
+      if (!nir_instr_as_alu(instr)->dest.dest.is_ssa)
+         return false;
+      break;
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      const nir_intrinsic_info *info = &nir_intrinsic_infos[intrin->intrinsic];
+      if (!info->has_dest || !intrin->dest.is_ssa ||
+          !(info->flags & NIR_INTRINSIC_CAN_REORDER))
+         return false;
+
+      /* System values and uniforms can be read at any time, but a load
+       * from memory may be guarded by the loop condition.
+       */
+      if (speculate && intrin->intrinsic != nir_intrinsic_load_uniform &&
+          info->num_srcs > 0)
+         return false;
+      break;
+   }
+
+   case nir_instr_type_tex: {
+      nir_tex_instr *tex = nir_instr_as_tex(instr);
+      if (speculate || !tex->dest.is_ssa)
+         return false;
+
+      /* Moving an implicit derivative out of the loop changes which
+       * invocations take part in computing it.
+       */
+      if (state->stage == MESA_SHADER_FRAGMENT &&
+          (tex->op == nir_texop_tex || tex->op == nir_texop_txb ||
+           tex->op == nir_texop_lod))
+         return false;
+      break;
+   }
+
+   default:
+      /* Phis, derefs, calls, jumps and parallel copies stay where they are */
+      return false;
+   }
+
+   return nir_foreach_src(instr, src_is_invariant, state);
+}
+
+static void
+collect_candidates(struct licm_state *state, struct exec_list *cf_list,
+                   nir_block *exit, bool in_body)
+{
+   foreach_list_typed(nir_cf_node, node, node, cf_list) {
+      switch (node->type) {
+      case nir_cf_node_block: {
+         nir_block *block = nir_cf_node_as_block(node);
+         bool runs = (in_body && state->body_runs) ||
+                     nir_block_dominates(block, exit);
+         if (!runs && !in_body)
+            break;
+
+         nir_foreach_instr(instr, block) {
+            if (can_hoist(state, instr, !runs)) {
+               instr->pass_flags = LICM_CANDIDATE;
+               util_dynarray_append(&state->candidates, nir_instr *, instr);
+            }
+         }
+         break;
+      }
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(node);
+         collect_candidates(state, &nif->then_list, exit, false);
+         collect_candidates(state, &nif->else_list, exit, false);
+         break;
+      }
+
+      case nir_cf_node_loop:
+         /* Anything invariant in this loop is also invariant in the nested
+          * one, which has already been processed.
+          */
+         break;
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+}
+
+static bool
+use_is_hoisted_or_before_loop(struct licm_state *state, nir_instr *instr)
+{
+   return (instr->pass_flags & LICM_CANDIDATE) ||
+          instr->block->index < state->first_block;
+}
+
+static bool
+if_use_is_before_loop(struct licm_state *state, nir_if *nif)
+{
+   nir_block *block = nir_cf_node_as_block(nir_cf_node_prev(&nif->cf_node));
+   return block->index < state->first_block;
+}
+
+/* Remembers values defined before the loop and used by hoisted instructions.
+ * If those are their only uses in and after the loop, they are no longer live
+ * in the loop once hoisted.
+ */
+static bool
+count_freed_src(nir_src *src, void *void_state)
+{
+   struct licm_state *state = void_state;
+   nir_instr *parent = src->ssa->parent_instr;
+
+   if (parent->block->index >= state->first_block ||
+       (parent->pass_flags & LICM_COUNTED))
+      return true;
+
+   parent->pass_flags |= LICM_COUNTED;
+   util_dynarray_append(&state->counted, nir_ssa_def *, src->ssa);
+
+   return true;
+}
+
+/* Estimated change in register pressure in the loop when hoisting the first
+ * count candidates.
+ */
+static int
+hoist_cost(struct licm_state *state, unsigned count)
+{
+   nir_instr **candidates = state->candidates.data;
+   unsigned num_candidates =
+      util_dynarray_num_elements(&state->candidates, nir_instr *);
+   int cost = 0;
+
+   for (unsigned i = 0; i < num_candidates; i++)
+      candidates[i]->pass_flags = i < count ? LICM_CANDIDATE : 0;
+
+   for (unsigned i = 0; i < count; i++) {
+      nir_ssa_def *def = instr_def(candidates[i]);
+
+      bool live_in_loop = !list_empty(&def->if_uses);
+      nir_foreach_use(use, def) {
+         if (!(use->parent_instr->pass_flags & LICM_CANDIDATE)) {
+            live_in_loop = true;
+            break;
+         }
+      }
+
+      if (live_in_loop)
+         cost += def_weight(def);
+
+      nir_foreach_src(candidates[i], count_freed_src, state);
+   }
+
+   util_dynarray_foreach(&state->counted, nir_ssa_def *, def_ptr) {
+      nir_ssa_def *def = *def_ptr;
+      bool freed = true;
+
+      nir_foreach_use(use, def) {
+         if (!use_is_hoisted_or_before_loop(state, use->parent_instr)) {
+            freed = false;
+            break;
+         }
+      }
+      nir_foreach_if_use(use, def) {
+         if (!if_use_is_before_loop(state, use->parent_if)) {
+            freed = false;
+            break;
+         }
+      }
+
+      if (freed)
+         cost -= def_weight(def);
+
+      def->parent_instr->pass_flags &= ~LICM_COUNTED;
+   }
+   util_dynarray_clear(&state->counted);
+
+   return cost;
+}
+
+static bool
+index_live_def(nir_ssa_def *def, void *void_state)
+{
+   struct licm_state *state = void_state;
+
+   state->live_defs[def->live_index] = def;
+   state->num_live_defs = MAX2(state->num_live_defs, def->live_index + 1);
+
+   return true;
+}
+
+/* Highest register pressure at the start of any block in the loop, before
+ * anything was hoisted.
+ */
+static unsigned
+loop_pressure(struct licm_state *state, nir_loop *loop)
+{
+   /* Every loop with candidates gets here before hoisting them, so the first
+    * call sees the original program.
+    */
+   if (!state->live_defs) {
+      nir_metadata_require(state->impl, nir_metadata_live_ssa_defs);
+
+      state->live_defs = malloc((state->impl->ssa_alloc + 1) *
+                                sizeof(nir_ssa_def *));
+      state->num_live_defs = 1;
+      nir_foreach_block(block, state->impl) {
+         nir_foreach_instr(instr, block)
+            nir_foreach_ssa_def(instr, index_live_def, state);
+      }
+   }
+
+   unsigned pressure = 0;
+   nir_foreach_block_in_cf_node(block, &loop->cf_node) {
+      unsigned live = 0, i;
+      BITSET_WORD tmp;
+
+      BITSET_FOREACH_SET(i, tmp, block->live_in, state->num_live_defs) {
+         /* Index 0 is shared by all undefs, which are never live */
+         if (i != 0)
+            live += def_weight(state->live_defs[i]);
+      }
+      pressure = MAX2(pressure, live);
+   }
+
+   return pressure;
+}
+
+/* Returns how many candidates, in order, fit in the register budget, and
+ * sets *added to the pressure that hoisting them adds to the loop.
+ */
+static unsigned
+fit_budget(struct licm_state *state, nir_loop *loop, unsigned inner_added,
+           unsigned *added)
+{
+   unsigned count = util_dynarray_num_elements(&state->candidates,
+                                               nir_instr *);
+   unsigned pressure = loop_pressure(state, loop) + inner_added;
+   int cost = 0;
+
+   /* Dropping candidates from the end never drops one that a remaining
+    * candidate depends on.
+    */
+   for (; count > 0; count--) {
+      cost = hoist_cost(state, count);
+      if (cost <= 0 || pressure + cost <= state->max_live)
+         break;
+   }
+
+   *added = count > 0 ? MAX2(cost, 0) : 0;
+   return count;
+}
+
+static bool
+should_optimize_loop(nir_loop *loop)
+{
+   nir_block *preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   nir_block *exit = nir_cf_node_as_block(nir_cf_node_next(&loop->cf_node));
+
+   /* Without a back-edge the body runs once, and without a break the loop
+    * never finishes.
+    */
+   if (nir_loop_first_block(loop)->predecessors->entries < 2 ||
+       exit->predecessors->entries == 0)
+      return false;
+
+   /* The loop is unreachable */
+   if (nir_block_ends_in_jump(preheader))
+      return false;
+
+   if (loop->info->limiting_terminator && loop->info->max_trip_count <= 1)
+      return false;
+
+   /* A return leaves the loop without going through the exit block */
+   nir_foreach_block_in_cf_node(block, &loop->cf_node) {
+      nir_instr *last = nir_block_last_instr(block);
+      if (last && last->type == nir_instr_type_jump &&
+          nir_instr_as_jump(last)->type == nir_jump_return)
+         return false;
+   }
+
+   return true;
+}
+
+/* inner_added is the pressure that hoisting out of the loops nested in this
+ * one added to it, *added is set to the pressure this loop ends up with on
+ * top of what liveness says.
+ */
+static bool
+process_loop(struct licm_state *state, nir_loop *loop, unsigned inner_added,
+             unsigned *added)
+{
+   *added = inner_added;
+
+   if (!should_optimize_loop(loop))
+      return false;
+
+   nir_block *preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   nir_block *exit = nir_cf_node_as_block(nir_cf_node_next(&loop->cf_node));
+
+   state->first_block = nir_loop_first_block(loop)->index;
+   state->body_runs = loop->info->exact_trip_count_known &&
+                      !loop->info->complex_loop &&
+                      loop->info->max_trip_count >= 1;
+
+   util_dynarray_clear(&state->candidates);
+   collect_candidates(state, &loop->body, exit, true);
+
+   unsigned count = util_dynarray_num_elements(&state->candidates,
+                                               nir_instr *);
+   if (count == 0)
+      return false;
+
+   if (state->max_live) {
+      unsigned own;
+      count = fit_budget(state, loop, inner_added, &own);
+      *added += own;
+   }
+
+   nir_instr **candidates = state->candidates.data;
+   for (unsigned i = 0; i < count; i++) {
+      nir_instr_remove(candidates[i]);
+      nir_instr_insert(nir_after_block(preheader), candidates[i]);
+   }
+
+   util_dynarray_foreach(&state->candidates, nir_instr *, instr)
+      (*instr)->pass_flags = 0;
+
+   if (count == 0)
+      return false;
+
+   nir_metadata_preserve(state->impl, nir_metadata_block_index |
+                                      nir_metadata_dominance);
+
+   return true;
+}
+
+/* Sets *added to the largest pressure added by hoisting out of the loops in
+ * cf_list.
+ */
+static bool
+visit_cf_list(struct licm_state *state, struct exec_list *cf_list,
+              unsigned *added)
+{
+   bool progress = false;
+
+   *added = 0;
+
+   foreach_list_typed(nir_cf_node, node, node, cf_list) {
+      switch (node->type) {
+      case nir_cf_node_block:
+         break;
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(node);
+         unsigned then_added, else_added;
+         progress |= visit_cf_list(state, &nif->then_list, &then_added);
+         progress |= visit_cf_list(state, &nif->else_list, &else_added);
+         *added = MAX3(*added, then_added, else_added);
+         break;
+      }
+
+      case nir_cf_node_loop: {
+         nir_loop *loop = nir_cf_node_as_loop(node);
+         unsigned inner_added, loop_added;
+         progress |= visit_cf_list(state, &loop->body, &inner_added);
+         progress |= process_loop(state, loop, inner_added, &loop_added);
+         *added = MAX2(*added, loop_added);
+         break;
+      }
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+
+   return progress;
+}
+
+static bool
+opt_licm_impl(nir_function_impl *impl, gl_shader_stage stage,
+              unsigned max_live)
+{
+   struct licm_state state = {
+      .impl = impl,
+      .stage = stage,
+      .max_live = max_live,
+   };
+   bool had_loop_analysis = impl->valid_metadata & nir_metadata_loop_analysis;
+
+   nir_metadata_require(impl, nir_metadata_block_index |
+                              nir_metadata_dominance |
+                              nir_metadata_loop_analysis,
+                        (nir_variable_mode)0);
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         instr->pass_flags = 0;
+   }
+
+   util_dynarray_init(&state.candidates, NULL);
+   util_dynarray_init(&state.counted, NULL);
+
+   unsigned added;
+   bool progress = visit_cf_list(&state, &impl->body, &added);
+
+   free(state.live_defs);
+   util_dynarray_fini(&state.counted);
+   util_dynarray_fini(&state.candidates);
+
+   /* Our loop information was computed with an empty indirect mask, which
+    * would mislead nir_opt_loop_unroll.
+    */
+   if (!had_loop_analysis)
+      nir_metadata_preserve(impl, ~nir_metadata_loop_analysis);
+
+   return progress;
+}
+
+bool
+nir_opt_licm(nir_shader *shader, unsigned max_live)
+{
+   bool progress = false;
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         progress |= opt_licm_impl(function->impl, shader->info.stage,
+                                   max_live);
+   }
+
+   return progress;
+}
@@ -0,0 +1,700 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "nir_builder.h"
+#include "util/u_dynarray.h"
+
+/**
+ * \file nir_opt_load_store_vectorize.c
+ *
+ * Combines loads and stores of neighbouring memory into wider ones.
+ *
+ * Two accesses are combined when they use the same intrinsic, the same
+ * buffer, and addresses that differ by a constant: each address is split
+ * into an SSA value and a constant added to it by a chain of iadds (plus the
+ * BASE index, if any), and the SSA values have to be the same.  Offsets are
+ * expected in bytes, which is what UBO, SSBO and global accesses always use
+ * and what nir_lower_io produces for shared memory and push constants with a
+ * byte-sized type_size callback.
+ *
+ * A combined load replaces the first of the two loads, and a combined store
+ * the second of the two stores, so one of them moves within the block.  This
+ * is only done if nothing in between may access the same memory in a way
+ * that matters: a store that may alias for loads, any access that may alias
+ * for stores.  Barriers, discards, calls and memory intrinsics the pass
+ * doesn't know about stop everything except loads from UBOs and push
+ * constants, which can't change during an invocation.
+ *
+ * The driver decides which combinations it can handle through a callback,
+ * which is given the alignment of the combined access as computed from the
+ * ALIGN_MUL/ALIGN_OFFSET indices and from the SSA value of the address.
+ */
+
+/* How far apart, in memory accesses, two accesses can be and still get
+ * combined.  This bounds the cost of checking everything in between.
+ */
+#define MAX_DISTANCE 64
+
+struct intrinsic_info {
+   nir_variable_mode mode;
+   bool is_load;
+   int resource_src; /* -1 if there is none */
+   int offset_src;
+   int value_src;    /* -1 for loads */
+};
+
+static const struct intrinsic_info *
+get_info(nir_intrinsic_op op)
+{
+   switch (op) {
+#define INFO(mode, op, is_load, resource, offset, value)                      \
+   case nir_intrinsic_##op: {                                                 \
+      static const struct intrinsic_info op##_info = {                        \
+         mode, is_load, resource, offset, value                               \
+      };                                                                      \
+      return &op##_info;                                                      \
+   }
+   INFO(nir_var_uniform, load_push_constant, true, -1, 0, -1)
+   INFO(nir_var_mem_ubo, load_ubo, true, 0, 1, -1)
+   INFO(nir_var_mem_ssbo, load_ssbo, true, 0, 1, -1)
+   INFO(nir_var_mem_ssbo, store_ssbo, false, 1, 2, 0)
+   INFO(nir_var_mem_shared, load_shared, true, -1, 0, -1)
+   INFO(nir_var_mem_shared, store_shared, false, -1, 1, 0)
+   INFO(nir_var_mem_global, load_global, true, -1, 0, -1)
+   INFO(nir_var_mem_global, store_global, false, -1, 1, 0)
+#undef INFO
+   default:
+      return NULL;
+   }
+}
+
+/* A memory access, or for info == NULL anything else the accesses can't be
+ * moved across freely.
+ */
+struct entry {
+   nir_instr *instr; /* NULL once combined into another entry */
+   nir_intrinsic_instr *intrin;
+   const struct intrinsic_info *info;
+
+   /* For info == NULL, whether the instruction may write memory */
+   bool writes;
+
+   /* The accessed address is offset_def + offset bytes, offset_def is NULL
+    * for constant addresses.
+    */
+   nir_ssa_def *offset_def;
+   int64_t offset;
+
+   unsigned bit_size;
+   unsigned num_components;
+   nir_component_mask_t write_mask;
+   enum gl_access_qualifier access;
+};
+
+struct vectorize_ctx {
+   nir_shader *shader;
+   nir_variable_mode modes;
+   nir_should_vectorize_mem_func callback;
+
+   struct util_dynarray entries;
+};
+
+static bool
+has_index(nir_intrinsic_instr *intrin, nir_intrinsic_index_flag index)
+{
+   return nir_intrinsic_infos[intrin->intrinsic].index_map[index] > 0;
+}
+
+/* Splits an address into an SSA value and a constant added to it */
+static void
+parse_offset(nir_ssa_def *def, nir_ssa_def **offset_def, int64_t *offset)
+{
+   *offset = 0;
+
+   while (true) {
+      if (def->parent_instr->type == nir_instr_type_load_const) {
+         *offset += nir_src_as_int(nir_src_for_ssa(def));
+         *offset_def = NULL;
+         return;
+      }
+
+      if (def->parent_instr->type != nir_instr_type_alu)
+         break;
+
+      nir_alu_instr *alu = nir_instr_as_alu(def->parent_instr);
+      if (alu->op != nir_op_iadd || !alu->dest.dest.is_ssa ||
+          !alu->src[0].src.is_ssa || !alu->src[1].src.is_ssa)
+         break;
+
+      unsigned const_src;
+      if (nir_src_is_const(alu->src[0].src))
+         const_src = 0;
+      else if (nir_src_is_const(alu->src[1].src))
+         const_src = 1;
+      else
+         break;
+
+      nir_alu_src *other = &alu->src[!const_src];
+      if (other->swizzle[0] != 0 || other->src.ssa->num_components != 1)
+         break;
+
+      *offset += nir_src_comp_as_int(alu->src[const_src].src,
+                                     alu->src[const_src].swizzle[0]);
+      def = other->src.ssa;
+   }
+
+   *offset_def = def;
+}
+
+static uint64_t
+const_alignment(uint64_t value)
+{
+   return value ? value & -value : 1ull << 32;
+}
+
+/* Largest power of two known to divide def */
+static uint64_t
+get_alignment(nir_ssa_def *def, unsigned depth)
+{
+   if (def->num_components != 1)
+      return 1;
+
+   if (def->parent_instr->type == nir_instr_type_load_const)
+      return const_alignment(nir_src_as_uint(nir_src_for_ssa(def)));
+
+   if (def->parent_instr->type != nir_instr_type_alu || depth > 8)
+      return 1;
+
+   nir_alu_instr *alu = nir_instr_as_alu(def->parent_instr);
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+      if (!alu->src[i].src.is_ssa)
+         return 1;
+   }
+
+   const uint64_t max = 1ull << 32;
+
+   switch (alu->op) {
+   case nir_op_imov:
+      return get_alignment(alu->src[0].src.ssa, depth + 1);
+
+   case nir_op_iadd:
+      return MIN2(get_alignment(alu->src[0].src.ssa, depth + 1),
+                  get_alignment(alu->src[1].src.ssa, depth + 1));
+
+   case nir_op_imul: {
+      uint64_t a = MIN2(get_alignment(alu->src[0].src.ssa, depth + 1), max);
+      uint64_t b = MIN2(get_alignment(alu->src[1].src.ssa, depth + 1), max);
+      return MIN2(a * b, max);
+   }
+
+   case nir_op_ishl: {
+      if (!nir_src_is_const(alu->src[1].src))
+         return 1;
+      uint64_t a = MIN2(get_alignment(alu->src[0].src.ssa, depth + 1), max);
+      unsigned shift = nir_src_comp_as_uint(alu->src[1].src,
+                                            alu->src[1].swizzle[0]) & 31;
+      return MIN2(a << shift, max);
+   }
+
+   case nir_op_iand:
+      return MAX2(get_alignment(alu->src[0].src.ssa, depth + 1),
+                  get_alignment(alu->src[1].src.ssa, depth + 1));
+
+   default:
+      return 1;
+   }
+}
+
+static unsigned
+entry_alignment(struct entry *entry)
+{
+   uint64_t align = const_alignment(entry->offset);
+
+   if (entry->offset_def)
+      align = MIN2(align, get_alignment(entry->offset_def, 0));
+
+   if (has_index(entry->intrin, NIR_INTRINSIC_ALIGN_MUL) &&
+       nir_intrinsic_align_mul(entry->intrin))
+      align = MAX2(align, nir_intrinsic_align(entry->intrin));
+
+   return MIN2(align, 1u << 31);
+}
+
+static int64_t
+entry_end(struct entry *entry)
+{
+   return entry->offset + entry->num_components * (entry->bit_size / 8);
+}
+
+static void
+init_entry(struct entry *entry, nir_instr *instr)
+{
+   memset(entry, 0, sizeof(*entry));
+   entry->instr = instr;
+
+   if (instr->type != nir_instr_type_intrinsic) {
+      entry->writes = true;
+      return;
+   }
+
+   nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+   const struct intrinsic_info *info = get_info(intrin->intrinsic);
+   entry->intrin = intrin;
+
+   if (!info) {
+      entry->writes = !(nir_intrinsic_infos[intrin->intrinsic].flags &
+                        NIR_INTRINSIC_CAN_ELIMINATE);
+      return;
+   }
+
+   if (has_index(intrin, NIR_INTRINSIC_ACCESS))
+      entry->access = nir_intrinsic_access(intrin);
+
+   bool is_ssa = intrin->src[info->offset_src].is_ssa &&
+                 (info->is_load ? intrin->dest.is_ssa :
+                                  intrin->src[info->value_src].is_ssa);
+
+   /* Leave these in place and don't let anything move across them */
+   if (!is_ssa || (entry->access & ACCESS_VOLATILE)) {
+      entry->writes = true;
+      return;
+   }
+
+   entry->info = info;
+   entry->writes = !info->is_load;
+
+   parse_offset(intrin->src[info->offset_src].ssa,
+                &entry->offset_def, &entry->offset);
+   if (has_index(intrin, NIR_INTRINSIC_BASE))
+      entry->offset += nir_intrinsic_base(intrin);
+
+   entry->num_components = intrin->num_components;
+   if (info->is_load) {
+      entry->bit_size = intrin->dest.ssa.bit_size;
+      entry->write_mask = (1 << entry->num_components) - 1;
+   } else {
+      entry->bit_size = intrin->src[info->value_src].ssa->bit_size;
+      entry->write_mask = nir_intrinsic_write_mask(intrin);
+   }
+}
+
+static bool
+resources_equal(struct entry *a, struct entry *b)
+{
+   if (a->info->resource_src < 0 || b->info->resource_src < 0)
+      return a->info->resource_src == b->info->resource_src;
+
+   nir_src *ra = &a->intrin->src[a->info->resource_src];
+   nir_src *rb = &b->intrin->src[b->info->resource_src];
+
+   if (!ra->is_ssa || !rb->is_ssa)
+      return false;
+
+   if (ra->ssa == rb->ssa)
+      return true;
+
+   return nir_src_is_const(*ra) && nir_src_is_const(*rb) &&
+          nir_src_as_uint(*ra) == nir_src_as_uint(*rb);
+}
+
+static bool
+is_read_only(struct entry *entry)
+{
+   return entry->info &&
+          (entry->info->mode & (nir_var_uniform | nir_var_mem_ubo));
+}
+
+static bool
+may_alias(struct entry *a, struct entry *b)
+{
+   if (a->info->mode != b->info->mode) {
+      /* A global address may point into an SSBO */
+      const nir_variable_mode buffers = nir_var_mem_ssbo | nir_var_mem_global;
+      return (a->info->mode & buffers) && (b->info->mode & buffers);
+   }
+
+   if (is_read_only(a))
+      return false;
+
+   if (!resources_equal(a, b) || a->offset_def != b->offset_def)
+      return true;
+
+   return a->offset < entry_end(b) && b->offset < entry_end(a);
+}
+
+/* Whether moved can be moved across other, in either direction */
+static bool
+can_move_across(struct entry *moved, struct entry *other)
+{
+   if (!other->info) {
+      if (is_read_only(moved))
+         return true;
+      return moved->info->is_load && !other->writes;
+   }
+
+   if (moved->info->is_load && other->info->is_load)
+      return true;
+
+   return !may_alias(moved, other);
+}
+
+static bool
+can_vectorize(struct vectorize_ctx *ctx, struct entry *entry)
+{
+   return entry->instr && entry->info && (entry->info->mode & ctx->modes);
+}
+
+static bool
+can_combine(struct vectorize_ctx *ctx, struct entry *a, struct entry *b)
+{
+   if (a->intrin->intrinsic != b->intrin->intrinsic ||
+       a->bit_size != b->bit_size || a->bit_size < 8 ||
+       a->access != b->access || a->offset_def != b->offset_def ||
+       !resources_equal(a, b))
+      return false;
+
+   const unsigned elem_size = a->bit_size / 8;
+   if ((b->offset - a->offset) % elem_size)
+      return false;
+
+   struct entry *low = a->offset <= b->offset ? a : b;
+   struct entry *high = low == a ? b : a;
+   int64_t size = MAX2(entry_end(a), entry_end(b)) - low->offset;
+   if (size > NIR_MAX_VEC_COMPONENTS * elem_size)
+      return false;
+
+   return ctx->callback(entry_alignment(low), a->bit_size, size / elem_size,
+                        low->intrin, high->intrin);
+}
+
+/* Whether the instructions between entries first and second allow moving
+ * the one that moves when they're combined.
+ */
+static bool
+path_is_clear(struct entry *entries, unsigned first, unsigned second)
+{
+   struct entry *moved = entries[first].info->is_load ? &entries[second] :
+                                                        &entries[first];
+
+   for (unsigned i = first + 1; i < second; i++) {
+      if (entries[i].instr && !can_move_across(moved, &entries[i]))
+         return false;
+   }
+
+   return true;
+}
+
+/* Sets the address of new_intrin to offset, based on that of entry */
+static void
+set_address(nir_builder *b, nir_intrinsic_instr *new_intrin,
+            struct entry *entry, int64_t offset)
+{
+   const struct intrinsic_info *info = entry->info;
+   nir_ssa_def *addr = entry->intrin->src[info->offset_src].ssa;
+   int64_t delta = offset - entry->offset;
+
+   if (!entry->offset_def) {
+      addr = nir_imm_intN_t(b, offset - (has_index(new_intrin, NIR_INTRINSIC_BASE) ?
+                                         nir_intrinsic_base(new_intrin) : 0),
+                            addr->bit_size);
+   } else if (has_index(new_intrin, NIR_INTRINSIC_BASE) &&
+       nir_intrinsic_base(entry->intrin) + delta >= 0) {
+      nir_intrinsic_set_base(new_intrin,
+                             nir_intrinsic_base(entry->intrin) + delta);
+   } else if (delta) {
+      addr = nir_iadd_imm(b, addr, delta);
+   }
+
+   new_intrin->src[info->offset_src] = nir_src_for_ssa(addr);
+}
+
+static void
+set_range_and_align(nir_intrinsic_instr *new_intrin,
+                    struct entry *a, struct entry *b, struct entry *low)
+{
+   if (has_index(new_intrin, NIR_INTRINSIC_RANGE)) {
+      int64_t end = MAX2(nir_intrinsic_base(a->intrin) +
+                         nir_intrinsic_range(a->intrin),
+                         nir_intrinsic_base(b->intrin) +
+                         nir_intrinsic_range(b->intrin));
+      nir_intrinsic_set_range(new_intrin,
+                              end - nir_intrinsic_base(new_intrin));
+   }
+
+   if (has_index(new_intrin, NIR_INTRINSIC_ALIGN_MUL)) {
+      nir_intrinsic_set_align_mul(new_intrin,
+                                  nir_intrinsic_align_mul(low->intrin));
+      nir_intrinsic_set_align_offset(new_intrin,
+                                     nir_intrinsic_align_offset(low->intrin));
+   }
+}
+
+static nir_intrinsic_instr *
+create_intrinsic(struct vectorize_ctx *ctx, struct entry *entry,
+                 unsigned num_components)
+{
+   nir_intrinsic_instr *intrin =
+      nir_intrinsic_instr_create(ctx->shader, entry->intrin->intrinsic);
+
+   intrin->num_components = num_components;
+   memcpy(intrin->const_index, entry->intrin->const_index,
+          sizeof(intrin->const_index));
+
+   if (entry->info->resource_src >= 0) {
+      intrin->src[entry->info->resource_src] =
+         nir_src_for_ssa(entry->intrin->src[entry->info->resource_src].ssa);
+   }
+
+   return intrin;
+}
+
+static nir_ssa_def *
+extract(nir_builder *b, nir_ssa_def *def, unsigned first,
+        unsigned num_components)
+{
+   if (first == 0 && num_components == def->num_components)
+      return def;
+
+   return nir_channels(b, def, ((1 << num_components) - 1) << first);
+}
+
+/* Replaces first and second with a single load where first was */
+static void
+combine_loads(struct vectorize_ctx *ctx, struct entry *first,
+              struct entry *second)
+{
+   struct entry *low = first->offset <= second->offset ? first : second;
+   const unsigned elem_size = first->bit_size / 8;
+   const int64_t offset = low->offset;
+   const unsigned num_components =
+      (MAX2(entry_end(first), entry_end(second)) - offset) / elem_size;
+   nir_builder b;
+
+   nir_builder_init(&b, nir_cf_node_get_function(&first->instr->block->cf_node));
+   b.cursor = nir_before_instr(first->instr);
+
+   nir_intrinsic_instr *load = create_intrinsic(ctx, first, num_components);
+   set_address(&b, load, first, offset);
+   set_range_and_align(load, first, second, low);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components,
+                     first->bit_size, NULL);
+   nir_builder_instr_insert(&b, &load->instr);
+
+   struct entry *old[2] = { first, second };
+   for (unsigned i = 0; i < 2; i++) {
+      nir_ssa_def *value =
+         extract(&b, &load->dest.ssa, (old[i]->offset - offset) / elem_size,
+                 old[i]->num_components);
+      nir_ssa_def_rewrite_uses(&old[i]->intrin->dest.ssa,
+                               nir_src_for_ssa(value));
+      nir_instr_remove(old[i]->instr);
+   }
+
+   first->instr = &load->instr;
+   first->intrin = load;
+   first->offset = offset;
+   first->num_components = num_components;
+   first->write_mask = (1 << num_components) - 1;
+   second->instr = NULL;
+}
+
+/* Replaces first and second with a single store where second was */
+static void
+combine_stores(struct vectorize_ctx *ctx, struct entry *first,
+               struct entry *second)
+{
+   struct entry *low = first->offset <= second->offset ? first : second;
+   const unsigned elem_size = first->bit_size / 8;
+   const int64_t offset = low->offset;
+   const unsigned num_components =
+      (MAX2(entry_end(first), entry_end(second)) - offset) / elem_size;
+   const unsigned value_src = first->info->value_src;
+   nir_component_mask_t write_mask = 0;
+   nir_builder b;
+
+   nir_builder_init(&b, nir_cf_node_get_function(&second->instr->block->cf_node));
+   b.cursor = nir_before_instr(second->instr);
+
+   nir_op vec_op;
+   switch (num_components) {
+   case 1: vec_op = nir_op_imov; break;
+   case 2: vec_op = nir_op_vec2; break;
+   case 3: vec_op = nir_op_vec3; break;
+   case 4: vec_op = nir_op_vec4; break;
+   default: unreachable("bad component count");
+   }
+
+   nir_alu_instr *vec = nir_alu_instr_create(ctx->shader, vec_op);
+   for (unsigned i = 0; i < num_components; i++)
+      vec->src[i].src = NIR_SRC_INIT;
+
+   /* The second store wins where they overlap */
+   struct entry *old[2] = { second, first };
+   for (unsigned i = 0; i < 2; i++) {
+      unsigned shift = (old[i]->offset - offset) / elem_size;
+      nir_ssa_def *value = old[i]->intrin->src[value_src].ssa;
+
+      for (unsigned c = 0; c < old[i]->num_components; c++) {
+         nir_alu_src *src = &vec->src[c + shift];
+         if (!(old[i]->write_mask & (1 << c)) || src->src.ssa)
+            continue;
+         src->src = nir_src_for_ssa(value);
+         src->swizzle[0] = c;
+      }
+      write_mask |= old[i]->write_mask << shift;
+   }
+
+   nir_ssa_def *undef = NULL;
+   for (unsigned i = 0; i < num_components; i++) {
+      if (vec->src[i].src.ssa)
+         continue;
+      if (!undef)
+         undef = nir_ssa_undef(&b, 1, first->bit_size);
+      vec->src[i].src = nir_src_for_ssa(undef);
+   }
+
+   nir_ssa_dest_init(&vec->instr, &vec->dest.dest, num_components,
+                     first->bit_size, NULL);
+   vec->dest.write_mask = (1 << num_components) - 1;
+   nir_builder_instr_insert(&b, &vec->instr);
+
+   nir_intrinsic_instr *store = create_intrinsic(ctx, second, num_components);
+   store->src[value_src] = nir_src_for_ssa(&vec->dest.dest.ssa);
+   set_address(&b, store, second, offset);
+   set_range_and_align(store, first, second, low);
+   nir_intrinsic_set_write_mask(store, write_mask);
+   nir_builder_instr_insert(&b, &store->instr);
+
+   nir_instr_remove(first->instr);
+   nir_instr_remove(second->instr);
+
+   second->instr = &store->instr;
+   second->intrin = store;
+   second->offset = offset;
+   second->num_components = num_components;
+   second->write_mask = write_mask;
+   first->instr = NULL;
+}
+
+static bool
+vectorize_entries(struct vectorize_ctx *ctx)
+{
+   struct entry *entries = ctx->entries.data;
+   unsigned num_entries = util_dynarray_num_elements(&ctx->entries,
+                                                     struct entry);
+   bool progress = false;
+
+   for (unsigned i = 0; i < num_entries; i++) {
+      struct entry *first = &entries[i];
+      if (!can_vectorize(ctx, first))
+         continue;
+
+      unsigned end = MIN2(num_entries, i + 1 + MAX_DISTANCE);
+      for (unsigned j = i + 1; j < end && first->instr; j++) {
+         struct entry *second = &entries[j];
+
+         /* Nothing after this can be combined with first */
+         if (second->instr && !second->info &&
+             !can_move_across(first, second))
+            break;
+
+         if (!can_vectorize(ctx, second) ||
+             !can_combine(ctx, first, second) ||
+             !path_is_clear(entries, i, j))
+            continue;
+
+         if (first->info->is_load)
+            combine_loads(ctx, first, second);
+         else
+            combine_stores(ctx, first, second);
+         progress = true;
+      }
+   }
+
+   return progress;
+}
+
+static bool
+vectorize_block(struct vectorize_ctx *ctx, nir_block *block)
+{
+   util_dynarray_clear(&ctx->entries);
+
+   nir_foreach_instr(instr, block) {
+      if (instr->type != nir_instr_type_intrinsic &&
+          instr->type != nir_instr_type_call)
+         continue;
+
+      if (instr->type == nir_instr_type_intrinsic) {
+         nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+         if (!get_info(intrin->intrinsic) &&
+             (nir_intrinsic_infos[intrin->intrinsic].flags &
+              NIR_INTRINSIC_CAN_REORDER))
+            continue;
+      }
+
+      struct entry *entry =
+         util_dynarray_grow(&ctx->entries, sizeof(struct entry));
+      init_entry(entry, instr);
+   }
+
+   /* A combined access may combine again */
+   bool progress = false;
+   while (vectorize_entries(ctx))
+      progress = true;
+
+   return progress;
+}
+
+bool
+nir_opt_load_store_vectorize(nir_shader *shader, nir_variable_mode modes,
+                             nir_should_vectorize_mem_func callback)
+{
+   struct vectorize_ctx ctx = {
+      .shader = shader,
+      .modes = modes,
+      .callback = callback,
+   };
+   bool progress = false;
+
+   util_dynarray_init(&ctx.entries, NULL);
+
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      bool impl_progress = false;
+      nir_foreach_block(block, function->impl)
+         impl_progress |= vectorize_block(&ctx, block);
+
+      if (impl_progress) {
+         nir_metadata_preserve(function->impl, nir_metadata_block_index |
+                                               nir_metadata_dominance);
+         progress = true;
+      }
+   }
+
+   util_dynarray_fini(&ctx.entries);
+
+   return progress;
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Statistics about the passes run through NIR_PASS and NIR_PASS_V.
+ *
+ * Once enabled, by NIR_PASS_STATS or nir_pass_stats_enable(), every pass run
+ * through those macros records its wall time, whether it made progress, and
+ * the number of instructions in the shader before and after.  These are
+ * summed per pass name, both for the whole process and for each shader, and
+ * can be dumped as a table or as JSON.  When disabled, the macros only test
+ * nir_pass_stats_mode.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir.h"
+#include "c11/threads.h"
+#include "util/debug.h"
+#include "util/hash_table.h"
+#include "util/list.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+
+int nir_pass_stats_mode = -1;
+
+struct pass_totals {
+   const char *name;
+   uint64_t calls;
+   /* Calls from NIR_PASS, which reports progress, and how many of them made
+    * progress.
+    */
+   uint64_t progress_calls;
+   uint64_t num_progress;
+   uint64_t time_ns;
+   uint64_t no_progress_time_ns;
+   uint64_t instrs_before;
+   uint64_t instrs_after;
+};
+
+struct shader_record {
+   struct list_head link;
+   unsigned id;
+   gl_shader_stage stage;
+   char *name;
+   /* NULL once the shader is freed. */
+   struct nir_shader_pass_stats *handle;
+   struct hash_table *passes;
+};
+
+/* What the shader points to.  It's a ralloc child of the shader, so that
+ * the record, which outlives the shader, learns when the shader is freed.
+ */
+struct nir_shader_pass_stats {
+   struct shader_record *record;
+};
+
+static mtx_t stats_mutex = _MTX_INITIALIZER_NP;
+static void *stats_mem_ctx;
+static struct hash_table *process_passes;
+static struct list_head shader_records;
+static unsigned next_shader_id;
+static bool exit_handler_registered;
+
+static const struct debug_control pass_stats_control[] = {
+   { "table", NIR_PASS_STATS_TABLE },
+   { "json", NIR_PASS_STATS_JSON },
+   { "shaders", NIR_PASS_STATS_SHADERS },
+   { NULL, 0 },
+};
+
+static void
+dump_at_exit(void)
+{
+   int mode = nir_pass_stats_mode;
+   const char *path = getenv("NIR_PASS_STATS_FILE");
+   FILE *fp = stderr;
+
+   if (mode <= 0 || !(mode & (NIR_PASS_STATS_TABLE | NIR_PASS_STATS_JSON)))
+      return;
+
+   if (path) {
+      fp = fopen(path, "w");
+      if (!fp) {
+         fprintf(stderr, "NIR_PASS_STATS: can't open %s\n", path);
+         return;
+      }
+   }
+
+   nir_pass_stats_dump(fp, mode & NIR_PASS_STATS_JSON);
+
+   if (fp != stderr)
+      fclose(fp);
+}
+
+/* Called with stats_mutex held. */
+static void
+init_locked(void)
+{
+   if (stats_mem_ctx)
+      return;
+
+   stats_mem_ctx = ralloc_context(NULL);
+   process_passes = _mesa_hash_table_create(stats_mem_ctx,
+                                            _mesa_key_hash_string,
+                                            _mesa_key_string_equal);
+   list_inithead(&shader_records);
+}
+
+void
+nir_pass_stats_enable(unsigned flags)
+{
+   mtx_lock(&stats_mutex);
+
+   init_locked();
+   if (!exit_handler_registered &&
+       (flags & (NIR_PASS_STATS_TABLE | NIR_PASS_STATS_JSON))) {
+      atexit(dump_at_exit);
+      exit_handler_registered = true;
+   }
+
+   p_atomic_set(&nir_pass_stats_mode, flags | NIR_PASS_STATS_RECORD);
+
+   mtx_unlock(&stats_mutex);
+}
+
+void
+nir_pass_stats_init(void)
+{
+   const char *env = getenv("NIR_PASS_STATS");
+   unsigned flags;
+
+   if (!env || !env[0]) {
+      p_atomic_cmpxchg(&nir_pass_stats_mode, -1, 0);
+      return;
+   }
+
+   /* Anything that isn't a list of known flags, like "1", means a table. */
+   flags = parse_debug_string(env, pass_stats_control);
+   if (!(flags & (NIR_PASS_STATS_TABLE | NIR_PASS_STATS_JSON)))
+      flags |= NIR_PASS_STATS_TABLE;
+
+   nir_pass_stats_enable(flags);
+}
+
+static unsigned
+count_instrs(nir_shader *shader)
+{
+   unsigned count = 0;
+
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block)
+            count++;
+      }
+   }
+
+   return count;
+}
+
+void
+nir_pass_stats_begin(nir_shader *shader, nir_pass_stats_sample *sample)
+{
+   sample->num_instrs = count_instrs(shader);
+   sample->start = os_time_get_nano();
+}
+
+static void
+shader_stats_destructor(void *ptr)
+{
+   struct nir_shader_pass_stats *stats = ptr;
+
+   mtx_lock(&stats_mutex);
+   if (stats->record)
+      stats->record->handle = NULL;
+   mtx_unlock(&stats_mutex);
+}
+
+/* Called with stats_mutex held. */
+static struct shader_record *
+get_shader_record(nir_shader *shader)
+{
+   struct nir_shader_pass_stats *stats = shader->pass_stats;
+
+   if (!stats) {
+      stats = ralloc(shader, struct nir_shader_pass_stats);
+      stats->record = NULL;
+      ralloc_set_destructor(stats, shader_stats_destructor);
+      shader->pass_stats = stats;
+   }
+
+   if (!stats->record) {
+      struct shader_record *record = rzalloc(stats_mem_ctx,
+                                             struct shader_record);
+      record->id = next_shader_id++;
+      record->stage = shader->info.stage;
+      record->handle = stats;
+      record->passes = _mesa_hash_table_create(record,
+                                               _mesa_key_hash_string,
+                                               _mesa_key_string_equal);
+      list_addtail(&record->link, &shader_records);
+      stats->record = record;
+   }
+
+   /* The name is often set after the first passes ran. */
+   if (!stats->record->name && shader->info.name)
+      stats->record->name = ralloc_strdup(stats->record, shader->info.name);
+
+   return stats->record;
+}
+
+static void
+add_sample(void *mem_ctx, struct hash_table *passes, const char *pass,
+           uint64_t time_ns, int progress, unsigned instrs_before,
+           unsigned instrs_after)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(passes, pass);
+   struct pass_totals *totals;
+
+   if (entry) {
+      totals = entry->data;
+   } else {
+      totals = rzalloc(mem_ctx, struct pass_totals);
+      totals->name = ralloc_strdup(totals, pass);
+      _mesa_hash_table_insert(passes, totals->name, totals);
+   }
+
+   totals->calls++;
+   totals->time_ns += time_ns;
+   totals->instrs_before += instrs_before;
+   totals->instrs_after += instrs_after;
+
+   if (progress >= 0) {
+      totals->progress_calls++;
+      totals->num_progress += progress;
+      if (!progress)
+         totals->no_progress_time_ns += time_ns;
+   }
+}
+
+void
+nir_pass_stats_end(nir_shader *shader, const char *pass,
+                   const nir_pass_stats_sample *sample, int progress)
+{
+   uint64_t time_ns = os_time_get_nano() - sample->start;
+   unsigned num_instrs = count_instrs(shader);
+
+   mtx_lock(&stats_mutex);
+
+   /* nir_pass_stats_reset() may have run since nir_pass_stats_begin(). */
+   init_locked();
+
+   add_sample(stats_mem_ctx, process_passes, pass, time_ns, progress,
+              sample->num_instrs, num_instrs);
+
+   if (nir_pass_stats_mode & NIR_PASS_STATS_SHADERS) {
+      struct shader_record *record = get_shader_record(shader);
+      add_sample(record, record->passes, pass, time_ns, progress,
+                 sample->num_instrs, num_instrs);
+   }
+
+   mtx_unlock(&stats_mutex);
+}
+
+void
+nir_shader_pass_stats_move(nir_shader *dst, nir_shader *src)
+{
+   if (!src->pass_stats)
+      return;
+
+   assert(!dst->pass_stats);
+   dst->pass_stats = src->pass_stats;
+   src->pass_stats = NULL;
+   ralloc_steal(dst, dst->pass_stats);
+}
+
+static int
+compare_totals(const void *a, const void *b)
+{
+   const struct pass_totals *ta = *(const struct pass_totals **)a;
+   const struct pass_totals *tb = *(const struct pass_totals **)b;
+
+   if (ta->time_ns != tb->time_ns)
+      return ta->time_ns < tb->time_ns ? 1 : -1;
+   return strcmp(ta->name, tb->name);
+}
+
+/* Returns the passes sorted by decreasing total time. */
+static struct pass_totals **
+sorted_totals(struct hash_table *passes, unsigned *count)
+{
+   struct pass_totals **sorted =
+      malloc(MAX2(passes->entries, 1) * sizeof(*sorted));
+   unsigned i = 0;
+
+   hash_table_foreach(passes, entry)
+      sorted[i++] = entry->data;
+
+   qsort(sorted, i, sizeof(*sorted), compare_totals);
+   *count = i;
+
+   return sorted;
+}
+
+static void
+dump_table(FILE *fp, struct hash_table *passes)
+{
+   unsigned count;
+   struct pass_totals **sorted = sorted_totals(passes, &count);
+
+   fprintf(fp, "%-40s %8s %17s %12s %12s %22s\n", "pass", "calls",
+           "progress", "time (ms)", "wasted (ms)", "instrs before/after");
+
+   for (unsigned i = 0; i < count; i++) {
+      const struct pass_totals *t = sorted[i];
+      char progress[32];
+
+      if (t->progress_calls) {
+         snprintf(progress, sizeof(progress), "%" PRIu64 " (%u%%)",
+                  t->num_progress,
+                  (unsigned)(t->num_progress * 100 / t->progress_calls));
+      } else {
+         snprintf(progress, sizeof(progress), "-");
+      }
+
+      fprintf(fp, "%-40s %8" PRIu64 " %17s %12.3f %12.3f %10" PRIu64
+              " %11" PRIu64 "\n", t->name, t->calls, progress,
+              t->time_ns / 1e6, t->no_progress_time_ns / 1e6,
+              t->instrs_before, t->instrs_after);
+   }
+
+   free(sorted);
+}
+
+static void
+dump_json_string(FILE *fp, const char *str)
+{
+   fputc('"', fp);
+   for (; *str; str++) {
+      if (*str == '"' || *str == '\\')
+         fprintf(fp, "\\%c", *str);
+      else if ((unsigned char)*str < 0x20)
+         fprintf(fp, "\\u%04x", *str);
+      else
+         fputc(*str, fp);
+   }
+   fputc('"', fp);
+}
+
+static void
+dump_json_passes(FILE *fp, struct hash_table *passes, const char *indent)
+{
+   unsigned count;
+   struct pass_totals **sorted = sorted_totals(passes, &count);
+
+   fprintf(fp, "[");
+   for (unsigned i = 0; i < count; i++) {
+      const struct pass_totals *t = sorted[i];
+
+      fprintf(fp, "%s\n%s  { \"name\": ", i ? "," : "", indent);
+      dump_json_string(fp, t->name);
+      fprintf(fp, ", \"calls\": %" PRIu64, t->calls);
+      if (t->progress_calls) {
+         fprintf(fp, ", \"progress_calls\": %" PRIu64
+                 ", \"progress\": %" PRIu64, t->progress_calls,
+                 t->num_progress);
+      }
+      fprintf(fp, ", \"time_ns\": %" PRIu64
+              ", \"no_progress_time_ns\": %" PRIu64
+              ", \"instrs_before\": %" PRIu64
+              ", \"instrs_after\": %" PRIu64 " }",
+              t->time_ns, t->no_progress_time_ns,
+              t->instrs_before, t->instrs_after);
+   }
+   fprintf(fp, "%s]", count ? "\n" : "");
+   if (count)
+      fprintf(fp, "%s", indent);
+
+   free(sorted);
+}
+
+void
+nir_pass_stats_dump(FILE *fp, bool json)
+{
+   mtx_lock(&stats_mutex);
+
+   init_locked();
+
+   if (json) {
+      bool first = true;
+
+      fprintf(fp, "{\n  \"passes\": ");
+      dump_json_passes(fp, process_passes, "  ");
+      fprintf(fp, ",\n  \"shaders\": [");
+      list_for_each_entry(struct shader_record, record, &shader_records, link) {
+         fprintf(fp, "%s\n    { \"id\": %u, \"stage\": ",
+                 first ? "" : ",", record->id);
+         dump_json_string(fp, gl_shader_stage_name(record->stage));
+         if (record->name) {
+            fprintf(fp, ", \"name\": ");
+            dump_json_string(fp, record->name);
+         }
+         fprintf(fp, ",\n      \"passes\": ");
+         dump_json_passes(fp, record->passes, "      ");
+         fprintf(fp, " }");
+         first = false;
+      }
+      fprintf(fp, "%s]\n}\n", first ? "" : "\n  ");
+   } else {
+      fprintf(fp, "NIR pass statistics, all shaders:\n");
+      dump_table(fp, process_passes);
+
+      list_for_each_entry(struct shader_record, record, &shader_records, link) {
+         fprintf(fp, "\nshader %u (%s%s%s):\n", record->id,
+                 gl_shader_stage_name(record->stage),
+                 record->name ? ", " : "", record->name ? record->name : "");
+         dump_table(fp, record->passes);
+      }
+   }
+
+   mtx_unlock(&stats_mutex);
+}
+
+void
+nir_pass_stats_reset(void)
+{
+   mtx_lock(&stats_mutex);
+
+   if (stats_mem_ctx) {
+      /* Live shaders get a new record when they run their next pass. */
+      list_for_each_entry(struct shader_record, record, &shader_records, link) {
+         if (record->handle)
+            record->handle->record = NULL;
+      }
+      ralloc_free(stats_mem_ctx);
+      stats_mem_ctx = NULL;
+   }
+
+   mtx_unlock(&stats_mutex);
+}
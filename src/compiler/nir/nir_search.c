@@ -95,25 +95,35 @@ nir_op_matches_search_op(nir_op nop, uint16_t sop)
    if (sop <= nir_last_opcode)
       return nop == sop;
 
+   return nir_search_op_for_nir_op(nop) == sop;
+}
+
+/**
+ * Returns the search opcode matching a NIR opcode: the generic conversion
+ * opcode for sized conversions, and the NIR opcode itself otherwise.
+ */
+uint16_t
+nir_search_op_for_nir_op(nir_op nop)
+{
 #define MATCH_FCONV_CASE(op) \
-   case nir_search_op_##op: \
-      return nop == nir_op_##op##16 || \
-             nop == nir_op_##op##32 || \
-             nop == nir_op_##op##64;
+   case nir_op_##op##16: \
+   case nir_op_##op##32: \
+   case nir_op_##op##64: \
+      return nir_search_op_##op;
 
 #define MATCH_ICONV_CASE(op) \
-   case nir_search_op_##op: \
-      return nop == nir_op_##op##8 || \
-             nop == nir_op_##op##16 || \
-             nop == nir_op_##op##32 || \
-             nop == nir_op_##op##64;
+   case nir_op_##op##8: \
+   case nir_op_##op##16: \
+   case nir_op_##op##32: \
+   case nir_op_##op##64: \
+      return nir_search_op_##op;
 
 #define MATCH_BCONV_CASE(op) \
-   case nir_search_op_##op: \
-      return nop == nir_op_##op##1 || \
-             nop == nir_op_##op##32;
+   case nir_op_##op##1: \
+   case nir_op_##op##32: \
+      return nir_search_op_##op;
 
-   switch (sop) {
+   switch (nop) {
    MATCH_FCONV_CASE(i2f)
    MATCH_FCONV_CASE(u2f)
    MATCH_FCONV_CASE(f2f)
@@ -126,11 +136,12 @@ nir_op_matches_search_op(nir_op nop, uint16_t sop)
    MATCH_BCONV_CASE(i2b)
    MATCH_BCONV_CASE(f2b)
    default:
-      unreachable("Invalid nir_search_op");
+      return nop;
    }
 
 #undef MATCH_FCONV_CASE
 #undef MATCH_ICONV_CASE
+#undef MATCH_BCONV_CASE
 }
 
 static nir_op
@@ -24,28 +24,40 @@
 #include "nir_serialize.h"
 #include "nir_control_flow.h"
 #include "util/u_dynarray.h"
+#include "util/u_math.h"
+
+/* The format is meant for caches whose keys already include the driver
+ * build, so it only has to be readable by the code that wrote it.  It aims
+ * to be small: almost everything is a variable-length integer
+ * (blob_write_uleb128), each instruction starts with a single packed header,
+ * and types and strings are written once and referred to by index after
+ * that.
+ *
+ * Objects that other objects refer to (variables, registers, functions,
+ * blocks and SSA values) get consecutive indices in the order the reader
+ * creates them.  Blocks and SSA values are numbered for a whole function
+ * before it's written, so phi sources can refer to values that come later.
+ */
 
-typedef struct {
-   size_t blob_offset;
-   nir_ssa_def *src;
-   nir_block *block;
-} write_phi_fixup;
+#define MAX_OBJECT_IDS (1 << 30)
 
 typedef struct {
    const nir_shader *nir;
 
    struct blob *blob;
 
+   /* whether to leave out names that are only there for debugging */
+   bool strip;
+
    /* maps pointer to index */
    struct hash_table *remap_table;
 
    /* the next index to assign to a NIR in-memory object */
-   uintptr_t next_idx;
+   uint32_t next_idx;
 
-   /* Array of write_phi_fixup structs representing phi sources that need to
-    * be resolved in the second pass.
-    */
-   struct util_dynarray phi_fixups;
+   /* maps glsl_type pointers and strings to their index plus one */
+   struct hash_table *type_table;
+   struct hash_table *string_table;
 } write_ctx;
 
 typedef struct {
@@ -54,14 +66,18 @@ typedef struct {
    struct blob_reader *blob;
 
    /* the next index to assign to a NIR in-memory object */
-   uintptr_t next_idx;
+   uint32_t next_idx;
 
    /* The length of the index -> object table */
-   uintptr_t idx_table_len;
+   uint32_t idx_table_len;
 
    /* map from index to deserialized pointer */
    void **idx_table;
 
+   /* types and strings in the order they were first written */
+   struct util_dynarray types;
+   struct util_dynarray strings;
+
    /* List of phi sources. */
    struct list_head phi_srcs;
 
@@ -70,22 +86,23 @@ typedef struct {
 static void
 write_add_object(write_ctx *ctx, const void *obj)
 {
-   uintptr_t index = ctx->next_idx++;
-   _mesa_hash_table_insert(ctx->remap_table, obj, (void *) index);
+   uint32_t index = ctx->next_idx++;
+   assert(index < MAX_OBJECT_IDS);
+   _mesa_hash_table_insert(ctx->remap_table, obj, (void *)(uintptr_t) index);
 }
 
-static uintptr_t
+static uint32_t
 write_lookup_object(write_ctx *ctx, const void *obj)
 {
    struct hash_entry *entry = _mesa_hash_table_search(ctx->remap_table, obj);
    assert(entry);
-   return (uintptr_t) entry->data;
+   return (uint32_t)(uintptr_t) entry->data;
 }
 
 static void
 write_object(write_ctx *ctx, const void *obj)
 {
-   blob_write_intptr(ctx->blob, write_lookup_object(ctx, obj));
+   blob_write_uleb128(ctx->blob, write_lookup_object(ctx, obj));
 }
 
 static void
@@ -96,7 +113,7 @@ read_add_object(read_ctx *ctx, void *obj)
 }
 
 static void *
-read_lookup_object(read_ctx *ctx, uintptr_t idx)
+read_lookup_object(read_ctx *ctx, uint32_t idx)
 {
    assert(idx < ctx->idx_table_len);
    return ctx->idx_table[idx];
@@ -105,14 +122,117 @@ read_lookup_object(read_ctx *ctx, uintptr_t idx)
 static void *
 read_object(read_ctx *ctx)
 {
-   return read_lookup_object(ctx, blob_read_intptr(ctx->blob));
+   return read_lookup_object(ctx, blob_read_uleb128(ctx->blob));
+}
+
+/* Writes a reference to an entry of a type or string table, followed by the
+ * entry itself the first time.  Zero stands for NULL.  Returns whether the
+ * entry has to be written.
+ */
+static bool
+write_table_ref(write_ctx *ctx, struct hash_table *table, const void *key)
+{
+   if (!key) {
+      blob_write_uleb128(ctx->blob, 0);
+      return false;
+   }
+
+   struct hash_entry *entry = _mesa_hash_table_search(table, key);
+   if (entry) {
+      blob_write_uleb128(ctx->blob, (uintptr_t) entry->data);
+      return false;
+   }
+
+   uintptr_t ref = table->entries + 1;
+   _mesa_hash_table_insert(table, key, (void *) ref);
+   blob_write_uleb128(ctx->blob, ref);
+   return true;
+}
+
+static void
+write_type(write_ctx *ctx, const struct glsl_type *type)
+{
+   if (write_table_ref(ctx, ctx->type_table, type))
+      encode_type_to_blob(ctx->blob, type);
+}
+
+static const struct glsl_type *
+read_type(read_ctx *ctx)
+{
+   uint32_t ref = blob_read_uleb128(ctx->blob);
+   unsigned num_types =
+      util_dynarray_num_elements(&ctx->types, const struct glsl_type *);
+
+   if (ref == 0)
+      return NULL;
+
+   if (ref == num_types + 1) {
+      const struct glsl_type *type = decode_type_from_blob(ctx->blob);
+      util_dynarray_append(&ctx->types, const struct glsl_type *, type);
+      return type;
+   }
+
+   assert(ref <= num_types);
+   return *util_dynarray_element(&ctx->types, const struct glsl_type *,
+                                 ref - 1);
+}
+
+static void
+write_string(write_ctx *ctx, const char *str)
+{
+   if (write_table_ref(ctx, ctx->string_table, str))
+      blob_write_string(ctx->blob, str);
+}
+
+/* Writes a name that can be left out when stripping */
+static void
+write_name(write_ctx *ctx, const char *name)
+{
+   write_string(ctx, ctx->strip ? NULL : name);
+}
+
+/* The returned string points into the blob */
+static const char *
+read_string(read_ctx *ctx)
+{
+   uint32_t ref = blob_read_uleb128(ctx->blob);
+   unsigned num_strings =
+      util_dynarray_num_elements(&ctx->strings, const char *);
+
+   if (ref == 0)
+      return NULL;
+
+   if (ref == num_strings + 1) {
+      const char *str = blob_read_string(ctx->blob);
+      util_dynarray_append(&ctx->strings, const char *, str);
+      return str;
+   }
+
+   assert(ref <= num_strings);
+   return *util_dynarray_element(&ctx->strings, const char *, ref - 1);
+}
+
+static char *
+read_name(read_ctx *ctx, void *mem_ctx)
+{
+   const char *name = read_string(ctx);
+   return name ? ralloc_strdup(mem_ctx, name) : NULL;
 }
 
 static void
 write_constant(write_ctx *ctx, const nir_constant *c)
 {
-   blob_write_bytes(ctx->blob, c->values, sizeof(c->values));
-   blob_write_uint32(ctx->blob, c->num_elements);
+   /* Most of the values are usually zero, so only write up to the last byte
+    * that isn't.
+    */
+   const uint8_t *values = (const uint8_t *) c->values;
+   uint32_t size = sizeof(c->values);
+   while (size > 0 && values[size - 1] == 0)
+      size--;
+
+   blob_write_uleb128(ctx->blob, size);
+   blob_write_bytes(ctx->blob, values, size);
+   blob_write_uleb128(ctx->blob, c->num_elements);
    for (unsigned i = 0; i < c->num_elements; i++)
       write_constant(ctx, c->elements[i]);
 }
@@ -120,10 +240,12 @@ write_constant(write_ctx *ctx, const nir_constant *c)
 static nir_constant *
 read_constant(read_ctx *ctx, nir_variable *nvar)
 {
-   nir_constant *c = ralloc(nvar, nir_constant);
+   nir_constant *c = rzalloc(nvar, nir_constant);
 
-   blob_copy_bytes(ctx->blob, (uint8_t *)c->values, sizeof(c->values));
-   c->num_elements = blob_read_uint32(ctx->blob);
+   uint32_t size = blob_read_uleb128(ctx->blob);
+   assert(size <= sizeof(c->values));
+   blob_copy_bytes(ctx->blob, (uint8_t *)c->values, size);
+   c->num_elements = blob_read_uleb128(ctx->blob);
    c->elements = ralloc_array(nvar, nir_constant *, c->num_elements);
    for (unsigned i = 0; i < c->num_elements; i++)
       c->elements[i] = read_constant(ctx, nvar);
@@ -135,21 +257,17 @@ static void
 write_variable(write_ctx *ctx, const nir_variable *var)
 {
    write_add_object(ctx, var);
-   encode_type_to_blob(ctx->blob, var->type);
-   blob_write_uint32(ctx->blob, !!(var->name));
-   if (var->name)
-      blob_write_string(ctx->blob, var->name);
+   write_type(ctx, var->type);
+   write_name(ctx, var->name);
    blob_write_bytes(ctx->blob, (uint8_t *) &var->data, sizeof(var->data));
-   blob_write_uint32(ctx->blob, var->num_state_slots);
+   blob_write_uleb128(ctx->blob, var->num_state_slots);
    blob_write_bytes(ctx->blob, (uint8_t *) var->state_slots,
                     var->num_state_slots * sizeof(nir_state_slot));
-   blob_write_uint32(ctx->blob, !!(var->constant_initializer));
+   blob_write_uleb128(ctx->blob, !!(var->constant_initializer));
    if (var->constant_initializer)
       write_constant(ctx, var->constant_initializer);
-   blob_write_uint32(ctx->blob, !!(var->interface_type));
-   if (var->interface_type)
-      encode_type_to_blob(ctx->blob, var->interface_type);
-   blob_write_uint32(ctx->blob, var->num_members);
+   write_type(ctx, var->interface_type);
+   blob_write_uleb128(ctx->blob, var->num_members);
    if (var->num_members > 0) {
       blob_write_bytes(ctx->blob, (uint8_t *) var->members,
                        var->num_members * sizeof(*var->members));
@@ -162,30 +280,20 @@ read_variable(read_ctx *ctx)
    nir_variable *var = rzalloc(ctx->nir, nir_variable);
    read_add_object(ctx, var);
 
-   var->type = decode_type_from_blob(ctx->blob);
-   bool has_name = blob_read_uint32(ctx->blob);
-   if (has_name) {
-      const char *name = blob_read_string(ctx->blob);
-      var->name = ralloc_strdup(var, name);
-   } else {
-      var->name = NULL;
-   }
+   var->type = read_type(ctx);
+   var->name = read_name(ctx, var);
    blob_copy_bytes(ctx->blob, (uint8_t *) &var->data, sizeof(var->data));
-   var->num_state_slots = blob_read_uint32(ctx->blob);
+   var->num_state_slots = blob_read_uleb128(ctx->blob);
    var->state_slots = ralloc_array(var, nir_state_slot, var->num_state_slots);
    blob_copy_bytes(ctx->blob, (uint8_t *) var->state_slots,
                    var->num_state_slots * sizeof(nir_state_slot));
-   bool has_const_initializer = blob_read_uint32(ctx->blob);
+   bool has_const_initializer = blob_read_uleb128(ctx->blob);
    if (has_const_initializer)
       var->constant_initializer = read_constant(ctx, var);
    else
       var->constant_initializer = NULL;
-   bool has_interface_type = blob_read_uint32(ctx->blob);
-   if (has_interface_type)
-      var->interface_type = decode_type_from_blob(ctx->blob);
-   else
-      var->interface_type = NULL;
-   var->num_members = blob_read_uint32(ctx->blob);
+   var->interface_type = read_type(ctx);
+   var->num_members = blob_read_uleb128(ctx->blob);
    if (var->num_members > 0) {
       var->members = ralloc_array(var, struct nir_variable_data,
                                   var->num_members);
@@ -199,7 +307,7 @@ read_variable(read_ctx *ctx)
 static void
 write_var_list(write_ctx *ctx, const struct exec_list *src)
 {
-   blob_write_uint32(ctx->blob, exec_list_length(src));
+   blob_write_uleb128(ctx->blob, exec_list_length(src));
    foreach_list_typed(nir_variable, var, node, src) {
       write_variable(ctx, var);
    }
@@ -209,7 +317,7 @@ static void
 read_var_list(read_ctx *ctx, struct exec_list *dst)
 {
    exec_list_make_empty(dst);
-   unsigned num_vars = blob_read_uint32(ctx->blob);
+   unsigned num_vars = blob_read_uleb128(ctx->blob);
    for (unsigned i = 0; i < num_vars; i++) {
       nir_variable *var = read_variable(ctx);
       exec_list_push_tail(dst, &var->node);
@@ -220,14 +328,13 @@ static void
 write_register(write_ctx *ctx, const nir_register *reg)
 {
    write_add_object(ctx, reg);
-   blob_write_uint32(ctx->blob, reg->num_components);
-   blob_write_uint32(ctx->blob, reg->bit_size);
-   blob_write_uint32(ctx->blob, reg->num_array_elems);
-   blob_write_uint32(ctx->blob, reg->index);
-   blob_write_uint32(ctx->blob, !!(reg->name));
-   if (reg->name)
-      blob_write_string(ctx->blob, reg->name);
-   blob_write_uint32(ctx->blob, reg->is_global << 1 | reg->is_packed);
+   blob_write_uleb128(ctx->blob, reg->num_components |
+                                 reg->is_global << 3 |
+                                 reg->is_packed << 4 |
+                                 reg->bit_size << 5);
+   blob_write_uleb128(ctx->blob, reg->num_array_elems);
+   blob_write_uleb128(ctx->blob, reg->index);
+   write_name(ctx, reg->name);
 }
 
 static nir_register *
@@ -235,20 +342,14 @@ read_register(read_ctx *ctx)
 {
    nir_register *reg = ralloc(ctx->nir, nir_register);
    read_add_object(ctx, reg);
-   reg->num_components = blob_read_uint32(ctx->blob);
-   reg->bit_size = blob_read_uint32(ctx->blob);
-   reg->num_array_elems = blob_read_uint32(ctx->blob);
-   reg->index = blob_read_uint32(ctx->blob);
-   bool has_name = blob_read_uint32(ctx->blob);
-   if (has_name) {
-      const char *name = blob_read_string(ctx->blob);
-      reg->name = ralloc_strdup(reg, name);
-   } else {
-      reg->name = NULL;
-   }
-   unsigned flags = blob_read_uint32(ctx->blob);
-   reg->is_global = flags & 0x2;
-   reg->is_packed = flags & 0x1;
+   uint32_t val = blob_read_uleb128(ctx->blob);
+   reg->num_components = val & 0x7;
+   reg->is_global = val & 0x8;
+   reg->is_packed = val & 0x10;
+   reg->bit_size = val >> 5;
+   reg->num_array_elems = blob_read_uleb128(ctx->blob);
+   reg->index = blob_read_uleb128(ctx->blob);
+   reg->name = read_name(ctx, reg);
 
    list_inithead(&reg->uses);
    list_inithead(&reg->defs);
@@ -260,7 +361,7 @@ read_register(read_ctx *ctx)
 static void
 write_reg_list(write_ctx *ctx, const struct exec_list *src)
 {
-   blob_write_uint32(ctx->blob, exec_list_length(src));
+   blob_write_uleb128(ctx->blob, exec_list_length(src));
    foreach_list_typed(nir_register, reg, node, src)
       write_register(ctx, reg);
 }
@@ -269,7 +370,7 @@ static void
 read_reg_list(read_ctx *ctx, struct exec_list *dst)
 {
    exec_list_make_empty(dst);
-   unsigned num_regs = blob_read_uint32(ctx->blob);
+   unsigned num_regs = blob_read_uleb128(ctx->blob);
    for (unsigned i = 0; i < num_regs; i++) {
       nir_register *reg = read_register(ctx);
       exec_list_push_tail(dst, &reg->node);
@@ -281,20 +382,19 @@ write_src(write_ctx *ctx, const nir_src *src)
 {
    /* Since sources are very frequent, we try to save some space when storing
     * them. In particular, we store whether the source is a register and
-    * whether the register has an indirect index in the low two bits. We can
-    * assume that the high two bits of the index are zero, since otherwise our
-    * address space would've been exhausted allocating the remap table!
+    * whether the register has an indirect index in the low two bits.
+    * MAX_OBJECT_IDS makes sure the result fits in 32 bits.
     */
    if (src->is_ssa) {
-      uintptr_t idx = write_lookup_object(ctx, src->ssa) << 2;
+      uint32_t idx = write_lookup_object(ctx, src->ssa) << 2;
       idx |= 1;
-      blob_write_intptr(ctx->blob, idx);
+      blob_write_uleb128(ctx->blob, idx);
    } else {
-      uintptr_t idx = write_lookup_object(ctx, src->reg.reg) << 2;
+      uint32_t idx = write_lookup_object(ctx, src->reg.reg) << 2;
       if (src->reg.indirect)
          idx |= 2;
-      blob_write_intptr(ctx->blob, idx);
-      blob_write_uint32(ctx->blob, src->reg.base_offset);
+      blob_write_uleb128(ctx->blob, idx);
+      blob_write_uleb128(ctx->blob, src->reg.base_offset);
       if (src->reg.indirect) {
          write_src(ctx, src->reg.indirect);
       }
@@ -304,15 +404,15 @@ write_src(write_ctx *ctx, const nir_src *src)
 static void
 read_src(read_ctx *ctx, nir_src *src, void *mem_ctx)
 {
-   uintptr_t val = blob_read_intptr(ctx->blob);
-   uintptr_t idx = val >> 2;
+   uint32_t val = blob_read_uleb128(ctx->blob);
+   uint32_t idx = val >> 2;
    src->is_ssa = val & 0x1;
    if (src->is_ssa) {
       src->ssa = read_lookup_object(ctx, idx);
    } else {
       bool is_indirect = val & 0x2;
       src->reg.reg = read_lookup_object(ctx, idx);
-      src->reg.base_offset = blob_read_uint32(ctx->blob);
+      src->reg.base_offset = blob_read_uleb128(ctx->blob);
       if (is_indirect) {
          src->reg.indirect = ralloc(mem_ctx, nir_src);
          read_src(ctx, src->reg.indirect, mem_ctx);
@@ -322,90 +422,211 @@ read_src(read_ctx *ctx, nir_src *src, void *mem_ctx)
    }
 }
 
-static void
-write_dest(write_ctx *ctx, const nir_dest *dst)
+/* Destinations are described by eight bits that are packed into the header
+ * of their instruction.
+ */
+union packed_dest {
+   uint8_t u8;
+   struct {
+      unsigned is_ssa:1;
+      unsigned has_name:1;
+      unsigned num_components:3;
+      unsigned bit_size:3; /* log2 of the bit size */
+   } ssa;
+   struct {
+      unsigned is_ssa:1;
+      unsigned is_indirect:1;
+      unsigned unused:6;
+   } reg;
+};
+
+static uint8_t
+pack_dest(write_ctx *ctx, const nir_dest *dst)
 {
-   uint32_t val = dst->is_ssa;
+   union packed_dest packed = { .u8 = 0 };
+
    if (dst->is_ssa) {
-      val |= !!(dst->ssa.name) << 1;
-      val |= dst->ssa.num_components << 2;
-      val |= dst->ssa.bit_size << 5;
+      packed.ssa.is_ssa = 1;
+      packed.ssa.has_name = dst->ssa.name && !ctx->strip;
+      packed.ssa.num_components = dst->ssa.num_components;
+      packed.ssa.bit_size = util_logbase2(dst->ssa.bit_size);
    } else {
-      val |= !!(dst->reg.indirect) << 1;
+      packed.reg.is_indirect = !!(dst->reg.indirect);
    }
-   blob_write_uint32(ctx->blob, val);
+
+   return packed.u8;
+}
+
+/* Writes what's left of a destination after pack_dest */
+static void
+write_dest(write_ctx *ctx, const nir_dest *dst)
+{
    if (dst->is_ssa) {
-      write_add_object(ctx, &dst->ssa);
-      if (dst->ssa.name)
-         blob_write_string(ctx->blob, dst->ssa.name);
+      if (dst->ssa.name && !ctx->strip)
+         write_string(ctx, dst->ssa.name);
    } else {
-      blob_write_intptr(ctx->blob, write_lookup_object(ctx, dst->reg.reg));
-      blob_write_uint32(ctx->blob, dst->reg.base_offset);
+      write_object(ctx, dst->reg.reg);
+      blob_write_uleb128(ctx->blob, dst->reg.base_offset);
       if (dst->reg.indirect)
          write_src(ctx, dst->reg.indirect);
    }
 }
 
 static void
-read_dest(read_ctx *ctx, nir_dest *dst, nir_instr *instr)
-{
-   uint32_t val = blob_read_uint32(ctx->blob);
-   bool is_ssa = val & 0x1;
-   if (is_ssa) {
-      bool has_name = val & 0x2;
-      unsigned num_components = (val >> 2) & 0x7;
-      unsigned bit_size = val >> 5;
-      char *name = has_name ? blob_read_string(ctx->blob) : NULL;
-      nir_ssa_dest_init(instr, dst, num_components, bit_size, name);
+read_dest(read_ctx *ctx, nir_dest *dst, nir_instr *instr, uint8_t val)
+{
+   union packed_dest packed = { .u8 = val };
+
+   if (packed.ssa.is_ssa) {
+      const char *name = packed.ssa.has_name ? read_string(ctx) : NULL;
+      nir_ssa_dest_init(instr, dst, packed.ssa.num_components,
+                        1 << packed.ssa.bit_size, name);
       read_add_object(ctx, &dst->ssa);
    } else {
-      bool is_indirect = val & 0x2;
       dst->reg.reg = read_object(ctx);
-      dst->reg.base_offset = blob_read_uint32(ctx->blob);
-      if (is_indirect) {
+      dst->reg.base_offset = blob_read_uleb128(ctx->blob);
+      if (packed.reg.is_indirect) {
          dst->reg.indirect = ralloc(instr, nir_src);
          read_src(ctx, dst->reg.indirect, instr);
       }
    }
 }
 
+/* The first thing written for each instruction.  The instruction type comes
+ * first and the fields that are usually small come next, so that the header
+ * usually takes two to four bytes.
+ */
+union packed_instr {
+   uint32_t u32;
+   struct {
+      unsigned instr_type:4;
+      unsigned unused:28;
+   } any;
+   struct {
+      unsigned instr_type:4;
+      unsigned exact:1;
+      unsigned saturate:1;
+      unsigned simple_srcs:1;
+      unsigned write_mask:4;
+      unsigned dest:8;
+      unsigned op:9;
+      unsigned unused:4;
+   } alu;
+   struct {
+      unsigned instr_type:4;
+      unsigned deref_type:3;
+      unsigned mode:4; /* log2 of the mode plus one, or 0 if written apart */
+      unsigned dest:8;
+      unsigned unused:13;
+   } deref;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_components:3;
+      unsigned dest:8;
+      unsigned intrinsic:9;
+      unsigned unused:8;
+   } intrinsic;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_components:3;
+      unsigned bit_size:3;
+      unsigned unused:22;
+   } load_const;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_components:3;
+      unsigned bit_size:3;
+      unsigned unused:22;
+   } undef;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_srcs:4;
+      unsigned op:4;
+      unsigned dest:8;
+      unsigned unused:12;
+   } tex;
+   struct {
+      unsigned instr_type:4;
+      unsigned dest:8;
+      unsigned num_srcs:20;
+   } phi;
+   struct {
+      unsigned instr_type:4;
+      unsigned type:2;
+      unsigned unused:26;
+   } jump;
+};
+
+/* Whether the sources of an ALU instruction have neither modifiers nor
+ * swizzles in the channels that are used, so that they can be written
+ * without any of those.
+ */
+static bool
+alu_srcs_are_simple(const nir_alu_instr *alu)
+{
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+      if (alu->src[i].negate || alu->src[i].abs)
+         return false;
+
+      for (unsigned j = 0; j < NIR_MAX_VEC_COMPONENTS; j++) {
+         if (nir_alu_instr_channel_used(alu, i, j) &&
+             alu->src[i].swizzle[j] != j)
+            return false;
+      }
+   }
+
+   return true;
+}
+
 static void
 write_alu(write_ctx *ctx, const nir_alu_instr *alu)
 {
-   blob_write_uint32(ctx->blob, alu->op);
-   uint32_t flags = alu->exact;
-   flags |= alu->dest.saturate << 1;
-   flags |= alu->dest.write_mask << 2;
-   blob_write_uint32(ctx->blob, flags);
+   STATIC_ASSERT(nir_num_opcodes <= 512);
+
+   bool simple_srcs = alu_srcs_are_simple(alu);
+   union packed_instr header = { .u32 = 0 };
+
+   header.alu.instr_type = alu->instr.type;
+   header.alu.exact = alu->exact;
+   header.alu.saturate = alu->dest.saturate;
+   header.alu.simple_srcs = simple_srcs;
+   header.alu.write_mask = alu->dest.write_mask;
+   header.alu.dest = pack_dest(ctx, &alu->dest.dest);
+   header.alu.op = alu->op;
+   blob_write_uleb128(ctx->blob, header.u32);
 
    write_dest(ctx, &alu->dest.dest);
 
    for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
       write_src(ctx, &alu->src[i].src);
-      flags = alu->src[i].negate;
+      if (simple_srcs)
+         continue;
+
+      uint32_t flags = alu->src[i].negate;
       flags |= alu->src[i].abs << 1;
       for (unsigned j = 0; j < 4; j++)
          flags |= alu->src[i].swizzle[j] << (2 + 2 * j);
-      blob_write_uint32(ctx->blob, flags);
+      blob_write_uleb128(ctx->blob, flags);
    }
 }
 
 static nir_alu_instr *
-read_alu(read_ctx *ctx)
+read_alu(read_ctx *ctx, union packed_instr header)
 {
-   nir_op op = blob_read_uint32(ctx->blob);
-   nir_alu_instr *alu = nir_alu_instr_create(ctx->nir, op);
+   nir_alu_instr *alu = nir_alu_instr_create(ctx->nir, header.alu.op);
 
-   uint32_t flags = blob_read_uint32(ctx->blob);
-   alu->exact = flags & 1;
-   alu->dest.saturate = flags & 2;
-   alu->dest.write_mask = flags >> 2;
+   alu->exact = header.alu.exact;
+   alu->dest.saturate = header.alu.saturate;
+   alu->dest.write_mask = header.alu.write_mask;
 
-   read_dest(ctx, &alu->dest.dest, &alu->instr);
+   read_dest(ctx, &alu->dest.dest, &alu->instr, header.alu.dest);
 
-   for (unsigned i = 0; i < nir_op_infos[op].num_inputs; i++) {
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
       read_src(ctx, &alu->src[i].src, &alu->instr);
-      flags = blob_read_uint32(ctx->blob);
+      if (header.alu.simple_srcs)
+         continue;
+
+      uint32_t flags = blob_read_uleb128(ctx->blob);
       alu->src[i].negate = flags & 1;
       alu->src[i].abs = flags & 2;
       for (unsigned j = 0; j < 4; j++)
@@ -418,10 +639,18 @@ read_alu(read_ctx *ctx)
 static void
 write_deref(write_ctx *ctx, const nir_deref_instr *deref)
 {
-   blob_write_uint32(ctx->blob, deref->deref_type);
+   union packed_instr header = { .u32 = 0 };
 
-   blob_write_uint32(ctx->blob, deref->mode);
-   encode_type_to_blob(ctx->blob, deref->type);
+   header.deref.instr_type = deref->instr.type;
+   header.deref.deref_type = deref->deref_type;
+   if (util_is_power_of_two_nonzero(deref->mode))
+      header.deref.mode = util_logbase2(deref->mode) + 1;
+   header.deref.dest = pack_dest(ctx, &deref->dest);
+   blob_write_uleb128(ctx->blob, header.u32);
+
+   if (header.deref.mode == 0)
+      blob_write_uleb128(ctx->blob, deref->mode);
+   write_type(ctx, deref->type);
 
    write_dest(ctx, &deref->dest);
 
@@ -434,7 +663,7 @@ write_deref(write_ctx *ctx, const nir_deref_instr *deref)
 
    switch (deref->deref_type) {
    case nir_deref_type_struct:
-      blob_write_uint32(ctx->blob, deref->strct.index);
+      blob_write_uleb128(ctx->blob, deref->strct.index);
       break;
 
    case nir_deref_type_array:
@@ -443,7 +672,7 @@ write_deref(write_ctx *ctx, const nir_deref_instr *deref)
       break;
 
    case nir_deref_type_cast:
-      blob_write_uint32(ctx->blob, deref->cast.ptr_stride);
+      blob_write_uleb128(ctx->blob, deref->cast.ptr_stride);
       break;
 
    case nir_deref_type_array_wildcard:
@@ -456,15 +685,18 @@ write_deref(write_ctx *ctx, const nir_deref_instr *deref)
 }
 
 static nir_deref_instr *
-read_deref(read_ctx *ctx)
+read_deref(read_ctx *ctx, union packed_instr header)
 {
-   nir_deref_type deref_type = blob_read_uint32(ctx->blob);
+   nir_deref_type deref_type = header.deref.deref_type;
    nir_deref_instr *deref = nir_deref_instr_create(ctx->nir, deref_type);
 
-   deref->mode = blob_read_uint32(ctx->blob);
-   deref->type = decode_type_from_blob(ctx->blob);
+   if (header.deref.mode)
+      deref->mode = 1 << (header.deref.mode - 1);
+   else
+      deref->mode = blob_read_uleb128(ctx->blob);
+   deref->type = read_type(ctx);
 
-   read_dest(ctx, &deref->dest, &deref->instr);
+   read_dest(ctx, &deref->dest, &deref->instr, header.deref.dest);
 
    if (deref_type == nir_deref_type_var) {
       deref->var = read_object(ctx);
@@ -475,7 +707,7 @@ read_deref(read_ctx *ctx)
 
    switch (deref->deref_type) {
    case nir_deref_type_struct:
-      deref->strct.index = blob_read_uint32(ctx->blob);
+      deref->strct.index = blob_read_uleb128(ctx->blob);
       break;
 
    case nir_deref_type_array:
@@ -484,7 +716,7 @@ read_deref(read_ctx *ctx)
       break;
 
    case nir_deref_type_cast:
-      deref->cast.ptr_stride = blob_read_uint32(ctx->blob);
+      deref->cast.ptr_stride = blob_read_uleb128(ctx->blob);
       break;
 
    case nir_deref_type_array_wildcard:
@@ -501,12 +733,18 @@ read_deref(read_ctx *ctx)
 static void
 write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
 {
-   blob_write_uint32(ctx->blob, intrin->intrinsic);
+   STATIC_ASSERT(nir_num_intrinsics <= 512);
 
    unsigned num_srcs = nir_intrinsic_infos[intrin->intrinsic].num_srcs;
    unsigned num_indices = nir_intrinsic_infos[intrin->intrinsic].num_indices;
+   union packed_instr header = { .u32 = 0 };
 
-   blob_write_uint32(ctx->blob, intrin->num_components);
+   header.intrinsic.instr_type = intrin->instr.type;
+   header.intrinsic.num_components = intrin->num_components;
+   if (nir_intrinsic_infos[intrin->intrinsic].has_dest)
+      header.intrinsic.dest = pack_dest(ctx, &intrin->dest);
+   header.intrinsic.intrinsic = intrin->intrinsic;
+   blob_write_uleb128(ctx->blob, header.u32);
 
    if (nir_intrinsic_infos[intrin->intrinsic].has_dest)
       write_dest(ctx, &intrin->dest);
@@ -515,29 +753,28 @@ write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
       write_src(ctx, &intrin->src[i]);
 
    for (unsigned i = 0; i < num_indices; i++)
-      blob_write_uint32(ctx->blob, intrin->const_index[i]);
+      blob_write_uleb128(ctx->blob, intrin->const_index[i]);
 }
 
 static nir_intrinsic_instr *
-read_intrinsic(read_ctx *ctx)
+read_intrinsic(read_ctx *ctx, union packed_instr header)
 {
-   nir_intrinsic_op op = blob_read_uint32(ctx->blob);
-
+   nir_intrinsic_op op = header.intrinsic.intrinsic;
    nir_intrinsic_instr *intrin = nir_intrinsic_instr_create(ctx->nir, op);
 
    unsigned num_srcs = nir_intrinsic_infos[op].num_srcs;
    unsigned num_indices = nir_intrinsic_infos[op].num_indices;
 
-   intrin->num_components = blob_read_uint32(ctx->blob);
+   intrin->num_components = header.intrinsic.num_components;
 
    if (nir_intrinsic_infos[op].has_dest)
-      read_dest(ctx, &intrin->dest, &intrin->instr);
+      read_dest(ctx, &intrin->dest, &intrin->instr, header.intrinsic.dest);
 
    for (unsigned i = 0; i < num_srcs; i++)
       read_src(ctx, &intrin->src[i], &intrin->instr);
 
    for (unsigned i = 0; i < num_indices; i++)
-      intrin->const_index[i] = blob_read_uint32(ctx->blob);
+      intrin->const_index[i] = blob_read_uleb128(ctx->blob);
 
    return intrin;
 }
@@ -545,22 +782,63 @@ read_intrinsic(read_ctx *ctx)
 static void
 write_load_const(write_ctx *ctx, const nir_load_const_instr *lc)
 {
-   uint32_t val = lc->def.num_components;
-   val |= lc->def.bit_size << 3;
-   blob_write_uint32(ctx->blob, val);
-   blob_write_bytes(ctx->blob, (uint8_t *) &lc->value, sizeof(lc->value));
-   write_add_object(ctx, &lc->def);
+   union packed_instr header = { .u32 = 0 };
+
+   header.load_const.instr_type = lc->instr.type;
+   header.load_const.num_components = lc->def.num_components;
+   header.load_const.bit_size = util_logbase2(lc->def.bit_size);
+   blob_write_uleb128(ctx->blob, header.u32);
+
+   /* Only write the components that are used, at their actual size */
+   switch (lc->def.bit_size) {
+   case 1:
+      blob_write_bytes(ctx->blob, lc->value.b, lc->def.num_components);
+      break;
+   case 8:
+      blob_write_bytes(ctx->blob, lc->value.u8, lc->def.num_components);
+      break;
+   case 16:
+      blob_write_bytes(ctx->blob, lc->value.u16, lc->def.num_components * 2);
+      break;
+   case 32:
+      blob_write_bytes(ctx->blob, lc->value.u32, lc->def.num_components * 4);
+      break;
+   case 64:
+      blob_write_bytes(ctx->blob, lc->value.u64, lc->def.num_components * 8);
+      break;
+   default:
+      unreachable("Invalid bit size");
+   }
 }
 
 static nir_load_const_instr *
-read_load_const(read_ctx *ctx)
+read_load_const(read_ctx *ctx, union packed_instr header)
 {
-   uint32_t val = blob_read_uint32(ctx->blob);
-
+   unsigned num_components = header.load_const.num_components;
+   unsigned bit_size = 1 << header.load_const.bit_size;
    nir_load_const_instr *lc =
-      nir_load_const_instr_create(ctx->nir, val & 0x7, val >> 3);
+      nir_load_const_instr_create(ctx->nir, num_components, bit_size);
+
+   switch (bit_size) {
+   case 1:
+      blob_copy_bytes(ctx->blob, lc->value.b, num_components);
+      break;
+   case 8:
+      blob_copy_bytes(ctx->blob, lc->value.u8, num_components);
+      break;
+   case 16:
+      blob_copy_bytes(ctx->blob, lc->value.u16, num_components * 2);
+      break;
+   case 32:
+      blob_copy_bytes(ctx->blob, lc->value.u32, num_components * 4);
+      break;
+   case 64:
+      blob_copy_bytes(ctx->blob, lc->value.u64, num_components * 8);
+      break;
+   default:
+      unreachable("Invalid bit size");
+   }
 
-   blob_copy_bytes(ctx->blob, (uint8_t *) &lc->value, sizeof(lc->value));
    read_add_object(ctx, &lc->def);
    return lc;
 }
@@ -568,19 +846,20 @@ read_load_const(read_ctx *ctx)
 static void
 write_ssa_undef(write_ctx *ctx, const nir_ssa_undef_instr *undef)
 {
-   uint32_t val = undef->def.num_components;
-   val |= undef->def.bit_size << 3;
-   blob_write_uint32(ctx->blob, val);
-   write_add_object(ctx, &undef->def);
+   union packed_instr header = { .u32 = 0 };
+
+   header.undef.instr_type = undef->instr.type;
+   header.undef.num_components = undef->def.num_components;
+   header.undef.bit_size = util_logbase2(undef->def.bit_size);
+   blob_write_uleb128(ctx->blob, header.u32);
 }
 
 static nir_ssa_undef_instr *
-read_ssa_undef(read_ctx *ctx)
+read_ssa_undef(read_ctx *ctx, union packed_instr header)
 {
-   uint32_t val = blob_read_uint32(ctx->blob);
-
    nir_ssa_undef_instr *undef =
-      nir_ssa_undef_instr_create(ctx->nir, val & 0x7, val >> 3);
+      nir_ssa_undef_instr_create(ctx->nir, header.undef.num_components,
+                                 1 << header.undef.bit_size);
 
    read_add_object(ctx, &undef->def);
    return undef;
@@ -596,18 +875,25 @@ union packed_tex_data {
       unsigned is_shadow:1;
       unsigned is_new_style_shadow:1;
       unsigned component:2;
-      unsigned unused:10; /* Mark unused for valgrind. */
+      unsigned unused:12; /* Mark unused for valgrind. */
    } u;
 };
 
 static void
 write_tex(write_ctx *ctx, const nir_tex_instr *tex)
 {
-   blob_write_uint32(ctx->blob, tex->num_srcs);
-   blob_write_uint32(ctx->blob, tex->op);
-   blob_write_uint32(ctx->blob, tex->texture_index);
-   blob_write_uint32(ctx->blob, tex->texture_array_size);
-   blob_write_uint32(ctx->blob, tex->sampler_index);
+   assert(tex->num_srcs < 16);
+   union packed_instr header = { .u32 = 0 };
+
+   header.tex.instr_type = tex->instr.type;
+   header.tex.num_srcs = tex->num_srcs;
+   header.tex.op = tex->op;
+   header.tex.dest = pack_dest(ctx, &tex->dest);
+   blob_write_uleb128(ctx->blob, header.u32);
+
+   blob_write_uleb128(ctx->blob, tex->texture_index);
+   blob_write_uleb128(ctx->blob, tex->texture_array_size);
+   blob_write_uleb128(ctx->blob, tex->sampler_index);
 
    STATIC_ASSERT(sizeof(union packed_tex_data) == sizeof(uint32_t));
    union packed_tex_data packed = {
@@ -619,28 +905,27 @@ write_tex(write_ctx *ctx, const nir_tex_instr *tex)
       .u.is_new_style_shadow = tex->is_new_style_shadow,
       .u.component = tex->component,
    };
-   blob_write_uint32(ctx->blob, packed.u32);
+   blob_write_uleb128(ctx->blob, packed.u32);
 
    write_dest(ctx, &tex->dest);
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      blob_write_uint32(ctx->blob, tex->src[i].src_type);
+      blob_write_uleb128(ctx->blob, tex->src[i].src_type);
       write_src(ctx, &tex->src[i].src);
    }
 }
 
 static nir_tex_instr *
-read_tex(read_ctx *ctx)
+read_tex(read_ctx *ctx, union packed_instr header)
 {
-   unsigned num_srcs = blob_read_uint32(ctx->blob);
-   nir_tex_instr *tex = nir_tex_instr_create(ctx->nir, num_srcs);
+   nir_tex_instr *tex = nir_tex_instr_create(ctx->nir, header.tex.num_srcs);
 
-   tex->op = blob_read_uint32(ctx->blob);
-   tex->texture_index = blob_read_uint32(ctx->blob);
-   tex->texture_array_size = blob_read_uint32(ctx->blob);
-   tex->sampler_index = blob_read_uint32(ctx->blob);
+   tex->op = header.tex.op;
+   tex->texture_index = blob_read_uleb128(ctx->blob);
+   tex->texture_array_size = blob_read_uleb128(ctx->blob);
+   tex->sampler_index = blob_read_uleb128(ctx->blob);
 
    union packed_tex_data packed;
-   packed.u32 = blob_read_uint32(ctx->blob);
+   packed.u32 = blob_read_uleb128(ctx->blob);
    tex->sampler_dim = packed.u.sampler_dim;
    tex->dest_type = packed.u.dest_type;
    tex->coord_components = packed.u.coord_components;
@@ -649,9 +934,9 @@ read_tex(read_ctx *ctx)
    tex->is_new_style_shadow = packed.u.is_new_style_shadow;
    tex->component = packed.u.component;
 
-   read_dest(ctx, &tex->dest, &tex->instr);
+   read_dest(ctx, &tex->dest, &tex->instr, header.tex.dest);
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      tex->src[i].src_type = blob_read_uint32(ctx->blob);
+      tex->src[i].src_type = blob_read_uleb128(ctx->blob);
       read_src(ctx, &tex->src[i].src, &tex->instr);
    }
 
@@ -661,52 +946,34 @@ read_tex(read_ctx *ctx)
 static void
 write_phi(write_ctx *ctx, const nir_phi_instr *phi)
 {
-   /* Phi nodes are special, since they may reference SSA definitions and
-    * basic blocks that don't exist yet. We leave two empty uintptr_t's here,
-    * and then store enough information so that a later fixup pass can fill
-    * them in correctly.
-    */
-   write_dest(ctx, &phi->dest);
+   union packed_instr header = { .u32 = 0 };
 
-   blob_write_uint32(ctx->blob, exec_list_length(&phi->srcs));
+   header.phi.instr_type = phi->instr.type;
+   header.phi.dest = pack_dest(ctx, &phi->dest);
+   header.phi.num_srcs = exec_list_length(&phi->srcs);
+   blob_write_uleb128(ctx->blob, header.u32);
 
+   write_dest(ctx, &phi->dest);
+
+   /* Phi sources may refer to values and blocks that come later, which is
+    * fine since write_function_impl numbers them all before writing any.
+    */
    nir_foreach_phi_src(src, phi) {
       assert(src->src.is_ssa);
-      size_t blob_offset = blob_reserve_intptr(ctx->blob);
-      MAYBE_UNUSED size_t blob_offset2 = blob_reserve_intptr(ctx->blob);
-      assert(blob_offset + sizeof(uintptr_t) == blob_offset2);
-      write_phi_fixup fixup = {
-         .blob_offset = blob_offset,
-         .src = src->src.ssa,
-         .block = src->pred,
-      };
-      util_dynarray_append(&ctx->phi_fixups, write_phi_fixup, fixup);
+      write_object(ctx, src->src.ssa);
+      write_object(ctx, src->pred);
    }
 }
 
-static void
-write_fixup_phis(write_ctx *ctx)
-{
-   util_dynarray_foreach(&ctx->phi_fixups, write_phi_fixup, fixup) {
-      uintptr_t *blob_ptr = (uintptr_t *)(ctx->blob->data + fixup->blob_offset);
-      blob_ptr[0] = write_lookup_object(ctx, fixup->src);
-      blob_ptr[1] = write_lookup_object(ctx, fixup->block);
-   }
-
-   util_dynarray_clear(&ctx->phi_fixups);
-}
-
 static nir_phi_instr *
-read_phi(read_ctx *ctx, nir_block *blk)
+read_phi(read_ctx *ctx, nir_block *blk, union packed_instr header)
 {
    nir_phi_instr *phi = nir_phi_instr_create(ctx->nir);
 
-   read_dest(ctx, &phi->dest, &phi->instr);
-
-   unsigned num_srcs = blob_read_uint32(ctx->blob);
+   read_dest(ctx, &phi->dest, &phi->instr, header.phi.dest);
 
-   /* For similar reasons as before, we just store the index directly into the
-    * pointer, and let a later pass resolve the phi sources.
+   /* The sources may not have been read yet, so we just store the index
+    * directly into the pointer, and let a later pass resolve the phi sources.
     *
     * In order to ensure that the copied sources (which are just the indices
     * from the blob for now) don't get inserted into the old shader's use-def
@@ -715,12 +982,12 @@ read_phi(read_ctx *ctx, nir_block *blk)
     */
    nir_instr_insert_after_block(blk, &phi->instr);
 
-   for (unsigned i = 0; i < num_srcs; i++) {
+   for (unsigned i = 0; i < header.phi.num_srcs; i++) {
       nir_phi_src *src = ralloc(phi, nir_phi_src);
 
       src->src.is_ssa = true;
-      src->src.ssa = (nir_ssa_def *) blob_read_intptr(ctx->blob);
-      src->pred = (nir_block *) blob_read_intptr(ctx->blob);
+      src->src.ssa = (nir_ssa_def *)(uintptr_t) blob_read_uleb128(ctx->blob);
+      src->pred = (nir_block *)(uintptr_t) blob_read_uleb128(ctx->blob);
 
       /* Since we're not letting nir_insert_instr handle use/def stuff for us,
        * we have to set the parent_instr manually.  It doesn't really matter
@@ -757,21 +1024,29 @@ read_fixup_phis(read_ctx *ctx)
 static void
 write_jump(write_ctx *ctx, const nir_jump_instr *jmp)
 {
-   blob_write_uint32(ctx->blob, jmp->type);
+   union packed_instr header = { .u32 = 0 };
+
+   header.jump.instr_type = jmp->instr.type;
+   header.jump.type = jmp->type;
+   blob_write_uleb128(ctx->blob, header.u32);
 }
 
 static nir_jump_instr *
-read_jump(read_ctx *ctx)
+read_jump(read_ctx *ctx, union packed_instr header)
 {
-   nir_jump_type type = blob_read_uint32(ctx->blob);
-   nir_jump_instr *jmp = nir_jump_instr_create(ctx->nir, type);
+   nir_jump_instr *jmp = nir_jump_instr_create(ctx->nir, header.jump.type);
    return jmp;
 }
 
 static void
 write_call(write_ctx *ctx, const nir_call_instr *call)
 {
-   blob_write_intptr(ctx->blob, write_lookup_object(ctx, call->callee));
+   union packed_instr header = { .u32 = 0 };
+
+   header.any.instr_type = call->instr.type;
+   blob_write_uleb128(ctx->blob, header.u32);
+
+   write_object(ctx, call->callee);
 
    for (unsigned i = 0; i < call->num_params; i++)
       write_src(ctx, &call->params[i]);
@@ -792,7 +1067,6 @@ read_call(read_ctx *ctx)
 static void
 write_instr(write_ctx *ctx, const nir_instr *instr)
 {
-   blob_write_uint32(ctx->blob, instr->type);
    switch (instr->type) {
    case nir_instr_type_alu:
       write_alu(ctx, nir_instr_as_alu(instr));
@@ -831,26 +1105,28 @@ write_instr(write_ctx *ctx, const nir_instr *instr)
 static void
 read_instr(read_ctx *ctx, nir_block *block)
 {
-   nir_instr_type type = blob_read_uint32(ctx->blob);
+   union packed_instr header;
+   header.u32 = blob_read_uleb128(ctx->blob);
+
    nir_instr *instr;
-   switch (type) {
+   switch (header.any.instr_type) {
    case nir_instr_type_alu:
-      instr = &read_alu(ctx)->instr;
+      instr = &read_alu(ctx, header)->instr;
       break;
    case nir_instr_type_deref:
-      instr = &read_deref(ctx)->instr;
+      instr = &read_deref(ctx, header)->instr;
       break;
    case nir_instr_type_intrinsic:
-      instr = &read_intrinsic(ctx)->instr;
+      instr = &read_intrinsic(ctx, header)->instr;
       break;
    case nir_instr_type_load_const:
-      instr = &read_load_const(ctx)->instr;
+      instr = &read_load_const(ctx, header)->instr;
       break;
    case nir_instr_type_ssa_undef:
-      instr = &read_ssa_undef(ctx)->instr;
+      instr = &read_ssa_undef(ctx, header)->instr;
       break;
    case nir_instr_type_tex:
-      instr = &read_tex(ctx)->instr;
+      instr = &read_tex(ctx, header)->instr;
       break;
    case nir_instr_type_phi:
       /* Phi instructions are a bit of a special case when reading because we
@@ -858,10 +1134,10 @@ read_instr(read_ctx *ctx, nir_block *block)
        * for us.  Instead, we need to wait until all the blocks/instructions
        * are read so that we can set their sources up.
        */
-      read_phi(ctx, block);
+      read_phi(ctx, block, header);
       return;
    case nir_instr_type_jump:
-      instr = &read_jump(ctx)->instr;
+      instr = &read_jump(ctx, header)->instr;
       break;
    case nir_instr_type_call:
       instr = &read_call(ctx)->instr;
@@ -878,8 +1154,7 @@ read_instr(read_ctx *ctx, nir_block *block)
 static void
 write_block(write_ctx *ctx, const nir_block *block)
 {
-   write_add_object(ctx, block);
-   blob_write_uint32(ctx->blob, exec_list_length(&block->instr_list));
+   blob_write_uleb128(ctx->blob, exec_list_length(&block->instr_list));
    nir_foreach_instr(instr, block)
       write_instr(ctx, instr);
 }
@@ -895,7 +1170,7 @@ read_block(read_ctx *ctx, struct exec_list *cf_list)
       exec_node_data(nir_block, exec_list_get_tail(cf_list), cf_node.node);
 
    read_add_object(ctx, block);
-   unsigned num_instrs = blob_read_uint32(ctx->blob);
+   unsigned num_instrs = blob_read_uleb128(ctx->blob);
    for (unsigned i = 0; i < num_instrs; i++) {
       read_instr(ctx, block);
    }
@@ -948,7 +1223,7 @@ read_loop(read_ctx *ctx, struct exec_list *cf_list)
 static void
 write_cf_node(write_ctx *ctx, nir_cf_node *cf)
 {
-   blob_write_uint32(ctx->blob, cf->type);
+   blob_write_uleb128(ctx->blob, cf->type);
 
    switch (cf->type) {
    case nir_cf_node_block:
@@ -968,7 +1243,7 @@ write_cf_node(write_ctx *ctx, nir_cf_node *cf)
 static void
 read_cf_node(read_ctx *ctx, struct exec_list *list)
 {
-   nir_cf_node_type type = blob_read_uint32(ctx->blob);
+   nir_cf_node_type type = blob_read_uleb128(ctx->blob);
 
    switch (type) {
    case nir_cf_node_block:
@@ -988,7 +1263,7 @@ read_cf_node(read_ctx *ctx, struct exec_list *list)
 static void
 write_cf_list(write_ctx *ctx, const struct exec_list *cf_list)
 {
-   blob_write_uint32(ctx->blob, exec_list_length(cf_list));
+   blob_write_uleb128(ctx->blob, exec_list_length(cf_list));
    foreach_list_typed(nir_cf_node, cf, node, cf_list) {
       write_cf_node(ctx, cf);
    }
@@ -997,20 +1272,38 @@ write_cf_list(write_ctx *ctx, const struct exec_list *cf_list)
 static void
 read_cf_list(read_ctx *ctx, struct exec_list *cf_list)
 {
-   uint32_t num_cf_nodes = blob_read_uint32(ctx->blob);
+   uint32_t num_cf_nodes = blob_read_uleb128(ctx->blob);
    for (unsigned i = 0; i < num_cf_nodes; i++)
       read_cf_node(ctx, cf_list);
 }
 
+static bool
+add_ssa_def_cb(nir_ssa_def *def, void *state)
+{
+   write_add_object(state, def);
+   return true;
+}
+
+/* Numbers blocks and SSA values in the order read_cf_list creates them */
+static void
+add_impl_objects(write_ctx *ctx, nir_function_impl *impl)
+{
+   nir_foreach_block(block, impl) {
+      write_add_object(ctx, block);
+      nir_foreach_instr(instr, block)
+         nir_foreach_ssa_def(instr, add_ssa_def_cb, ctx);
+   }
+}
+
 static void
 write_function_impl(write_ctx *ctx, const nir_function_impl *fi)
 {
    write_var_list(ctx, &fi->locals);
    write_reg_list(ctx, &fi->registers);
-   blob_write_uint32(ctx->blob, fi->reg_alloc);
+   blob_write_uleb128(ctx->blob, fi->reg_alloc);
 
+   add_impl_objects(ctx, (nir_function_impl *) fi);
    write_cf_list(ctx, &fi->body);
-   write_fixup_phis(ctx);
 }
 
 static nir_function_impl *
@@ -1021,7 +1314,7 @@ read_function_impl(read_ctx *ctx, nir_function *fxn)
 
    read_var_list(ctx, &fi->locals);
    read_reg_list(ctx, &fi->registers);
-   fi->reg_alloc = blob_read_uint32(ctx->blob);
+   fi->reg_alloc = blob_read_uleb128(ctx->blob);
 
    read_cf_list(ctx, &fi->body);
    read_fixup_phis(ctx);
@@ -1034,21 +1327,19 @@ read_function_impl(read_ctx *ctx, nir_function *fxn)
 static void
 write_function(write_ctx *ctx, const nir_function *fxn)
 {
-   blob_write_uint32(ctx->blob, !!(fxn->name));
-   if (fxn->name)
-      blob_write_string(ctx->blob, fxn->name);
+   write_string(ctx, fxn->name);
 
    write_add_object(ctx, fxn);
 
-   blob_write_uint32(ctx->blob, fxn->num_params);
+   blob_write_uleb128(ctx->blob, fxn->num_params);
    for (unsigned i = 0; i < fxn->num_params; i++) {
       uint32_t val =
          ((uint32_t)fxn->params[i].num_components) |
          ((uint32_t)fxn->params[i].bit_size) << 8;
-      blob_write_uint32(ctx->blob, val);
+      blob_write_uleb128(ctx->blob, val);
    }
 
-   blob_write_uint32(ctx->blob, fxn->is_entrypoint);
+   blob_write_uleb128(ctx->blob, fxn->is_entrypoint);
 
    /* At first glance, it looks like we should write the function_impl here.
     * However, call instructions need to be able to reference at least the
@@ -1060,47 +1351,49 @@ write_function(write_ctx *ctx, const nir_function *fxn)
 static void
 read_function(read_ctx *ctx)
 {
-   bool has_name = blob_read_uint32(ctx->blob);
-   char *name = has_name ? blob_read_string(ctx->blob) : NULL;
+   const char *name = read_string(ctx);
 
    nir_function *fxn = nir_function_create(ctx->nir, name);
 
    read_add_object(ctx, fxn);
 
-   fxn->num_params = blob_read_uint32(ctx->blob);
+   fxn->num_params = blob_read_uleb128(ctx->blob);
    fxn->params = ralloc_array(fxn, nir_parameter, fxn->num_params);
    for (unsigned i = 0; i < fxn->num_params; i++) {
-      uint32_t val = blob_read_uint32(ctx->blob);
+      uint32_t val = blob_read_uleb128(ctx->blob);
       fxn->params[i].num_components = val & 0xff;
       fxn->params[i].bit_size = (val >> 8) & 0xff;
    }
 
-   fxn->is_entrypoint = blob_read_uint32(ctx->blob);
+   fxn->is_entrypoint = blob_read_uleb128(ctx->blob);
 }
 
+/**
+ * Serialize NIR into a binary blob.
+ *
+ * \param strip  Don't serialize the names of the shader, of variables,
+ *               registers and SSA values.  They are only used for
+ *               debugging output, so drivers that cache their final NIR can
+ *               save space and time by stripping them.
+ */
 void
-nir_serialize(struct blob *blob, const nir_shader *nir)
+nir_serialize(struct blob *blob, const nir_shader *nir, bool strip)
 {
    write_ctx ctx;
    ctx.remap_table = _mesa_pointer_hash_table_create(NULL);
+   ctx.type_table = _mesa_pointer_hash_table_create(NULL);
+   ctx.string_table = _mesa_hash_table_create(NULL, _mesa_key_hash_string,
+                                              _mesa_key_string_equal);
    ctx.next_idx = 0;
    ctx.blob = blob;
    ctx.nir = nir;
-   util_dynarray_init(&ctx.phi_fixups, NULL);
+   ctx.strip = strip;
 
-   size_t idx_size_offset = blob_reserve_intptr(blob);
+   size_t idx_size_offset = blob_reserve_uint32(blob);
 
    struct shader_info info = nir->info;
-   uint32_t strings = 0;
-   if (info.name)
-      strings |= 0x1;
-   if (info.label)
-      strings |= 0x2;
-   blob_write_uint32(blob, strings);
-   if (info.name)
-      blob_write_string(blob, info.name);
-   if (info.label)
-      blob_write_string(blob, info.label);
+   write_name(&ctx, info.name);
+   write_name(&ctx, info.label);
    info.name = info.label = NULL;
    blob_write_bytes(blob, (uint8_t *) &info, sizeof(info));
 
@@ -1112,13 +1405,13 @@ nir_serialize(struct blob *blob, const nir_shader *nir)
    write_var_list(&ctx, &nir->system_values);
 
    write_reg_list(&ctx, &nir->registers);
-   blob_write_uint32(blob, nir->reg_alloc);
-   blob_write_uint32(blob, nir->num_inputs);
-   blob_write_uint32(blob, nir->num_uniforms);
-   blob_write_uint32(blob, nir->num_outputs);
-   blob_write_uint32(blob, nir->num_shared);
+   blob_write_uleb128(blob, nir->reg_alloc);
+   blob_write_uleb128(blob, nir->num_inputs);
+   blob_write_uleb128(blob, nir->num_uniforms);
+   blob_write_uleb128(blob, nir->num_outputs);
+   blob_write_uleb128(blob, nir->num_shared);
 
-   blob_write_uint32(blob, exec_list_length(&nir->functions));
+   blob_write_uleb128(blob, exec_list_length(&nir->functions));
    nir_foreach_function(fxn, nir) {
       write_function(&ctx, fxn);
    }
@@ -1127,14 +1420,15 @@ nir_serialize(struct blob *blob, const nir_shader *nir)
       write_function_impl(&ctx, fxn->impl);
    }
 
-   blob_write_uint32(blob, nir->constant_data_size);
+   blob_write_uleb128(blob, nir->constant_data_size);
    if (nir->constant_data_size > 0)
       blob_write_bytes(blob, nir->constant_data, nir->constant_data_size);
 
-   *(uintptr_t *)(blob->data + idx_size_offset) = ctx.next_idx;
+   blob_overwrite_uint32(blob, idx_size_offset, ctx.next_idx);
 
    _mesa_hash_table_destroy(ctx.remap_table, NULL);
-   util_dynarray_fini(&ctx.phi_fixups);
+   _mesa_hash_table_destroy(ctx.type_table, NULL);
+   _mesa_hash_table_destroy(ctx.string_table, NULL);
 }
 
 nir_shader *
@@ -1145,13 +1439,14 @@ nir_deserialize(void *mem_ctx,
    read_ctx ctx;
    ctx.blob = blob;
    list_inithead(&ctx.phi_srcs);
-   ctx.idx_table_len = blob_read_intptr(blob);
+   ctx.idx_table_len = blob_read_uint32(blob);
    ctx.idx_table = calloc(ctx.idx_table_len, sizeof(uintptr_t));
    ctx.next_idx = 0;
+   util_dynarray_init(&ctx.types, NULL);
+   util_dynarray_init(&ctx.strings, NULL);
 
-   uint32_t strings = blob_read_uint32(blob);
-   char *name = (strings & 0x1) ? blob_read_string(blob) : NULL;
-   char *label = (strings & 0x2) ? blob_read_string(blob) : NULL;
+   const char *name = read_string(&ctx);
+   const char *label = read_string(&ctx);
 
    struct shader_info info;
    blob_copy_bytes(blob, (uint8_t *) &info, sizeof(info));
@@ -1171,20 +1466,20 @@ nir_deserialize(void *mem_ctx,
    read_var_list(&ctx, &ctx.nir->system_values);
 
    read_reg_list(&ctx, &ctx.nir->registers);
-   ctx.nir->reg_alloc = blob_read_uint32(blob);
-   ctx.nir->num_inputs = blob_read_uint32(blob);
-   ctx.nir->num_uniforms = blob_read_uint32(blob);
-   ctx.nir->num_outputs = blob_read_uint32(blob);
-   ctx.nir->num_shared = blob_read_uint32(blob);
+   ctx.nir->reg_alloc = blob_read_uleb128(blob);
+   ctx.nir->num_inputs = blob_read_uleb128(blob);
+   ctx.nir->num_uniforms = blob_read_uleb128(blob);
+   ctx.nir->num_outputs = blob_read_uleb128(blob);
+   ctx.nir->num_shared = blob_read_uleb128(blob);
 
-   unsigned num_functions = blob_read_uint32(blob);
+   unsigned num_functions = blob_read_uleb128(blob);
    for (unsigned i = 0; i < num_functions; i++)
       read_function(&ctx);
 
    nir_foreach_function(fxn, ctx.nir)
       fxn->impl = read_function_impl(&ctx, fxn);
 
-   ctx.nir->constant_data_size = blob_read_uint32(blob);
+   ctx.nir->constant_data_size = blob_read_uleb128(blob);
    if (ctx.nir->constant_data_size > 0) {
       ctx.nir->constant_data =
          ralloc_size(ctx.nir, ctx.nir->constant_data_size);
@@ -1193,6 +1488,8 @@ nir_deserialize(void *mem_ctx,
    }
 
    free(ctx.idx_table);
+   util_dynarray_fini(&ctx.types);
+   util_dynarray_fini(&ctx.strings);
 
    return ctx.nir;
 }
@@ -1204,13 +1501,15 @@ nir_shader_serialize_deserialize(void *mem_ctx, nir_shader *s)
 
    struct blob writer;
    blob_init(&writer);
-   nir_serialize(&writer, s);
-   ralloc_free(s);
+   nir_serialize(&writer, s, false);
 
    struct blob_reader reader;
    blob_reader_init(&reader, writer.data, writer.size);
    nir_shader *ns = nir_deserialize(mem_ctx, options, &reader);
 
+   nir_shader_pass_stats_move(ns, s);
+   ralloc_free(s);
+
    blob_finish(&writer);
 
    return ns;
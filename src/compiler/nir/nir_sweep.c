@@ -178,6 +178,9 @@ nir_sweep(nir_shader *nir)
 
    ralloc_steal(nir, nir->constant_data);
 
+   if (nir->pass_stats)
+      ralloc_steal(nir, nir->pass_stats);
+
    /* Free everything we didn't steal back. */
    ralloc_free(rubbish);
 }
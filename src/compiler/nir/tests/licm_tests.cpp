@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_opt_licm_test : public ::testing::Test {
+protected:
+   nir_opt_licm_test();
+   ~nir_opt_licm_test();
+
+   nir_ssa_def *load_uniform(unsigned base, unsigned num_components = 1);
+   nir_ssa_def *load_ubo(unsigned offset, unsigned num_components = 1);
+   void store(nir_ssa_def *value, unsigned offset);
+   nir_ssa_def *tex(nir_texop op, nir_ssa_def *coord);
+
+   nir_loop *push_loop();
+   void break_if_done(nir_ssa_def *count);
+   nir_loop *push_for_loop(nir_ssa_def *count);
+   void pop_for_loop(nir_loop *loop);
+
+   bool run_licm(unsigned max_live = 0);
+
+   bool in_loop(nir_ssa_def *def, nir_loop *loop);
+
+   void *mem_ctx;
+
+   nir_builder *b;
+
+   nir_variable *counter;
+};
+
+nir_opt_licm_test::nir_opt_licm_test()
+{
+   mem_ctx = ralloc_context(NULL);
+   static const nir_shader_compiler_options options = { };
+   b = rzalloc(mem_ctx, nir_builder);
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_COMPUTE, &options);
+   counter = NULL;
+}
+
+nir_opt_licm_test::~nir_opt_licm_test()
+{
+   if (HasFailure()) {
+      printf("\nShader from the failed test:\n\n");
+      nir_print_shader(b->shader, stdout);
+   }
+
+   ralloc_free(mem_ctx);
+}
+
+nir_ssa_def *
+nir_opt_licm_test::load_uniform(unsigned base, unsigned num_components)
+{
+   nir_intrinsic_instr *load =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_load_uniform);
+   load->src[0] = nir_src_for_ssa(nir_imm_int(b, 0));
+   load->num_components = num_components;
+   nir_intrinsic_set_base(load, base);
+   nir_intrinsic_set_range(load, num_components * 4);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components, 32, NULL);
+   nir_builder_instr_insert(b, &load->instr);
+   return &load->dest.ssa;
+}
+
+nir_ssa_def *
+nir_opt_licm_test::load_ubo(unsigned offset, unsigned num_components)
+{
+   nir_intrinsic_instr *load =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_load_ubo);
+   load->src[0] = nir_src_for_ssa(nir_imm_int(b, 0));
+   load->src[1] = nir_src_for_ssa(nir_imm_int(b, offset));
+   load->num_components = num_components;
+   nir_intrinsic_set_align(load, 4, 0);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components, 32, NULL);
+   nir_builder_instr_insert(b, &load->instr);
+   return &load->dest.ssa;
+}
+
+void
+nir_opt_licm_test::store(nir_ssa_def *value, unsigned offset)
+{
+   nir_intrinsic_instr *store =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_store_ssbo);
+   store->src[0] = nir_src_for_ssa(value);
+   store->src[1] = nir_src_for_ssa(nir_imm_int(b, 0));
+   store->src[2] = nir_src_for_ssa(nir_imm_int(b, offset));
+   store->num_components = value->num_components;
+   nir_intrinsic_set_write_mask(store, (1 << value->num_components) - 1);
+   nir_intrinsic_set_align(store, 4, 0);
+   nir_builder_instr_insert(b, &store->instr);
+}
+
+nir_ssa_def *
+nir_opt_licm_test::tex(nir_texop op, nir_ssa_def *coord)
+{
+   nir_tex_instr *tex = nir_tex_instr_create(b->shader, op == nir_texop_txl ? 2 : 1);
+   tex->op = op;
+   tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+   tex->dest_type = nir_type_float;
+   tex->coord_components = 2;
+   tex->src[0].src_type = nir_tex_src_coord;
+   tex->src[0].src = nir_src_for_ssa(coord);
+   if (op == nir_texop_txl) {
+      tex->src[1].src_type = nir_tex_src_lod;
+      tex->src[1].src = nir_src_for_ssa(nir_imm_float(b, 0.0));
+   }
+   nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+   nir_builder_instr_insert(b, &tex->instr);
+   return &tex->dest.ssa;
+}
+
+/* Starts a loop counting up from 0 in a local variable */
+nir_loop *
+nir_opt_licm_test::push_loop()
+{
+   counter = nir_local_variable_create(b->impl, glsl_int_type(), "i");
+   nir_store_var(b, counter, nir_imm_int(b, 0), 0x1);
+   return nir_push_loop(b);
+}
+
+void
+nir_opt_licm_test::break_if_done(nir_ssa_def *count)
+{
+   nir_push_if(b, nir_ige(b, nir_load_var(b, counter), count));
+   nir_jump(b, nir_jump_break);
+   nir_pop_if(b, NULL);
+}
+
+/* for (int i = 0; i < count; i++) */
+nir_loop *
+nir_opt_licm_test::push_for_loop(nir_ssa_def *count)
+{
+   nir_loop *loop = push_loop();
+   break_if_done(count);
+   return loop;
+}
+
+void
+nir_opt_licm_test::pop_for_loop(nir_loop *loop)
+{
+   nir_ssa_def *next = nir_iadd(b, nir_load_var(b, counter), nir_imm_int(b, 1));
+   nir_store_var(b, counter, next, 0x1);
+   nir_pop_loop(b, loop);
+}
+
+bool
+nir_opt_licm_test::run_licm(unsigned max_live)
+{
+   nir_validate_shader(b->shader, NULL);
+   nir_lower_vars_to_ssa(b->shader);
+   nir_copy_prop(b->shader);
+   nir_opt_dce(b->shader);
+
+   bool progress = nir_opt_licm(b->shader, max_live);
+   nir_validate_shader(b->shader, NULL);
+   return progress;
+}
+
+bool
+nir_opt_licm_test::in_loop(nir_ssa_def *def, nir_loop *loop)
+{
+   for (nir_cf_node *node = def->parent_instr->block->cf_node.parent;
+        node; node = node->parent) {
+      if (node == &loop->cf_node)
+         return true;
+   }
+   return false;
+}
+
+} // namespace
+
+TEST_F(nir_opt_licm_test, for_loop_hoists_speculatable)
+{
+   nir_ssa_def *count = load_uniform(0);
+   nir_loop *loop = push_for_loop(count);
+   nir_ssa_def *sum = nir_fadd(b, load_uniform(4), load_uniform(8));
+   store(sum, 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_FALSE(in_loop(sum, loop));
+}
+
+TEST_F(nir_opt_licm_test, for_loop_keeps_unspeculatable_after_break)
+{
+   /* The trip count isn't known, so the code after the break may not run */
+   nir_ssa_def *count = load_uniform(0);
+   nir_loop *loop = push_for_loop(count);
+   nir_ssa_def *value = load_ubo(16);
+   store(value, 0);
+   pop_for_loop(loop);
+
+   run_licm();
+
+   EXPECT_TRUE(in_loop(value, loop));
+}
+
+TEST_F(nir_opt_licm_test, for_loop_hoists_unspeculatable_before_break)
+{
+   /* The block before the break dominates the loop exit */
+   nir_ssa_def *count = load_uniform(0);
+   nir_loop *loop = push_loop();
+   nir_ssa_def *value = load_ubo(16);
+   break_if_done(count);
+   store(value, 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_FALSE(in_loop(value, loop));
+}
+
+TEST_F(nir_opt_licm_test, for_loop_with_trip_count_hoists_unspeculatable)
+{
+   /* The loop always runs 4 times, so the whole body runs at least once */
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   nir_ssa_def *value = load_ubo(16);
+   store(value, 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_FALSE(in_loop(value, loop));
+}
+
+TEST_F(nir_opt_licm_test, for_loop_hoists_only_speculatable_after_break)
+{
+   nir_ssa_def *count = load_uniform(0);
+   nir_loop *loop = push_for_loop(count);
+   nir_ssa_def *value = load_ubo(16);
+   nir_ssa_def *sum = nir_fadd(b, load_uniform(4), load_uniform(8));
+   store(nir_fadd(b, value, sum), 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_TRUE(in_loop(value, loop));
+   EXPECT_FALSE(in_loop(sum, loop));
+}
+
+TEST_F(nir_opt_licm_test, fragment_keeps_implicit_derivatives)
+{
+   b->shader->info.stage = MESA_SHADER_FRAGMENT;
+
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   nir_ssa_def *coord = load_uniform(0, 2);
+   nir_ssa_def *implicit = tex(nir_texop_tex, coord);
+   nir_ssa_def *explicit_lod = tex(nir_texop_txl, coord);
+   store(nir_fadd(b, implicit, explicit_lod), 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_TRUE(in_loop(implicit, loop));
+   EXPECT_FALSE(in_loop(explicit_lod, loop));
+   EXPECT_FALSE(in_loop(coord, loop));
+}
+
+TEST_F(nir_opt_licm_test, compute_hoists_implicit_lod)
+{
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   nir_ssa_def *value = tex(nir_texop_tex, load_uniform(0, 2));
+   store(value, 0);
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm());
+
+   EXPECT_FALSE(in_loop(value, loop));
+}
+
+TEST_F(nir_opt_licm_test, loop_with_return)
+{
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   nir_ssa_def *sum = nir_fadd(b, load_uniform(4), load_uniform(8));
+   store(sum, 0);
+   nir_push_if(b, nir_ieq(b, load_uniform(12), nir_imm_int(b, 0)));
+   nir_jump(b, nir_jump_return);
+   nir_pop_if(b, NULL);
+   pop_for_loop(loop);
+
+   EXPECT_FALSE(run_licm());
+
+   EXPECT_TRUE(in_loop(sum, loop));
+}
+
+TEST_F(nir_opt_licm_test, max_live_unlimited)
+{
+   nir_ssa_def *values[4];
+
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   for (unsigned i = 0; i < 4; i++) {
+      nir_ssa_def *u = load_uniform(i * 16, 4);
+      values[i] = nir_fmul(b, u, u);
+      store(values[i], i * 16);
+   }
+   pop_for_loop(loop);
+
+   EXPECT_TRUE(run_licm(0));
+
+   for (unsigned i = 0; i < 4; i++)
+      EXPECT_FALSE(in_loop(values[i], loop));
+}
+
+TEST_F(nir_opt_licm_test, max_live_trims_candidates)
+{
+   nir_ssa_def *values[4];
+
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   for (unsigned i = 0; i < 4; i++) {
+      nir_ssa_def *u = load_uniform(i * 16, 4);
+      values[i] = nir_fmul(b, u, u);
+      store(values[i], i * 16);
+   }
+   pop_for_loop(loop);
+
+   /* Only the counter is live in the loop, and every hoisted vec4 adds four
+    * registers, so two of them fit.
+    */
+   EXPECT_TRUE(run_licm(10));
+
+   EXPECT_FALSE(in_loop(values[0], loop));
+   EXPECT_FALSE(in_loop(values[1], loop));
+   EXPECT_TRUE(in_loop(values[2], loop));
+   EXPECT_TRUE(in_loop(values[3], loop));
+}
+
+TEST_F(nir_opt_licm_test, max_live_nothing_fits)
+{
+   nir_ssa_def *value;
+
+   nir_loop *loop = push_for_loop(nir_imm_int(b, 4));
+   nir_ssa_def *u = load_uniform(0, 4);
+   value = nir_fmul(b, u, u);
+   store(value, 0);
+   pop_for_loop(loop);
+
+   run_licm(2);
+
+   EXPECT_TRUE(in_loop(value, loop));
+}
@@ -0,0 +1,542 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_load_store_vectorize_test : public ::testing::Test {
+protected:
+   nir_load_store_vectorize_test();
+   ~nir_load_store_vectorize_test();
+
+   nir_intrinsic_instr *create_load(nir_intrinsic_op op, nir_ssa_def *index,
+                                    nir_ssa_def *offset,
+                                    unsigned num_components = 1,
+                                    unsigned bit_size = 32);
+   nir_intrinsic_instr *create_store(nir_intrinsic_op op, nir_ssa_def *index,
+                                     nir_ssa_def *offset, nir_ssa_def *value,
+                                     unsigned write_mask = 0x1);
+   nir_alu_instr *use(nir_intrinsic_instr *load);
+
+   bool run_vectorizer(nir_variable_mode modes);
+
+   unsigned count_intrinsics(nir_intrinsic_op intrinsic);
+   nir_intrinsic_instr *find_intrinsic(nir_intrinsic_op intrinsic,
+                                       unsigned index = 0);
+   bool reads_component(nir_alu_instr *use, nir_intrinsic_instr *load,
+                        unsigned component);
+   uint64_t stored_value(nir_intrinsic_instr *store, unsigned component);
+
+   static bool accept(unsigned align, unsigned bit_size,
+                      unsigned num_components,
+                      nir_intrinsic_instr *low, nir_intrinsic_instr *high);
+   static bool reject(unsigned align, unsigned bit_size,
+                      unsigned num_components,
+                      nir_intrinsic_instr *low, nir_intrinsic_instr *high);
+
+   void *mem_ctx;
+
+   nir_builder *b;
+
+   nir_should_vectorize_mem_func callback;
+   static unsigned last_align;
+};
+
+unsigned nir_load_store_vectorize_test::last_align;
+
+nir_load_store_vectorize_test::nir_load_store_vectorize_test()
+{
+   mem_ctx = ralloc_context(NULL);
+   static const nir_shader_compiler_options options = { };
+   b = rzalloc(mem_ctx, nir_builder);
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_COMPUTE, &options);
+   callback = accept;
+   last_align = 0;
+}
+
+nir_load_store_vectorize_test::~nir_load_store_vectorize_test()
+{
+   if (HasFailure()) {
+      printf("\nShader from the failed test:\n\n");
+      nir_print_shader(b->shader, stdout);
+   }
+
+   ralloc_free(mem_ctx);
+}
+
+bool
+nir_load_store_vectorize_test::accept(unsigned align, unsigned bit_size,
+                                      unsigned num_components,
+                                      nir_intrinsic_instr *low,
+                                      nir_intrinsic_instr *high)
+{
+   last_align = align;
+   return true;
+}
+
+bool
+nir_load_store_vectorize_test::reject(unsigned align, unsigned bit_size,
+                                      unsigned num_components,
+                                      nir_intrinsic_instr *low,
+                                      nir_intrinsic_instr *high)
+{
+   return false;
+}
+
+nir_intrinsic_instr *
+nir_load_store_vectorize_test::create_load(nir_intrinsic_op op,
+                                           nir_ssa_def *index,
+                                           nir_ssa_def *offset,
+                                           unsigned num_components,
+                                           unsigned bit_size)
+{
+   nir_intrinsic_instr *load = nir_intrinsic_instr_create(b->shader, op);
+   unsigned src = 0;
+   if (index)
+      load->src[src++] = nir_src_for_ssa(index);
+   load->src[src] = nir_src_for_ssa(offset);
+   load->num_components = num_components;
+   if (op == nir_intrinsic_load_push_constant)
+      nir_intrinsic_set_range(load, 64);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components, bit_size, NULL);
+   nir_builder_instr_insert(b, &load->instr);
+   return load;
+}
+
+nir_intrinsic_instr *
+nir_load_store_vectorize_test::create_store(nir_intrinsic_op op,
+                                            nir_ssa_def *index,
+                                            nir_ssa_def *offset,
+                                            nir_ssa_def *value,
+                                            unsigned write_mask)
+{
+   nir_intrinsic_instr *store = nir_intrinsic_instr_create(b->shader, op);
+   unsigned src = 0;
+   store->src[src++] = nir_src_for_ssa(value);
+   if (index)
+      store->src[src++] = nir_src_for_ssa(index);
+   store->src[src] = nir_src_for_ssa(offset);
+   store->num_components = value->num_components;
+   nir_intrinsic_set_write_mask(store, write_mask);
+   nir_builder_instr_insert(b, &store->instr);
+   return store;
+}
+
+nir_alu_instr *
+nir_load_store_vectorize_test::use(nir_intrinsic_instr *load)
+{
+   return nir_instr_as_alu(nir_imov(b, &load->dest.ssa)->parent_instr);
+}
+
+bool
+nir_load_store_vectorize_test::run_vectorizer(nir_variable_mode modes)
+{
+   bool progress = nir_opt_load_store_vectorize(b->shader, modes, callback);
+   if (progress)
+      nir_validate_shader(b->shader, NULL);
+   return progress;
+}
+
+unsigned
+nir_load_store_vectorize_test::count_intrinsics(nir_intrinsic_op intrinsic)
+{
+   unsigned count = 0;
+   nir_foreach_block(block, b->impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_intrinsic)
+            continue;
+         nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+         if (intrin->intrinsic == intrinsic)
+            count++;
+      }
+   }
+   return count;
+}
+
+nir_intrinsic_instr *
+nir_load_store_vectorize_test::find_intrinsic(nir_intrinsic_op intrinsic,
+                                              unsigned index)
+{
+   nir_foreach_block(block, b->impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_intrinsic)
+            continue;
+         nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+         if (intrin->intrinsic == intrinsic && index-- == 0)
+            return intrin;
+      }
+   }
+   return NULL;
+}
+
+/* Whether use, which used to read a scalar load, now reads the given
+ * component of load.
+ */
+bool
+nir_load_store_vectorize_test::reads_component(nir_alu_instr *use,
+                                               nir_intrinsic_instr *load,
+                                               unsigned component)
+{
+   nir_ssa_def *def = use->src[0].src.ssa;
+   unsigned swizzle = use->src[0].swizzle[0];
+
+   if (def->parent_instr->type == nir_instr_type_alu) {
+      nir_alu_instr *mov = nir_instr_as_alu(def->parent_instr);
+      if (mov->op != nir_op_imov)
+         return false;
+      def = mov->src[0].src.ssa;
+      swizzle = mov->src[0].swizzle[swizzle];
+   }
+
+   return def == &load->dest.ssa && swizzle == component;
+}
+
+/* The constant written to the given component by a combined store */
+uint64_t
+nir_load_store_vectorize_test::stored_value(nir_intrinsic_instr *store,
+                                            unsigned component)
+{
+   nir_alu_instr *vec = nir_instr_as_alu(store->src[0].ssa->parent_instr);
+   return nir_src_comp_as_uint(vec->src[component].src,
+                               vec->src[component].swizzle[0]);
+}
+
+} // namespace
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_adjacent)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 8)));
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 12)));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ubo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_ubo);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_EQ(load->dest.ssa.num_components, 2);
+   EXPECT_EQ(nir_src_as_uint(load->src[1]), 8);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+   EXPECT_EQ(last_align, 8);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_reversed)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 20)));
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 16)));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ubo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_ubo);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_EQ(nir_src_as_uint(load->src[1]), 16);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_indirect)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   nir_ssa_def *base = nir_imul(b, nir_load_local_invocation_index(b),
+                                nir_imm_int(b, 16));
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_ubo, index, base));
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_ubo, index,
+                                      nir_iadd(b, base, nir_imm_int(b, 4))));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ubo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_ubo);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_EQ(load->src[1].ssa, base);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+   EXPECT_EQ(last_align, 16);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_different_buffers)
+{
+   create_load(nir_intrinsic_load_ubo, nir_imm_int(b, 0), nir_imm_int(b, 0));
+   create_load(nir_intrinsic_load_ubo, nir_imm_int(b, 1), nir_imm_int(b, 4));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ubo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_different_bit_size)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 0), 1, 32);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 4), 1, 16);
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ubo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_too_wide)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   for (unsigned i = 0; i < 5; i++)
+      create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, i * 4));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ubo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+   EXPECT_EQ(find_intrinsic(nir_intrinsic_load_ubo, 0)->num_components, 4);
+   EXPECT_EQ(find_intrinsic(nir_intrinsic_load_ubo, 1)->num_components, 1);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_rejected)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 0));
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 4));
+
+   callback = reject;
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ubo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_mode_disabled)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 0));
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 4));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ssbo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_load_across_barrier)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 0));
+   nir_intrinsic_instr *barrier =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_memory_barrier);
+   nir_builder_instr_insert(b, &barrier->instr);
+   create_load(nir_intrinsic_load_ubo, index, nir_imm_int(b, 4));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ubo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+}
+
+TEST_F(nir_load_store_vectorize_test, push_const_load_adjacent)
+{
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_push_constant, NULL,
+                                      nir_imm_int(b, 0)));
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_push_constant, NULL,
+                                      nir_imm_int(b, 4)));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_uniform));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_push_constant), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_push_constant);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_EQ(nir_src_as_uint(load->src[0]), 0);
+   EXPECT_EQ(nir_intrinsic_base(load), 0);
+   EXPECT_EQ(nir_intrinsic_range(load), 64);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_intersecting_store)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 0));
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 4),
+                nir_imm_int(b, 7));
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 4));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ssbo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_separate_store)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 0)));
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 8),
+                nir_imm_int(b, 7));
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 4)));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ssbo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_ssbo);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_store_other_buffer)
+{
+   nir_ssa_def *index = nir_load_local_invocation_index(b);
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 0));
+   /* Any buffer may alias an SSBO accessed with a non-constant index */
+   create_store(nir_intrinsic_store_ssbo, nir_imm_int(b, 1), nir_imm_int(b, 16),
+                nir_imm_int(b, 7));
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 4));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ssbo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_volatile)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 0));
+   nir_intrinsic_instr *load =
+      create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 4));
+   nir_intrinsic_set_access(load, ACCESS_VOLATILE);
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ssbo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_store_adjacent)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   nir_ssa_def *x = nir_imm_int(b, 1);
+   nir_ssa_def *y = nir_imm_int(b, 2);
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 4), y);
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 0), x);
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ssbo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 1);
+   nir_intrinsic_instr *store = find_intrinsic(nir_intrinsic_store_ssbo);
+   EXPECT_EQ(store->num_components, 2);
+   EXPECT_EQ(nir_intrinsic_write_mask(store), 0x3);
+   EXPECT_EQ(nir_src_as_uint(store->src[2]), 0);
+   EXPECT_EQ(stored_value(store, 0), 1);
+   EXPECT_EQ(stored_value(store, 1), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_store_overlapping)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 0),
+                nir_imm_ivec2(b, 1, 2), 0x3);
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 4),
+                nir_imm_ivec2(b, 3, 4), 0x3);
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_ssbo));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 1);
+   nir_intrinsic_instr *store = find_intrinsic(nir_intrinsic_store_ssbo);
+   EXPECT_EQ(store->num_components, 3);
+   EXPECT_EQ(nir_intrinsic_write_mask(store), 0x7);
+   EXPECT_EQ(stored_value(store, 0), 1);
+   EXPECT_EQ(stored_value(store, 1), 3);
+   EXPECT_EQ(stored_value(store, 2), 4);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_store_across_load)
+{
+   nir_ssa_def *index = nir_imm_int(b, 0);
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 0),
+                nir_imm_int(b, 1));
+   create_load(nir_intrinsic_load_ssbo, index, nir_imm_int(b, 0));
+   create_store(nir_intrinsic_store_ssbo, index, nir_imm_int(b, 4),
+                nir_imm_int(b, 2));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_ssbo));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, shared_load_adjacent)
+{
+   nir_alu_instr *x = use(create_load(nir_intrinsic_load_shared, NULL,
+                                      nir_imm_int(b, 8)));
+   nir_alu_instr *y = use(create_load(nir_intrinsic_load_shared, NULL,
+                                      nir_imm_int(b, 12)));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_shared));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_shared), 1);
+   nir_intrinsic_instr *load = find_intrinsic(nir_intrinsic_load_shared);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_TRUE(reads_component(x, load, 0));
+   EXPECT_TRUE(reads_component(y, load, 1));
+}
+
+TEST_F(nir_load_store_vectorize_test, shared_load_across_barrier)
+{
+   create_load(nir_intrinsic_load_shared, NULL, nir_imm_int(b, 0));
+   nir_intrinsic_instr *barrier =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_barrier);
+   nir_builder_instr_insert(b, &barrier->instr);
+   create_load(nir_intrinsic_load_shared, NULL, nir_imm_int(b, 4));
+
+   EXPECT_FALSE(run_vectorizer(nir_var_mem_shared));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_shared), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, shared_load_ssbo_store)
+{
+   create_load(nir_intrinsic_load_shared, NULL, nir_imm_int(b, 0));
+   create_store(nir_intrinsic_store_ssbo, nir_imm_int(b, 0), nir_imm_int(b, 4),
+                nir_imm_int(b, 7));
+   create_load(nir_intrinsic_load_shared, NULL, nir_imm_int(b, 4));
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_shared));
+
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_shared), 1);
+}
+
+TEST_F(nir_load_store_vectorize_test, shared_store_base)
+{
+   nir_ssa_def *offset = nir_load_local_invocation_index(b);
+   nir_intrinsic_instr *first =
+      create_store(nir_intrinsic_store_shared, NULL, offset, nir_imm_int(b, 1));
+   nir_intrinsic_set_base(first, 16);
+   nir_intrinsic_instr *second =
+      create_store(nir_intrinsic_store_shared, NULL, offset, nir_imm_int(b, 2));
+   nir_intrinsic_set_base(second, 20);
+
+   EXPECT_TRUE(run_vectorizer(nir_var_mem_shared));
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_store_shared), 1);
+   nir_intrinsic_instr *store = find_intrinsic(nir_intrinsic_store_shared);
+   EXPECT_EQ(store->src[1].ssa, offset);
+   EXPECT_EQ(nir_intrinsic_base(store), 16);
+   EXPECT_EQ(nir_intrinsic_write_mask(store), 0x3);
+   EXPECT_EQ(stored_value(store, 0), 1);
+   EXPECT_EQ(stored_value(store, 1), 2);
+}
@@ -0,0 +1,629 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "nir.h"
+#include "nir_builder.h"
+#include "nir_serialize.h"
+
+/* Round-trip tests for nir_serialize/nir_deserialize on randomly generated
+ * shaders.  Each shader is serialized, deserialized and serialized again,
+ * and both blobs and the printed shaders have to be identical.
+ */
+
+namespace {
+
+class nir_serialize_test : public ::testing::Test {
+protected:
+   nir_serialize_test();
+   ~nir_serialize_test();
+
+   uint32_t random(uint32_t range);
+   bool chance(unsigned percent) { return random(100) < percent; }
+
+   const glsl_type *random_type(unsigned depth);
+   nir_variable *create_var(nir_variable_mode mode, const glsl_type *type);
+   void create_vars();
+
+   nir_ssa_def *random_value(unsigned num_components);
+   nir_ssa_def *random_bool();
+   nir_ssa_def *random_int();
+   nir_deref_instr *random_deref(nir_variable *var, bool *is_float);
+   void emit_alu();
+   void emit_const();
+   void emit_deref_access();
+   void emit_intrinsic();
+   void emit_tex();
+   void emit_call();
+   void emit_cf_list(unsigned depth, bool in_loop);
+
+   void generate(uint32_t seed);
+   void check_round_trip(nir_shader *shader, bool strip);
+
+   char *print(nir_shader *shader);
+
+   void *mem_ctx;
+   nir_builder *b;
+
+   uint32_t state;
+   std::vector<nir_ssa_def *> values;
+   std::vector<nir_variable *> vars;
+   nir_variable *sampler;
+   nir_function *callee;
+};
+
+nir_serialize_test::nir_serialize_test()
+{
+   mem_ctx = ralloc_context(NULL);
+   b = rzalloc(mem_ctx, nir_builder);
+}
+
+nir_serialize_test::~nir_serialize_test()
+{
+   ralloc_free(mem_ctx);
+}
+
+uint32_t
+nir_serialize_test::random(uint32_t range)
+{
+   /* xorshift32 */
+   state ^= state << 13;
+   state ^= state >> 17;
+   state ^= state << 5;
+   return state % range;
+}
+
+const glsl_type *
+nir_serialize_test::random_type(unsigned depth)
+{
+   switch (depth < 2 ? random(6) : random(3)) {
+   case 0:
+      return glsl_vector_type(GLSL_TYPE_FLOAT, 1 + random(4));
+   case 1:
+      return glsl_vector_type(GLSL_TYPE_INT, 1 + random(4));
+   case 2:
+      return glsl_vector_type(GLSL_TYPE_UINT, 1 + random(4));
+   case 3:
+   case 4:
+      return glsl_array_type(random_type(depth + 1), 2 + random(6), 0);
+   default: {
+      glsl_struct_field fields[3];
+      unsigned num_fields = 1 + random(3);
+      for (unsigned i = 0; i < num_fields; i++) {
+         fields[i] = glsl_struct_field(random_type(depth + 1),
+                                       ralloc_asprintf(mem_ctx, "f%u", i));
+      }
+      return glsl_struct_type(fields, num_fields,
+                              ralloc_asprintf(mem_ctx, "s%u", random(4)));
+   }
+   }
+}
+
+nir_variable *
+nir_serialize_test::create_var(nir_variable_mode mode, const glsl_type *type)
+{
+   const char *name = chance(90) ?
+      ralloc_asprintf(mem_ctx, "v%u", random(8)) : NULL;
+   nir_variable *var;
+
+   if (mode == nir_var_function_temp)
+      var = nir_local_variable_create(b->impl, type, name);
+   else
+      var = nir_variable_create(b->shader, mode, type, name);
+
+   var->data.location = random(64);
+   var->data.driver_location = random(64);
+   var->data.binding = random(4);
+   var->data.interpolation = random(3);
+   var->data.invariant = chance(10);
+   vars.push_back(var);
+   return var;
+}
+
+void
+nir_serialize_test::create_vars()
+{
+   unsigned num_inputs = random(4);
+   for (unsigned i = 0; i < num_inputs; i++)
+      create_var(nir_var_shader_in, random_type(0));
+
+   unsigned num_outputs = 1 + random(3);
+   for (unsigned i = 0; i < num_outputs; i++)
+      create_var(nir_var_shader_out, random_type(0));
+
+   unsigned num_uniforms = random(4);
+   for (unsigned i = 0; i < num_uniforms; i++) {
+      nir_variable *var = create_var(nir_var_uniform, random_type(0));
+      if (chance(30)) {
+         var->num_state_slots = 1 + random(2);
+         var->state_slots = rzalloc_array(var, nir_state_slot,
+                                          var->num_state_slots);
+         for (unsigned j = 0; j < var->num_state_slots; j++) {
+            var->state_slots[j].tokens[0] = random(100);
+            var->state_slots[j].swizzle = random(256);
+         }
+      }
+   }
+
+   unsigned num_locals = random(5);
+   for (unsigned i = 0; i < num_locals; i++) {
+      nir_variable *var = create_var(nir_var_function_temp, random_type(0));
+      if (glsl_type_is_vector_or_scalar(var->type) && chance(30)) {
+         var->constant_initializer = rzalloc(var, nir_constant);
+         for (unsigned j = 0; j < glsl_get_vector_elements(var->type); j++)
+            var->constant_initializer->values[0].u32[j] = random(1000);
+      }
+   }
+
+   /* An interface block with per-member data */
+   if (chance(30)) {
+      glsl_struct_field fields[2] = {
+         glsl_struct_field(glsl_vec4_type(), "a"),
+         glsl_struct_field(glsl_float_type(), "b"),
+      };
+      const glsl_type *iface =
+         glsl_interface_type(fields, 2, GLSL_INTERFACE_PACKING_STD140,
+                             false, "block");
+      nir_variable *var =
+         nir_variable_create(b->shader, nir_var_shader_in, iface, "block");
+      var->interface_type = iface;
+      var->num_members = 2;
+      var->members = rzalloc_array(var, struct nir_variable::nir_variable_data, 2);
+      var->members[1].location = 7;
+   }
+
+   sampler = nir_variable_create(b->shader, nir_var_uniform,
+                                 glsl_sampler_type(GLSL_SAMPLER_DIM_2D, false,
+                                                   false, GLSL_TYPE_FLOAT),
+                                 "tex");
+}
+
+nir_ssa_def *
+nir_serialize_test::random_value(unsigned num_components)
+{
+   nir_ssa_def *value;
+   if (values.empty() || chance(5))
+      value = nir_imm_float(b, random(100));
+   else
+      value = values[values.size() - 1 - random(MIN2(values.size(), 8))];
+
+   unsigned swiz[4];
+   for (unsigned i = 0; i < num_components; i++)
+      swiz[i] = random(value->num_components);
+   return nir_swizzle(b, value, swiz, num_components, false);
+}
+
+nir_ssa_def *
+nir_serialize_test::random_bool()
+{
+   return nir_flt(b, random_value(1), random_value(1));
+}
+
+nir_ssa_def *
+nir_serialize_test::random_int()
+{
+   return nir_iand(b, nir_f2i32(b, random_value(1)), nir_imm_int(b, 1));
+}
+
+void
+nir_serialize_test::emit_alu()
+{
+   static const nir_op unary[] = {
+      nir_op_fneg, nir_op_fabs, nir_op_fsqrt, nir_op_ffloor, nir_op_fsat,
+   };
+   static const nir_op binary[] = {
+      nir_op_fadd, nir_op_fmul, nir_op_fmin, nir_op_fmax, nir_op_fpow,
+   };
+   unsigned num_components = 1 + random(4);
+   nir_alu_instr *alu;
+
+   switch (random(4)) {
+   case 0:
+      alu = nir_alu_instr_create(b->shader, unary[random(ARRAY_SIZE(unary))]);
+      break;
+   case 1:
+      alu = nir_alu_instr_create(b->shader, nir_op_ffma);
+      break;
+   case 2:
+      alu = nir_alu_instr_create(b->shader, nir_op_fmov);
+      break;
+   default:
+      alu = nir_alu_instr_create(b->shader, binary[random(ARRAY_SIZE(binary))]);
+      break;
+   }
+
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+      nir_ssa_def *src = random_value(1 + random(4));
+      alu->src[i].src = nir_src_for_ssa(src);
+      alu->src[i].negate = chance(10);
+      alu->src[i].abs = chance(10);
+      for (unsigned j = 0; j < num_components; j++) {
+         alu->src[i].swizzle[j] =
+            chance(70) ? MIN2(j, src->num_components - 1) :
+                         random(src->num_components);
+      }
+   }
+
+   alu->exact = chance(10);
+   alu->dest.saturate = chance(10);
+   alu->dest.write_mask = (1 << num_components) - 1;
+   nir_ssa_dest_init(&alu->instr, &alu->dest.dest, num_components, 32,
+                     chance(10) ? "named" : NULL);
+   nir_builder_instr_insert(b, &alu->instr);
+   values.push_back(&alu->dest.dest.ssa);
+}
+
+void
+nir_serialize_test::emit_const()
+{
+   static const unsigned bit_sizes[] = { 1, 8, 16, 32, 64 };
+   unsigned bit_size = bit_sizes[random(ARRAY_SIZE(bit_sizes))];
+   nir_load_const_instr *load =
+      nir_load_const_instr_create(b->shader, 1 + random(4), bit_size);
+
+   for (unsigned i = 0; i < load->def.num_components; i++) {
+      switch (bit_size) {
+      case 1:  load->value.b[i] = chance(50); break;
+      case 8:  load->value.u8[i] = random(256); break;
+      case 16: load->value.u16[i] = random(65536); break;
+      case 32: load->value.u32[i] = random(~0u); break;
+      case 64: load->value.u64[i] = (uint64_t) random(~0u) << 32 | random(~0u); break;
+      }
+   }
+   nir_builder_instr_insert(b, &load->instr);
+
+   if (bit_size == 32)
+      values.push_back(&load->def);
+
+   if (chance(20)) {
+      nir_ssa_def *undef = nir_ssa_undef(b, 1 + random(4), 32);
+      if (chance(50))
+         values.push_back(undef);
+   }
+}
+
+nir_deref_instr *
+nir_serialize_test::random_deref(nir_variable *var, bool *is_float)
+{
+   nir_deref_instr *deref = nir_build_deref_var(b, var);
+
+   while (!glsl_type_is_vector_or_scalar(deref->type)) {
+      if (glsl_type_is_array(deref->type)) {
+         nir_ssa_def *index = chance(50) ? nir_imm_int(b, 0) : random_int();
+         deref = nir_build_deref_array(b, deref, index);
+      } else {
+         deref = nir_build_deref_struct(b, deref,
+                                        random(glsl_get_length(deref->type)));
+      }
+   }
+
+   *is_float = glsl_get_base_type(deref->type) == GLSL_TYPE_FLOAT;
+   return deref;
+}
+
+void
+nir_serialize_test::emit_deref_access()
+{
+   nir_variable *var = vars[random(vars.size())];
+   bool is_float;
+   nir_deref_instr *deref = random_deref(var, &is_float);
+   unsigned num_components = glsl_get_vector_elements(deref->type);
+
+   if (var->data.mode != nir_var_shader_in &&
+       var->data.mode != nir_var_uniform && chance(50)) {
+      nir_ssa_def *value = random_value(num_components);
+      if (!is_float)
+         value = nir_f2i32(b, value);
+      nir_store_deref(b, deref, value, (1 << num_components) - 1);
+   } else if (var->data.mode != nir_var_shader_out) {
+      nir_ssa_def *value = nir_load_deref(b, deref);
+      if (!is_float)
+         value = nir_i2f32(b, value);
+      values.push_back(value);
+   }
+}
+
+void
+nir_serialize_test::emit_intrinsic()
+{
+   switch (random(4)) {
+   case 0: {
+      nir_intrinsic_instr *load =
+         nir_intrinsic_instr_create(b->shader, nir_intrinsic_load_uniform);
+      load->num_components = 1 + random(4);
+      load->src[0] = nir_src_for_ssa(random_int());
+      nir_intrinsic_set_base(load, random(2) ? random(64) : -1 - random(4));
+      nir_intrinsic_set_range(load, random(1000));
+      nir_ssa_dest_init(&load->instr, &load->dest, load->num_components, 32,
+                        NULL);
+      nir_builder_instr_insert(b, &load->instr);
+      values.push_back(&load->dest.ssa);
+      break;
+   }
+   case 1: {
+      nir_intrinsic_instr *discard =
+         nir_intrinsic_instr_create(b->shader, nir_intrinsic_discard_if);
+      discard->src[0] = nir_src_for_ssa(random_bool());
+      nir_builder_instr_insert(b, &discard->instr);
+      break;
+   }
+   case 2:
+      values.push_back(nir_b2f32(b, nir_load_front_face(b, 1)));
+      break;
+   default: {
+      nir_intrinsic_instr *barrier =
+         nir_intrinsic_instr_create(b->shader, nir_intrinsic_memory_barrier);
+      nir_builder_instr_insert(b, &barrier->instr);
+      break;
+   }
+   }
+}
+
+void
+nir_serialize_test::emit_tex()
+{
+   bool txl = chance(50);
+   nir_tex_instr *tex = nir_tex_instr_create(b->shader, txl ? 4 : 3);
+   nir_deref_instr *deref = nir_build_deref_var(b, sampler);
+
+   tex->op = txl ? nir_texop_txl : nir_texop_tex;
+   tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+   tex->dest_type = nir_type_float;
+   tex->coord_components = 2;
+   tex->texture_index = random(4);
+   tex->sampler_index = random(4);
+   tex->src[0].src_type = nir_tex_src_texture_deref;
+   tex->src[0].src = nir_src_for_ssa(&deref->dest.ssa);
+   tex->src[1].src_type = nir_tex_src_sampler_deref;
+   tex->src[1].src = nir_src_for_ssa(&deref->dest.ssa);
+   tex->src[2].src_type = nir_tex_src_coord;
+   tex->src[2].src = nir_src_for_ssa(random_value(2));
+   if (txl) {
+      tex->src[3].src_type = nir_tex_src_lod;
+      tex->src[3].src = nir_src_for_ssa(random_value(1));
+   }
+
+   nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+   nir_builder_instr_insert(b, &tex->instr);
+   values.push_back(&tex->dest.ssa);
+}
+
+void
+nir_serialize_test::emit_call()
+{
+   nir_call_instr *call = nir_call_instr_create(b->shader, callee);
+   call->params[0] = nir_src_for_ssa(random_value(2));
+   nir_builder_instr_insert(b, &call->instr);
+}
+
+void
+nir_serialize_test::emit_cf_list(unsigned depth, bool in_loop)
+{
+   unsigned num_items = 1 + random(depth ? 6 : 12);
+   size_t num_values = values.size();
+
+   for (unsigned i = 0; i < num_items; i++) {
+      unsigned kind = random(depth < 3 ? 12 : 10);
+      if (kind < 4) {
+         emit_alu();
+      } else if (kind < 5) {
+         emit_const();
+      } else if (kind < 7) {
+         emit_deref_access();
+      } else if (kind < 8) {
+         emit_intrinsic();
+      } else if (kind < 9) {
+         if (chance(80))
+            emit_tex();
+         else
+            emit_call();
+      } else if (kind < 10) {
+         if (in_loop && chance(50)) {
+            nir_if *nif = nir_push_if(b, random_bool());
+            nir_jump(b, chance(70) ? nir_jump_break : nir_jump_continue);
+            nir_pop_if(b, nif);
+         } else {
+            emit_alu();
+         }
+      } else if (kind < 11) {
+         nir_if *nif = nir_push_if(b, random_bool());
+         emit_cf_list(depth + 1, in_loop);
+         if (chance(50)) {
+            nir_push_else(b, nif);
+            emit_cf_list(depth + 1, in_loop);
+         }
+         nir_pop_if(b, nif);
+      } else {
+         nir_loop *loop = nir_push_loop(b);
+         emit_cf_list(depth + 1, true);
+         nir_if *nif = nir_push_if(b, random_bool());
+         nir_jump(b, nir_jump_break);
+         nir_pop_if(b, nif);
+         nir_pop_loop(b, loop);
+      }
+   }
+
+   /* Values defined in here don't dominate what comes after */
+   if (depth > 0)
+      values.resize(num_values);
+}
+
+void
+nir_serialize_test::generate(uint32_t seed)
+{
+   static const nir_shader_compiler_options options = { };
+
+   state = seed * 2654435761u + 1;
+   values.clear();
+   vars.clear();
+
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_FRAGMENT, &options);
+   b->shader->info.name = ralloc_asprintf(b->shader, "shader%u", seed);
+   if (chance(50))
+      b->shader->info.label = ralloc_strdup(b->shader, "label");
+
+   callee = nir_function_create(b->shader, "callee");
+   callee->num_params = 1;
+   callee->params = rzalloc_array(b->shader, nir_parameter, 1);
+   callee->params[0].num_components = 2;
+   callee->params[0].bit_size = 32;
+   nir_function_impl_create(callee);
+
+   create_vars();
+   emit_cf_list(0, false);
+
+   if (chance(30)) {
+      b->shader->constant_data_size = 1 + random(64);
+      b->shader->constant_data =
+         rzalloc_size(b->shader, b->shader->constant_data_size);
+      ((uint8_t *) b->shader->constant_data)[0] = random(256);
+   }
+
+   /* The lowering passes below don't handle initialized locals */
+   nir_lower_constant_initializers(b->shader, nir_var_function_temp);
+
+   /* Get phis, registers and indirect register accesses into some shaders */
+   switch (random(3)) {
+   case 0:
+      nir_lower_vars_to_ssa(b->shader);
+      break;
+   case 1:
+      nir_lower_locals_to_regs(b->shader);
+      nir_lower_vars_to_ssa(b->shader);
+      break;
+   default:
+      nir_lower_vars_to_ssa(b->shader);
+      nir_convert_from_ssa(b->shader, true);
+      break;
+   }
+}
+
+char *
+nir_serialize_test::print(nir_shader *shader)
+{
+   char *str;
+   size_t size;
+   FILE *f = open_memstream(&str, &size);
+
+   nir_foreach_function(function, shader) {
+      if (function->impl) {
+         nir_index_ssa_defs(function->impl);
+         nir_index_local_regs(function->impl);
+      }
+   }
+   nir_index_global_regs(shader);
+   nir_print_shader(shader, f);
+   fclose(f);
+
+   return str;
+}
+
+void
+nir_serialize_test::check_round_trip(nir_shader *shader, bool strip)
+{
+   struct blob first, second;
+   struct blob_reader reader;
+
+   nir_validate_shader(shader, "before nir_serialize");
+
+   blob_init(&first);
+   nir_serialize(&first, shader, strip);
+
+   blob_reader_init(&reader, first.data, first.size);
+   nir_shader *copy = nir_deserialize(mem_ctx, shader->options, &reader);
+   EXPECT_EQ(reader.current, reader.end);
+   EXPECT_FALSE(reader.overrun);
+   nir_validate_shader(copy, "after nir_deserialize");
+
+   blob_init(&second);
+   nir_serialize(&second, copy, strip);
+   ASSERT_EQ(first.size, second.size);
+   EXPECT_EQ(memcmp(first.data, second.data, first.size), 0);
+
+   if (strip) {
+      EXPECT_TRUE(copy->info.name == NULL);
+      nir_foreach_variable(var, &copy->outputs)
+         EXPECT_TRUE(var->name == NULL);
+   } else {
+      char *expected = print(shader);
+      char *actual = print(copy);
+      EXPECT_STREQ(expected, actual);
+      free(expected);
+      free(actual);
+   }
+
+   nir_validate_shader(shader, "after nir_serialize");
+
+   blob_finish(&first);
+   blob_finish(&second);
+   ralloc_free(copy);
+}
+
+} // namespace
+
+TEST_F(nir_serialize_test, round_trip)
+{
+   for (uint32_t seed = 0; seed < 200; seed++) {
+      generate(seed);
+      check_round_trip(b->shader, false);
+      if (HasFailure()) {
+         printf("\nShader from the failed seed %u:\n\n", seed);
+         nir_print_shader(b->shader, stdout);
+         return;
+      }
+      ralloc_free(b->shader);
+   }
+}
+
+TEST_F(nir_serialize_test, round_trip_stripped)
+{
+   for (uint32_t seed = 0; seed < 200; seed++) {
+      generate(seed);
+      check_round_trip(b->shader, true);
+      if (HasFailure()) {
+         printf("\nShader from the failed seed %u:\n\n", seed);
+         nir_print_shader(b->shader, stdout);
+         return;
+      }
+      ralloc_free(b->shader);
+   }
+}
+
+TEST_F(nir_serialize_test, strip_is_smaller)
+{
+   struct blob full, stripped;
+
+   generate(1);
+
+   blob_init(&full);
+   nir_serialize(&full, b->shader, false);
+   blob_init(&stripped);
+   nir_serialize(&stripped, b->shader, true);
+
+   EXPECT_LT(stripped.size, full.size);
+
+   blob_finish(&full);
+   blob_finish(&stripped);
+}
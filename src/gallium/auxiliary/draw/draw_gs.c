@@ -40,6 +40,7 @@
 
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/hash_table.h"
 #include "util/u_prim.h"
 
 /* fixme: move it from here */
@@ -736,6 +737,11 @@ draw_create_geometry_shader(struct draw_context *draw,
       gs = &llvm_gs->base;
 
       make_empty_list(&llvm_gs->variants);
+      llvm_gs->variants_ht = draw_gs_llvm_create_variant_table();
+      if (!llvm_gs->variants_ht) {
+         FREE(llvm_gs);
+         return NULL;
+      }
    } else
 #endif
    {
@@ -749,6 +755,10 @@ draw_create_geometry_shader(struct draw_context *draw,
    gs->state = *state;
    gs->state.tokens = tgsi_dup_tokens(state->tokens);
    if (!gs->state.tokens) {
+#ifdef HAVE_LLVM
+      if (llvm_gs)
+         _mesa_hash_table_destroy(llvm_gs->variants_ht, NULL);
+#endif
       FREE(gs);
       return NULL;
    }
@@ -880,6 +890,7 @@ void draw_delete_geometry_shader(struct draw_context *draw,
       }
 
       assert(shader->variants_cached == 0);
+      _mesa_hash_table_destroy(shader->variants_ht, NULL);
 
       if (dgs->llvm_prim_lengths) {
          unsigned i;
@@ -52,7 +52,10 @@
 
 #include "tgsi/tgsi_exec.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
+#include "util/hash_table.h"
+#include "util/mesa-sha1.h"
 #include "util/u_math.h"
 #include "util/u_pointer.h"
 #include "util/u_string.h"
@@ -539,6 +542,29 @@ draw_llvm_destroy(struct draw_llvm *llvm)
 }
 
 
+/**
+ * Compute the persistent cache key of a vertex shader variant.
+ * It must cover everything the generated code depends on.
+ */
+static void
+draw_get_ir_cache_key(struct llvm_vertex_shader *shader,
+                      unsigned num_inputs,
+                      const struct draw_llvm_variant_key *key,
+                      unsigned key_size,
+                      unsigned char ir_sha1_cache_key[20])
+{
+   const struct tgsi_token *tokens = shader->base.state.tokens;
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, tokens,
+                     tgsi_num_tokens(tokens) * sizeof(struct tgsi_token));
+   _mesa_sha1_update(&ctx, &num_inputs, sizeof num_inputs);
+   _mesa_sha1_update(&ctx, key, key_size);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
 /**
  * Create LLVM-generated code for a vertex shader.
  */
@@ -550,8 +576,12 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    struct draw_llvm_variant *variant;
    struct llvm_vertex_shader *shader =
       llvm_vertex_shader(llvm->draw->vs.vertex_shader);
+   struct draw_context *draw = llvm->draw;
    LLVMTypeRef vertex_header;
    char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   bool needs_caching = false;
 
    variant = MALLOC(sizeof *variant +
                     shader->variant_key_size -
@@ -565,7 +595,16 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    util_snprintf(module_name, sizeof(module_name), "draw_llvm_vs_variant%u",
                  variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   if (draw->disk_cache_find_shader) {
+      draw_get_ir_cache_key(shader, num_inputs, key,
+                            shader->variant_key_size, ir_sha1_cache_key);
+      draw->disk_cache_find_shader(draw->disk_cache_cookie,
+                                   &cached, ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = true;
+   }
+
+   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
    create_jit_types(variant);
 
@@ -587,7 +626,11 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_jit_vert_func)
          gallivm_jit_function(variant->gallivm, variant->function);
 
+   if (needs_caching)
+      draw->disk_cache_insert_shader(draw->disk_cache_cookie,
+                                     &cached, ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -629,6 +672,7 @@ generate_vs(struct draw_llvm_variant *variant,
                      NULL,
                      draw_sampler,
                      &llvm->draw->vs.vertex_shader->info,
+                     NULL,
                      NULL);
 
    {
@@ -1574,8 +1618,10 @@ draw_llvm_generate(struct draw_llvm *llvm, struct draw_llvm_variant *variant)
 
    memset(&system_values, 0, sizeof(system_values));
 
-   util_snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant%u",
-                 variant->shader->variants_cached);
+   /* The function name ends up in the (possibly cached) object code,
+    * so it must not depend on per-process state.
+    */
+   util_snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant");
 
    i = 0;
    arg_types[i++] = get_context_ptr_type(variant);       /* context */
@@ -2151,6 +2197,41 @@ draw_llvm_set_sampler_state(struct draw_context *draw,
 }
 
 
+static uint32_t
+draw_llvm_variant_key_hash(const void *key)
+{
+   const struct draw_llvm_variant_key *k = key;
+
+   return _mesa_hash_data(k, draw_llvm_variant_key_size(
+                                k->nr_vertex_elements,
+                                MAX2(k->nr_samplers, k->nr_sampler_views)));
+}
+
+
+static bool
+draw_llvm_variant_key_equal(const void *a, const void *b)
+{
+   const struct draw_llvm_variant_key *ka = a;
+   const struct draw_llvm_variant_key *kb = b;
+
+   return memcmp(ka, kb, draw_llvm_variant_key_size(
+                            ka->nr_vertex_elements,
+                            MAX2(ka->nr_samplers, ka->nr_sampler_views))) == 0;
+}
+
+
+/**
+ * Create the table of a vertex shader's variants, keyed by their
+ * (variable-sized) draw_llvm_variant_key.
+ */
+struct hash_table *
+draw_llvm_create_variant_table(void)
+{
+   return _mesa_hash_table_create(NULL, draw_llvm_variant_key_hash,
+                                  draw_llvm_variant_key_equal);
+}
+
+
 void
 draw_llvm_destroy_variant(struct draw_llvm_variant *variant)
 {
@@ -2164,6 +2245,7 @@ draw_llvm_destroy_variant(struct draw_llvm_variant *variant)
    gallivm_destroy(variant->gallivm);
 
    remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variants_ht, &variant->key);
    variant->shader->variants_cached--;
    remove_from_list(&variant->list_item_global);
    llvm->nr_variants--;
@@ -2356,7 +2438,8 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
                      NULL,
                      sampler,
                      &llvm->draw->gs.geometry_shader->info,
-                     (const struct lp_build_tgsi_gs_iface *)&gs_iface);
+                     (const struct lp_build_tgsi_gs_iface *)&gs_iface,
+                     NULL);
 
    sampler->destroy(sampler);
 
@@ -2391,7 +2474,7 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    util_snprintf(module_name, sizeof(module_name), "draw_llvm_gs_variant%u",
                  variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   variant->gallivm = gallivm_create(module_name, llvm->context, NULL);
 
    create_gs_jit_types(variant);
 
@@ -2418,6 +2501,39 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    return variant;
 }
 
+static uint32_t
+draw_gs_llvm_variant_key_hash(const void *key)
+{
+   const struct draw_gs_llvm_variant_key *k = key;
+
+   return _mesa_hash_data(k, draw_gs_llvm_variant_key_size(
+                                MAX2(k->nr_samplers, k->nr_sampler_views)));
+}
+
+
+static bool
+draw_gs_llvm_variant_key_equal(const void *a, const void *b)
+{
+   const struct draw_gs_llvm_variant_key *ka = a;
+   const struct draw_gs_llvm_variant_key *kb = b;
+
+   return memcmp(ka, kb, draw_gs_llvm_variant_key_size(
+                            MAX2(ka->nr_samplers, ka->nr_sampler_views))) == 0;
+}
+
+
+/**
+ * Create the table of a geometry shader's variants, keyed by their
+ * (variable-sized) draw_gs_llvm_variant_key.
+ */
+struct hash_table *
+draw_gs_llvm_create_variant_table(void)
+{
+   return _mesa_hash_table_create(NULL, draw_gs_llvm_variant_key_hash,
+                                  draw_gs_llvm_variant_key_equal);
+}
+
+
 void
 draw_gs_llvm_destroy_variant(struct draw_gs_llvm_variant *variant)
 {
@@ -2431,6 +2547,7 @@ draw_gs_llvm_destroy_variant(struct draw_gs_llvm_variant *variant)
    gallivm_destroy(variant->gallivm);
 
    remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variants_ht, &variant->key);
    variant->shader->variants_cached--;
    remove_from_list(&variant->list_item_global);
    llvm->nr_gs_variants--;
@@ -43,6 +43,7 @@
 struct draw_llvm;
 struct llvm_vertex_shader;
 struct llvm_geometry_shader;
+struct hash_table;
 
 struct draw_jit_texture
 {
@@ -423,6 +424,7 @@ struct llvm_vertex_shader {
 
    unsigned variant_key_size;
    struct draw_llvm_variant_list_item variants;
+   struct hash_table *variants_ht;
    unsigned variants_created;
    unsigned variants_cached;
 };
@@ -432,6 +434,7 @@ struct llvm_geometry_shader {
 
    unsigned variant_key_size;
    struct draw_gs_llvm_variant_list_item variants;
+   struct hash_table *variants_ht;
    unsigned variants_created;
    unsigned variants_cached;
 };
@@ -486,6 +489,9 @@ draw_llvm_destroy_variant(struct draw_llvm_variant *variant);
 struct draw_llvm_variant_key *
 draw_llvm_make_variant_key(struct draw_llvm *llvm, char *store);
 
+struct hash_table *
+draw_llvm_create_variant_table(void);
+
 void
 draw_llvm_dump_variant_key(struct draw_llvm_variant_key *key);
 
@@ -501,6 +507,9 @@ draw_gs_llvm_destroy_variant(struct draw_gs_llvm_variant *variant);
 struct draw_gs_llvm_variant_key *
 draw_gs_llvm_make_variant_key(struct draw_llvm *llvm, char *store);
 
+struct hash_table *
+draw_gs_llvm_create_variant_table(void);
+
 void
 draw_gs_llvm_dump_variant_key(struct draw_gs_llvm_variant_key *key);
 
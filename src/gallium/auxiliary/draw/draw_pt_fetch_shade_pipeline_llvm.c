@@ -25,9 +25,13 @@
  *
  **************************************************************************/
 
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_queue.h"
+#include "util/hash_table.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_vbuf.h"
@@ -40,6 +44,35 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+/**
+ * Vertex shading of a chunk is split into batches of at least this many
+ * vertices, which are run in parallel on the vertex shading threads.
+ */
+#define DRAW_VS_MIN_BATCH    256
+#define DRAW_VS_MAX_THREADS  8
+#define DRAW_VS_DEFAULT_THREADS 4
+
+DEBUG_GET_ONCE_NUM_OPTION(draw_vs_threads, "DRAW_VS_THREADS", -1)
+
+
+struct llvm_middle_end;
+
+/**
+ * A range of a chunk's vertices, shaded by one vertex shading thread.
+ */
+struct llvm_vs_batch {
+   struct llvm_middle_end *fpme;
+   struct vertex_header *verts;
+   const unsigned *elts;
+   unsigned count;
+   unsigned start_or_maxelt;
+   unsigned vid_base;
+   unsigned fpstate;
+   boolean clipped;
+   struct util_queue_fence fence;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -57,6 +90,15 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /*
+    * Threads shading batches of large chunks, created on first use.
+    * vs_threads counts the calling thread too.
+    */
+   boolean vs_split;
+   unsigned vs_threads;
+   struct util_queue vs_queue;
+   struct llvm_vs_batch vs_batches[DRAW_VS_MAX_THREADS];
 };
 
 
@@ -76,22 +118,17 @@ llvm_middle_end_prepare_gs(struct llvm_middle_end *fpme)
    struct draw_geometry_shader *gs = draw->gs.geometry_shader;
    struct draw_gs_llvm_variant_key *key;
    struct draw_gs_llvm_variant *variant = NULL;
-   struct draw_gs_llvm_variant_list_item *li;
    struct llvm_geometry_shader *shader = llvm_geometry_shader(gs);
+   struct hash_entry *entry;
    char store[DRAW_GS_LLVM_MAX_VARIANT_KEY_SIZE];
    unsigned i;
 
    key = draw_gs_llvm_make_variant_key(llvm, store);
 
-   /* Search shader's list of variants for the key */
-   li = first_elem(&shader->variants);
-   while (!at_end(&shader->variants, li)) {
-      if (memcmp(&li->base->key, key, shader->variant_key_size) == 0) {
-         variant = li->base;
-         break;
-      }
-      li = next_elem(li);
-   }
+   /* Search shader's variants for the key */
+   entry = _mesa_hash_table_search(shader->variants_ht, key);
+   if (entry)
+      variant = entry->data;
 
    if (variant) {
       /* found the variant, move to head of global list (for LRU) */
@@ -128,6 +165,7 @@ llvm_middle_end_prepare_gs(struct llvm_middle_end *fpme)
 
       if (variant) {
          insert_at_head(&shader->variants, &variant->list_item_local);
+         _mesa_hash_table_insert(shader->variants_ht, &variant->key, variant);
          insert_at_head(&llvm->gs_variants_list,
                         &variant->list_item_global);
          llvm->nr_gs_variants++;
@@ -163,6 +201,12 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
    fpme->input_prim = in_prim;
    fpme->opt = opt;
 
+   /*
+    * Batches are shaded in no particular order, which is only invisible
+    * as long as the shader has no side effects.
+    */
+   fpme->vs_split = !vs->info.writes_memory;
+
    draw_pt_post_vs_prepare( fpme->post_vs,
                             draw->clip_xy,
                             draw->clip_z,
@@ -205,22 +249,17 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
    {
       struct draw_llvm_variant_key *key;
       struct draw_llvm_variant *variant = NULL;
-      struct draw_llvm_variant_list_item *li;
       struct llvm_vertex_shader *shader = llvm_vertex_shader(vs);
+      struct hash_entry *entry;
       char store[DRAW_LLVM_MAX_VARIANT_KEY_SIZE];
       unsigned i;
 
       key = draw_llvm_make_variant_key(llvm, store);
 
-      /* Search shader's list of variants for the key */
-      li = first_elem(&shader->variants);
-      while (!at_end(&shader->variants, li)) {
-         if (memcmp(&li->base->key, key, shader->variant_key_size) == 0) {
-            variant = li->base;
-            break;
-         }
-         li = next_elem(li);
-      }
+      /* Search shader's variants for the key */
+      entry = _mesa_hash_table_search(shader->variants_ht, key);
+      if (entry)
+         variant = entry->data;
 
       if (variant) {
          /* found the variant, move to head of global list (for LRU) */
@@ -257,6 +296,8 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
 
          if (variant) {
             insert_at_head(&shader->variants, &variant->list_item_local);
+            _mesa_hash_table_insert(shader->variants_ht, &variant->key,
+                                    variant);
             insert_at_head(&llvm->vs_variants_list,
                            &variant->list_item_global);
             llvm->nr_variants++;
@@ -347,6 +388,159 @@ emit(struct pt_emit *emit,
 }
 
 
+static void
+llvm_vs_batch_run(struct llvm_vs_batch *batch)
+{
+   struct llvm_middle_end *fpme = batch->fpme;
+   struct draw_context *draw = fpme->draw;
+
+   batch->clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
+                                                    batch->verts,
+                                                    draw->pt.user.vbuffer,
+                                                    batch->count,
+                                                    batch->start_or_maxelt,
+                                                    fpme->vertex_size,
+                                                    draw->pt.vertex_buffer,
+                                                    draw->instance_id,
+                                                    batch->vid_base,
+                                                    draw->start_instance,
+                                                    batch->elts);
+}
+
+
+static void
+llvm_vs_batch_execute(void *data, int thread_index)
+{
+   struct llvm_vs_batch *batch = (struct llvm_vs_batch *)data;
+
+   /* match the denorm handling of the thread which issued the draw */
+   util_fpstate_set(batch->fpstate);
+   llvm_vs_batch_run(batch);
+}
+
+
+/**
+ * Number of threads vertex shading may be split across, starting the
+ * worker threads the first time more than one is wanted.
+ */
+static unsigned
+llvm_middle_end_vs_threads(struct llvm_middle_end *fpme)
+{
+   if (!fpme->vs_threads) {
+      long threads = debug_get_option_draw_vs_threads();
+      unsigned i;
+
+      /* The draw module's users usually run their own threads, one per CPU
+       * for llvmpipe's rasterizer, which are busy with the previous scene
+       * while the next one is shaded.  Only take a share of the CPUs.
+       */
+      if (threads < 0)
+         threads = MIN2(util_cpu_caps.nr_cpus / 4, DRAW_VS_DEFAULT_THREADS);
+      threads = CLAMP(threads, 1, DRAW_VS_MAX_THREADS);
+
+      if (threads > 1 &&
+          !util_queue_init(&fpme->vs_queue, "draw_vs",
+                           DRAW_VS_MAX_THREADS, threads - 1, 0))
+         threads = 1;
+
+      for (i = 0; i < DRAW_VS_MAX_THREADS; i++)
+         util_queue_fence_init(&fpme->vs_batches[i].fence);
+
+      fpme->vs_threads = threads;
+   }
+
+   return fpme->vs_threads;
+}
+
+
+/**
+ * Run fetch, vertex shader, cliptest and viewport transform over a chunk.
+ *
+ * Large chunks are cut into batches of vertices which are shaded
+ * concurrently.  Each batch writes its own range of the chunk's vertex
+ * array, so the vertices come out in the same order as with a single call.
+ * Batches are multiples of the SoA vector length since the shader writes
+ * whole vectors of vertices, and only the last batch may be partial.
+ *
+ * \return TRUE if any vertex needs clipping (or has a non-one edgeflag)
+ */
+static boolean
+llvm_middle_end_run_vs(struct llvm_middle_end *fpme,
+                       struct vertex_header *verts,
+                       const struct draw_fetch_info *fetch_info,
+                       unsigned start_or_maxelt,
+                       unsigned vid_base,
+                       const unsigned *elts)
+{
+   const unsigned vector_length = lp_native_vector_width / 32;
+   unsigned count = fetch_info->count;
+   unsigned nr_batches = 1, batch_size, fpstate, i;
+   boolean clipped;
+
+   if (fpme->vs_split && count >= 2 * DRAW_VS_MIN_BATCH)
+      nr_batches = MIN2(llvm_middle_end_vs_threads(fpme),
+                        count / DRAW_VS_MIN_BATCH);
+
+   if (nr_batches <= 1) {
+      struct llvm_vs_batch *batch = &fpme->vs_batches[0];
+
+      batch->fpme = fpme;
+      batch->verts = verts;
+      batch->elts = elts;
+      batch->count = count;
+      batch->start_or_maxelt = start_or_maxelt;
+      batch->vid_base = vid_base;
+      llvm_vs_batch_run(batch);
+      return batch->clipped;
+   }
+
+   batch_size = align(DIV_ROUND_UP(count, nr_batches), vector_length);
+   fpstate = util_fpstate_get();
+
+   for (i = 0; i < nr_batches; i++) {
+      struct llvm_vs_batch *batch = &fpme->vs_batches[i];
+      unsigned first = i * batch_size;
+
+      batch->fpme = fpme;
+      batch->verts = (struct vertex_header *)
+         ((char *)verts + first * fpme->vertex_size);
+      batch->count = MIN2(batch_size, count - first);
+      batch->vid_base = vid_base;
+      batch->fpstate = fpstate;
+      if (fetch_info->linear) {
+         batch->elts = NULL;
+         batch->start_or_maxelt = start_or_maxelt + first;
+      }
+      else {
+         batch->elts = elts + first;
+         batch->start_or_maxelt = start_or_maxelt;
+      }
+
+      if (batch->count == count - first) {
+         nr_batches = i + 1;
+         break;
+      }
+   }
+
+   /* the calling thread takes the first batch */
+   for (i = 1; i < nr_batches; i++) {
+      util_queue_add_job(&fpme->vs_queue, &fpme->vs_batches[i],
+                         &fpme->vs_batches[i].fence,
+                         llvm_vs_batch_execute, NULL);
+   }
+
+   llvm_vs_batch_run(&fpme->vs_batches[0]);
+   clipped = fpme->vs_batches[0].clipped;
+
+   for (i = 1; i < nr_batches; i++) {
+      util_queue_fence_wait(&fpme->vs_batches[i].fence);
+      clipped |= fpme->vs_batches[i].clipped;
+   }
+
+   return clipped;
+}
+
+
 static void
 llvm_pipeline_generic(struct draw_pt_middle_end *middle,
                       const struct draw_fetch_info *fetch_info,
@@ -397,17 +591,8 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
       vid_base = draw->pt.user.eltBias;
       elts = fetch_info->elts;
    }
-   clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
-                                             llvm_vert_info.verts,
-                                             draw->pt.user.vbuffer,
-                                             fetch_info->count,
-                                             start_or_maxelt,
-                                             fpme->vertex_size,
-                                             draw->pt.vertex_buffer,
-                                             draw->instance_id,
-                                             vid_base,
-                                             draw->start_instance,
-                                             elts);
+   clipped = llvm_middle_end_run_vs(fpme, llvm_vert_info.verts, fetch_info,
+                                    start_or_maxelt, vid_base, elts);
 
    /* Finished with fetch and vs:
     */
@@ -607,6 +792,16 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 {
    struct llvm_middle_end *fpme = llvm_middle_end(middle);
 
+   if (fpme->vs_threads > 1)
+      util_queue_destroy(&fpme->vs_queue);
+
+   if (fpme->vs_threads) {
+      unsigned i;
+
+      for (i = 0; i < DRAW_VS_MAX_THREADS; i++)
+         util_queue_fence_destroy(&fpme->vs_batches[i].fence);
+   }
+
    if (fpme->fetch)
       draw_pt_fetch_destroy( fpme->fetch );
 
@@ -134,13 +134,19 @@ lp_build_const_float(struct gallivm_state *gallivm, float x)
 }
 
 
-/** Return constant-valued pointer to int */
+/**
+ * Return constant-valued pointer to int.
+ * The address is only valid in this process, so the module won't be cached.
+ */
 static inline LLVMValueRef
 lp_build_const_int_pointer(struct gallivm_state *gallivm, const void *ptr)
 {
    LLVMTypeRef int_type;
    LLVMValueRef v;
 
+   if (gallivm->cache)
+      gallivm->cache->dont_cache = true;
+
    /* int type large enough to hold a pointer */
    int_type = LLVMIntTypeInContext(gallivm->context, 8 * sizeof(void *));
    v = LLVMConstInt(int_type, (uintptr_t) ptr, 0);
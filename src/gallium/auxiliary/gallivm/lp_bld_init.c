@@ -38,6 +38,12 @@
 #include "lp_bld_misc.h"
 #include "lp_bld_init.h"
 
+#include <inttypes.h>
+#if defined(PIPE_OS_LINUX)
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
 #include <llvm-c/Analysis.h>
 #include <llvm-c/Transforms/Scalar.h>
 #if HAVE_LLVM >= 0x0700
@@ -143,7 +149,7 @@ create_pass_manager(struct gallivm_state *gallivm)
       free(td_str);
    }
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0 && !gallivm->no_opt) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -181,6 +187,54 @@ create_pass_manager(struct gallivm_state *gallivm)
 }
 
 
+/**
+ * Resident set size of the process in KiB, or zero where unknown.
+ * Only used for GALLIVM_DEBUG=perf reporting.
+ */
+static int64_t
+resident_kib(void)
+{
+#if defined(PIPE_OS_LINUX)
+   FILE *f = fopen("/proc/self/statm", "r");
+   long size, resident;
+   int64_t kib = 0;
+
+   if (!f)
+      return 0;
+   if (fscanf(f, "%ld %ld", &size, &resident) == 2)
+      kib = (int64_t)resident * sysconf(_SC_PAGESIZE) / 1024;
+   fclose(f);
+   return kib;
+#else
+   return 0;
+#endif
+}
+
+
+/**
+ * Report how much memory a compiled module kept once its IR, engine and
+ * target machine are gone, along with the totals over all live modules.
+ *
+ * The resident delta is only indicative when several modules are compiled
+ * concurrently.  It is usually well above the code size, as the memory
+ * manager hands out code and data sections with page granularity.
+ */
+static void
+report_module_memory(const struct gallivm_state *gallivm)
+{
+   unsigned live_count;
+   uint64_t live_size;
+
+   lp_generated_code_stats(&live_count, &live_size);
+   debug_printf("module %s: %u bytes of code, resident %+"PRId64" KiB; "
+                "%u modules with %"PRIu64" bytes of code live\n",
+                gallivm->module_name ? gallivm->module_name : "",
+                (unsigned)lp_generated_code_size(gallivm->code),
+                resident_kib() - gallivm->resident_begin,
+                live_count, live_size);
+}
+
+
 /**
  * Free gallivm object's LLVM allocations, but not any generated code
  * nor the gallivm object itself.
@@ -199,6 +253,10 @@ gallivm_free_ir(struct gallivm_state *gallivm)
       LLVMDisposeModule(gallivm->module);
    }
 
+   if ((gallivm_debug & GALLIVM_DEBUG_PERF) && gallivm->compiled &&
+       gallivm->module_name)
+      report_module_memory(gallivm);
+
    FREE(gallivm->module_name);
 
    if (!use_mcjit) {
@@ -212,6 +270,12 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    if (gallivm->builder)
       LLVMDisposeBuilder(gallivm->builder);
 
+   /* The object cache must outlive the engine which references it. */
+   if (gallivm->cache) {
+      lp_free_objcache(gallivm->cache->jit_obj_cache);
+      gallivm->cache->jit_obj_cache = NULL;
+   }
+
    /* The LLVMContext should be owned by the parent of gallivm. */
 
    gallivm->engine = NULL;
@@ -221,6 +285,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    gallivm->passmgr = NULL;
    gallivm->context = NULL;
    gallivm->builder = NULL;
+   gallivm->cache = NULL;
 }
 
 
@@ -247,7 +312,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if ((gallivm_perf & GALLIVM_PERF_NO_OPT) || gallivm->no_opt) {
          optlevel = None;
       }
       else {
@@ -258,6 +323,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
                                                     &gallivm->code,
                                                     gallivm->module,
                                                     gallivm->memorymgr,
+                                                    gallivm->cache,
                                                     (unsigned) optlevel,
                                                     use_mcjit,
                                                     &error);
@@ -308,7 +374,7 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context)
+                   LLVMContextRef context, struct lp_cached_code *cache)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -317,6 +383,10 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       return FALSE;
 
    gallivm->context = context;
+   gallivm->cache = cache;
+
+   if (gallivm_debug & GALLIVM_DEBUG_PERF)
+      gallivm->resident_begin = resident_kib();
 
    if (!gallivm->context)
       goto fail;
@@ -518,15 +588,45 @@ lp_build_init(void)
 
 /**
  * Create a new gallivm_state object.
+ *
+ * If cache is non-NULL and holds the machine code of a previous compilation
+ * of the very same module, that code is loaded instead of running the
+ * optimizer and code generator.  Otherwise the freshly generated code is
+ * returned in it, unless dont_cache gets set while building the IR.
+ */
+struct gallivm_state *
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache)
+{
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      if (!init_gallivm_state(gallivm, name, context, cache)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   return gallivm;
+}
+
+
+/**
+ * Create a new gallivm_state object which skips the optimization passes
+ * and compiles with the lowest code generation level, regardless of
+ * GALLIVM_PERF.  Meant for stand-in code which is needed quickly and
+ * only for a short time.
  */
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context)
+gallivm_create_no_opt(const char *name, LLVMContextRef context)
 {
    struct gallivm_state *gallivm;
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context)) {
+      gallivm->no_opt = TRUE;
+      if (!init_gallivm_state(gallivm, name, context, NULL)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -582,6 +682,7 @@ gallivm_compile_module(struct gallivm_state *gallivm)
 {
    LLVMValueRef func;
    int64_t time_begin = 0;
+   boolean skip_opt;
 
    assert(!gallivm->compiled);
 
@@ -609,7 +710,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
-   /* Run optimization passes */
+   /* Run optimization passes, unless the machine code is already cached */
+   skip_opt = gallivm->cache && gallivm->cache->data_size;
    LLVMInitializeFunctionPassManager(gallivm->passmgr);
    func = LLVMGetFirstFunction(gallivm->module);
    while (func) {
@@ -626,7 +728,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       LLVMAddTargetDependentFunctionAttr(func, "no-frame-pointer-elim-non-leaf", "true");
 #endif
 
-      LLVMRunFunctionPassManager(gallivm->passmgr, func);
+      if (!skip_opt)
+         LLVMRunFunctionPassManager(gallivm->passmgr, func);
       func = LLVMGetNextFunction(func);
    }
    LLVMFinalizeFunctionPassManager(gallivm->passmgr);
@@ -39,6 +39,17 @@
 extern "C" {
 #endif
 
+/**
+ * Machine code of a module, as produced by (or to be fed back to) the
+ * MCJIT object cache.  Owned by the caller of gallivm_create().
+ */
+struct lp_cached_code {
+   void *data;
+   size_t data_size;
+   bool dont_cache;       /**< code refers to process-local addresses */
+   void *jit_obj_cache;
+};
+
 struct gallivm_state
 {
    char *module_name;
@@ -50,7 +61,10 @@ struct gallivm_state
    LLVMBuilderRef builder;
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
+   struct lp_cached_code *cache;
    unsigned compiled;
+   boolean no_opt;
+   int64_t resident_begin;   /**< resident KiB at creation, for GALLIVM_DEBUG=perf */
 };
 
 
@@ -59,7 +73,11 @@ lp_build_init(void);
 
 
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context);
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache);
+
+struct gallivm_state *
+gallivm_create_no_opt(const char *name, LLVMContextRef context);
 
 void
 gallivm_destroy(struct gallivm_state *gallivm);
@@ -42,6 +42,7 @@
 #include "util/u_math.h"
 #include "util/u_format.h"
 #include "util/u_cpu_detect.h"
+#include "util/u_pointer.h"
 #include "util/format_rgb9e5.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_type.h"
@@ -2709,6 +2710,364 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
  * Just set texels to white instead of actually sampling the texture.
  * For debugging.
  */
+
+/**
+ * Whether stores to images of this format can just write the 32-bit
+ * channel values as they are.
+ */
+static boolean
+img_store_is_direct(const struct util_format_description *format_desc)
+{
+   unsigned chan;
+
+   if (format_desc->layout != UTIL_FORMAT_LAYOUT_PLAIN ||
+       format_desc->block.width != 1 ||
+       format_desc->block.height != 1)
+      return FALSE;
+
+   for (chan = 0; chan < format_desc->nr_channels; chan++) {
+      const struct util_format_channel_description *channel =
+         &format_desc->channel[chan];
+      if (channel->size != 32 ||
+          channel->normalized ||
+          (channel->type != UTIL_FORMAT_TYPE_FLOAT &&
+           channel->type != UTIL_FORMAT_TYPE_UNSIGNED &&
+           channel->type != UTIL_FORMAT_TYPE_SIGNED) ||
+          format_desc->swizzle[chan] != chan)
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Store the texels of the active elements, one element at a time.
+ */
+static void
+img_store(struct gallivm_state *gallivm,
+          const struct util_format_description *format_desc,
+          const struct lp_img_params *params,
+          struct lp_build_context *int_bld,
+          LLVMValueRef base_ptr,
+          LLVMValueRef offset,
+          LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef pi32t = LLVMPointerType(i32t, 0);
+   LLVMTypeRef pi8t = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+   boolean direct = img_store_is_direct(format_desc);
+   LLVMValueRef data[4];
+   LLVMValueRef function = NULL;
+   LLVMValueRef tmp_ptr = NULL;
+   unsigned chan, k;
+
+   for (chan = 0; chan < 4; chan++) {
+      data[chan] = LLVMBuildBitCast(builder, params->indata[chan],
+                                    int_bld->vec_type, "");
+   }
+
+   if (!direct) {
+      /*
+       * Call util_format_*_pack_rgba_*() for each element, like
+       * lp_build_fetch_rgba_aos() does for fetching unusual formats:
+       *   pack(uint8_t *dst, unsigned dst_stride,
+       *        const void *src, unsigned src_stride,
+       *        unsigned width, unsigned height)
+       */
+      LLVMTypeRef arg_types[6];
+      func_pointer pack;
+
+      if (util_format_is_pure_sint(format_desc->format))
+         pack = (func_pointer) format_desc->pack_rgba_sint;
+      else if (util_format_is_pure_uint(format_desc->format))
+         pack = (func_pointer) format_desc->pack_rgba_uint;
+      else
+         pack = (func_pointer) format_desc->pack_rgba_float;
+
+      if (!pack) {
+         debug_printf("%s: cannot store to %s images\n",
+                      __FUNCTION__, format_desc->short_name);
+         return;
+      }
+
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         debug_printf("%s: falling back to util_format_%s_pack_rgba\n",
+                      __FUNCTION__, format_desc->short_name);
+      }
+
+      arg_types[0] = pi8t;
+      arg_types[1] = i32t;
+      arg_types[2] = pi32t;
+      arg_types[3] = i32t;
+      arg_types[4] = i32t;
+      arg_types[5] = i32t;
+      function = lp_build_const_func_pointer(gallivm, func_to_pointer(pack),
+                                             LLVMVoidTypeInContext(gallivm->context),
+                                             arg_types, ARRAY_SIZE(arg_types),
+                                             format_desc->short_name);
+      tmp_ptr = lp_build_alloca(gallivm, LLVMVectorType(i32t, 4), "");
+   }
+
+   for (k = 0; k < int_bld->type.length; k++) {
+      LLVMValueRef kk = lp_build_const_int32(gallivm, k);
+      LLVMValueRef active, texel_ptr;
+      struct lp_build_if_state ifthen;
+
+      active = LLVMBuildExtractElement(builder, mask, kk, "");
+      active = LLVMBuildICmp(builder, LLVMIntNE, active,
+                             lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, active);
+
+      texel_ptr = lp_build_gather_elem_ptr(gallivm, int_bld->type.length,
+                                           base_ptr, offset, k);
+
+      if (direct) {
+         texel_ptr = LLVMBuildBitCast(builder, texel_ptr, pi32t, "");
+         for (chan = 0; chan < format_desc->nr_channels; chan++) {
+            LLVMValueRef index = lp_build_const_int32(gallivm, chan);
+            LLVMValueRef chan_ptr = LLVMBuildGEP(builder, texel_ptr,
+                                                 &index, 1, "");
+            LLVMBuildStore(builder,
+                           LLVMBuildExtractElement(builder, data[chan], kk, ""),
+                           chan_ptr);
+         }
+      }
+      else {
+         LLVMValueRef texel = LLVMGetUndef(LLVMVectorType(i32t, 4));
+         LLVMValueRef args[6];
+
+         for (chan = 0; chan < 4; chan++) {
+            texel = LLVMBuildInsertElement(builder, texel,
+                                           LLVMBuildExtractElement(builder, data[chan], kk, ""),
+                                           lp_build_const_int32(gallivm, chan), "");
+         }
+         LLVMBuildStore(builder, texel, tmp_ptr);
+
+         args[0] = texel_ptr;
+         args[1] = lp_build_const_int32(gallivm, 0);
+         args[2] = LLVMBuildBitCast(builder, tmp_ptr, pi32t, "");
+         args[3] = lp_build_const_int32(gallivm, 0);
+         args[4] = lp_build_const_int32(gallivm, 1);
+         args[5] = lp_build_const_int32(gallivm, 1);
+         LLVMBuildCall(builder, function, args, ARRAY_SIZE(args), "");
+      }
+
+      lp_build_endif(&ifthen);
+   }
+}
+
+
+/**
+ * Atomic operation on 32-bit single channel images, one element at a time.
+ */
+static void
+img_atomic(struct gallivm_state *gallivm,
+           const struct util_format_description *format_desc,
+           const struct lp_img_params *params,
+           struct lp_build_context *int_bld,
+           LLVMValueRef base_ptr,
+           LLVMValueRef offset,
+           LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef pi32t = LLVMPointerType(LLVMInt32TypeInContext(gallivm->context), 0);
+   LLVMValueRef value, value2 = NULL, result_ptr, result;
+   unsigned k;
+
+   /* Inactive and out of bounds elements return zero */
+   result_ptr = lp_build_alloca(gallivm, int_bld->vec_type, "");
+   LLVMBuildStore(builder, int_bld->zero, result_ptr);
+
+   if (format_desc->block.bits != 32 || format_desc->nr_channels != 1) {
+      debug_printf("%s: no atomics on %s images\n",
+                   __FUNCTION__, format_desc->short_name);
+      params->outdata[0] = LLVMBuildBitCast(builder, int_bld->zero,
+                                            lp_build_vec_type(gallivm, params->type), "");
+      return;
+   }
+
+   value = LLVMBuildBitCast(builder, params->indata[0], int_bld->vec_type, "");
+   if (params->img_op == LP_IMG_ATOMIC_CAS) {
+      value2 = LLVMBuildBitCast(builder, params->indata2[0],
+                                int_bld->vec_type, "");
+   }
+
+   for (k = 0; k < int_bld->type.length; k++) {
+      LLVMValueRef kk = lp_build_const_int32(gallivm, k);
+      LLVMValueRef active, texel_ptr, scalar, res;
+      struct lp_build_if_state ifthen;
+
+      active = LLVMBuildExtractElement(builder, mask, kk, "");
+      active = LLVMBuildICmp(builder, LLVMIntNE, active,
+                             lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, active);
+
+      texel_ptr = lp_build_gather_elem_ptr(gallivm, int_bld->type.length,
+                                           base_ptr, offset, k);
+      texel_ptr = LLVMBuildBitCast(builder, texel_ptr, pi32t, "");
+      scalar = LLVMBuildExtractElement(builder, value, kk, "");
+
+#if HAVE_LLVM >= 0x0306
+      if (params->img_op == LP_IMG_ATOMIC_CAS) {
+         LLVMValueRef new_val = LLVMBuildExtractElement(builder, value2, kk, "");
+         scalar = LLVMBuildAtomicCmpXchg(builder, texel_ptr, scalar, new_val,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         FALSE);
+         scalar = LLVMBuildExtractValue(builder, scalar, 0, "");
+      }
+      else
+#endif
+      {
+         scalar = LLVMBuildAtomicRMW(builder, params->op, texel_ptr, scalar,
+                                     LLVMAtomicOrderingSequentiallyConsistent,
+                                     FALSE);
+      }
+
+      res = LLVMBuildLoad(builder, result_ptr, "");
+      res = LLVMBuildInsertElement(builder, res, scalar, kk, "");
+      LLVMBuildStore(builder, res, result_ptr);
+
+      lp_build_endif(&ifthen);
+   }
+
+   result = LLVMBuildLoad(builder, result_ptr, "");
+   params->outdata[0] = LLVMBuildBitCast(builder, result,
+                                         lp_build_vec_type(gallivm, params->type), "");
+}
+
+
+/**
+ * Image load/store/atomic code generation.
+ *
+ * Images always access a single level (baked into the base pointer by the
+ * driver) with unnormalized integer coordinates, and have no sampler state.
+ * Out of bounds and inactive elements load zero and are never written.
+ */
+void
+lp_build_img_op_soa(const struct lp_static_texture_state *static_texture_state,
+                    struct lp_sampler_dynamic_state *dynamic_state,
+                    struct gallivm_state *gallivm,
+                    const struct lp_img_params *params)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct util_format_description *format_desc;
+   const unsigned target = params->target;
+   const unsigned dims = texture_dims(target);
+   const unsigned image_index = params->image_index;
+   LLVMValueRef context_ptr = params->context_ptr;
+   struct lp_build_context int_bld;
+   LLVMValueRef x, y = NULL, z = NULL;
+   LLVMValueRef row_stride = NULL, img_stride = NULL;
+   LLVMValueRef base_ptr, size, in_bounds, offset, i, j;
+   LLVMValueRef zero_index = lp_build_const_int32(gallivm, 0);
+   unsigned chan;
+
+   if (static_texture_state->format == PIPE_FORMAT_NONE) {
+      /* Nothing bound: loads and atomics return zero, stores are dropped. */
+      if (params->outdata) {
+         for (chan = 0; chan < 4; chan++)
+            params->outdata[chan] = lp_build_zero(gallivm, params->type);
+      }
+      return;
+   }
+
+   format_desc = util_format_description(static_texture_state->format);
+   lp_build_context_init(&int_bld, gallivm, lp_uint_type(params->type));
+
+   x = params->coords[0];
+   size = dynamic_state->width(dynamic_state, gallivm, context_ptr, image_index);
+   size = lp_build_broadcast_scalar(&int_bld, size);
+   in_bounds = lp_build_cmp(&int_bld, PIPE_FUNC_LESS, x, size);
+
+   if (dims >= 2) {
+      y = params->coords[1];
+      size = dynamic_state->height(dynamic_state, gallivm, context_ptr, image_index);
+      size = lp_build_broadcast_scalar(&int_bld, size);
+      in_bounds = lp_build_and(&int_bld, in_bounds,
+                               lp_build_cmp(&int_bld, PIPE_FUNC_LESS, y, size));
+      row_stride = dynamic_state->row_stride(dynamic_state, gallivm,
+                                             context_ptr, image_index);
+      row_stride = lp_build_array_get(gallivm, row_stride, zero_index);
+      row_stride = lp_build_broadcast_scalar(&int_bld, row_stride);
+   }
+
+   if (dims >= 3 || has_layer_coord(target)) {
+      /* The 3D depth or the layer (the face for cube maps) */
+      z = params->coords[dims >= 3 ? 2 : dims];
+      size = dynamic_state->depth(dynamic_state, gallivm, context_ptr, image_index);
+      size = lp_build_broadcast_scalar(&int_bld, size);
+      in_bounds = lp_build_and(&int_bld, in_bounds,
+                               lp_build_cmp(&int_bld, PIPE_FUNC_LESS, z, size));
+      img_stride = dynamic_state->img_stride(dynamic_state, gallivm,
+                                             context_ptr, image_index);
+      img_stride = lp_build_array_get(gallivm, img_stride, zero_index);
+      img_stride = lp_build_broadcast_scalar(&int_bld, img_stride);
+   }
+
+   in_bounds = lp_build_and(&int_bld, in_bounds, params->exec_mask);
+
+   /* Redirect the disabled elements to the first texel, which always exists */
+   x = lp_build_select(&int_bld, in_bounds, x, int_bld.zero);
+   if (y)
+      y = lp_build_select(&int_bld, in_bounds, y, int_bld.zero);
+   if (z)
+      z = lp_build_select(&int_bld, in_bounds, z, int_bld.zero);
+
+   base_ptr = dynamic_state->base_ptr(dynamic_state, gallivm,
+                                      context_ptr, image_index);
+   lp_build_sample_offset(&int_bld, format_desc, x, y, z,
+                          row_stride, img_stride, &offset, &i, &j);
+
+   switch (params->img_op) {
+   case LP_IMG_LOAD:
+   {
+      struct lp_type texel_type = params->type;
+      LLVMValueRef texel[4];
+
+      if (format_desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB &&
+          format_desc->channel[0].pure_integer) {
+         if (format_desc->channel[0].type == UTIL_FORMAT_TYPE_SIGNED)
+            texel_type = lp_int_type(params->type);
+         else if (format_desc->channel[0].type == UTIL_FORMAT_TYPE_UNSIGNED)
+            texel_type = lp_uint_type(params->type);
+      }
+
+      lp_build_fetch_rgba_soa(gallivm, format_desc, texel_type, TRUE,
+                              base_ptr, offset, i, j, NULL, texel);
+
+      for (chan = 0; chan < 4; chan++) {
+         LLVMValueRef val = LLVMBuildBitCast(builder, texel[chan],
+                                             int_bld.vec_type, "");
+         val = lp_build_select(&int_bld, in_bounds, val, int_bld.zero);
+         params->outdata[chan] =
+            LLVMBuildBitCast(builder, val,
+                             lp_build_vec_type(gallivm, params->type), "");
+      }
+      break;
+   }
+
+   case LP_IMG_STORE:
+      img_store(gallivm, format_desc, params, &int_bld,
+                base_ptr, offset, in_bounds);
+      break;
+
+   case LP_IMG_ATOMIC:
+   case LP_IMG_ATOMIC_CAS:
+      img_atomic(gallivm, format_desc, params, &int_bld,
+                 base_ptr, offset, in_bounds);
+      for (chan = 1; chan < 4; chan++)
+         params->outdata[chan] = lp_build_zero(gallivm, params->type);
+      break;
+
+   default:
+      assert(0);
+      break;
+   }
+}
+
 void
 lp_build_sample_nop(struct gallivm_state *gallivm,
                     struct lp_type type,
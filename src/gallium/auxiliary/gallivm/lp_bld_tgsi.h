@@ -67,6 +67,8 @@ struct lp_build_mask_context;
 struct gallivm_state;
 struct lp_derivatives;
 struct lp_build_tgsi_gs_iface;
+struct lp_build_tgsi_resources;
+struct lp_img_params;
 
 
 enum lp_build_tex_modifier {
@@ -170,6 +172,12 @@ struct lp_bld_tgsi_system_values {
    LLVMValueRef prim_id;
    LLVMValueRef basevertex;
    LLVMValueRef invocation_id;
+
+   /* Compute shaders: thread_id is a vector, the others are scalars */
+   LLVMValueRef thread_id[3];
+   LLVMValueRef block_id[3];
+   LLVMValueRef grid_size[3];
+   LLVMValueRef block_size[3];
 };
 
 
@@ -198,6 +206,51 @@ struct lp_build_sampler_soa
 };
 
 
+/**
+ * Image (shader load/store) code generation interface.
+ */
+struct lp_build_image_soa
+{
+   void
+   (*destroy)( struct lp_build_image_soa *image );
+
+   void
+   (*emit_op)(const struct lp_build_image_soa *image,
+              struct gallivm_state *gallivm,
+              const struct lp_img_params *params);
+
+   void
+   (*emit_size_query)( const struct lp_build_image_soa *image,
+                       struct gallivm_state *gallivm,
+                       const struct lp_sampler_size_query_params *params);
+};
+
+
+/**
+ * Shader storage buffers, images and workgroup shared memory.
+ *
+ * All members are optional; a shader accessing a resource which isn't
+ * provided here will fail to translate.
+ */
+struct lp_build_tgsi_resources
+{
+   /** Arrays of buffer pointers and of buffer sizes in bytes */
+   LLVMValueRef ssbo_ptr;
+   LLVMValueRef ssbo_sizes_ptr;
+
+   /** Shared memory (TGSI_FILE_MEMORY) and its size in bytes (i32) */
+   LLVMValueRef shared_ptr;
+   LLVMValueRef shared_size;
+
+   const struct lp_build_image_soa *image;
+
+   /** Wait until all invocations of the workgroup reach the barrier */
+   void (*emit_barrier)(const struct lp_build_tgsi_resources *resources,
+                        struct gallivm_state *gallivm,
+                        LLVMValueRef thread_data_ptr);
+};
+
+
 struct lp_build_sampler_aos
 {
    LLVMValueRef
@@ -230,7 +283,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   LLVMValueRef thread_data_ptr,
                   const struct lp_build_sampler_soa *sampler,
                   const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface);
+                  const struct lp_build_tgsi_gs_iface *gs_iface,
+                  const struct lp_build_tgsi_resources *resources);
 
 
 void
@@ -454,6 +508,10 @@ struct lp_build_tgsi_soa_context
 
    const struct lp_build_sampler_soa *sampler;
 
+   const struct lp_build_tgsi_resources *resources;
+   LLVMValueRef ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   LLVMValueRef ssbo_sizes[LP_MAX_TGSI_SHADER_BUFFERS];
+
    struct tgsi_declaration_sampler_view sv[PIPE_MAX_SHADER_SAMPLER_VIEWS];
 
    LLVMValueRef immediates[LP_MAX_INLINED_IMMEDIATES][TGSI_NUM_CHANNELS];
@@ -1670,6 +1670,7 @@ emit_fetch_system_value(
    LLVMBuilderRef builder = gallivm->builder;
    LLVMValueRef res;
    enum tgsi_opcode_type atype; // Actual type of the value
+   unsigned chan;
 
    assert(!reg->Register.Indirect);
 
@@ -1704,6 +1705,36 @@ emit_fetch_system_value(
       atype = TGSI_TYPE_UNSIGNED;
       break;
 
+   case TGSI_SEMANTIC_THREAD_ID:
+      chan = swizzle_in & 0xffff;
+      res = chan < 3 ? bld->system_values.thread_id[chan] :
+                       bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_BLOCK_ID:
+   case TGSI_SEMANTIC_GRID_SIZE:
+   case TGSI_SEMANTIC_BLOCK_SIZE:
+   {
+      const LLVMValueRef *values;
+      chan = swizzle_in & 0xffff;
+      switch (info->system_value_semantic_name[reg->Register.Index]) {
+      case TGSI_SEMANTIC_BLOCK_ID:
+         values = bld->system_values.block_id;
+         break;
+      case TGSI_SEMANTIC_GRID_SIZE:
+         values = bld->system_values.grid_size;
+         break;
+      default:
+         values = bld->system_values.block_size;
+         break;
+      }
+      res = chan < 3 ? lp_build_broadcast_scalar(&bld_base->uint_bld, values[chan]) :
+                       bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+   }
+
    default:
       assert(!"unexpected semantic in emit_fetch_system_value");
       res = bld_base->base.zero;
@@ -2962,6 +2993,21 @@ lp_emit_declaration_soa(
    }
       break;
 
+   case TGSI_FILE_BUFFER:
+      /* Same reasoning as for constants above. */
+      if (bld->resources && bld->resources->ssbo_ptr) {
+         for (idx = first; idx <= last; ++idx) {
+            LLVMValueRef index = lp_build_const_int32(gallivm, idx);
+            assert(idx < LP_MAX_TGSI_SHADER_BUFFERS);
+            bld->ssbos[idx] =
+               lp_build_array_get(gallivm, bld->resources->ssbo_ptr, index);
+            bld->ssbo_sizes[idx] =
+               lp_build_array_get(gallivm, bld->resources->ssbo_sizes_ptr,
+                                  index);
+         }
+      }
+      break;
+
    default:
       /* don't need to declare other vars */
       break;
@@ -3356,6 +3402,516 @@ lod_emit(
                FALSE, LP_SAMPLER_OP_LODQ, emit_data->output);
 }
 
+#if HAVE_LLVM >= 0x0306
+
+/**
+ * Mask of the elements which may access memory: the shader mask (kill)
+ * combined with the control flow mask.
+ */
+static LLVMValueRef
+mem_exec_mask(struct lp_build_tgsi_soa_context *bld)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef mask = NULL;
+
+   if (bld->mask)
+      mask = lp_build_mask_value(bld->mask);
+
+   if (bld->exec_mask.has_mask) {
+      mask = mask ? LLVMBuildAnd(builder, mask, bld->exec_mask.exec_mask, "") :
+                    bld->exec_mask.exec_mask;
+   }
+
+   if (!mask)
+      mask = lp_build_const_int_vec(gallivm, bld->bld_base.int_bld.type, ~0);
+
+   return mask;
+}
+
+
+/**
+ * Get the base pointer (as int32 pointer) and the size in dwords of a
+ * shader buffer or of the shared memory.
+ */
+static boolean
+get_mem_resource(struct lp_build_tgsi_soa_context *bld,
+                 unsigned file,
+                 unsigned index,
+                 boolean indirect,
+                 const struct tgsi_ind_register *indirect_reg,
+                 LLVMValueRef *base_ptr,
+                 LLVMValueRef *num_elems)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i32_ptr_type =
+      LLVMPointerType(LLVMInt32TypeInContext(gallivm->context), 0);
+   LLVMValueRef ptr, size;
+
+   if (file == TGSI_FILE_BUFFER) {
+      if (!bld->resources || !bld->resources->ssbo_ptr) {
+         _debug_printf("warning: found buffer access but no buffers supplied\n");
+         return FALSE;
+      }
+
+      if (indirect) {
+         /* The index must be dynamically uniform, so just use the first
+          * element.
+          */
+         LLVMValueRef index_vec =
+            get_indirect_index(bld, file, index, indirect_reg,
+                               LP_MAX_TGSI_SHADER_BUFFERS - 1);
+         LLVMValueRef buf_index =
+            LLVMBuildExtractElement(builder, index_vec,
+                                    lp_build_const_int32(gallivm, 0), "");
+         ptr = lp_build_array_get(gallivm, bld->resources->ssbo_ptr,
+                                  buf_index);
+         size = lp_build_array_get(gallivm, bld->resources->ssbo_sizes_ptr,
+                                   buf_index);
+      }
+      else {
+         assert(index < LP_MAX_TGSI_SHADER_BUFFERS);
+         ptr = bld->ssbos[index];
+         size = bld->ssbo_sizes[index];
+         if (!ptr) {
+            LLVMValueRef buf_index = lp_build_const_int32(gallivm, index);
+            ptr = lp_build_array_get(gallivm, bld->resources->ssbo_ptr,
+                                     buf_index);
+            size = lp_build_array_get(gallivm, bld->resources->ssbo_sizes_ptr,
+                                      buf_index);
+         }
+      }
+   }
+   else {
+      assert(file == TGSI_FILE_MEMORY);
+      if (!bld->resources || !bld->resources->shared_ptr) {
+         _debug_printf("warning: found shared memory access but no shared memory supplied\n");
+         return FALSE;
+      }
+      ptr = bld->resources->shared_ptr;
+      size = bld->resources->shared_size;
+   }
+
+   *base_ptr = LLVMBuildBitCast(builder, ptr, i32_ptr_type, "");
+   size = LLVMBuildLShr(builder, size, lp_build_const_int32(gallivm, 2), "");
+   *num_elems = lp_build_broadcast_scalar(&bld->bld_base.uint_bld, size);
+   return TRUE;
+}
+
+
+/**
+ * Store the active elements of a vector to memory.
+ *
+ * Unlike emit_mask_scatter() this never touches the inactive elements, as
+ * other invocations may be writing to the same memory concurrently.
+ */
+static void
+emit_mem_scatter(struct lp_build_tgsi_soa_context *bld,
+                 LLVMValueRef base_ptr,
+                 LLVMValueRef indexes,
+                 LLVMValueRef values,
+                 LLVMValueRef mask)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned i;
+
+   for (i = 0; i < bld->bld_base.base.type.length; i++) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      LLVMValueRef active, index, scalar_ptr, val;
+      struct lp_build_if_state ifthen;
+
+      active = LLVMBuildExtractElement(builder, mask, ii, "");
+      active = LLVMBuildICmp(builder, LLVMIntNE, active,
+                             lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, active);
+      index = LLVMBuildExtractElement(builder, indexes, ii, "");
+      val = LLVMBuildExtractElement(builder, values, ii, "");
+      scalar_ptr = LLVMBuildGEP(builder, base_ptr, &index, 1, "");
+      LLVMBuildStore(builder, val, scalar_ptr);
+      lp_build_endif(&ifthen);
+   }
+}
+
+
+static LLVMAtomicRMWBinOp
+get_atomic_op(enum tgsi_opcode opcode)
+{
+   switch (opcode) {
+   case TGSI_OPCODE_ATOMUADD:
+      return LLVMAtomicRMWBinOpAdd;
+   case TGSI_OPCODE_ATOMXCHG:
+      return LLVMAtomicRMWBinOpXchg;
+   case TGSI_OPCODE_ATOMAND:
+      return LLVMAtomicRMWBinOpAnd;
+   case TGSI_OPCODE_ATOMOR:
+      return LLVMAtomicRMWBinOpOr;
+   case TGSI_OPCODE_ATOMXOR:
+      return LLVMAtomicRMWBinOpXor;
+   case TGSI_OPCODE_ATOMUMIN:
+      return LLVMAtomicRMWBinOpUMin;
+   case TGSI_OPCODE_ATOMUMAX:
+      return LLVMAtomicRMWBinOpUMax;
+   case TGSI_OPCODE_ATOMIMIN:
+      return LLVMAtomicRMWBinOpMin;
+   case TGSI_OPCODE_ATOMIMAX:
+      return LLVMAtomicRMWBinOpMax;
+   default:
+      /* ATOMCAS doesn't use this */
+      return LLVMAtomicRMWBinOpXchg;
+   }
+}
+
+
+static void
+emit_image_op(struct lp_build_tgsi_soa_context *bld,
+              const struct tgsi_full_instruction *inst,
+              unsigned image_index,
+              unsigned img_op,
+              const struct tgsi_full_src_register *coord_reg,
+              unsigned data_src,
+              LLVMValueRef *outdata)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   struct lp_img_params params;
+   LLVMValueRef coords[3];
+   unsigned chan;
+
+   if (!bld->resources || !bld->resources->image) {
+      _debug_printf("warning: found image instruction but no image generator supplied\n");
+      if (outdata) {
+         for (chan = 0; chan < 4; chan++)
+            outdata[chan] = bld_base->base.zero;
+      }
+      return;
+   }
+
+   memset(&params, 0, sizeof params);
+
+   for (chan = 0; chan < 3; chan++) {
+      coords[chan] = lp_build_emit_fetch_src(bld_base, coord_reg,
+                                             TGSI_TYPE_UNSIGNED, chan);
+   }
+
+   if (data_src) {
+      for (chan = 0; chan < 4; chan++) {
+         params.indata[chan] =
+            lp_build_emit_fetch_src(bld_base, &inst->Src[data_src],
+                                    TGSI_TYPE_FLOAT, chan);
+      }
+      if (img_op == LP_IMG_ATOMIC_CAS) {
+         params.indata2[0] =
+            lp_build_emit_fetch_src(bld_base, &inst->Src[data_src + 1],
+                                    TGSI_TYPE_FLOAT, TGSI_CHAN_X);
+      }
+   }
+
+   params.type = bld_base->base.type;
+   params.image_index = image_index;
+   params.img_op = img_op;
+   params.op = get_atomic_op(inst->Instruction.Opcode);
+   params.target = tgsi_to_pipe_tex_target(inst->Memory.Texture);
+   params.exec_mask = mem_exec_mask(bld);
+   params.context_ptr = bld->context_ptr;
+   params.coords = coords;
+   params.outdata = outdata;
+
+   bld->resources->image->emit_op(bld->resources->image,
+                                  bld_base->base.gallivm,
+                                  &params);
+}
+
+
+static void
+load_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *reg = &inst->Src[0];
+   LLVMValueRef base_ptr, num_elems, offset;
+   unsigned chan;
+
+   if (reg->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, reg->Register.Index, LP_IMG_LOAD,
+                    &inst->Src[1], 0, emit_data->output);
+      return;
+   }
+
+   if (!get_mem_resource(bld, reg->Register.File, reg->Register.Index,
+                         reg->Register.Indirect, &reg->Indirect,
+                         &base_ptr, &num_elems)) {
+      TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+         emit_data->output[chan] = bld_base->base.zero;
+      }
+      return;
+   }
+
+   /*
+    * Out of bounds loads return zero. As for constants, we rely on the
+    * callers providing a valid (fake) buffer for index zero.
+    */
+   base_ptr = LLVMBuildBitCast(builder, base_ptr,
+                               LLVMPointerType(bld->elem_bld.elem_type, 0), "");
+   offset = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                    TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef index, overflow_mask;
+
+      index = lp_build_add(uint_bld, offset,
+                           lp_build_const_int_vec(gallivm, uint_bld->type, chan));
+      overflow_mask = lp_build_cmp(uint_bld, PIPE_FUNC_GEQUAL,
+                                   index, num_elems);
+      emit_data->output[chan] = build_gather(bld_base, base_ptr, index,
+                                             overflow_mask, NULL);
+   }
+}
+
+
+static void
+store_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_dst_register *reg = &inst->Dst[0];
+   LLVMValueRef base_ptr, num_elems, offset, exec_mask;
+   unsigned chan;
+
+   if (reg->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, reg->Register.Index, LP_IMG_STORE,
+                    &inst->Src[0], 1, NULL);
+      return;
+   }
+
+   if (!get_mem_resource(bld, reg->Register.File, reg->Register.Index,
+                         reg->Register.Indirect, &reg->Indirect,
+                         &base_ptr, &num_elems)) {
+      return;
+   }
+
+   exec_mask = mem_exec_mask(bld);
+   offset = lp_build_emit_fetch_src(bld_base, &inst->Src[0],
+                                    TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef index, value, store_mask;
+
+      index = lp_build_add(uint_bld, offset,
+                           lp_build_const_int_vec(gallivm, uint_bld->type, chan));
+      store_mask = lp_build_cmp(uint_bld, PIPE_FUNC_LESS, index, num_elems);
+      store_mask = lp_build_and(uint_bld, store_mask, exec_mask);
+      value = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                      TGSI_TYPE_UNSIGNED, chan);
+      emit_mem_scatter(bld, base_ptr, index, value, store_mask);
+   }
+}
+
+
+static void
+atomic_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *reg = &inst->Src[0];
+   enum tgsi_opcode opcode = inst->Instruction.Opcode;
+   LLVMValueRef base_ptr, num_elems, index, mask;
+   LLVMValueRef value, value2 = NULL, result_ptr, result;
+   unsigned i, chan;
+
+   if (reg->Register.File == TGSI_FILE_IMAGE) {
+      LLVMValueRef outdata[4];
+
+      emit_image_op(bld, inst, reg->Register.Index,
+                    opcode == TGSI_OPCODE_ATOMCAS ? LP_IMG_ATOMIC_CAS :
+                                                    LP_IMG_ATOMIC,
+                    &inst->Src[1], 2, outdata);
+      TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+         emit_data->output[chan] = outdata[0];
+      }
+      return;
+   }
+
+   if (!get_mem_resource(bld, reg->Register.File, reg->Register.Index,
+                         reg->Register.Indirect, &reg->Indirect,
+                         &base_ptr, &num_elems)) {
+      TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+         emit_data->output[chan] = bld_base->base.zero;
+      }
+      return;
+   }
+
+   index = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   index = lp_build_shr_imm(uint_bld, index, 2);
+   mask = lp_build_cmp(uint_bld, PIPE_FUNC_LESS, index, num_elems);
+   mask = lp_build_and(uint_bld, mask, mem_exec_mask(bld));
+
+   value = lp_build_emit_fetch_src(bld_base, &inst->Src[2],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   if (opcode == TGSI_OPCODE_ATOMCAS) {
+      value2 = lp_build_emit_fetch_src(bld_base, &inst->Src[3],
+                                       TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   }
+
+   /* Inactive and out of bounds elements return zero */
+   result_ptr = lp_build_alloca(gallivm, uint_bld->vec_type, "");
+   LLVMBuildStore(builder, uint_bld->zero, result_ptr);
+
+   for (i = 0; i < uint_bld->type.length; i++) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      LLVMValueRef active, scalar_index, scalar_ptr, scalar, res;
+      struct lp_build_if_state ifthen;
+
+      active = LLVMBuildExtractElement(builder, mask, ii, "");
+      active = LLVMBuildICmp(builder, LLVMIntNE, active,
+                             lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, active);
+
+      scalar_index = LLVMBuildExtractElement(builder, index, ii, "");
+      scalar_ptr = LLVMBuildGEP(builder, base_ptr, &scalar_index, 1, "");
+      scalar = LLVMBuildExtractElement(builder, value, ii, "");
+      if (opcode == TGSI_OPCODE_ATOMCAS) {
+         LLVMValueRef new_val = LLVMBuildExtractElement(builder, value2, ii, "");
+         scalar = LLVMBuildAtomicCmpXchg(builder, scalar_ptr, scalar, new_val,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         FALSE);
+         scalar = LLVMBuildExtractValue(builder, scalar, 0, "");
+      }
+      else {
+         scalar = LLVMBuildAtomicRMW(builder, get_atomic_op(opcode),
+                                     scalar_ptr, scalar,
+                                     LLVMAtomicOrderingSequentiallyConsistent,
+                                     FALSE);
+      }
+
+      res = LLVMBuildLoad(builder, result_ptr, "");
+      res = LLVMBuildInsertElement(builder, res, scalar, ii, "");
+      LLVMBuildStore(builder, res, result_ptr);
+
+      lp_build_endif(&ifthen);
+   }
+
+   result = LLVMBuildLoad(builder, result_ptr, "");
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      emit_data->output[chan] = result;
+   }
+}
+
+
+static void
+resq_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *reg = &inst->Src[0];
+   LLVMValueRef size;
+   unsigned chan;
+
+   if (reg->Register.File == TGSI_FILE_IMAGE) {
+      struct lp_sampler_size_query_params params;
+
+      if (!bld->resources || !bld->resources->image) {
+         _debug_printf("warning: found image query but no image generator supplied\n");
+         TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+            emit_data->output[chan] = bld_base->int_bld.zero;
+         }
+         return;
+      }
+
+      params.int_type = bld_base->int_bld.type;
+      params.texture_unit = reg->Register.Index;
+      params.target = tgsi_to_pipe_tex_target(inst->Memory.Texture);
+      params.context_ptr = bld->context_ptr;
+      params.is_sviewinfo = FALSE;
+      params.lod_property = LP_SAMPLER_LOD_SCALAR;
+      params.explicit_lod = NULL;
+      params.sizes_out = emit_data->output;
+
+      bld->resources->image->emit_size_query(bld->resources->image,
+                                             gallivm, &params);
+      return;
+   }
+
+   /* Buffer size in bytes */
+   if (!bld->resources || !bld->resources->ssbo_sizes_ptr) {
+      size = bld_base->uint_bld.zero;
+   }
+   else if (reg->Register.Indirect) {
+      LLVMValueRef index_vec =
+         get_indirect_index(bld, reg->Register.File, reg->Register.Index,
+                            &reg->Indirect, LP_MAX_TGSI_SHADER_BUFFERS - 1);
+      LLVMValueRef buf_index =
+         LLVMBuildExtractElement(gallivm->builder, index_vec,
+                                 lp_build_const_int32(gallivm, 0), "");
+      size = lp_build_array_get(gallivm, bld->resources->ssbo_sizes_ptr,
+                                buf_index);
+      size = lp_build_broadcast_scalar(&bld_base->uint_bld, size);
+   }
+   else {
+      size = lp_build_array_get(gallivm, bld->resources->ssbo_sizes_ptr,
+                                lp_build_const_int32(gallivm,
+                                                     reg->Register.Index));
+      size = lp_build_broadcast_scalar(&bld_base->uint_bld, size);
+   }
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      emit_data->output[chan] = size;
+   }
+}
+
+
+static void
+membar_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   LLVMBuildFence(bld_base->base.gallivm->builder,
+                  LLVMAtomicOrderingSequentiallyConsistent, FALSE, "");
+}
+
+
+static void
+barrier_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+
+   if (bld->resources && bld->resources->emit_barrier) {
+      bld->resources->emit_barrier(bld->resources, bld_base->base.gallivm,
+                                   bld->thread_data_ptr);
+   }
+}
+
+#endif /* HAVE_LLVM >= 0x0306 */
+
 static LLVMValueRef
 mask_vec(struct lp_build_tgsi_context *bld_base)
 {
@@ -3838,7 +4394,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   LLVMValueRef thread_data_ptr,
                   const struct lp_build_sampler_soa *sampler,
                   const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface)
+                  const struct lp_build_tgsi_gs_iface *gs_iface,
+                  const struct lp_build_tgsi_resources *resources)
 {
    struct lp_build_tgsi_soa_context bld;
 
@@ -3880,6 +4437,7 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.consts_ptr = consts_ptr;
    bld.const_sizes_ptr = const_sizes_ptr;
    bld.sampler = sampler;
+   bld.resources = resources;
    bld.bld_base.info = info;
    bld.indirect_files = info->indirect_files;
    bld.context_ptr = context_ptr;
@@ -3968,6 +4526,25 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.bld_base.op_actions[TGSI_OPCODE_SVIEWINFO].emit = sviewinfo_emit;
    bld.bld_base.op_actions[TGSI_OPCODE_LOD].emit = lod_emit;
 
+#if HAVE_LLVM >= 0x0306
+   /* Buffer, image and shared memory ops */
+   bld.bld_base.op_actions[TGSI_OPCODE_LOAD].emit = load_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_STORE].emit = store_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_RESQ].emit = resq_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUADD].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXCHG].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMCAS].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMAND].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_MEMBAR].emit = membar_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_BARRIER].emit = barrier_emit;
+#endif
+
 
    if (gs_iface) {
       /* There's no specific value for this because it should always
@@ -69,6 +69,12 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
    if (lp->dirty)
       llvmpipe_update_derived( lp );
 
+   /* Switch to optimized fragment shader code which became ready since,
+    * even if no state changed.
+    */
+   if (lp->nr_fs_pending)
+      llvmpipe_poll_fs_variants(lp);
+
    /*
     * Map vertex buffers
     */
@@ -61,7 +61,24 @@
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
 
-#define LP_MAX_THREADS 16
+/**
+ * Max number of rasterizer threads.  By default one thread is created per
+ * CPU, so this only needs to cover the biggest machines around.
+ */
+#define LP_MAX_THREADS 128
+
+/**
+ * Max number of groups the rasterizer threads are split into, one per
+ * L3 cache domain (see util_cpu_caps::cores_per_L3) or socket.  Machines
+ * with more domains get several of them per group.
+ */
+#define LP_MAX_THREAD_GROUPS 16
+
+/**
+ * Max number of threads compiling optimized shader variants in the
+ * background, by default.  LP_NUM_COMPILE_THREADS overrides it.
+ */
+#define LP_MAX_COMPILE_THREADS 4
 
 
 /**
@@ -55,7 +55,8 @@ llvmpipe_create_query(struct pipe_context *pipe,
 {
    struct llvmpipe_query *pq;
 
-   assert(type < PIPE_QUERY_TYPES);
+   assert(type < PIPE_QUERY_TYPES ||
+          (type >= LP_QUERY_FS_COMPILES && type <= LP_QUERY_FS_FALLBACKS));
 
    pq = CALLOC_STRUCT( llvmpipe_query );
 
@@ -177,6 +178,11 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
       *stats = pq->stats;
    }
       break;
+   case LP_QUERY_FS_COMPILES:
+   case LP_QUERY_FS_COMPILE_LATENCY:
+   case LP_QUERY_FS_FALLBACKS:
+      *result = pq->value;
+      break;
    default:
       assert(0);
       break;
@@ -186,18 +192,39 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
 }
 
 
+static uint64_t
+get_driver_query_value(const struct llvmpipe_context *llvmpipe, unsigned type)
+{
+   switch (type) {
+   case LP_QUERY_FS_COMPILES:
+      return llvmpipe->nr_fs_compiles;
+   case LP_QUERY_FS_COMPILE_LATENCY:
+      return llvmpipe->fs_compile_latency;
+   case LP_QUERY_FS_FALLBACKS:
+      return llvmpipe->nr_fs_fallbacks;
+   default:
+      assert(0);
+      return 0;
+   }
+}
+
+
 static boolean
 llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
-   /* Check if the query is already in the scene.  If so, we need to
-    * flush the scene now.  Real apps shouldn't re-use a query in a
-    * frame of rendering.
+   /* Check if the query is already in a scene.  If so, we need to
+    * flush the scene now and wait for it, as the rasterizer threads
+    * still accumulate into pq->end[].  Real apps shouldn't re-use a
+    * query in a frame of rendering.
     */
-   if (pq->fence && !lp_fence_issued(pq->fence)) {
-      llvmpipe_finish(pipe, __FUNCTION__);
+   if (pq->fence && !lp_fence_signalled(pq->fence)) {
+      if (!lp_fence_issued(pq->fence))
+         llvmpipe_flush(pipe, NULL, __FUNCTION__);
+
+      lp_fence_wait(pq->fence);
    }
 
 
@@ -236,6 +263,12 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->active_occlusion_queries++;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
       break;
+   case LP_QUERY_FS_COMPILES:
+   case LP_QUERY_FS_COMPILE_LATENCY:
+   case LP_QUERY_FS_FALLBACKS:
+      llvmpipe_poll_fs_variants(llvmpipe);
+      pq->value = get_driver_query_value(llvmpipe, pq->type);
+      break;
    default:
       break;
    }
@@ -301,6 +334,12 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->active_occlusion_queries--;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
       break;
+   case LP_QUERY_FS_COMPILES:
+   case LP_QUERY_FS_COMPILE_LATENCY:
+   case LP_QUERY_FS_FALLBACKS:
+      llvmpipe_poll_fs_variants(llvmpipe);
+      pq->value = get_driver_query_value(llvmpipe, pq->type) - pq->value;
+      break;
    default:
       break;
    }
@@ -308,6 +347,35 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
    return true;
 }
 
+static const struct pipe_driver_query_info llvmpipe_driver_query_list[] = {
+   /* number of fragment shader variants generated */
+   {"llvmpipe-fs-compiles", LP_QUERY_FS_COMPILES, {0}},
+   /* time from a fragment shader variant being needed until its optimized
+    * code is available, including the time spent waiting in the queue
+    */
+   {"llvmpipe-fs-compile-latency", LP_QUERY_FS_COMPILE_LATENCY, {0},
+    PIPE_DRIVER_QUERY_TYPE_MICROSECONDS},
+   /* number of fragment shader variants which started out as fallbacks */
+   {"llvmpipe-fs-fallbacks", LP_QUERY_FS_FALLBACKS, {0}},
+};
+
+
+int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+   if (!info)
+      return ARRAY_SIZE(llvmpipe_driver_query_list);
+
+   if (index >= ARRAY_SIZE(llvmpipe_driver_query_list))
+      return 0;
+
+   *info = llvmpipe_driver_query_list[index];
+   return 1;
+}
+
+
 boolean
 llvmpipe_check_render_cond(struct llvmpipe_context *lp)
 {
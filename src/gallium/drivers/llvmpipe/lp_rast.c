@@ -26,6 +26,7 @@
  **************************************************************************/
 
 #include <limits.h>
+#include <stdio.h>
 #include "util/u_memory.h"
 #include "util/u_math.h"
 #include "util/u_rect.h"
@@ -33,6 +34,8 @@
 #include "util/u_pack_color.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
+#include "util/u_cpu_detect.h"
+#include "util/bitset.h"
 
 #include "util/os_time.h"
 
@@ -70,10 +73,15 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+   lp_scene_bin_iter_begin( scene, rast->num_groups );
 }
 
 
+/**
+ * End rasterizing a scene.
+ * Called once per scene by one thread, after all threads are done with it.
+ * The scene itself is reset by the setup code once its fence is signalled.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
@@ -316,6 +324,12 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    }
    variant = state->variant;
 
+   if (inputs->linear) {
+      lp_rast_linear_rect(task, inputs, tile_x, tile_y,
+                          task->width, task->height, 0xffff);
+      return;
+   }
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (y = 0; y < task->height; y += 4){
       for (x = 0; x < task->width; x += 4) {
@@ -420,6 +434,11 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
    assert((x % 4) == 0);
    assert((y % 4) == 0);
 
+   if (inputs->linear) {
+      lp_rast_linear_rect(task, inputs, x, y, 4, 4, mask);
+      return;
+   }
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
@@ -682,9 +701,12 @@ rasterize_scene(struct lp_rasterizer_task *task,
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-            if (!is_empty_bin( bin ))
+         while ((bin = lp_scene_bin_iter_next(scene, task->group, &i, &j))) {
+            if (!is_empty_bin( bin )) {
                rasterize_bin(task, bin, i, j);
+               if (LP_DEBUG & DEBUG_COUNTERS)
+                  task->nr_bins++;
+            }
          }
       }
    }
@@ -704,10 +726,6 @@ rasterize_scene(struct lp_rasterizer_task *task,
    }
 #endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
-
    task->scene = NULL;
 }
 
@@ -736,6 +754,10 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 
       lp_rast_end( rast );
 
+      if (scene->fence) {
+         lp_fence_signal(scene->fence);
+      }
+
       util_fpstate_set(fpstate);
 
       rast->curr_scene = NULL;
@@ -756,19 +778,36 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
+/**
+ * Run a job synchronously on all the rasterizer threads (or on the calling
+ * thread if there are none), e.g. to execute compute shaders.
+ *
+ * The caller must make sure no scene is queued or being rasterized, and
+ * that no scene gets queued before this returns.
+ */
 void
-lp_rast_finish( struct lp_rasterizer *rast )
+lp_rast_run_job( struct lp_rasterizer *rast,
+                 lp_rast_job_func func,
+                 void *data )
 {
    if (rast->num_threads == 0) {
-      /* nothing to do */
+      unsigned fpstate = util_fpstate_get();
+
+      util_fpstate_set_denorms_to_zero(fpstate);
+      func(data, 0, 1);
+      util_fpstate_set(fpstate);
    }
    else {
-      int i;
+      unsigned i;
+
+      rast->job_data = data;
+      rast->job_func = func;
 
-      /* wait for work to complete */
       for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
+         pipe_semaphore_signal(&rast->tasks[i].work_ready);
       }
+
+      pipe_semaphore_wait(&rast->job_done);
    }
 }
 
@@ -778,7 +817,7 @@ lp_rast_finish( struct lp_rasterizer *rast )
  * It's a simple loop:
  *   1. wait for work
  *   2. do work
- *   3. signal that we're done
+ *   3. signal the scene's fence
  */
 static int
 thread_function(void *init_data)
@@ -799,6 +838,9 @@ thread_function(void *init_data)
    util_fpstate_set_denorms_to_zero(fpstate);
 
    while (1) {
+      struct lp_scene *scene;
+      int64_t start = 0, done = 0;
+
       /* wait for work */
       if (debug)
          debug_printf("thread %d waiting for work\n", task->thread_index);
@@ -807,6 +849,22 @@ thread_function(void *init_data)
       if (rast->exit_flag)
          break;
 
+      if (rast->job_func) {
+         /* All threads run the job, thread[0] reports completion once
+          * everybody is done with it.
+          */
+         rast->job_func(rast->job_data, task->thread_index, rast->num_threads);
+
+         util_barrier_wait( &rast->barrier );
+
+         if (task->thread_index == 0) {
+            rast->job_func = NULL;
+            rast->job_data = NULL;
+            pipe_semaphore_signal(&rast->job_done);
+         }
+         continue;
+      }
+
       if (task->thread_index == 0) {
          /* thread[0]:
           *  - get next scene to rasterize
@@ -825,23 +883,38 @@ thread_function(void *init_data)
       if (debug)
          debug_printf("thread %d doing work\n", task->thread_index);
 
-      rasterize_scene(task,
-                      rast->curr_scene);
+      scene = rast->curr_scene;
+
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         start = os_time_get();
+
+      rasterize_scene(task, scene);
+
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         done = os_time_get();
       
       /* wait for all threads to finish with this scene */
       util_barrier_wait( &rast->barrier );
 
-      /* XXX: shouldn't be necessary:
-       */
+      if (LP_DEBUG & DEBUG_COUNTERS) {
+         task->busy_time += done - start;
+         task->idle_time += os_time_get() - done;
+      }
+
       if (task->thread_index == 0) {
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
+      /* signal done with work.  Thread 0 only signals once the surfaces
+       * have been unmapped, so the fence completes only when the setup
+       * code may safely reuse the scene.
+       */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
 
-      pipe_semaphore_signal(&task->work_done);
+      if (scene->fence) {
+         lp_fence_signal(scene->fence);
+      }
    }
 
 #ifdef _WIN32
@@ -866,7 +939,134 @@ create_rast_threads(struct lp_rasterizer *rast)
       pipe_semaphore_init(&rast->tasks[i].work_done, 0);
       rast->threads[i] = u_thread_create(thread_function,
                                             (void *) &rast->tasks[i]);
+
+      /* Keep each group on its own L3 caches or sockets, so the tiles it
+       * rasterizes stay in local caches and memory.
+       */
+      if (rast->group_cpus && rast->threads[i]) {
+         unsigned words = BITSET_WORDS(rast->num_cpus);
+
+         util_set_thread_affinity(rast->threads[i],
+                                  &rast->group_cpus[rast->tasks[i].group *
+                                                    words],
+                                  rast->num_cpus);
+      }
+   }
+}
+
+
+/**
+ * Find the cache / memory domain of each CPU: its L3 cache where there are
+ * several per socket (AMD Zen), else its socket as reported by Linux.
+ * Intel CPUs share one L3 per socket, which util_cpu_caps can't tell apart
+ * from a single socket.
+ *
+ * \return the number of domains
+ */
+static unsigned
+get_cpu_domains(unsigned num_cpus, unsigned *domains)
+{
+   unsigned cores_per_L3 = util_cpu_caps.cores_per_L3;
+   unsigned num_domains = 1;
+   unsigned i;
+
+   if (cores_per_L3 && cores_per_L3 < num_cpus) {
+      for (i = 0; i < num_cpus; i++)
+         domains[i] = i / cores_per_L3;
+      return DIV_ROUND_UP(num_cpus, cores_per_L3);
+   }
+
+   memset(domains, 0, num_cpus * sizeof *domains);
+
+#if defined(PIPE_OS_LINUX)
+   {
+      int *packages = MALLOC(num_cpus * sizeof *packages);
+      unsigned num_packages = 0;
+      unsigned j;
+
+      if (!packages)
+         return 1;
+
+      for (i = 0; i < num_cpus; i++) {
+         char path[80];
+         FILE *f;
+         int package = -1;
+
+         util_snprintf(path, sizeof path,
+                       "/sys/devices/system/cpu/cpu%u/topology/physical_package_id",
+                       i);
+         f = fopen(path, "r");
+         if (f) {
+            if (fscanf(f, "%d", &package) != 1)
+               package = -1;
+            fclose(f);
+         }
+
+         /* Without the whole topology, don't guess. */
+         if (package < 0) {
+            memset(domains, 0, num_cpus * sizeof *domains);
+            num_packages = 1;
+            break;
+         }
+
+         for (j = 0; j < num_packages && packages[j] != package; j++)
+            ;
+         if (j == num_packages)
+            packages[num_packages++] = package;
+         domains[i] = j;
+      }
+
+      num_domains = num_packages;
+      FREE(packages);
+   }
+#endif
+
+   return num_domains;
+}
+
+
+/**
+ * Split the rasterizer threads into groups, one per L3 cache or socket.
+ * Each group is handed its own band of tiles, and only steals bins from
+ * the other groups once that band is done.
+ *
+ * With more domains than groups, each group gets several of them, so that
+ * all the CPUs are used.
+ */
+static void
+init_rast_groups(struct lp_rasterizer *rast)
+{
+   unsigned num_threads = MAX2(1, rast->num_threads);
+   unsigned num_cpus = MAX2(util_cpu_caps.nr_cpus, 1);
+   unsigned num_domains = 1;
+   unsigned *domains = NULL;
+   unsigned words = BITSET_WORDS(num_cpus);
+   unsigned i;
+
+   if (!debug_get_bool_option("LP_NO_THREAD_GROUPS", FALSE)) {
+      domains = MALLOC(num_cpus * sizeof *domains);
+      if (domains)
+         num_domains = get_cpu_domains(num_cpus, domains);
    }
+
+   rast->num_groups = MIN3(num_domains, num_threads, LP_MAX_THREAD_GROUPS);
+
+   for (i = 0; i < num_threads; i++)
+      rast->tasks[i].group = i * rast->num_groups / num_threads;
+
+   if (rast->num_groups > 1) {
+      rast->group_cpus = CALLOC(rast->num_groups * words,
+                                sizeof *rast->group_cpus);
+      if (rast->group_cpus) {
+         rast->num_cpus = num_cpus;
+         for (i = 0; i < num_cpus; i++) {
+            unsigned group = domains[i] * rast->num_groups / num_domains;
+            BITSET_SET(&rast->group_cpus[group * words], i);
+         }
+      }
+   }
+
+   FREE(domains);
 }
 
 
@@ -907,13 +1107,21 @@ lp_rast_create( unsigned num_threads )
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
 
+   init_rast_groups(rast);
+
    create_rast_threads(rast);
 
+   /* Only needed to pin the threads */
+   FREE(rast->group_cpus);
+   rast->group_cpus = NULL;
+
    /* for synchronizing rasterization threads */
    if (rast->num_threads > 0) {
       util_barrier_init( &rast->barrier, rast->num_threads );
    }
 
+   pipe_semaphore_init(&rast->job_done, 0);
+
    memset(lp_dummy_tile, 0, sizeof lp_dummy_tile);
 
    return rast;
@@ -959,6 +1167,16 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 #endif
    }
 
+   if (LP_DEBUG & DEBUG_COUNTERS) {
+      for (i = 0; i < rast->num_threads; i++) {
+         debug_printf("llvmpipe: thread %3u group %2u bins: %9u "
+                      "busy: %8.3f sec idle: %8.3f sec\n",
+                      i, rast->tasks[i].group, rast->tasks[i].nr_bins,
+                      rast->tasks[i].busy_time / 1000000.0,
+                      rast->tasks[i].idle_time / 1000000.0);
+      }
+   }
+
    /* Clean up per-thread data */
    for (i = 0; i < rast->num_threads; i++) {
       pipe_semaphore_destroy(&rast->tasks[i].work_ready);
@@ -973,6 +1191,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
       util_barrier_destroy( &rast->barrier );
    }
 
+   pipe_semaphore_destroy(&rast->job_done);
+
    lp_scene_queue_destroy(rast->full_scenes);
 
    FREE(rast);
@@ -46,6 +46,8 @@ struct lp_rasterizer;
 struct lp_scene;
 struct lp_fence;
 struct cmd_bin;
+struct lp_fragment_shader_variant;
+struct u_rect;
 
 #define FIXED_TYPE_WIDTH 64
 /** For sub-pixel positioning */
@@ -100,7 +102,8 @@ struct lp_rast_shader_inputs {
    unsigned frontfacing:1;      /** True for front-facing */
    unsigned disable:1;          /** Partially binned, disable this command */
    unsigned opaque:1;           /** Is opaque */
-   unsigned pad0:29;            /* wasted space */
+   unsigned linear:1;           /** Shaded by lp_rast_linear_rect() */
+   unsigned pad0:28;            /* wasted space */
    unsigned stride;             /* how much to advance data between a0, dadx, dady */
    unsigned layer;              /* the layer to render to (from gs, already clamped) */
    unsigned viewport_index;     /* the active viewport index (from gs, already clamped) */
@@ -166,8 +169,22 @@ void
 lp_rast_queue_scene( struct lp_rasterizer *rast,
                      struct lp_scene *scene );
 
+/**
+ * Function run on every rasterizer thread by lp_rast_run_job().
+ */
+typedef void
+(*lp_rast_job_func)(void *data, unsigned thread_index, unsigned num_threads);
+
 void
-lp_rast_finish( struct lp_rasterizer *rast );
+lp_rast_run_job( struct lp_rasterizer *rast,
+                 lp_rast_job_func func,
+                 void *data );
+
+boolean
+lp_rast_linear_check_tri( const struct lp_fragment_shader_variant *variant,
+                          const struct lp_jit_context *jit_context,
+                          const struct lp_rast_shader_inputs *inputs,
+                          const struct u_rect *bbox );
 
 
 union lp_rast_cmd_arg {
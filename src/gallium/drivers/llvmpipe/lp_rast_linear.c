@@ -0,0 +1,466 @@
+/**************************************************************************
+ *
+ * Copyright 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Linear rasterizer.
+ *
+ * Shades whole rectangles of pixels inside a triangle, a row at a time, for
+ * the variants recognized by lp_fs_linear_analyse().  The triangle
+ * traversal is shared with the JIT-compiled code; only the shading
+ * differs: texture coordinates are stepped in fixed point along the rows,
+ * and pixels are handled as 32-bit words of four 8-bit channels, in the
+ * channel order of the color buffer.
+ *
+ * Whether a triangle goes through here is decided once, at setup time, by
+ * lp_rast_linear_check_tri(), so that all of its pixels are shaded by the
+ * same path and there are no seams within a triangle.
+ */
+
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_rect.h"
+#include "lp_rast_priv.h"
+#include "lp_state_fs.h"
+
+
+/** Texture coordinates are 16.16 fixed point */
+#define TEXEL_SHIFT 16
+#define TEXEL_ONE   (1 << TEXEL_SHIFT)
+
+/** Largest texture coordinate, in texels, which fits in fixed point */
+#define TEXEL_MAX   ((float)(1 << (31 - TEXEL_SHIFT)) - 2.0f)
+
+
+struct linear_texture
+{
+   const uint8_t *data;
+   unsigned stride;
+   int width;
+   int height;
+   unsigned repeat_s:1;
+   unsigned repeat_t:1;
+};
+
+
+static inline uint32_t
+swap_rb(uint32_t p)
+{
+   return (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+
+/**
+ * Per-channel a * (256 - w) / 256 + b * w / 256, with w in [0, 256].
+ */
+static inline uint32_t
+lerp_8888(uint32_t a, uint32_t b, unsigned w)
+{
+   uint32_t rb, ag;
+
+   rb = ((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w) >> 8;
+   ag = ((a >> 8) & 0x00ff00ff) * (256 - w) + ((b >> 8) & 0x00ff00ff) * w;
+
+   return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+}
+
+
+/**
+ * Per-channel c * f / 255, rounded, with f in [0, 255].
+ */
+static inline uint32_t
+mul_8888(uint32_t c, unsigned f)
+{
+   uint32_t rb = (c & 0x00ff00ff) * f + 0x00800080;
+   uint32_t ag = ((c >> 8) & 0x00ff00ff) * f + 0x00800080;
+
+   rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+   ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+
+   return rb | ag;
+}
+
+
+/**
+ * Per-channel saturated a + b.
+ */
+static inline uint32_t
+adds_8888(uint32_t a, uint32_t b)
+{
+   uint32_t rb = (a & 0x00ff00ff) + (b & 0x00ff00ff);
+   uint32_t ag = ((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff);
+
+   rb |= 0x01000100 - ((rb >> 8) & 0x00010001);
+   ag |= 0x01000100 - ((ag >> 8) & 0x00010001);
+
+   return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+
+static inline int
+wrap_texel(int i, int size, boolean repeat)
+{
+   if (repeat) {
+      if (util_is_power_of_two_nonzero(size))
+         return i & (size - 1);
+      i %= size;
+      return i < 0 ? i + size : i;
+   }
+   return CLAMP(i, 0, size - 1);
+}
+
+
+static inline uint32_t
+fetch_texel(const struct linear_texture *tex, int i, int j)
+{
+   const uint8_t *row = tex->data + j * tex->stride;
+   return ((const uint32_t *)row)[i];
+}
+
+
+static void
+sample_nearest(const struct linear_texture *tex,
+               int u, int v, int du, int dv,
+               unsigned n, uint32_t *dst)
+{
+   int i0 = u >> TEXEL_SHIFT;
+   int i1 = (u + du * (int)(n - 1)) >> TEXEL_SHIFT;
+   int j0 = v >> TEXEL_SHIFT;
+   int j1 = (v + dv * (int)(n - 1)) >> TEXEL_SHIFT;
+   unsigned k;
+
+   if (MIN2(i0, i1) >= 0 && MAX2(i0, i1) < tex->width &&
+       MIN2(j0, j1) >= 0 && MAX2(j0, j1) < tex->height) {
+      if (du == TEXEL_ONE && dv == 0) {
+         /* 1:1 blit of a texture row */
+         const uint32_t *src = (const uint32_t *)(tex->data + j0 * tex->stride);
+         memcpy(dst, src + i0, n * 4);
+         return;
+      }
+
+      for (k = 0; k < n; k++) {
+         dst[k] = fetch_texel(tex, u >> TEXEL_SHIFT, v >> TEXEL_SHIFT);
+         u += du;
+         v += dv;
+      }
+      return;
+   }
+
+   for (k = 0; k < n; k++) {
+      int i = wrap_texel(u >> TEXEL_SHIFT, tex->width, tex->repeat_s);
+      int j = wrap_texel(v >> TEXEL_SHIFT, tex->height, tex->repeat_t);
+      dst[k] = fetch_texel(tex, i, j);
+      u += du;
+      v += dv;
+   }
+}
+
+
+static void
+sample_bilinear(const struct linear_texture *tex,
+                int u, int v, int du, int dv,
+                unsigned n, uint32_t *dst)
+{
+   unsigned k;
+
+   /* Texel centers are at half integers */
+   u -= TEXEL_ONE / 2;
+   v -= TEXEL_ONE / 2;
+
+   for (k = 0; k < n; k++) {
+      int i = u >> TEXEL_SHIFT;
+      int j = v >> TEXEL_SHIFT;
+      unsigned wu = (u >> (TEXEL_SHIFT - 8)) & 0xff;
+      unsigned wv = (v >> (TEXEL_SHIFT - 8)) & 0xff;
+      int i0 = wrap_texel(i, tex->width, tex->repeat_s);
+      int i1 = wrap_texel(i + 1, tex->width, tex->repeat_s);
+      int j0 = wrap_texel(j, tex->height, tex->repeat_t);
+      int j1 = wrap_texel(j + 1, tex->height, tex->repeat_t);
+      uint32_t t0, t1;
+
+      t0 = lerp_8888(fetch_texel(tex, i0, j0), fetch_texel(tex, i1, j0), wu);
+      t1 = lerp_8888(fetch_texel(tex, i0, j1), fetch_texel(tex, i1, j1), wu);
+      dst[k] = lerp_8888(t0, t1, wv);
+
+      u += du;
+      v += dv;
+   }
+}
+
+
+/**
+ * Write a row of shaded pixels, blending them over the color buffer.
+ * Unless mask is ~0, only the pixels whose bit is set in it are written.
+ */
+static void
+store_row(const struct lp_fs_linear_info *linear,
+          const uint32_t *src, uint32_t *dst,
+          unsigned n, unsigned mask)
+{
+   unsigned k;
+
+   if (linear->blend == LP_FS_LINEAR_BLEND_NONE && mask == ~0u) {
+      memcpy(dst, src, n * 4);
+      return;
+   }
+
+   for (k = 0; k < n; k++) {
+      uint32_t s = src[k];
+      unsigned sa = s >> 24;
+
+      if (mask != ~0u && !(mask & (1 << k)))
+         continue;
+
+      if (linear->blend == LP_FS_LINEAR_BLEND_NONE || sa == 0xff) {
+         dst[k] = s;
+      }
+      else if (linear->blend == LP_FS_LINEAR_BLEND_PREMUL) {
+         dst[k] = adds_8888(s, mul_8888(dst[k], 0xff - sa));
+      }
+      else if (sa != 0) {
+         dst[k] = adds_8888(mul_8888(s, sa), mul_8888(dst[k], 0xff - sa));
+      }
+   }
+}
+
+
+static inline uint32_t
+pack_color(const float *rgba, boolean bgra)
+{
+   uint32_t r = float_to_ubyte(rgba[0]);
+   uint32_t g = float_to_ubyte(rgba[1]);
+   uint32_t b = float_to_ubyte(rgba[2]);
+   uint32_t a = float_to_ubyte(rgba[3]);
+
+   return bgra ? (a << 24) | (r << 16) | (g << 8) | b
+               : (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+
+/**
+ * Check at setup time whether a triangle can be shaded by
+ * lp_rast_linear_rect(), given its interpolation coefficients and its
+ * bounding box, in pixels, clipped to the draw region.
+ */
+boolean
+lp_rast_linear_check_tri(const struct lp_fragment_shader_variant *variant,
+                         const struct lp_jit_context *jit_context,
+                         const struct lp_rast_shader_inputs *inputs,
+                         const struct u_rect *bbox)
+{
+   const struct lp_fs_linear_info *linear = &variant->linear;
+   const float (*a0)[4] = GET_A0(inputs);
+   const float (*dadx)[4] = GET_DADX(inputs);
+   const float (*dady)[4] = GET_DADY(inputs);
+   const unsigned attrib = linear->input + 1;
+   const struct lp_jit_texture *jit_tex;
+   float oow = 1.0f;
+   float su, sv, x0, y0, x1, y1;
+   unsigned i;
+
+   if (linear->kind == LP_FS_LINEAR_NONE)
+      return FALSE;
+
+   if (linear->perspective) {
+      /*
+       * Perspective correct interpolation reduces to linear interpolation
+       * only if 1/w is constant across the triangle.
+       */
+      if (dadx[0][3] != 0.0f || dady[0][3] != 0.0f || a0[0][3] == 0.0f)
+         return FALSE;
+      oow = 1.0f / a0[0][3];
+   }
+
+   if (linear->kind != LP_FS_LINEAR_TEXTURE)
+      return TRUE;
+
+   jit_tex = &jit_context->textures[linear->unit];
+   if (!jit_tex->base || !jit_tex->width || !jit_tex->height)
+      return FALSE;
+
+   su = linear->normalized ?
+      (float)u_minify(jit_tex->width, jit_tex->first_level) : 1.0f;
+   sv = linear->normalized ?
+      (float)u_minify(jit_tex->height, jit_tex->first_level) : 1.0f;
+
+   /*
+    * The coordinates are linear, so their extremes are at the corners of
+    * the bounding box, widened to the 4x4 blocks the rasterizer shades.
+    * Leave the rare triangles with huge ones to the JIT code.
+    */
+   x0 = (float)(bbox->x0 & ~3);
+   y0 = (float)(bbox->y0 & ~3);
+   x1 = (float)((bbox->x1 | 3) + 1);
+   y1 = (float)((bbox->y1 | 3) + 1);
+   for (i = 0; i < 4; i++) {
+      const float cx = (i & 1) ? x1 : x0;
+      const float cy = (i & 2) ? y1 : y0;
+      const float u = (a0[attrib][0] + dadx[attrib][0] * cx +
+                       dady[attrib][0] * cy) * oow * su;
+      const float v = (a0[attrib][1] + dadx[attrib][1] * cx +
+                       dady[attrib][1] * cy) * oow * sv;
+
+      if (!(u > -TEXEL_MAX && u < TEXEL_MAX &&
+            v > -TEXEL_MAX && v < TEXEL_MAX))
+         return FALSE;
+   }
+}
+
+
+/**
+ * Shade a rectangle of pixels fully inside the triangle (or, for a 4x4
+ * block, those with their bit set in mask).  Only called for triangles
+ * accepted by lp_rast_linear_check_tri().
+ */
+void
+lp_rast_linear_rect(struct lp_rasterizer_task *task,
+                    const struct lp_rast_shader_inputs *inputs,
+                    unsigned x, unsigned y,
+                    unsigned width, unsigned height,
+                    unsigned mask)
+{
+   const struct lp_scene *scene = task->scene;
+   const struct lp_rast_state *state = task->state;
+   const struct lp_fragment_shader_variant *variant = state->variant;
+   const struct lp_fs_linear_info *linear = &variant->linear;
+   const float (*a0)[4] = GET_A0(inputs);
+   const float (*dadx)[4] = GET_DADX(inputs);
+   const float (*dady)[4] = GET_DADY(inputs);
+   const unsigned attrib = linear->input + 1;
+   const unsigned stride = scene->cbufs[0].stride;
+   float c0[4], cdx[4], cdy[4];
+   float oow = 1.0f;
+   uint32_t row[TILE_SIZE];
+   uint8_t *color;
+   unsigned i, j;
+
+   assert(inputs->linear);
+   assert(width == 4 || mask == 0xffff);
+
+   if (linear->perspective)
+      oow = 1.0f / a0[0][3];
+
+   for (i = 0; i < 4; i++) {
+      c0[i] = a0[attrib][i] * oow;
+      cdx[i] = dadx[attrib][i] * oow;
+      cdy[i] = dady[attrib][i] * oow;
+   }
+
+   /* Pixels outside the framebuffer, in the last tiles of a row/column */
+   if (x % TILE_SIZE >= task->width || y % TILE_SIZE >= task->height)
+      return;
+   width = MIN2(width, task->width - x % TILE_SIZE);
+   height = MIN2(height, task->height - y % TILE_SIZE);
+
+   if (linear->kind == LP_FS_LINEAR_TEXTURE) {
+      const struct lp_jit_texture *jit_tex =
+         &state->jit_context.textures[linear->unit];
+      const unsigned level = jit_tex->first_level;
+      struct linear_texture tex;
+      float su, sv, u0, v0, dudx, dudy, dvdx, dvdy;
+
+      tex.data = (const uint8_t *)jit_tex->base + jit_tex->mip_offsets[level];
+      tex.stride = jit_tex->row_stride[level];
+      tex.width = u_minify(jit_tex->width, level);
+      tex.height = u_minify(jit_tex->height, level);
+      tex.repeat_s = linear->repeat_s;
+      tex.repeat_t = linear->repeat_t;
+
+      su = linear->normalized ? (float)tex.width : 1.0f;
+      sv = linear->normalized ? (float)tex.height : 1.0f;
+      u0 = c0[0] * su;
+      v0 = c0[1] * sv;
+      dudx = cdx[0] * su;
+      dvdx = cdx[1] * sv;
+      dudy = cdy[0] * su;
+      dvdy = cdy[1] * sv;
+
+      color = lp_rast_get_color_block_pointer(task, 0, x, y, inputs->layer);
+
+      for (j = 0; j < height; j++) {
+         const float px = (float)x;
+         const float py = (float)(y + j);
+         int u = util_iround((u0 + dudx * px + dudy * py) * TEXEL_ONE);
+         int v = util_iround((v0 + dvdx * px + dvdy * py) * TEXEL_ONE);
+         int du = util_iround(dudx * TEXEL_ONE);
+         int dv = util_iround(dvdx * TEXEL_ONE);
+
+         if (linear->filter_linear)
+            sample_bilinear(&tex, u, v, du, dv, width, row);
+         else
+            sample_nearest(&tex, u, v, du, dv, width, row);
+
+         if (linear->force_alpha || linear->swap_rb) {
+            for (i = 0; i < width; i++) {
+               uint32_t p = row[i];
+               if (linear->swap_rb)
+                  p = swap_rb(p);
+               if (linear->force_alpha)
+                  p |= 0xff000000;
+               row[i] = p;
+            }
+         }
+
+         store_row(linear, row, (uint32_t *)color, width,
+                   mask == 0xffff ? ~0u : (mask >> (4 * j)) & 0xf);
+         color += stride;
+      }
+   }
+   else {
+      const enum pipe_format format = variant->key.cbuf_format[0];
+      const boolean bgra = format == PIPE_FORMAT_B8G8R8A8_UNORM ||
+                           format == PIPE_FORMAT_B8G8R8X8_UNORM;
+      const boolean flat = !cdx[0] && !cdx[1] && !cdx[2] && !cdx[3] &&
+                           !cdy[0] && !cdy[1] && !cdy[2] && !cdy[3];
+
+      color = lp_rast_get_color_block_pointer(task, 0, x, y, inputs->layer);
+
+      if (flat) {
+         const uint32_t p = pack_color(c0, bgra);
+         for (i = 0; i < width; i++)
+            row[i] = p;
+      }
+
+      for (j = 0; j < height; j++) {
+         if (!flat) {
+            float rgba[4];
+            unsigned chan;
+
+            for (chan = 0; chan < 4; chan++)
+               rgba[chan] = c0[chan] + cdx[chan] * x + cdy[chan] * (y + j);
+
+            for (i = 0; i < width; i++) {
+               row[i] = pack_color(rgba, bgra);
+               for (chan = 0; chan < 4; chan++)
+                  rgba[chan] += cdx[chan];
+            }
+         }
+
+         store_row(linear, row, (uint32_t *)color, width,
+                   mask == 0xffff ? ~0u : (mask >> (4 * j)) & 0xf);
+         color += stride;
+      }
+   }
+}
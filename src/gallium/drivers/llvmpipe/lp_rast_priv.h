@@ -28,6 +28,7 @@
 #ifndef LP_RAST_PRIV_H
 #define LP_RAST_PRIV_H
 
+#include "util/bitset.h"
 #include "util/u_format.h"
 #include "util/u_thread.h"
 #include "gallivm/lp_bld_debug.h"
@@ -97,11 +98,21 @@ struct lp_rasterizer_task
    /** "my" index */
    unsigned thread_index;
 
+   /** Thread group (L3 caches or sockets) this thread is pinned to */
+   unsigned group;
+
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
    pipe_semaphore work_ready;
    pipe_semaphore work_done;
+
+   /** For LP_DEBUG=counters: time spent rasterizing bins, and time spent
+    * idle waiting for the other threads to finish the scene, in usecs.
+    */
+   int64_t busy_time;
+   int64_t idle_time;
+   unsigned nr_bins;
 };
 
 
@@ -127,8 +138,20 @@ struct lp_rasterizer
    unsigned num_threads;
    thrd_t threads[LP_MAX_THREADS];
 
+   /** Number of thread groups; bins are split into a band per group */
+   unsigned num_groups;
+
+   /** CPUs of each group, while the threads are being created */
+   BITSET_WORD *group_cpus;
+   unsigned num_cpus;
+
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
+
+   /** Job run by all threads instead of a scene, see lp_rast_run_job() */
+   lp_rast_job_func job_func;
+   void *job_data;
+   pipe_semaphore job_done;
 };
 
 
@@ -215,6 +238,14 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
 
 
 
+void
+lp_rast_linear_rect(struct lp_rasterizer_task *task,
+                    const struct lp_rast_shader_inputs *inputs,
+                    unsigned x, unsigned y,
+                    unsigned width, unsigned height,
+                    unsigned mask);
+
+
 /**
  * Shade all pixels in a 4x4 block.  The fragment code omits the
  * triangle in/out tests.
@@ -234,6 +265,11 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    unsigned depth_stride = 0;
    unsigned i;
 
+   if (inputs->linear) {
+      lp_rast_linear_rect(task, inputs, x, y, 4, 4, 0xffff);
+      return;
+   }
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
@@ -58,6 +58,10 @@ block_full_16(struct lp_rasterizer_task *task,
    unsigned ix, iy;
    assert(x % 16 == 0);
    assert(y % 16 == 0);
+   if (tri->inputs.linear) {
+      lp_rast_linear_rect(task, &tri->inputs, x, y, 16, 16, 0xffff);
+      return;
+   }
    for (iy = 0; iy < 16; iy += 4)
       for (ix = 0; ix < 16; ix += 4)
 	 block_full_4(task, tri, x + ix, y + iy);
@@ -29,6 +29,7 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_inlines.h"
+#include "util/u_atomic.h"
 #include "util/simple_list.h"
 #include "util/u_format.h"
 #include "lp_scene.h"
@@ -41,6 +42,7 @@
 /** List of resource references */
 struct resource_ref {
    struct pipe_resource *resource[RESOURCE_REF_SZ];
+   uint32_t writeable_mask;   /**< which resources the scene may write */
    int count;
    struct resource_ref *next;
 };
@@ -62,8 +64,6 @@ lp_scene_create( struct pipe_context *pipe )
    scene->data.head =
       CALLOC_STRUCT(data_block);
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
-
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
    {
@@ -90,7 +90,6 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_fence_reference(&scene->fence, NULL);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head->next == NULL);
    FREE(scene->data.head);
    FREE(scene);
@@ -204,12 +203,13 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer surfaces mapped by lp_scene_begin_rasterization().
+ * Called by the rasterizer once all threads are done with the scene.
  */
 void
 lp_scene_end_rasterization(struct lp_scene *scene )
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -232,6 +232,20 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene.
+ *
+ * This is done by the setup code, either when the rasterizer has signalled
+ * the scene's fence or when the scene was never queued, so that resource
+ * references are always dropped on the thread which took them.
+ */
+void
+lp_scene_reset(struct lp_scene *scene )
+{
+   int i, j;
 
    /* Reset all command lists:
     */
@@ -370,11 +384,13 @@ lp_scene_data_size( const struct lp_scene *scene )
 
 /**
  * Add a reference to a resource by the scene.
+ * \param writeable  whether the shaders may write to the resource
  */
 boolean
 lp_scene_add_resource_reference(struct lp_scene *scene,
                                 struct pipe_resource *resource,
-                                boolean initializing_scene)
+                                boolean initializing_scene,
+                                boolean writeable)
 {
    struct resource_ref *ref, **last = &scene->resources;
    int i;
@@ -386,9 +402,13 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
 
       /* Search for this resource:
        */
-      for (i = 0; i < ref->count; i++)
-         if (ref->resource[i] == resource)
+      for (i = 0; i < ref->count; i++) {
+         if (ref->resource[i] == resource) {
+            if (writeable)
+               ref->writeable_mask |= 1u << i;
             return TRUE;
+         }
+      }
 
       if (ref->count < RESOURCE_REF_SZ) {
          /* If the block is half-empty, then append the reference here.
@@ -411,6 +431,8 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
 
    /* Append the reference to the reference block.
     */
+   if (writeable)
+      ref->writeable_mask |= 1u << ref->count;
    pipe_resource_reference(&ref->resource[ref->count++], resource);
    scene->resource_reference_size += llvmpipe_resource_size(resource);
 
@@ -429,81 +451,153 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
 
 /**
  * Does this scene have a reference to the given resource?
+ * Returns a mask of LP_REFERENCED_FOR_READ/WRITE bits.
  */
-boolean
+unsigned
 lp_scene_is_resource_referenced(const struct lp_scene *scene,
                                 const struct pipe_resource *resource)
 {
    const struct resource_ref *ref;
    int i;
 
+   /* check the render targets */
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (scene->fb.cbufs[i] && scene->fb.cbufs[i]->texture == resource)
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+   if (scene->fb.zsbuf && scene->fb.zsbuf->texture == resource) {
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+
+   /* check textures referenced by the scene */
    for (ref = scene->resources; ref; ref = ref->next) {
-      for (i = 0; i < ref->count; i++)
-         if (ref->resource[i] == resource)
-            return TRUE;
+      for (i = 0; i < ref->count; i++) {
+         if (ref->resource[i] == resource) {
+            if (ref->writeable_mask & (1u << i))
+               return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+            return LP_REFERENCED_FOR_READ;
+         }
+      }
    }
 
-   return FALSE;
+   return LP_UNREFERENCED;
 }
 
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/** Estimated cost of rasterizing a bin: the number of commands in it */
+static unsigned
+bin_cost(const struct cmd_bin *bin)
+{
+   const struct cmd_block *block;
+   unsigned cost = 0;
+
+   for (block = bin->head; block; block = block->next)
+      cost += block->count;
+
+   return cost;
+}
+
+
+/** qsort callback: most expensive bins first, then in raster order */
+static int
+compare_bin_pos(const void *a, const void *b)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
-   }
-   return TRUE;
+   const struct lp_scene_bin_pos *pa = (const struct lp_scene_bin_pos *) a;
+   const struct lp_scene_bin_pos *pb = (const struct lp_scene_bin_pos *) b;
+
+   if (pa->cost != pb->cost)
+      return pa->cost > pb->cost ? -1 : 1;
+   if (pa->y != pb->y)
+      return pa->y - pb->y;
+   return pa->x - pb->x;
 }
 
 
+/**
+ * Build the order in which bins will be handed out to the rasterizer
+ * threads.  Empty bins are dropped, and the most expensive bins go first
+ * so that a few heavy tiles don't end up as a long tail at the end of
+ * the scene.
+ *
+ * The tile rows are split into one band per thread group, so that each
+ * group keeps touching the same part of the color/depth buffers from
+ * one scene to the next.
+ *
+ * Called once per scene by one thread, before the others start iterating.
+ */
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_groups )
 {
-   scene->curr_x = scene->curr_y = -1;
+   unsigned x, y, g, n = 0;
+
+   assert(num_groups >= 1 && num_groups <= LP_MAX_THREAD_GROUPS);
+   num_groups = MIN2(num_groups, scene->tiles_y);
+   num_groups = MAX2(num_groups, 1);
+
+   for (g = 0; g < num_groups; g++) {
+      unsigned y0 = scene->tiles_y * g / num_groups;
+      unsigned y1 = scene->tiles_y * (g + 1) / num_groups;
+      unsigned begin = n;
+
+      for (y = y0; y < y1; y++) {
+         for (x = 0; x < scene->tiles_x; x++) {
+            const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+            if (bin->head) {
+               scene->bin_order[n].x = x;
+               scene->bin_order[n].y = y;
+               scene->bin_order[n].cost = bin_cost(bin);
+               n++;
+            }
+         }
+      }
+
+      if (n - begin > 1)
+         qsort(&scene->bin_order[begin], n - begin,
+               sizeof scene->bin_order[0], compare_bin_pos);
+
+      scene->bin_groups[g].begin = begin;
+      scene->bin_groups[g].end = n;
+      scene->bin_groups[g].next = begin;
+   }
+
+   scene->num_bin_groups = num_groups;
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  This is lock-free: each call claims
+ * the next slot of a group's range of lp_scene::bin_order with an
+ * atomic increment.  Once its own group is drained, a thread steals
+ * bins from the other groups.
+ * \param group  the thread group of the calling thread
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned group,
+                        int *x, int *y )
 {
-   struct cmd_bin *bin = NULL;
+   unsigned k;
 
-   mtx_lock(&scene->mutex);
+   for (k = 0; k < scene->num_bin_groups; k++) {
+      unsigned g = (group + k) % scene->num_bin_groups;
+      unsigned i;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
+      if (scene->bin_groups[g].next >= scene->bin_groups[g].end)
+         continue;
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+      i = p_atomic_inc_return(&scene->bin_groups[g].next) - 1;
+      if (i < scene->bin_groups[g].end) {
+         *x = scene->bin_order[i].x;
+         *y = scene->bin_order[i].y;
+         return lp_scene_get_bin(scene, *x, *y);
+      }
+   }
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   /* no more bins left */
+   return NULL;
 }
 
 
@@ -117,13 +117,22 @@ struct data_block_list {
 
 struct resource_ref;
 
+/**
+ * Position and estimated cost of a non-empty bin, used to order the
+ * bins handed out to the rasterizer threads.
+ */
+struct lp_scene_bin_pos {
+   uint16_t x, y;
+   unsigned cost;
+};
+
 /**
  * All bins and bin data are contained here.
  * Per-bin data goes into the 'tile' bins.
  * Shared data goes into the 'data' buffer.
  *
- * When there are multiple threads, will want to double-buffer between
- * scenes:
+ * Each setup context owns several of these so that one scene can be
+ * binned while previously flushed ones are being rasterized.
  */
 struct lp_scene {
    struct pipe_context *pipe;
@@ -172,8 +181,16 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /** Non-empty bins, in the order they are handed to rasterizer threads.
+    * The tile rows are split in one band per thread group, and each
+    * group's bins are stored contiguously in [begin, end).
+    */
+   struct lp_scene_bin_pos bin_order[TILES_X * TILES_Y];
+   struct {
+      unsigned begin, end;
+      unsigned next;  /**< next index into bin_order, atomically advanced */
+   } bin_groups[LP_MAX_THREAD_GROUPS];
+   unsigned num_bin_groups;
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -196,10 +213,11 @@ struct cmd_block *lp_scene_new_cmd_block( struct lp_scene *scene,
 
 boolean lp_scene_add_resource_reference(struct lp_scene *scene,
                                         struct pipe_resource *resource,
-                                        boolean initializing_scene);
+                                        boolean initializing_scene,
+                                        boolean writeable);
 
-boolean lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                        const struct pipe_resource *resource );
+unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                         const struct pipe_resource *resource );
 
 
 /**
@@ -378,10 +396,11 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_groups );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned group,
+                        int *x, int *y );
 
 
 
@@ -404,6 +423,12 @@ void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
 
+/* Release everything the scene references once it has been rasterized
+ */
+void
+lp_scene_reset(struct lp_scene *scene);
+
+
 
 
 
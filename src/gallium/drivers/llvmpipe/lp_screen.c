@@ -33,10 +33,18 @@
 #include "util/u_screen.h"
 #include "util/u_string.h"
 #include "util/u_format_s3tc.h"
+#include "util/disk_cache.h"
+#include "util/mesa-sha1.h"
 #include "pipe/p_defines.h"
 #include "pipe/p_screen.h"
 #include "draw/draw_context.h"
 #include "gallivm/lp_bld_type.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_debug.h"
+
+#if HAVE_LLVM >= 0x0700
+#include <llvm-c/TargetMachine.h>
+#endif
 
 #include "util/os_misc.h"
 #include "util/os_time.h"
@@ -47,8 +55,10 @@
 #include "lp_context.h"
 #include "lp_debug.h"
 #include "lp_public.h"
+#include "lp_query.h"
 #include "lp_limits.h"
 #include "lp_rast.h"
+#include "lp_state_cs.h"
 
 #include "state_tracker/sw_winsys.h"
 
@@ -82,6 +92,7 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_blend",       PERF_NO_BLEND, NULL },
    { "no_depth",       PERF_NO_DEPTH, NULL },
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
+   { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -214,7 +225,7 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_QUADS_FOLLOW_PROVOKING_VERTEX_CONVENTION:
       return 0;
    case PIPE_CAP_COMPUTE:
-      return 0;
+      return LP_HAVE_COMPUTE;
    case PIPE_CAP_USER_VERTEX_BUFFERS:
       return 1;
    case PIPE_CAP_VERTEX_BUFFER_OFFSET_4BYTE_ALIGNED_ONLY:
@@ -324,7 +335,6 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_MULTI_DRAW_INDIRECT_PARAMS:
    case PIPE_CAP_TGSI_FS_POSITION_IS_SYSVAL:
    case PIPE_CAP_TGSI_FS_FACE_IS_INTEGER_SYSVAL:
-   case PIPE_CAP_SHADER_BUFFER_OFFSET_ALIGNMENT:
    case PIPE_CAP_INVALIDATE_BUFFER:
    case PIPE_CAP_GENERATE_MIPMAP:
    case PIPE_CAP_STRING_MARKER:
@@ -377,6 +387,9 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_MAX_CONSERVATIVE_RASTER_SUBPIXEL_PRECISION_BIAS:
    case PIPE_CAP_PROGRAMMABLE_SAMPLE_LOCATIONS:
       return 0;
+   case PIPE_CAP_SHADER_BUFFER_OFFSET_ALIGNMENT:
+      /* shader buffer access needs LLVM 3.6 */
+      return HAVE_LLVM >= 0x0306 ? 16 : 0;
    case PIPE_CAP_MAX_GS_INVOCATIONS:
       return 32;
    case PIPE_CAP_MAX_SHADER_BUFFER_SIZE:
@@ -396,6 +409,19 @@ llvmpipe_get_shader_param(struct pipe_screen *screen,
    {
    case PIPE_SHADER_FRAGMENT:
       switch (param) {
+      case PIPE_SHADER_CAP_MAX_SHADER_BUFFERS:
+         return HAVE_LLVM >= 0x0306 ? LP_MAX_TGSI_SHADER_BUFFERS : 0;
+      default:
+         return gallivm_get_shader_param(param);
+      }
+   case PIPE_SHADER_COMPUTE:
+      if (!LP_HAVE_COMPUTE)
+         return 0;
+      switch (param) {
+      case PIPE_SHADER_CAP_MAX_SHADER_BUFFERS:
+         return LP_MAX_TGSI_SHADER_BUFFERS;
+      case PIPE_SHADER_CAP_MAX_SHADER_IMAGES:
+         return LP_MAX_TGSI_SHADER_IMAGES;
       default:
          return gallivm_get_shader_param(param);
       }
@@ -453,6 +479,77 @@ llvmpipe_get_paramf(struct pipe_screen *screen, enum pipe_capf param)
 }
 
 
+static int
+llvmpipe_get_compute_param(struct pipe_screen *_screen,
+                           enum pipe_shader_ir ir_type,
+                           enum pipe_compute_cap param,
+                           void *ret)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+
+   switch (param) {
+   case PIPE_COMPUTE_CAP_IR_TARGET:
+      return 0;
+   case PIPE_COMPUTE_CAP_GRID_DIMENSION:
+      if (ret) {
+         uint64_t *grid_dimension = ret;
+         *grid_dimension = 3;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_GRID_SIZE:
+      if (ret) {
+         uint64_t *grid_size = ret;
+         grid_size[0] = 65535;
+         grid_size[1] = 65535;
+         grid_size[2] = 65535;
+      }
+      return 3 * sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_BLOCK_SIZE:
+      if (ret) {
+         uint64_t *block_size = ret;
+         block_size[0] = 1024;
+         block_size[1] = 1024;
+         block_size[2] = 1024;
+      }
+      return 3 * sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_THREADS_PER_BLOCK:
+      if (ret) {
+         uint64_t *max_threads_per_block = ret;
+         *max_threads_per_block = 1024;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_LOCAL_SIZE:
+      if (ret) {
+         uint64_t *max_local_size = ret;
+         *max_local_size = 32768;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_COMPUTE_UNITS:
+      if (ret) {
+         uint32_t *max_compute_units = ret;
+         *max_compute_units = MAX2(screen->num_threads, 1);
+      }
+      return sizeof(uint32_t);
+   case PIPE_COMPUTE_CAP_SUBGROUP_SIZE:
+      if (ret) {
+         uint32_t *subgroup_size = ret;
+         *subgroup_size = lp_native_vector_width / 32;
+      }
+      return sizeof(uint32_t);
+   case PIPE_COMPUTE_CAP_MAX_GLOBAL_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_PRIVATE_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_INPUT_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_MEM_ALLOC_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_CLOCK_FREQUENCY:
+   case PIPE_COMPUTE_CAP_IMAGES_SUPPORTED:
+   case PIPE_COMPUTE_CAP_ADDRESS_BITS:
+   case PIPE_COMPUTE_CAP_MAX_VARIABLE_THREADS_PER_BLOCK:
+      break;
+   }
+   return 0;
+}
+
+
 /**
  * Query format support for creating a texture, drawing surface, etc.
  * \param format  the format to test
@@ -577,6 +674,18 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
    struct llvmpipe_resource *texture = llvmpipe_resource(resource);
+   struct lp_fence *fence = NULL;
+
+   /* Scenes are rasterized asynchronously, so make sure everything
+    * flushed so far has landed before the display target is shown.
+    */
+   mtx_lock(&screen->rast_mutex);
+   lp_fence_reference(&fence, screen->last_fence);
+   mtx_unlock(&screen->rast_mutex);
+   if (fence) {
+      lp_fence_wait(fence);
+      lp_fence_reference(&fence, NULL);
+   }
 
    assert(texture->dt);
    if (texture->dt)
@@ -589,9 +698,16 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
 
+   if (util_queue_is_initialized(&screen->compile_queue))
+      util_queue_destroy(&screen->compile_queue);
+
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
+   lp_fence_reference(&screen->last_fence, NULL);
+
+   disk_cache_destroy(screen->disk_shader_cache);
+
    lp_jit_screen_cleanup(screen);
 
    if(winsys->destroy)
@@ -644,6 +760,139 @@ llvmpipe_get_timestamp(struct pipe_screen *_screen)
    return os_time_get_nano();
 }
 
+
+#if defined(ENABLE_SHADER_CACHE) && defined(HAVE_DLFCN_H)
+/**
+ * Hash the host CPU features gallivm generates code for.
+ *
+ * Only the ISA extension flags are used: the CPU count, cache topology and
+ * the like in util_cpu_caps don't change the generated code and must not
+ * split the cache between otherwise identical machines.  The CPU name is
+ * added too, as LLVM enables features implied by it beyond these flags.
+ */
+static void
+lp_disk_cache_hash_cpu(struct mesa_sha1 *ctx)
+{
+   const struct util_cpu_caps *caps = &util_cpu_caps;
+   const uint32_t flags =
+      caps->has_sse << 0 |
+      caps->has_sse2 << 1 |
+      caps->has_sse3 << 2 |
+      caps->has_ssse3 << 3 |
+      caps->has_sse4_1 << 4 |
+      caps->has_sse4_2 << 5 |
+      caps->has_avx << 6 |
+      caps->has_avx2 << 7 |
+      caps->has_f16c << 8 |
+      caps->has_fma << 9 |
+      caps->has_daz << 10 |
+      caps->has_avx512f << 11 |
+      caps->has_altivec << 12 |
+      caps->has_vsx << 13 |
+      caps->has_neon << 14;
+
+   _mesa_sha1_update(ctx, &flags, sizeof flags);
+
+#if HAVE_LLVM >= 0x0700
+   {
+      char *cpu_name = LLVMGetHostCPUName();
+
+      _mesa_sha1_update(ctx, cpu_name, strlen(cpu_name));
+      LLVMDisposeMessage(cpu_name);
+   }
+#endif
+}
+#endif
+
+
+/**
+ * Create the on-disk cache for the generated code.
+ *
+ * The cache is keyed on this driver's and LLVM's build, and on everything
+ * about the host CPU which may influence code generation.  Without dladdr()
+ * there is no way to identify the build, so no cache is created.
+ */
+static void
+lp_disk_cache_create(struct llvmpipe_screen *screen)
+{
+#if defined(ENABLE_SHADER_CACHE) && defined(HAVE_DLFCN_H)
+   struct mesa_sha1 ctx;
+   unsigned char sha1[20];
+   char cache_id[20 * 2 + 1];
+   uint64_t driver_flags;
+
+   _mesa_sha1_init(&ctx);
+
+   if (!disk_cache_get_function_identifier(lp_disk_cache_create, &ctx) ||
+       !disk_cache_get_function_identifier(LLVMLinkInMCJIT, &ctx))
+      return;
+
+   lp_disk_cache_hash_cpu(&ctx);
+   _mesa_sha1_update(&ctx, &lp_native_vector_width,
+                     sizeof lp_native_vector_width);
+   _mesa_sha1_final(&ctx, sha1);
+   disk_cache_format_hex_id(cache_id, sha1, 20 * 2);
+
+   /* These flags affect code generation. */
+   driver_flags = ((uint64_t)gallivm_perf << 32) | (unsigned)LP_PERF;
+
+   screen->disk_shader_cache = disk_cache_create("llvmpipe", cache_id,
+                                                 driver_flags);
+#endif
+}
+
+
+/**
+ * Look up the machine code of a shader variant, identified by the SHA-1 of
+ * everything its IR depends on.  On a hit, cache->data holds a malloc'ed
+ * copy of the code.
+ */
+void
+lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
+                          struct lp_cached_code *cache,
+                          unsigned char ir_sha1_cache_key[20])
+{
+   unsigned char sha1[CACHE_KEY_SIZE];
+   size_t binary_size;
+   void *buffer;
+
+   if (!screen->disk_shader_cache)
+      return;
+
+   disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key,
+                          20, sha1);
+
+   buffer = disk_cache_get(screen->disk_shader_cache, sha1, &binary_size);
+   if (!buffer) {
+      cache->data_size = 0;
+      return;
+   }
+   cache->data = buffer;
+   cache->data_size = binary_size;
+}
+
+
+/**
+ * Store freshly generated machine code, unless it can't be reused by
+ * another process.
+ */
+void
+lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
+                            struct lp_cached_code *cache,
+                            unsigned char ir_sha1_cache_key[20])
+{
+   unsigned char sha1[CACHE_KEY_SIZE];
+
+   if (!screen->disk_shader_cache || !cache->data_size || cache->dont_cache)
+      return;
+
+   disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key,
+                          20, sha1);
+   disk_cache_put(screen->disk_shader_cache, sha1, cache->data,
+                  cache->data_size, NULL);
+}
+
+
 /**
  * Create a new pipe_screen object
  * Note: we're not presently subclassing pipe_screen (no llvmpipe_screen).
@@ -652,6 +901,7 @@ struct pipe_screen *
 llvmpipe_create_screen(struct sw_winsys *winsys)
 {
    struct llvmpipe_screen *screen;
+   unsigned num_compile_threads;
 
    util_cpu_detect();
 
@@ -680,6 +930,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.get_param = llvmpipe_get_param;
    screen->base.get_shader_param = llvmpipe_get_shader_param;
    screen->base.get_paramf = llvmpipe_get_paramf;
+   screen->base.get_compute_param = llvmpipe_get_compute_param;
    screen->base.is_format_supported = llvmpipe_is_format_supported;
 
    screen->base.context_create = llvmpipe_create_context;
@@ -688,6 +939,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.fence_finish = llvmpipe_fence_finish;
 
    screen->base.get_timestamp = llvmpipe_get_timestamp;
+   screen->base.get_driver_query_info = llvmpipe_get_driver_query_info;
 
    llvmpipe_init_screen_resource_funcs(&screen->base);
 
@@ -706,5 +958,26 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    }
    (void) mtx_init(&screen->rast_mutex, mtx_plain);
 
+   /* Optimized fragment shader variants are compiled on these threads, at
+    * minimum priority so that they don't compete with the rasterizer, while
+    * draws use quickly generated unoptimized code.  Zero threads means
+    * compiling synchronously.
+    */
+   num_compile_threads = util_cpu_caps.nr_cpus > 1 ?
+      MIN2(util_cpu_caps.nr_cpus - 1, LP_MAX_COMPILE_THREADS) : 0;
+#ifdef PIPE_SUBSYSTEM_EMBEDDED
+   num_compile_threads = 0;
+#endif
+   num_compile_threads = debug_get_num_option("LP_NUM_COMPILE_THREADS",
+                                              num_compile_threads);
+   if (num_compile_threads) {
+      util_queue_init(&screen->compile_queue, "lp_shader", 64,
+                      num_compile_threads,
+                      UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                      UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY);
+   }
+
+   lp_disk_cache_create(screen);
+
    return &screen->base;
 }
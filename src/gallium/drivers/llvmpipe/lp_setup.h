@@ -42,6 +42,7 @@ struct pipe_screen;
 struct pipe_framebuffer_state;
 struct lp_fragment_shader_variant;
 struct lp_jit_context;
+struct lp_jit_texture;
 struct llvmpipe_query;
 struct pipe_fence_handle;
 struct lp_setup_variant;
@@ -104,6 +105,11 @@ lp_setup_set_fs_constants(struct lp_setup_context *setup,
                           unsigned num,
                           struct pipe_constant_buffer *buffers);
 
+void
+lp_setup_set_fs_ssbos(struct lp_setup_context *setup,
+                      unsigned num,
+                      const struct pipe_shader_buffer *buffers);
+
 void
 lp_setup_set_alpha_ref_value( struct lp_setup_context *setup,
                               float alpha_ref_value );
@@ -125,6 +131,10 @@ lp_setup_set_viewports(struct lp_setup_context *setup,
                        unsigned num_viewports,
                        const struct pipe_viewport_state *viewports);
 
+void
+lp_setup_fill_jit_texture(struct lp_jit_texture *jit_tex,
+                          struct pipe_sampler_view *view);
+
 void
 lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
                                     unsigned num,
@@ -136,7 +146,7 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
                                     struct pipe_sampler_state **samplers);
 
 unsigned
-lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
+lp_setup_is_resource_referenced( struct lp_setup_context *setup,
                                 const struct pipe_resource *texture );
 
 void
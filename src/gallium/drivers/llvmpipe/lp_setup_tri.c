@@ -387,6 +387,18 @@ do_triangle_ccw(struct lp_setup_context *setup,
    tri->inputs.layer = layer;
    tri->inputs.viewport_index = viewport_index;
 
+   if (setup->fs.current.variant->linear.kind) {
+      struct u_rect shaded = bboxpos;
+      u_rect_find_intersection(&setup->draw_regions[viewport_index], &shaded);
+      tri->inputs.linear =
+         lp_rast_linear_check_tri(setup->fs.current.variant,
+                                  &setup->fs.current.jit_context,
+                                  &tri->inputs, &shaded);
+   }
+   else {
+      tri->inputs.linear = FALSE;
+   }
+
    if (0)
       lp_dump_setup_coef(&setup->setup.variant->key,
                          (const float (*)[4])GET_A0(&tri->inputs),
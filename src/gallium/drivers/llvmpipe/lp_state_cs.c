@@ -0,0 +1,980 @@
+/**************************************************************************
+ *
+ * Copyright 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * Compute shaders.
+ *
+ * The TGSI compute shader is translated with the same gallivm code as the
+ * fragment shader, one SIMD vector of invocations per call of the generated
+ * function.  Workgroups are dealt out to the rasterizer threads, each of
+ * which runs all the vectors of a workgroup before taking the next one.
+ *
+ * When the shader uses barriers, each vector of the workgroup runs on its
+ * own fiber (ucontext), and a barrier just switches back to the thread's
+ * scheduler, which resumes the vectors round-robin.  As all the vectors
+ * must reach the same barrier, one round brings the whole workgroup from
+ * one barrier to the next.
+ */
+
+#include "lp_state_cs.h"
+
+#if LP_HAVE_COMPUTE
+#include <ucontext.h>
+#endif
+
+#include "pipe/p_defines.h"
+#include "util/u_atomic.h"
+#include "util/u_inlines.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_pointer.h"
+#include "util/u_format.h"
+#include "util/u_string.h"
+#include "util/simple_list.h"
+#include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
+#include "gallivm/lp_bld_type.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_intr.h"
+#include "gallivm/lp_bld_logic.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_arit.h"
+#include "gallivm/lp_bld_debug.h"
+#include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_fence.h"
+#include "lp_flush.h"
+#include "lp_perf.h"
+#include "lp_rast.h"
+#include "lp_screen.h"
+#include "lp_setup.h"
+#include "lp_state.h"
+#include "lp_tex_sample.h"
+#include "lp_texture.h"
+
+
+#if LP_HAVE_COMPUTE
+
+/** Stack size of the fibers running the vectors of a workgroup */
+#define LP_CS_FIBER_STACK_SIZE (256 * 1024)
+
+
+static unsigned cs_no = 0;
+
+
+struct lp_cs_fiber
+{
+   ucontext_t context;
+   void *stack;
+   boolean done;
+};
+
+
+struct lp_cs_launch;
+
+
+/**
+ * Per rasterizer thread state of a grid launch.
+ */
+struct lp_cs_thread
+{
+   /* Must be first, the barrier callback only gets a pointer to it */
+   struct lp_jit_cs_thread_data jit;
+
+   const struct lp_cs_launch *launch;
+
+   unsigned block[3];
+
+   ucontext_t sched_context;
+   struct lp_cs_fiber *fibers;
+   unsigned current;
+};
+
+
+struct lp_cs_launch
+{
+   const struct lp_compute_shader_variant *variant;
+
+   struct lp_jit_cs_context jit_context;
+
+   unsigned grid[3];
+   unsigned num_blocks;
+   unsigned next_block;
+
+   /** Number of SIMD vectors per workgroup */
+   unsigned num_vectors;
+   unsigned vector_length;
+
+   boolean use_fibers;
+
+   unsigned num_threads;
+   struct lp_cs_thread *threads;
+};
+
+
+static void
+run_vector(struct lp_cs_thread *thread, unsigned vector)
+{
+   const struct lp_cs_launch *launch = thread->launch;
+
+   launch->variant->jit_function(&launch->jit_context,
+                                 thread->block[0],
+                                 thread->block[1],
+                                 thread->block[2],
+                                 launch->grid[0],
+                                 launch->grid[1],
+                                 launch->grid[2],
+                                 vector * launch->vector_length,
+                                 &thread->jit);
+}
+
+
+/**
+ * Fiber entrypoint.  makecontext() only passes int arguments, so the
+ * thread pointer is split in two halves.
+ */
+static void
+fiber_function(unsigned ptr_hi, unsigned ptr_lo)
+{
+   struct lp_cs_thread *thread =
+      (struct lp_cs_thread *)(uintptr_t)(((uint64_t)ptr_hi << 32) | ptr_lo);
+   unsigned vector = thread->current;
+
+   run_vector(thread, vector);
+
+   thread->fibers[vector].done = TRUE;
+
+   /* Returning resumes uc_link, i.e. the scheduler */
+}
+
+
+/**
+ * Called by the generated code on TGSI_OPCODE_BARRIER.
+ */
+static void
+lp_cs_barrier(struct lp_jit_cs_thread_data *thread_data)
+{
+   struct lp_cs_thread *thread = (struct lp_cs_thread *)thread_data;
+
+   /* A workgroup of a single vector reaches the barrier all at once */
+   if (!thread->launch->use_fibers)
+      return;
+
+   swapcontext(&thread->fibers[thread->current].context,
+               &thread->sched_context);
+}
+
+
+static void
+run_workgroup(struct lp_cs_thread *thread)
+{
+   const struct lp_cs_launch *launch = thread->launch;
+   uint64_t ptr = (uintptr_t)thread;
+   boolean pending;
+   unsigned i;
+
+   if (!launch->use_fibers) {
+      for (i = 0; i < launch->num_vectors; i++)
+         run_vector(thread, i);
+      return;
+   }
+
+   for (i = 0; i < launch->num_vectors; i++) {
+      struct lp_cs_fiber *fiber = &thread->fibers[i];
+
+      getcontext(&fiber->context);
+      fiber->context.uc_stack.ss_sp = fiber->stack;
+      fiber->context.uc_stack.ss_size = LP_CS_FIBER_STACK_SIZE;
+      fiber->context.uc_link = &thread->sched_context;
+      makecontext(&fiber->context, (void (*)(void))fiber_function, 2,
+                  (unsigned)(ptr >> 32), (unsigned)ptr);
+      fiber->done = FALSE;
+   }
+
+   do {
+      pending = FALSE;
+      for (i = 0; i < launch->num_vectors; i++) {
+         if (thread->fibers[i].done)
+            continue;
+
+         thread->current = i;
+         swapcontext(&thread->sched_context, &thread->fibers[i].context);
+         pending |= !thread->fibers[i].done;
+      }
+   } while (pending);
+}
+
+
+/**
+ * Run on every rasterizer thread by lp_rast_run_job().
+ */
+static void
+cs_job(void *data, unsigned thread_index, unsigned num_threads)
+{
+   struct lp_cs_launch *launch = (struct lp_cs_launch *)data;
+   struct lp_cs_thread *thread = &launch->threads[thread_index];
+   unsigned block;
+
+   assert(thread_index < launch->num_threads);
+
+   while ((block = p_atomic_inc_return(&launch->next_block) - 1) <
+          launch->num_blocks) {
+      thread->block[0] = block % launch->grid[0];
+      block /= launch->grid[0];
+      thread->block[1] = block % launch->grid[1];
+      thread->block[2] = block / launch->grid[1];
+
+      run_workgroup(thread);
+   }
+}
+
+
+static void
+cs_emit_barrier(const struct lp_build_tgsi_resources *resources,
+                struct gallivm_state *gallivm,
+                LLVMValueRef thread_data_ptr)
+{
+   LLVMTypeRef arg_type = LLVMTypeOf(thread_data_ptr);
+   LLVMValueRef function;
+
+   function = lp_build_const_func_pointer(gallivm,
+                                          func_to_pointer((func_pointer)lp_cs_barrier),
+                                          LLVMVoidTypeInContext(gallivm->context),
+                                          &arg_type, 1, "barrier");
+
+   LLVMBuildCall(gallivm->builder, function, &thread_data_ptr, 1, "");
+}
+
+
+/**
+ * Generate the compute shader function.  Any change of the prototype must
+ * be reflected in lp_jit.h's lp_jit_cs_func, and vice-versa.
+ */
+static void
+generate_compute(struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant *variant)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   const struct lp_compute_shader_variant_key *key = &variant->key;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef arg_types[9];
+   LLVMTypeRef func_type;
+   LLVMValueRef function;
+   LLVMValueRef cs_context_ptr, context_ptr, thread_data_ptr;
+   LLVMValueRef block_id[3], grid_size[3], invocation;
+   LLVMValueRef consts_ptr, num_consts_ptr;
+   LLVMValueRef index, block_size, valid, tmp;
+   LLVMValueRef offsets[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+   LLVMBasicBlockRef block;
+   struct lp_type cs_type;
+   struct lp_build_context uint_bld;
+   struct lp_build_mask_context mask;
+   struct lp_bld_tgsi_system_values system_values;
+   struct lp_build_tgsi_resources resources;
+   struct lp_build_sampler_soa *sampler;
+   struct lp_build_image_soa *image;
+   unsigned i;
+
+   memset(&cs_type, 0, sizeof cs_type);
+   cs_type.floating = TRUE;      /* floating point values */
+   cs_type.sign = TRUE;          /* values are signed */
+   cs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
+   cs_type.width = 32;           /* 32-bit float */
+   cs_type.length = MIN2(lp_native_vector_width / 32, 16);
+
+   arg_types[0] = variant->jit_cs_context_ptr_type;    /* context */
+   arg_types[1] = int32_type;                          /* block_x */
+   arg_types[2] = int32_type;                          /* block_y */
+   arg_types[3] = int32_type;                          /* block_z */
+   arg_types[4] = int32_type;                          /* grid_x */
+   arg_types[5] = int32_type;                          /* grid_y */
+   arg_types[6] = int32_type;                          /* grid_z */
+   arg_types[7] = int32_type;                          /* invocation */
+   arg_types[8] = variant->jit_cs_thread_data_ptr_type; /* per thread data */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                                arg_types, ARRAY_SIZE(arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, "cs_variant", func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   variant->function = function;
+
+   for (i = 0; i < ARRAY_SIZE(arg_types); ++i)
+      if (LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
+         lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
+
+   cs_context_ptr = LLVMGetParam(function, 0);
+   for (i = 0; i < 3; i++) {
+      block_id[i] = LLVMGetParam(function, 1 + i);
+      grid_size[i] = LLVMGetParam(function, 4 + i);
+   }
+   invocation = LLVMGetParam(function, 7);
+   thread_data_ptr = LLVMGetParam(function, 8);
+
+   lp_build_name(cs_context_ptr, "context");
+   lp_build_name(block_id[0], "block_x");
+   lp_build_name(block_id[1], "block_y");
+   lp_build_name(block_id[2], "block_z");
+   lp_build_name(grid_size[0], "grid_x");
+   lp_build_name(grid_size[1], "grid_y");
+   lp_build_name(grid_size[2], "grid_z");
+   lp_build_name(invocation, "invocation");
+   lp_build_name(thread_data_ptr, "thread_data");
+
+   /*
+    * Function body
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   lp_build_context_init(&uint_bld, gallivm, lp_uint_type(cs_type));
+
+   /* The sampling and constant code operates on the common jit context */
+   context_ptr = lp_jit_cs_context_base(gallivm, cs_context_ptr);
+   consts_ptr = lp_jit_context_constants(gallivm, context_ptr);
+   num_consts_ptr = lp_jit_context_num_constants(gallivm, context_ptr);
+
+   /* Local invocation index of each vector element */
+   for (i = 0; i < cs_type.length; i++)
+      offsets[i] = lp_build_const_int32(gallivm, i);
+   index = lp_build_broadcast_scalar(&uint_bld, invocation);
+   index = LLVMBuildAdd(builder, index,
+                        LLVMConstVector(offsets, cs_type.length), "index");
+
+   memset(&system_values, 0, sizeof(system_values));
+
+   tmp = index;
+   for (i = 0; i < 3; i++) {
+      LLVMValueRef size = lp_build_const_int_vec(gallivm, uint_bld.type,
+                                                 shader->block_size[i]);
+
+      system_values.thread_id[i] = i < 2 ? lp_build_mod(&uint_bld, tmp, size) :
+                                           tmp;
+      if (i < 2)
+         tmp = lp_build_div(&uint_bld, tmp, size);
+
+      system_values.block_id[i] = block_id[i];
+      system_values.grid_size[i] = grid_size[i];
+      system_values.block_size[i] =
+         lp_build_const_int32(gallivm, shader->block_size[i]);
+   }
+
+   /* Disable the elements past the end of the workgroup */
+   block_size = lp_build_const_int_vec(gallivm, uint_bld.type,
+                                       shader->block_size[0] *
+                                       shader->block_size[1] *
+                                       shader->block_size[2]);
+   valid = lp_build_cmp(&uint_bld, PIPE_FUNC_LESS, index, block_size);
+   lp_build_mask_begin(&mask, gallivm, cs_type, valid);
+
+   memset(&resources, 0, sizeof resources);
+   resources.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   resources.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+   resources.shared_ptr = lp_jit_cs_thread_data_shared(gallivm,
+                                                       thread_data_ptr);
+   resources.shared_size = lp_build_const_int32(gallivm, shader->shared_size);
+   resources.emit_barrier = cs_emit_barrier;
+
+   /* code generated texture sampling and image access */
+   sampler = lp_llvm_sampler_soa_create(key->state);
+   image = lp_llvm_image_soa_create(key->image_state,
+                                    variant->jit_cs_context_ptr_type);
+   resources.image = image;
+
+   memset(outputs, 0, sizeof outputs);
+
+   lp_build_tgsi_soa(gallivm, shader->tokens, cs_type, &mask,
+                     consts_ptr, num_consts_ptr, &system_values,
+                     NULL, outputs, context_ptr, thread_data_ptr,
+                     sampler, &shader->info.base, NULL, &resources);
+
+   sampler->destroy(sampler);
+   image->destroy(image);
+
+   lp_build_mask_end(&mask);
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, function);
+}
+
+
+static struct lp_compute_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const struct lp_compute_shader_variant_key *key)
+{
+   struct lp_compute_shader_variant *variant;
+   char module_name[64];
+
+   variant = CALLOC_STRUCT(lp_compute_shader_variant);
+   if (!variant)
+      return NULL;
+
+   variant->shader = shader;
+   variant->list_item_global.base = variant;
+   variant->list_item_local.base = variant;
+   variant->no = shader->variants_created++;
+
+   util_snprintf(module_name, sizeof(module_name), "cs%u_variant%u",
+                 shader->no, variant->no);
+
+   /* The code refers to C functions of this process, so it is never
+    * written to the disk cache.
+    */
+   variant->gallivm = gallivm_create(module_name, lp->context, NULL);
+   if (!variant->gallivm) {
+      FREE(variant);
+      return NULL;
+   }
+
+   memcpy(&variant->key, key,
+          lp_cs_variant_key_size(key->nr_samplers, key->nr_sampler_views));
+
+   lp_jit_init_cs_types(variant);
+
+   generate_compute(shader, variant);
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs = lp_build_count_ir_module(variant->gallivm->module);
+
+   variant->jit_function = (lp_jit_cs_func)
+      gallivm_jit_function(variant->gallivm, variant->function);
+
+   gallivm_free_ir(variant->gallivm);
+
+   return variant;
+}
+
+
+static void
+make_variant_key(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant_key *key)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   unsigned i;
+
+   memset(key, 0, sizeof *key);
+
+   key->nr_samplers = info->file_max[TGSI_FILE_SAMPLER] + 1;
+
+   for (i = 0; i < key->nr_samplers; ++i) {
+      if (info->file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+         lp_sampler_static_sampler_state(&key->state[i].sampler_state,
+                                         lp->samplers[PIPE_SHADER_COMPUTE][i]);
+      }
+   }
+
+   /* See make_variant_key() of the fragment shaders. */
+   if (info->file_max[TGSI_FILE_SAMPLER_VIEW] != -1) {
+      key->nr_sampler_views = info->file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (info->file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
+            lp_sampler_static_texture_state(&key->state[i].texture_state,
+                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+   else {
+      key->nr_sampler_views = key->nr_samplers;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (info->file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+            lp_sampler_static_texture_state(&key->state[i].texture_state,
+                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+
+   key->nr_images = info->file_max[TGSI_FILE_IMAGE] + 1;
+   for (i = 0; i < key->nr_images; ++i) {
+      lp_sampler_static_texture_state_image(&key->image_state[i],
+                                            &lp->images[PIPE_SHADER_COMPUTE][i]);
+   }
+}
+
+
+/**
+ * Remove a variant from the shader's and the context's variant lists, and
+ * free it.  Compute shaders run synchronously, so nothing refers to the
+ * code anymore.
+ */
+static void
+remove_variant(struct llvmpipe_context *lp,
+               struct lp_compute_shader_variant *variant)
+{
+   if (LP_DEBUG & DEBUG_FS) {
+      debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
+                   "v total cached %u inst %u total inst %u\n",
+                   variant->shader->no, variant->no,
+                   variant->shader->variants_created,
+                   variant->shader->variants_cached,
+                   lp->nr_cs_variants, variant->nr_instrs, lp->nr_cs_instrs);
+   }
+
+   gallivm_destroy(variant->gallivm);
+
+   remove_from_list(&variant->list_item_local);
+   variant->shader->variants_cached--;
+
+   remove_from_list(&variant->list_item_global);
+   lp->nr_cs_variants--;
+   lp->nr_cs_instrs -= variant->nr_instrs;
+
+   FREE(variant);
+}
+
+
+static struct lp_compute_shader_variant *
+get_variant(struct llvmpipe_context *lp, struct lp_compute_shader *shader)
+{
+   struct lp_compute_shader_variant_key key;
+   struct lp_compute_shader_variant *variant;
+   struct lp_cs_variant_list_item *li;
+   size_t key_size;
+
+   make_variant_key(lp, shader, &key);
+   key_size = lp_cs_variant_key_size(key.nr_samplers, key.nr_sampler_views);
+
+   foreach(li, &shader->variants) {
+      variant = li->base;
+      if (memcmp(&variant->key, &key, key_size) == 0) {
+         move_to_head(&shader->variants, &variant->list_item_local);
+         move_to_head(&lp->cs_variants_list, &variant->list_item_global);
+         return variant;
+      }
+   }
+
+   /* Like for the fragment shaders, free the least recently used variants
+    * until 1/16th of both budgets is available again.
+    */
+   if (lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ||
+       lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
+      const unsigned max_variants =
+         LP_MAX_SHADER_VARIANTS - LP_MAX_SHADER_VARIANTS / 16;
+      const unsigned max_instrs =
+         LP_MAX_SHADER_INSTRUCTIONS - LP_MAX_SHADER_INSTRUCTIONS / 16;
+
+      while (!is_empty_list(&lp->cs_variants_list) &&
+             (lp->nr_cs_variants > max_variants ||
+              lp->nr_cs_instrs > max_instrs)) {
+         remove_variant(lp, last_elem(&lp->cs_variants_list)->base);
+      }
+   }
+
+   variant = generate_variant(lp, shader, &key);
+   if (!variant)
+      return NULL;
+
+   if (LP_DEBUG & DEBUG_FS) {
+      debug_printf("llvmpipe: new cs #%u var #%u\n", shader->no, variant->no);
+   }
+
+   insert_at_head(&shader->variants, &variant->list_item_local);
+   insert_at_head(&lp->cs_variants_list, &variant->list_item_global);
+   shader->variants_cached++;
+   lp->nr_cs_variants++;
+   lp->nr_cs_instrs += variant->nr_instrs;
+
+   return variant;
+}
+
+
+/**
+ * Point the JIT texture record at level / layers of an image view.
+ */
+static void
+fill_jit_image(struct lp_jit_texture *jit_image,
+               const struct pipe_image_view *view)
+{
+   struct pipe_resource *res = view->resource;
+   struct llvmpipe_resource *lp_res = llvmpipe_resource(res);
+
+   memset(jit_image, 0, sizeof *jit_image);
+
+   if (llvmpipe_resource_is_texture(res)) {
+      unsigned level = view->u.tex.level;
+
+      assert(!lp_res->dt);
+      jit_image->base = lp_res->tex_data;
+      jit_image->width = u_minify(res->width0, level);
+      jit_image->height = u_minify(res->height0, level);
+      jit_image->depth = res->target == PIPE_TEXTURE_3D ?
+                         u_minify(res->depth0, level) :
+                         view->u.tex.last_layer - view->u.tex.first_layer + 1;
+      jit_image->row_stride[0] = lp_res->row_stride[level];
+      jit_image->img_stride[0] = lp_res->img_stride[level];
+      jit_image->mip_offsets[0] = lp_res->mip_offsets[level];
+      if (res->target != PIPE_TEXTURE_3D) {
+         jit_image->mip_offsets[0] += view->u.tex.first_layer *
+                                      lp_res->img_stride[level];
+      }
+   }
+   else {
+      unsigned blocksize = util_format_get_blocksize(view->format);
+
+      jit_image->base = (uint8_t *)lp_res->data + view->u.buf.offset;
+      jit_image->width = view->u.buf.size / blocksize;
+      jit_image->height = 1;
+      jit_image->depth = 1;
+   }
+}
+
+
+/**
+ * Set up the JIT context from the compute state of the context.
+ */
+static void
+update_jit_context(struct llvmpipe_context *lp,
+                   struct lp_jit_cs_context *jit_context)
+{
+   static const uint32_t fake_buf[4];
+   struct lp_jit_context *base = &jit_context->base;
+   unsigned i;
+
+   memset(jit_context, 0, sizeof *jit_context);
+
+   for (i = 0; i < LP_MAX_TGSI_CONST_BUFFERS; ++i) {
+      const struct pipe_constant_buffer *cb =
+         &lp->constants[PIPE_SHADER_COMPUTE][i];
+      const ubyte *data = NULL;
+
+      if (cb->buffer)
+         data = (const ubyte *) llvmpipe_resource_data(cb->buffer);
+      else if (cb->user_buffer)
+         data = (const ubyte *) cb->user_buffer;
+
+      if (data) {
+         unsigned size = MIN2(cb->buffer_size,
+                              LP_MAX_TGSI_CONST_BUFFER_SIZE);
+         base->constants[i] = (const float *)(data + cb->buffer_offset);
+         base->num_constants[i] = size / (sizeof(float) * 4);
+      }
+      else {
+         base->constants[i] = (const float *) fake_buf;
+         base->num_constants[i] = 0;
+      }
+   }
+
+   for (i = 0; i < LP_MAX_TGSI_SHADER_BUFFERS; ++i) {
+      const struct pipe_shader_buffer *sb = &lp->ssbos[PIPE_SHADER_COMPUTE][i];
+
+      if (sb->buffer) {
+         const ubyte *data = (const ubyte *) llvmpipe_resource_data(sb->buffer);
+         base->ssbos[i] = (const uint32_t *)(data + sb->buffer_offset);
+         base->num_ssbos[i] = MIN2(sb->buffer_size,
+                                   sb->buffer->width0 - sb->buffer_offset);
+      }
+      else {
+         base->ssbos[i] = fake_buf;
+         base->num_ssbos[i] = 0;
+      }
+   }
+
+   for (i = 0; i < lp->num_sampler_views[PIPE_SHADER_COMPUTE]; ++i) {
+      struct pipe_sampler_view *view = lp->sampler_views[PIPE_SHADER_COMPUTE][i];
+      if (view)
+         lp_setup_fill_jit_texture(&base->textures[i], view);
+   }
+
+   for (i = 0; i < lp->num_samplers[PIPE_SHADER_COMPUTE]; ++i) {
+      const struct pipe_sampler_state *sampler =
+         lp->samplers[PIPE_SHADER_COMPUTE][i];
+      if (sampler) {
+         struct lp_jit_sampler *jit_sam = &base->samplers[i];
+         jit_sam->min_lod = sampler->min_lod;
+         jit_sam->max_lod = sampler->max_lod;
+         jit_sam->lod_bias = sampler->lod_bias;
+         COPY_4V(jit_sam->border_color, sampler->border_color.f);
+      }
+   }
+
+   for (i = 0; i < LP_MAX_TGSI_SHADER_IMAGES; ++i) {
+      const struct pipe_image_view *view = &lp->images[PIPE_SHADER_COMPUTE][i];
+      if (view->resource)
+         fill_jit_image(&jit_context->images[i], view);
+   }
+}
+
+
+/**
+ * Make sure the context has at least \p count fiber stacks.  They are kept
+ * until the context is destroyed, so that launching a grid doesn't
+ * allocate megabytes of stacks each time.
+ */
+static boolean
+reserve_fiber_stacks(struct llvmpipe_context *lp, unsigned count)
+{
+   void **stacks;
+
+   if (count <= lp->nr_cs_fiber_stacks)
+      return TRUE;
+
+   stacks = REALLOC(lp->cs_fiber_stacks,
+                    lp->nr_cs_fiber_stacks * sizeof *stacks,
+                    count * sizeof *stacks);
+   if (!stacks)
+      return FALSE;
+   lp->cs_fiber_stacks = stacks;
+
+   while (lp->nr_cs_fiber_stacks < count) {
+      stacks[lp->nr_cs_fiber_stacks] = MALLOC(LP_CS_FIBER_STACK_SIZE);
+      if (!stacks[lp->nr_cs_fiber_stacks])
+         return FALSE;
+      lp->nr_cs_fiber_stacks++;
+   }
+
+   return TRUE;
+}
+
+
+static void
+llvmpipe_launch_grid(struct pipe_context *pipe,
+                     const struct pipe_grid_info *info)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct lp_compute_shader *shader = lp->cs;
+   struct lp_cs_launch *launch;
+   struct lp_fence *fence = NULL;
+   unsigned block_threads;
+   boolean out_of_memory = FALSE;
+   unsigned i, j;
+
+   if (!shader)
+      return;
+
+   launch = CALLOC_STRUCT(lp_cs_launch);
+   if (!launch)
+      return;
+
+   if (info->indirect) {
+      /* Flush first, the grid size may have been written by the GPU */
+      llvmpipe_flush_resource(pipe, info->indirect, 0, TRUE, TRUE, FALSE,
+                              "launch_grid");
+      memcpy(launch->grid,
+             (const ubyte *)llvmpipe_resource_data(info->indirect) +
+             info->indirect_offset,
+             sizeof launch->grid);
+   }
+   else {
+      memcpy(launch->grid, info->grid, sizeof launch->grid);
+   }
+
+   launch->num_blocks = launch->grid[0] * launch->grid[1] * launch->grid[2];
+   if (!launch->num_blocks) {
+      FREE(launch);
+      return;
+   }
+
+   launch->variant = get_variant(lp, shader);
+   if (!launch->variant) {
+      FREE(launch);
+      return;
+   }
+
+   block_threads = shader->block_size[0] * shader->block_size[1] *
+                   shader->block_size[2];
+   launch->vector_length = MIN2(lp_native_vector_width / 32, 16);
+   launch->num_vectors = DIV_ROUND_UP(block_threads, launch->vector_length);
+   launch->use_fibers = shader->uses_barrier && launch->num_vectors > 1;
+   launch->num_threads = MAX2(screen->num_threads, 1);
+
+   launch->threads = CALLOC(launch->num_threads, sizeof *launch->threads);
+   if (!launch->threads) {
+      FREE(launch);
+      return;
+   }
+
+   if (launch->use_fibers &&
+       !reserve_fiber_stacks(lp, launch->num_threads * launch->num_vectors))
+      out_of_memory = TRUE;
+
+   for (i = 0; i < launch->num_threads; i++) {
+      struct lp_cs_thread *thread = &launch->threads[i];
+
+      thread->launch = launch;
+      thread->jit.shared = align_malloc(MAX2(shader->shared_size, 16), 16);
+      if (!thread->jit.shared)
+         out_of_memory = TRUE;
+
+      if (launch->use_fibers && !out_of_memory) {
+         thread->fibers = CALLOC(launch->num_vectors, sizeof *thread->fibers);
+         if (!thread->fibers) {
+            out_of_memory = TRUE;
+            continue;
+         }
+         for (j = 0; j < launch->num_vectors; j++) {
+            thread->fibers[j].stack =
+               lp->cs_fiber_stacks[i * launch->num_vectors + j];
+         }
+      }
+   }
+
+   if (out_of_memory)
+      goto out;
+
+   update_jit_context(lp, &launch->jit_context);
+
+   /* Everything drawn so far must land before the shader runs, and the
+    * shader's writes must be visible to everything drawn afterwards, so
+    * run the grid on the rasterizer threads while no scene is queued.
+    */
+   llvmpipe_flush(pipe, NULL, __FUNCTION__);
+
+   mtx_lock(&screen->rast_mutex);
+   lp_fence_reference(&fence, screen->last_fence);
+   if (fence) {
+      lp_fence_wait(fence);
+      lp_fence_reference(&fence, NULL);
+   }
+
+   lp_rast_run_job(screen->rast, cs_job, launch);
+   mtx_unlock(&screen->rast_mutex);
+
+out:
+   for (i = 0; i < launch->num_threads; i++) {
+      struct lp_cs_thread *thread = &launch->threads[i];
+
+      FREE(thread->fibers);
+      align_free(thread->jit.shared);
+   }
+   FREE(launch->threads);
+   FREE(launch);
+}
+
+
+static void *
+llvmpipe_create_compute_state(struct pipe_context *pipe,
+                              const struct pipe_compute_state *templ)
+{
+   struct lp_compute_shader *shader;
+   const struct tgsi_token *tokens;
+   unsigned i;
+
+   if (templ->ir_type != PIPE_SHADER_IR_TGSI)
+      return NULL;
+
+   tokens = templ->prog;
+
+   shader = CALLOC_STRUCT(lp_compute_shader);
+   if (!shader)
+      return NULL;
+
+   shader->no = cs_no++;
+   make_empty_list(&shader->variants);
+
+   /* get/save the summary info for this shader */
+   lp_build_tgsi_info(tokens, &shader->info);
+
+   /* we need to keep a local copy of the tokens */
+   shader->tokens = tgsi_dup_tokens(tokens);
+
+   for (i = 0; i < 3; i++) {
+      shader->block_size[i] =
+         MAX2(shader->info.base.properties[TGSI_PROPERTY_CS_FIXED_BLOCK_WIDTH + i], 1);
+   }
+   shader->shared_size = templ->req_local_mem;
+   shader->uses_barrier =
+      shader->info.base.opcode_count[TGSI_OPCODE_BARRIER] > 0;
+
+   if (LP_DEBUG & DEBUG_TGSI) {
+      debug_printf("llvmpipe: Create compute shader #%u %p:\n",
+                   shader->no, (void *) shader);
+      tgsi_dump(tokens, 0);
+   }
+
+   return shader;
+}
+
+
+static void
+llvmpipe_bind_compute_state(struct pipe_context *pipe,
+                            void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+
+   llvmpipe->cs = (struct lp_compute_shader *)cs;
+}
+
+
+static void
+llvmpipe_delete_compute_state(struct pipe_context *pipe,
+                              void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct lp_compute_shader *shader = (struct lp_compute_shader *)cs;
+   struct lp_cs_variant_list_item *li;
+
+   assert(llvmpipe->cs != shader);
+
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      struct lp_cs_variant_list_item *next = next_elem(li);
+      remove_variant(llvmpipe, li->base);
+      li = next;
+   }
+
+   FREE((void *) shader->tokens);
+   FREE(shader);
+}
+
+#endif /* LP_HAVE_COMPUTE */
+
+
+/**
+ * Free the compute state owned by the context.
+ */
+void
+llvmpipe_cleanup_cs(struct llvmpipe_context *llvmpipe)
+{
+   unsigned i;
+
+   for (i = 0; i < llvmpipe->nr_cs_fiber_stacks; i++)
+      FREE(llvmpipe->cs_fiber_stacks[i]);
+   FREE(llvmpipe->cs_fiber_stacks);
+   llvmpipe->cs_fiber_stacks = NULL;
+   llvmpipe->nr_cs_fiber_stacks = 0;
+}
+
+
+void
+llvmpipe_init_cs_funcs(struct llvmpipe_context *llvmpipe)
+{
+#if LP_HAVE_COMPUTE
+   llvmpipe->pipe.create_compute_state = llvmpipe_create_compute_state;
+   llvmpipe->pipe.bind_compute_state = llvmpipe_bind_compute_state;
+   llvmpipe->pipe.delete_compute_state = llvmpipe_delete_compute_state;
+   llvmpipe->pipe.launch_grid = llvmpipe_launch_grid;
+#endif
+}
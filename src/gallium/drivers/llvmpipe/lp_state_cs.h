@@ -0,0 +1,134 @@
+/**************************************************************************
+ *
+ * Copyright 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+#ifndef LP_STATE_CS_H_
+#define LP_STATE_CS_H_
+
+
+#include <stdlib.h>
+
+#include "pipe/p_config.h"
+#include "pipe/p_state.h"
+#include "util/u_memory.h" /* for Offset */
+#include "gallivm/lp_bld_sample.h" /* for struct lp_static_texture_state */
+#include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
+#include "lp_jit.h"
+#include "lp_state_fs.h" /* for struct lp_sampler_static_state */
+
+
+/**
+ * Compute shaders need the memory instructions of gallivm, and barriers are
+ * implemented by switching between the SIMD vectors of a workgroup with
+ * ucontext, which isn't available everywhere.
+ */
+#if HAVE_LLVM >= 0x0306 && (defined(__GLIBC__) || defined(PIPE_OS_BSD))
+#define LP_HAVE_COMPUTE 1
+#else
+#define LP_HAVE_COMPUTE 0
+#endif
+
+
+struct lp_compute_shader_variant_key
+{
+   unsigned nr_samplers:8;
+   unsigned nr_sampler_views:8;
+   unsigned nr_images:8;
+
+   struct lp_static_texture_state image_state[LP_MAX_TGSI_SHADER_IMAGES];
+
+   /* Variable number of samplers/views, see lp_cs_variant_key_size() */
+   struct lp_sampler_static_state state[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+};
+
+
+static inline size_t
+lp_cs_variant_key_size(unsigned nr_samplers, unsigned nr_sampler_views)
+{
+   return Offset(struct lp_compute_shader_variant_key,
+                 state[MAX2(nr_samplers, nr_sampler_views)]);
+}
+
+
+/** doubly-linked list item */
+struct lp_cs_variant_list_item
+{
+   struct lp_compute_shader_variant *base;
+   struct lp_cs_variant_list_item *next, *prev;
+};
+
+
+struct lp_compute_shader_variant
+{
+   struct lp_compute_shader_variant_key key;
+
+   struct gallivm_state *gallivm;
+
+   LLVMTypeRef jit_cs_context_ptr_type;
+   LLVMTypeRef jit_cs_thread_data_ptr_type;
+
+   LLVMValueRef function;
+
+   lp_jit_cs_func jit_function;
+
+   /* Total number of LLVM instructions generated */
+   unsigned nr_instrs;
+
+   struct lp_cs_variant_list_item list_item_global, list_item_local;
+   struct lp_compute_shader *shader;
+
+   /* For debugging/profiling purposes */
+   unsigned no;
+};
+
+
+/** Subclass of pipe_compute_state */
+struct lp_compute_shader
+{
+   const struct tgsi_token *tokens;
+
+   struct lp_tgsi_info info;
+
+   /** Workgroup size, as declared by the shader */
+   unsigned block_size[3];
+
+   /** Workgroup shared memory size in bytes */
+   unsigned shared_size;
+
+   /** Whether the shader uses barriers, and needs to run on fibers */
+   boolean uses_barrier;
+
+   /** Variants, most recently used first */
+   struct lp_cs_variant_list_item variants;
+   unsigned variants_created;
+   unsigned variants_cached;
+
+   /* For debugging/profiling purposes */
+   unsigned no;
+};
+
+
+#endif /* LP_STATE_CS_H_ */
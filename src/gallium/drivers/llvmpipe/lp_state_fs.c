@@ -59,6 +59,7 @@
 
 #include <limits.h>
 #include "pipe/p_defines.h"
+#include "util/u_atomic.h"
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
 #include "util/u_pointer.h"
@@ -68,6 +69,8 @@
 #include "util/simple_list.h"
 #include "util/u_dual_blend.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
+#include "util/hash_table.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "tgsi/tgsi_dump.h"
@@ -102,6 +105,7 @@
 #include "lp_flush.h"
 #include "lp_state_fs.h"
 #include "lp_rast.h"
+#include "lp_screen.h"
 
 
 /** Fragment shader number (for debugging) */
@@ -336,6 +340,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
    unsigned depth_mode;
 
    struct lp_bld_tgsi_system_values system_values;
+   struct lp_build_tgsi_resources resources;
 
    memset(&system_values, 0, sizeof(system_values));
 
@@ -370,6 +375,13 @@ generate_fs_loop(struct gallivm_state *gallivm,
          depth_mode = LATE_DEPTH_TEST | LATE_DEPTH_WRITE;
       }
 
+      /* Stores to shader buffers must not happen for fragments which fail
+       * the depth/stencil test, unless early tests were requested.
+       */
+      if (shader->info.base.writes_memory &&
+          !shader->info.base.properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL])
+         depth_mode = LATE_DEPTH_TEST | LATE_DEPTH_WRITE;
+
       if (!(key->depth.enabled && key->depth.writemask) &&
           !(key->stencil[0].enabled && (key->stencil[0].writemask ||
                                         (key->stencil[1].enabled &&
@@ -392,6 +404,10 @@ generate_fs_loop(struct gallivm_state *gallivm,
    consts_ptr = lp_jit_context_constants(gallivm, context_ptr);
    num_consts_ptr = lp_jit_context_num_constants(gallivm, context_ptr);
 
+   memset(&resources, 0, sizeof resources);
+   resources.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   resources.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+
    lp_build_for_loop_begin(&loop_state, gallivm,
                            lp_build_const_int32(gallivm, 0),
                            LLVMIntULT,
@@ -479,7 +495,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                      consts_ptr, num_consts_ptr, &system_values,
                      interp->inputs,
                      outputs, context_ptr, thread_data_ptr,
-                     sampler, &shader->info.base, NULL);
+                     sampler, &shader->info.base, NULL, &resources);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -2397,8 +2413,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
  * 2x2 pixels.
  */
 static void
-generate_fragment(struct llvmpipe_context *lp,
-                  struct lp_fragment_shader *shader,
+generate_fragment(struct lp_fragment_shader *shader,
                   struct lp_fragment_shader_variant *variant,
                   unsigned partial_mask)
 {
@@ -2486,8 +2501,11 @@ generate_fragment(struct llvmpipe_context *lp,
 
    blend_vec_type = lp_build_vec_type(gallivm, blend_type);
 
-   util_snprintf(func_name, sizeof(func_name), "fs%u_variant%u_%s",
-                 shader->no, variant->no, partial_mask ? "partial" : "whole");
+   /* The function name ends up in the (possibly cached) object code,
+    * so it must not depend on per-process state.
+    */
+   util_snprintf(func_name, sizeof(func_name), "fs_variant_%s",
+                 partial_mask ? "partial" : "whole");
 
    arg_types[0] = variant->jit_context_ptr_type;       /* context */
    arg_types[1] = int32_type;                          /* x */
@@ -2803,41 +2821,48 @@ lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant)
    tgsi_dump(variant->shader->base.tokens, 0);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
+   debug_printf("variant->linear.kind = %u\n", variant->linear.kind);
    debug_printf("\n");
 }
 
 
 /**
- * Generate a new fragment shader variant from the shader code and
- * other state indicated by the key.
+ * Compute the persistent cache key of a fragment shader variant.
+ * It must cover everything the generated code depends on.
  */
-static struct lp_fragment_shader_variant *
-generate_variant(struct llvmpipe_context *lp,
-                 struct lp_fragment_shader *shader,
-                 const struct lp_fragment_shader_variant_key *key)
+static void
+lp_fs_get_ir_cache_key(const struct lp_fragment_shader *shader,
+                       const struct lp_fragment_shader_variant_key *key,
+                       unsigned char ir_sha1_cache_key[20])
 {
-   struct lp_fragment_shader_variant *variant;
-   const struct util_format_description *cbuf0_format_desc = NULL;
-   boolean fullcolormask;
-   char module_name[64];
+   const struct tgsi_token *tokens = shader->base.tokens;
+   struct mesa_sha1 ctx;
 
-   variant = CALLOC_STRUCT(lp_fragment_shader_variant);
-   if (!variant)
-      return NULL;
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, tokens,
+                     tgsi_num_tokens(tokens) * sizeof(struct tgsi_token));
+   _mesa_sha1_update(&ctx, key, shader->variant_key_size);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
 
-   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-                 shader->no, shader->variants_created);
 
-   variant->gallivm = gallivm_create(module_name, lp->context);
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
-   }
+/**
+ * Initialize the state of a variant which doesn't depend on the generated
+ * code.
+ */
+static void
+init_variant(struct lp_fragment_shader_variant *variant,
+             struct lp_fragment_shader *shader,
+             const struct lp_fragment_shader_variant_key *key,
+             unsigned no)
+{
+   const struct util_format_description *cbuf0_format_desc = NULL;
+   boolean fullcolormask;
 
    variant->shader = shader;
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
-   variant->no = shader->variants_created++;
+   variant->no = no;
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
@@ -2862,19 +2887,48 @@ generate_variant(struct llvmpipe_context *lp,
          !shader->info.base.writes_samplemask
       ? TRUE : FALSE;
 
-   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
-      lp_debug_fs_variant(variant);
-   }
+   lp_fs_linear_analyse(variant);
+}
+
+
+/**
+ * Generate and compile the code of a variant in the given LLVM context.
+ *
+ * The fallback code is only the edge test function, with no optimization
+ * passes run, which is enough to rasterize anything (the whole tile
+ * function just being a specialization of it).
+ *
+ * The IR is kept so that the caller can still write the machine code to
+ * the disk cache, and must be freed with gallivm_free_ir().
+ */
+static boolean
+compile_variant(struct lp_fragment_shader_variant *variant,
+                LLVMContextRef context,
+                struct lp_cached_code *cached,
+                boolean fallback)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   char module_name[64];
+
+   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
+                 shader->no, variant->no);
+
+   if (fallback)
+      variant->gallivm = gallivm_create_no_opt(module_name, context);
+   else
+      variant->gallivm = gallivm_create(module_name, context, cached);
+   if (!variant->gallivm)
+      return FALSE;
 
    lp_jit_init_types(variant);
-   
+
    if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+      generate_fragment(shader, variant, RAST_EDGE_TEST);
 
    if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
+      if (variant->opaque && !fallback) {
          /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
+         generate_fragment(shader, variant, RAST_WHOLE);
       }
    }
 
@@ -2900,12 +2954,229 @@ generate_variant(struct llvmpipe_context *lp,
       variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
    }
 
+   return TRUE;
+}
+
+
+/**
+ * Compilation of the optimized code of a variant on the screen's compile
+ * queue.  The code is generated into a scratch variant with a private LLVM
+ * context, as LLVM contexts are not thread safe, and handed over to the
+ * real variant by fs_variant_job_finish() on the context's thread.
+ */
+struct lp_fs_variant_job
+{
+   struct util_queue_fence ready;
+   struct llvmpipe_screen *screen;
+
+   boolean needs_caching;
+   unsigned char ir_sha1_cache_key[20];
+
+   /** When the variant was needed, and when the optimized code was ready */
+   int64_t queued_time;
+   int64_t done_time;
+
+   /** Scratch variant, only the machine code of which is kept */
+   struct lp_fragment_shader_variant variant;
+};
+
+
+static void
+fs_variant_job_execute(void *data, int thread_index)
+{
+   struct lp_fs_variant_job *job = data;
+   struct lp_fragment_shader_variant *variant = &job->variant;
+   struct lp_cached_code cached = { 0 };
+   LLVMContextRef context;
+
+   context = LLVMContextCreate();
+   if (context) {
+      if (compile_variant(variant, context, &cached, FALSE)) {
+         if (job->needs_caching)
+            lp_disk_cache_insert_shader(job->screen, &cached,
+                                        job->ir_sha1_cache_key);
+         gallivm_free_ir(variant->gallivm);
+      }
+      /* Only the machine code is left, which doesn't need the context. */
+      LLVMContextDispose(context);
+   }
+   free(cached.data);
+
+   job->done_time = os_time_get();
+}
+
+
+/**
+ * Wait for the optimized code of a variant and switch to it.
+ */
+static void
+fs_variant_job_finish(struct llvmpipe_context *lp,
+                      struct lp_fragment_shader_variant *variant)
+{
+   struct lp_fs_variant_job *job = variant->job;
+   struct lp_fragment_shader_variant *optimized = &job->variant;
+
+   util_queue_fence_wait(&job->ready);
+   util_queue_fence_destroy(&job->ready);
+
+   if (optimized->gallivm) {
+      variant->fallback_gallivm = variant->gallivm;
+      variant->gallivm = optimized->gallivm;
+
+      /* Rasterizer threads may be running the fallback code right now, and
+       * see either function from here on.
+       */
+      p_atomic_set(&variant->jit_function[RAST_EDGE_TEST],
+                   optimized->jit_function[RAST_EDGE_TEST]);
+      p_atomic_set(&variant->jit_function[RAST_WHOLE],
+                   optimized->jit_function[RAST_WHOLE]);
+
+      /* The fallback code stays around for as long as the variant, as
+       * scenes still queued may call it, so both count against the
+       * eviction budget.
+       */
+      variant->nr_instrs += optimized->nr_instrs;
+      lp->nr_fs_instrs += optimized->nr_instrs;
+   }
+
+   /* Dropped jobs never ran. */
+   if (job->done_time)
+      lp->fs_compile_latency += job->done_time - job->queued_time;
+
+   variant->job = NULL;
+   lp->nr_fs_pending--;
+   FREE(job);
+}
+
+
+/**
+ * Queue the compilation of the optimized code of a variant, whose fallback
+ * code has already been compiled.
+ */
+static boolean
+fs_variant_job_queue(struct llvmpipe_screen *screen,
+                     struct lp_fragment_shader_variant *variant,
+                     boolean needs_caching,
+                     const unsigned char ir_sha1_cache_key[20],
+                     int64_t queued_time)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   struct lp_fs_variant_job *job;
+
+   job = CALLOC_STRUCT(lp_fs_variant_job);
+   if (!job)
+      return FALSE;
+
+   init_variant(&job->variant, shader, &variant->key, variant->no);
+
+   job->screen = screen;
+   job->needs_caching = needs_caching;
+   if (needs_caching)
+      memcpy(job->ir_sha1_cache_key, ir_sha1_cache_key,
+             sizeof job->ir_sha1_cache_key);
+   job->queued_time = queued_time;
+
+   util_queue_fence_init(&job->ready);
+   util_queue_add_job(&screen->compile_queue, job, &job->ready,
+                      fs_variant_job_execute, NULL);
+
+   variant->job = job;
+   return TRUE;
+}
+
+
+/**
+ * Generate a new fragment shader variant from the shader code and
+ * other state indicated by the key.
+ *
+ * Unless the machine code is in the disk cache, or there are no compile
+ * threads, only quickly generated fallback code is produced here, and the
+ * optimized code follows asynchronously.
+ */
+static struct lp_fragment_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader *shader,
+                 const struct lp_fragment_shader_variant_key *key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant;
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   bool needs_caching = false;
+   int64_t t0 = os_time_get();
+
+   variant = CALLOC_STRUCT(lp_fragment_shader_variant);
+   if (!variant)
+      return NULL;
+
+   init_variant(variant, shader, key, shader->variants_created++);
+
+   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      lp_debug_fs_variant(variant);
+   }
+
+   if (screen->disk_shader_cache) {
+      lp_fs_get_ir_cache_key(shader, key, ir_sha1_cache_key);
+      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = true;
+   }
+
+   if (!cached.data_size && util_queue_is_initialized(&screen->compile_queue)) {
+      if (compile_variant(variant, lp->context, NULL, TRUE)) {
+         gallivm_free_ir(variant->gallivm);
+         if (fs_variant_job_queue(screen, variant, needs_caching,
+                                  ir_sha1_cache_key, t0)) {
+            lp->nr_fs_pending++;
+            lp->nr_fs_fallbacks++;
+            return variant;
+         }
+         /* Keep the fallback code then. */
+         lp->fs_compile_latency += os_time_get() - t0;
+         return variant;
+      }
+      FREE(variant);
+      return NULL;
+   }
+
+   if (!compile_variant(variant, lp->context, &cached, FALSE)) {
+      free(cached.data);
+      FREE(variant);
+      return NULL;
+   }
+
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
+
+   lp->fs_compile_latency += os_time_get() - t0;
 
    return variant;
 }
 
 
+static uint32_t
+fs_variant_key_hash(const void *key)
+{
+   const struct lp_fragment_shader_variant_key *k = key;
+
+   return _mesa_hash_data(k, lp_fs_variant_key_size(k->nr_samplers,
+                                                    k->nr_sampler_views));
+}
+
+
+static bool
+fs_variant_key_equal(const void *a, const void *b)
+{
+   const struct lp_fragment_shader_variant_key *ka = a;
+   const struct lp_fragment_shader_variant_key *kb = b;
+
+   return memcmp(ka, kb, lp_fs_variant_key_size(ka->nr_samplers,
+                                                ka->nr_sampler_views)) == 0;
+}
+
+
 static void *
 llvmpipe_create_fs_state(struct pipe_context *pipe,
                          const struct pipe_shader_state *templ)
@@ -2920,6 +3191,13 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    if (!shader)
       return NULL;
 
+   shader->variants_ht = _mesa_hash_table_create(NULL, fs_variant_key_hash,
+                                                 fs_variant_key_equal);
+   if (!shader->variants_ht) {
+      FREE(shader);
+      return NULL;
+   }
+
    shader->no = fs_no++;
    make_empty_list(&shader->variants);
 
@@ -2931,6 +3209,7 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
 
    shader->draw_data = draw_create_fragment_shader(llvmpipe->draw, templ);
    if (shader->draw_data == NULL) {
+      _mesa_hash_table_destroy(shader->variants_ht, NULL);
       FREE((void *) shader->base.tokens);
       FREE(shader);
       return NULL;
@@ -2939,8 +3218,8 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    nr_samplers = shader->info.base.file_max[TGSI_FILE_SAMPLER] + 1;
    nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
 
-   shader->variant_key_size = Offset(struct lp_fragment_shader_variant_key,
-                                     state[MAX2(nr_samplers, nr_sampler_views)]);
+   shader->variant_key_size = lp_fs_variant_key_size(nr_samplers,
+                                                     nr_sampler_views);
 
    for (i = 0; i < shader->info.base.num_inputs; i++) {
       shader->inputs[i].usage_mask = shader->info.base.input_usage_mask[i];
@@ -3036,10 +3315,21 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                    lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
    }
 
+   if (variant->job) {
+      struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+      /* No point in waiting for code which won't be used. */
+      util_queue_drop_job(&screen->compile_queue, &variant->job->ready);
+      fs_variant_job_finish(lp, variant);
+   }
+
    gallivm_destroy(variant->gallivm);
+   if (variant->fallback_gallivm)
+      gallivm_destroy(variant->fallback_gallivm);
 
-   /* remove from shader's list */
+   /* remove from shader's list and table */
    remove_from_list(&variant->list_item_local);
+   _mesa_hash_table_remove_key(variant->shader->variants_ht, &variant->key);
    variant->shader->variants_cached--;
 
    /* remove from context's list */
@@ -3079,6 +3369,7 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    draw_delete_fragment_shader(llvmpipe->draw, shader->draw_data);
 
    assert(shader->variants_cached == 0);
+   _mesa_hash_table_destroy(shader->variants_ht, NULL);
    FREE((void *) shader->base.tokens);
    FREE(shader);
 }
@@ -3128,7 +3419,7 @@ llvmpipe_set_constant_buffer(struct pipe_context *pipe,
       draw_set_mapped_constant_buffer(llvmpipe->draw, shader,
                                       index, data, size);
    }
-   else {
+   else if (shader == PIPE_SHADER_FRAGMENT) {
       llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
    }
 
@@ -3138,6 +3429,55 @@ llvmpipe_set_constant_buffer(struct pipe_context *pipe,
 }
 
 
+static void
+llvmpipe_set_shader_buffers(struct pipe_context *pipe,
+                            enum pipe_shader_type shader,
+                            unsigned start_slot, unsigned count,
+                            const struct pipe_shader_buffer *buffers)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   assert(shader < PIPE_SHADER_TYPES);
+   assert(start_slot + count <= ARRAY_SIZE(llvmpipe->ssbos[shader]));
+
+   draw_flush(llvmpipe->draw);
+
+   for (i = 0; i < count; i++) {
+      const struct pipe_shader_buffer *buffer = buffers ? &buffers[i] : NULL;
+
+      /* note: reference counting */
+      util_copy_shader_buffer(&llvmpipe->ssbos[shader][start_slot + i],
+                              buffer);
+   }
+
+   if (shader == PIPE_SHADER_FRAGMENT)
+      llvmpipe->dirty |= LP_NEW_FS_SSBOS;
+}
+
+
+static void
+llvmpipe_set_shader_images(struct pipe_context *pipe,
+                           enum pipe_shader_type shader,
+                           unsigned start_slot, unsigned count,
+                           const struct pipe_image_view *images)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   assert(shader < PIPE_SHADER_TYPES);
+   assert(start_slot + count <= ARRAY_SIZE(llvmpipe->images[shader]));
+
+   /* Images are only supported by compute shaders, which don't go
+    * through the draw module.
+    */
+   for (i = 0; i < count; i++) {
+      util_copy_image_view(&llvmpipe->images[shader][start_slot + i],
+                           images ? &images[i] : NULL);
+   }
+}
+
+
 /**
  * Return the blend factor equivalent to a destination alpha of one.
  */
@@ -3369,21 +3709,20 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
    struct lp_fragment_shader *shader = lp->fs;
    struct lp_fragment_shader_variant_key key;
    struct lp_fragment_shader_variant *variant = NULL;
-   struct lp_fs_variant_list_item *li;
+   struct hash_entry *entry;
 
    make_variant_key(lp, shader, &key);
 
    /* Search the variants for one which matches the key */
-   li = first_elem(&shader->variants);
-   while(!at_end(&shader->variants, li)) {
-      if(memcmp(&li->base->key, &key, shader->variant_key_size) == 0) {
-         variant = li->base;
-         break;
-      }
-      li = next_elem(li);
-   }
+   entry = _mesa_hash_table_search(shader->variants_ht, &key);
+   if (entry)
+      variant = entry->data;
 
    if (variant) {
+      /* Switch to the optimized code if it's ready */
+      if (variant->job && util_queue_fence_is_signalled(&variant->job->ready))
+         fs_variant_job_finish(lp, variant);
+
       /* Move this variant to the head of the list to implement LRU
        * deletion of shader's when we have too many.
        */
@@ -3392,8 +3731,6 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
    else {
       /* variant not found, create it now */
       int64_t t0, t1, dt;
-      unsigned i;
-      unsigned variants_to_cull;
 
       if (LP_DEBUG & DEBUG_FS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
@@ -3402,13 +3739,17 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
                       lp->nr_fs_variants ? lp->nr_fs_instrs / lp->nr_fs_variants : 0);
       }
 
-      /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 6.25% of them (the least recently used ones).
+      /* First, check if we've exceeded the max number of shader variants or
+       * instructions.  If so, free the least recently used ones until 1/16th
+       * of both budgets is available again, so that the amount of variants
+       * evicted depends on their size rather than being a fixed count.
        */
-      variants_to_cull = lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
-
-      if (variants_to_cull ||
+      if (lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ||
           lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
+         const unsigned max_variants =
+            LP_MAX_SHADER_VARIANTS - LP_MAX_SHADER_VARIANTS / 16;
+         const unsigned max_instrs =
+            LP_MAX_SHADER_INSTRUCTIONS - LP_MAX_SHADER_INSTRUCTIONS / 16;
          struct pipe_context *pipe = &lp->pipe;
 
          if (gallivm_debug & GALLIVM_DEBUG_PERF) {
@@ -3432,7 +3773,8 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
           * pending for destruction on flush.
           */
 
-         for (i = 0; i < variants_to_cull || lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
+         while (lp->nr_fs_variants > max_variants ||
+                lp->nr_fs_instrs > max_instrs) {
             struct lp_fs_variant_list_item *item;
             if (is_empty_list(&lp->fs_variants_list)) {
                break;
@@ -3456,7 +3798,9 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 
       /* Put the new variant into the list */
       if (variant) {
+         lp->nr_fs_compiles++;
          insert_at_head(&shader->variants, &variant->list_item_local);
+         _mesa_hash_table_insert(shader->variants_ht, &variant->key, variant);
          insert_at_head(&lp->fs_variants_list, &variant->list_item_global);
          lp->nr_fs_variants++;
          lp->nr_fs_instrs += variant->nr_instrs;
@@ -3469,6 +3813,29 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 }
 
 
+/**
+ * Switch all the variants whose optimized code is ready to it.
+ */
+void
+llvmpipe_poll_fs_variants(struct llvmpipe_context *lp)
+{
+   struct lp_fs_variant_list_item *li;
+
+   if (!lp->nr_fs_pending)
+      return;
+
+   foreach(li, &lp->fs_variants_list) {
+      struct lp_fragment_shader_variant *variant = li->base;
+
+      if (variant->job && util_queue_fence_is_signalled(&variant->job->ready)) {
+         fs_variant_job_finish(lp, variant);
+         if (!lp->nr_fs_pending)
+            break;
+      }
+   }
+}
+
+
 
 
 
@@ -3480,6 +3847,8 @@ llvmpipe_init_fs_funcs(struct llvmpipe_context *llvmpipe)
    llvmpipe->pipe.delete_fs_state = llvmpipe_delete_fs_state;
 
    llvmpipe->pipe.set_constant_buffer = llvmpipe_set_constant_buffer;
+   llvmpipe->pipe.set_shader_buffers = llvmpipe_set_shader_buffers;
+   llvmpipe->pipe.set_shader_images = llvmpipe_set_shader_images;
 }
 
 
@@ -32,6 +32,7 @@
 
 #include "pipe/p_compiler.h"
 #include "pipe/p_state.h"
+#include "util/u_memory.h" /* for Offset */
 #include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
@@ -40,6 +41,8 @@
 
 struct tgsi_token;
 struct lp_fragment_shader;
+struct lp_fs_variant_job;
+struct hash_table;
 
 
 /** Indexes into jit_function[] array */
@@ -85,6 +88,53 @@ struct lp_fragment_shader_variant_key
 };
 
 
+/**
+ * Size of the used portion of a variant key.  It only depends on the number
+ * of samplers, so all the variants of a shader have the same key size.
+ */
+static inline size_t
+lp_fs_variant_key_size(unsigned nr_samplers, unsigned nr_sampler_views)
+{
+   return Offset(struct lp_fragment_shader_variant_key,
+                 state[MAX2(nr_samplers, nr_sampler_views)]);
+}
+
+
+/** lp_fs_linear_info::kind */
+#define LP_FS_LINEAR_NONE    0
+#define LP_FS_LINEAR_COLOR   1  /**< output = interpolated input */
+#define LP_FS_LINEAR_TEXTURE 2  /**< output = texture sampled at an input */
+
+/** lp_fs_linear_info::blend */
+#define LP_FS_LINEAR_BLEND_NONE    0
+#define LP_FS_LINEAR_BLEND_PREMUL  1  /**< ONE, INV_SRC_ALPHA */
+#define LP_FS_LINEAR_BLEND_ALPHA   2  /**< SRC_ALPHA, INV_SRC_ALPHA */
+
+
+/**
+ * Description of a variant simple enough to be run by the linear
+ * rasterizer, which shades whole spans of 8-bit pixels in C rather than
+ * 4x4 blocks with the JIT-compiled SoA code.  Each triangle drawn with
+ * such a variant is checked once at setup time, by
+ * lp_rast_linear_check_tri(), and then shaded entirely by one path or the
+ * other.  See lp_rast_linear.c.
+ */
+struct lp_fs_linear_info
+{
+   unsigned kind:2;          /**< LP_FS_LINEAR_x */
+   unsigned blend:2;         /**< LP_FS_LINEAR_BLEND_x */
+   unsigned input:8;         /**< shader input with the color or texcoords */
+   unsigned perspective:1;   /**< is the input perspective corrected? */
+   unsigned unit:8;          /**< texture unit */
+   unsigned filter_linear:1;
+   unsigned repeat_s:1;      /**< PIPE_TEX_WRAP_REPEAT, else CLAMP_TO_EDGE */
+   unsigned repeat_t:1;
+   unsigned normalized:1;
+   unsigned swap_rb:1;       /**< texture and color buffer differ in R/B order */
+   unsigned force_alpha:1;   /**< texture has no alpha channel */
+};
+
+
 /** doubly-linked list item */
 struct lp_fs_variant_list_item
 {
@@ -99,6 +149,8 @@ struct lp_fragment_shader_variant
 
    boolean opaque;
 
+   struct lp_fs_linear_info linear;
+
    struct gallivm_state *gallivm;
 
    LLVMTypeRef jit_context_ptr_type;
@@ -109,6 +161,14 @@ struct lp_fragment_shader_variant
 
    lp_jit_frag_func jit_function[2];
 
+   /* Compilation of the optimized code in the background, while the
+    * unoptimized code in gallivm is used (NULL once done).  The
+    * unoptimized code is then kept in fallback_gallivm, as scenes still
+    * in flight may reference it.
+    */
+   struct lp_fs_variant_job *job;
+   struct gallivm_state *fallback_gallivm;
+
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
@@ -129,6 +189,9 @@ struct lp_fragment_shader
 
    struct lp_fs_variant_list_item variants;
 
+   /** Variants, keyed by lp_fragment_shader_variant_key */
+   struct hash_table *variants_ht;
+
    struct draw_fragment_shader *draw_data;
 
    /* For debugging/profiling purposes */
@@ -145,6 +208,9 @@ struct lp_fragment_shader
 void
 lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant);
 
+void
+lp_fs_linear_analyse(struct lp_fragment_shader_variant *variant);
+
 void
 llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant);
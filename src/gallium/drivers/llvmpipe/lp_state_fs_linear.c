@@ -0,0 +1,383 @@
+/**************************************************************************
+ *
+ * Copyright 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Detection of the fragment shader variants which can be run by the linear
+ * rasterizer.
+ *
+ * This is aimed at 2D compositing: a quad either textured with a single
+ * 8-bit texture, or filled with an interpolated color, written to an 8-bit
+ * color buffer without depth/stencil, and optionally blended over it.
+ */
+
+#include "pipe/p_config.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_format.h"
+#include "util/u_memory.h"
+#include "tgsi/tgsi_parse.h"
+#include "tgsi/tgsi_util.h"
+
+#include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_state_fs.h"
+
+
+static boolean
+is_bgra8_unorm(enum pipe_format format)
+{
+   return format == PIPE_FORMAT_B8G8R8A8_UNORM ||
+          format == PIPE_FORMAT_B8G8R8X8_UNORM;
+}
+
+
+static boolean
+is_rgba8_unorm(enum pipe_format format)
+{
+   return format == PIPE_FORMAT_R8G8B8A8_UNORM ||
+          format == PIPE_FORMAT_R8G8B8X8_UNORM;
+}
+
+
+/**
+ * Whether the instruction writes all the channels of a temporary or of the
+ * (only) output, without modifiers.
+ */
+static boolean
+is_plain_dst(const struct tgsi_full_instruction *inst)
+{
+   const struct tgsi_dst_register *dst = &inst->Dst[0].Register;
+
+   return inst->Instruction.NumDstRegs == 1 &&
+          !inst->Instruction.Saturate &&
+          (dst->File == TGSI_FILE_OUTPUT ||
+           dst->File == TGSI_FILE_TEMPORARY) &&
+          !dst->Indirect &&
+          dst->WriteMask == TGSI_WRITEMASK_XYZW;
+}
+
+
+/**
+ * Whether the source register channels [0, nr_chans) are read unswizzled,
+ * without modifiers.
+ */
+static boolean
+is_plain_src(const struct tgsi_full_src_register *src, unsigned nr_chans)
+{
+   unsigned chan;
+
+   if (src->Register.Indirect ||
+       src->Register.Dimension ||
+       src->Register.Absolute ||
+       src->Register.Negate)
+      return FALSE;
+
+   for (chan = 0; chan < nr_chans; chan++) {
+      if (tgsi_util_get_full_src_register_swizzle(src, chan) != chan)
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Match the two shapes of shaders we handle:
+ *
+ *    TEX OUT[0], IN[i].xy, SAMP[s], 2D/RECT
+ *
+ * (possibly through a temporary, as glsl_to_tgsi emits it) and
+ *
+ *    MOV OUT[0], IN[i]
+ */
+static boolean
+match_shader(const struct tgsi_token *tokens,
+             struct lp_fs_linear_info *linear,
+             unsigned *tex_target)
+{
+   struct tgsi_parse_context parse;
+   int tex_temp = -1;
+   unsigned tex_input = 0, tex_unit = 0;
+   boolean ok = TRUE;
+
+   tgsi_parse_init(&parse, tokens);
+
+   while (ok && !tgsi_parse_end_of_tokens(&parse)) {
+      const struct tgsi_full_instruction *inst;
+
+      tgsi_parse_token(&parse);
+      if (parse.FullToken.Token.Type != TGSI_TOKEN_TYPE_INSTRUCTION)
+         continue;
+
+      inst = &parse.FullToken.FullInstruction;
+
+      if (inst->Instruction.Opcode == TGSI_OPCODE_END)
+         break;
+
+      /* The color write must be the last instruction. */
+      if (linear->kind != LP_FS_LINEAR_NONE || !is_plain_dst(inst)) {
+         ok = FALSE;
+         break;
+      }
+
+      switch (inst->Instruction.Opcode) {
+      case TGSI_OPCODE_TEX:
+         if (tex_temp >= 0 ||
+             inst->Src[0].Register.File != TGSI_FILE_INPUT ||
+             !is_plain_src(&inst->Src[0], 2) ||
+             inst->Src[1].Register.File != TGSI_FILE_SAMPLER ||
+             inst->Src[1].Register.Indirect ||
+             inst->Texture.NumOffsets != 0 ||
+             (inst->Texture.Texture != TGSI_TEXTURE_2D &&
+              inst->Texture.Texture != TGSI_TEXTURE_RECT)) {
+            ok = FALSE;
+            break;
+         }
+         tex_input = inst->Src[0].Register.Index;
+         tex_unit = inst->Src[1].Register.Index;
+         *tex_target = inst->Texture.Texture;
+         if (inst->Dst[0].Register.File == TGSI_FILE_OUTPUT) {
+            linear->kind = LP_FS_LINEAR_TEXTURE;
+            linear->input = tex_input;
+            linear->unit = tex_unit;
+         }
+         else {
+            tex_temp = inst->Dst[0].Register.Index;
+         }
+         break;
+
+      case TGSI_OPCODE_MOV:
+         if (inst->Dst[0].Register.File != TGSI_FILE_OUTPUT ||
+             !is_plain_src(&inst->Src[0], 4)) {
+            ok = FALSE;
+         }
+         else if (inst->Src[0].Register.File == TGSI_FILE_TEMPORARY &&
+                  inst->Src[0].Register.Index == tex_temp) {
+            linear->kind = LP_FS_LINEAR_TEXTURE;
+            linear->input = tex_input;
+            linear->unit = tex_unit;
+         }
+         else if (inst->Src[0].Register.File == TGSI_FILE_INPUT &&
+                  tex_temp < 0) {
+            linear->kind = LP_FS_LINEAR_COLOR;
+            linear->input = inst->Src[0].Register.Index;
+         }
+         else {
+            ok = FALSE;
+         }
+         break;
+
+      default:
+         ok = FALSE;
+         break;
+      }
+   }
+
+   tgsi_parse_free(&parse);
+
+   return ok && linear->kind != LP_FS_LINEAR_NONE;
+}
+
+
+static boolean
+match_blend(const struct lp_fragment_shader_variant_key *key,
+            struct lp_fs_linear_info *linear)
+{
+   const struct pipe_rt_blend_state *rt = &key->blend.rt[0];
+   const struct util_format_description *desc =
+      util_format_description(key->cbuf_format[0]);
+
+   if (key->blend.logicop_enable ||
+       key->blend.alpha_to_coverage ||
+       !util_format_colormask_full(desc, rt->colormask))
+      return FALSE;
+
+   if (!rt->blend_enable) {
+      linear->blend = LP_FS_LINEAR_BLEND_NONE;
+      return TRUE;
+   }
+
+   if (rt->rgb_func != PIPE_BLEND_ADD ||
+       rt->alpha_func != PIPE_BLEND_ADD ||
+       rt->rgb_dst_factor != PIPE_BLENDFACTOR_INV_SRC_ALPHA ||
+       rt->alpha_dst_factor != PIPE_BLENDFACTOR_INV_SRC_ALPHA ||
+       rt->rgb_src_factor != rt->alpha_src_factor)
+      return FALSE;
+
+   switch (rt->rgb_src_factor) {
+   case PIPE_BLENDFACTOR_ONE:
+      linear->blend = LP_FS_LINEAR_BLEND_PREMUL;
+      return TRUE;
+   case PIPE_BLENDFACTOR_SRC_ALPHA:
+      linear->blend = LP_FS_LINEAR_BLEND_ALPHA;
+      return TRUE;
+   default:
+      return FALSE;
+   }
+}
+
+
+static boolean
+match_texture(const struct lp_fragment_shader_variant_key *key,
+              unsigned tex_target,
+              struct lp_fs_linear_info *linear)
+{
+   const struct lp_static_texture_state *texture;
+   const struct lp_static_sampler_state *sampler;
+   boolean has_alpha;
+
+   if (linear->unit >= key->nr_samplers ||
+       linear->unit >= key->nr_sampler_views ||
+       (LP_PERF & PERF_NO_TEX))
+      return FALSE;
+
+   texture = &key->state[linear->unit].texture_state;
+   sampler = &key->state[linear->unit].sampler_state;
+
+   if (tex_target == TGSI_TEXTURE_2D) {
+      if (texture->target != PIPE_TEXTURE_2D || !sampler->normalized_coords)
+         return FALSE;
+   }
+   else {
+      if (texture->target != PIPE_TEXTURE_RECT || sampler->normalized_coords)
+         return FALSE;
+   }
+
+   if (is_bgra8_unorm(texture->format))
+      linear->swap_rb = is_rgba8_unorm(key->cbuf_format[0]);
+   else if (is_rgba8_unorm(texture->format))
+      linear->swap_rb = is_bgra8_unorm(key->cbuf_format[0]);
+   else
+      return FALSE;
+
+   has_alpha = util_format_has_alpha(texture->format);
+   if (texture->swizzle_r != PIPE_SWIZZLE_X ||
+       texture->swizzle_g != PIPE_SWIZZLE_Y ||
+       texture->swizzle_b != PIPE_SWIZZLE_Z ||
+       (texture->swizzle_a != PIPE_SWIZZLE_1 &&
+        (texture->swizzle_a != PIPE_SWIZZLE_W || !has_alpha)))
+      return FALSE;
+   linear->force_alpha = texture->swizzle_a == PIPE_SWIZZLE_1;
+
+   /*
+    * Without mipmapping, and with the same filter for minification and
+    * magnification, the LOD is irrelevant.
+    */
+   if (sampler->compare_mode != PIPE_TEX_COMPARE_NONE ||
+       sampler->min_mip_filter != PIPE_TEX_MIPFILTER_NONE ||
+       sampler->min_img_filter != sampler->mag_img_filter ||
+       sampler->force_nearest_s ||
+       sampler->force_nearest_t)
+      return FALSE;
+   linear->filter_linear = sampler->min_img_filter == PIPE_TEX_FILTER_LINEAR;
+
+   if ((sampler->wrap_s != PIPE_TEX_WRAP_REPEAT &&
+        sampler->wrap_s != PIPE_TEX_WRAP_CLAMP_TO_EDGE) ||
+       (sampler->wrap_t != PIPE_TEX_WRAP_REPEAT &&
+        sampler->wrap_t != PIPE_TEX_WRAP_CLAMP_TO_EDGE))
+      return FALSE;
+   linear->repeat_s = sampler->wrap_s == PIPE_TEX_WRAP_REPEAT;
+   linear->repeat_t = sampler->wrap_t == PIPE_TEX_WRAP_REPEAT;
+   linear->normalized = sampler->normalized_coords;
+
+   return TRUE;
+}
+
+
+/**
+ * Fill in variant->linear, leaving it zeroed if the variant must go
+ * through the JIT-compiled code.
+ */
+void
+lp_fs_linear_analyse(struct lp_fragment_shader_variant *variant)
+{
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
+   const struct lp_fragment_shader *shader = variant->shader;
+   const struct tgsi_shader_info *info = &shader->info.base;
+   struct lp_fs_linear_info linear;
+   unsigned tex_target = TGSI_TEXTURE_UNKNOWN;
+   unsigned interp;
+
+   memset(&variant->linear, 0, sizeof variant->linear);
+   memset(&linear, 0, sizeof linear);
+
+#ifdef PIPE_ARCH_BIG_ENDIAN
+   /* Pixels are handled as 32-bit words. */
+   return;
+#endif
+
+   if (LP_PERF & PERF_NO_RAST_LINEAR)
+      return;
+
+   if (key->nr_cbufs != 1 ||
+       !(is_bgra8_unorm(key->cbuf_format[0]) ||
+         is_rgba8_unorm(key->cbuf_format[0])) ||
+       key->depth.enabled ||
+       key->stencil[0].enabled ||
+       key->alpha.enabled ||
+       key->occlusion_count)
+      return;
+
+   if (info->num_outputs != 1 ||
+       info->output_semantic_name[0] != TGSI_SEMANTIC_COLOR ||
+       info->output_semantic_index[0] != 0 ||
+       info->uses_kill ||
+       info->writes_memory)
+      return;
+
+   if (!match_blend(key, &linear) ||
+       !match_shader(shader->base.tokens, &linear, &tex_target))
+      return;
+
+   if (linear.kind == LP_FS_LINEAR_TEXTURE &&
+       !match_texture(key, tex_target, &linear))
+      return;
+
+   if (linear.input >= info->num_inputs)
+      return;
+
+   interp = shader->inputs[linear.input].interp;
+   switch (interp) {
+   case LP_INTERP_CONSTANT:
+   case LP_INTERP_LINEAR:
+      linear.perspective = FALSE;
+      break;
+   case LP_INTERP_PERSPECTIVE:
+      linear.perspective = TRUE;
+      break;
+   case LP_INTERP_COLOR:
+      linear.perspective = !key->flatshade;
+      break;
+   default:
+      return;
+   }
+
+   /* Interpolation at the centroid/sample differs along the edges. */
+   if (info->input_interpolate_loc[linear.input] != TGSI_INTERPOLATE_LOC_CENTER)
+      return;
+
+   variant->linear = linear;
+}
@@ -30,6 +30,8 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
+#include "util/hash_table.h"
 #include "gallivm/lp_bld_arit.h"
 #include "gallivm/lp_bld_bitarit.h"
 #include "gallivm/lp_bld_const.h"
@@ -717,6 +719,11 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    LLVMBasicBlockRef block;
    LLVMBuilderRef builder;
    int64_t t0 = 0, t1;
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   bool needs_caching = false;
 
    if (0)
       goto fail;
@@ -727,10 +734,19 @@ generate_setup_variant(struct lp_setup_variant_key *key,
 
    variant->no = setup_no++;
 
-   util_snprintf(func_name, sizeof(func_name), "setup_variant_%u",
+   util_snprintf(module_name, sizeof(module_name), "setup_variant_%u",
                  variant->no);
 
-   variant->gallivm = gallivm = gallivm_create(func_name, lp->context);
+   /* The setup code depends on nothing but the key. */
+   if (screen->disk_shader_cache) {
+      _mesa_sha1_compute(key, key->size, ir_sha1_cache_key);
+      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = true;
+   }
+
+   variant->gallivm = gallivm = gallivm_create(module_name, lp->context,
+                                               &cached);
    if (!variant->gallivm) {
       goto fail;
    }
@@ -761,6 +777,9 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
                                 arg_types, ARRAY_SIZE(arg_types), 0);
 
+   /* Must not depend on per-process state, see lp_disk_cache_find_shader. */
+   util_snprintf(func_name, sizeof(func_name), "setup_variant");
+
    variant->function = LLVMAddFunction(gallivm->module, func_name, func_type);
    if (!variant->function)
       goto fail;
@@ -805,7 +824,10 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    if (!variant->jit_function)
       goto fail;
 
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
 
    /*
     * Update timing information:
@@ -825,6 +847,7 @@ fail:
       }
       FREE(variant);
    }
+   free(cached.data);
 
    return NULL;
 }
@@ -896,6 +919,7 @@ remove_setup_variant(struct llvmpipe_context *lp,
    }
 
    remove_from_list(&variant->list_item_global);
+   _mesa_hash_table_remove_key(lp->setup_variants_ht, &variant->key);
    lp->nr_setup_variants--;
    FREE(variant);
 }
@@ -941,17 +965,13 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
 {
    struct lp_setup_variant_key *key = &lp->setup_variant.key;
    struct lp_setup_variant *variant = NULL;
-   struct lp_setup_variant_list_item *li;
+   struct hash_entry *entry;
 
    lp_make_setup_variant_key(lp, key);
 
-   foreach(li, &lp->setup_variants_list) {
-      if(li->base->key.size == key->size &&
-         memcmp(&li->base->key, key, key->size) == 0) {
-         variant = li->base;
-         break;
-      }
-   }
+   entry = _mesa_hash_table_search(lp->setup_variants_ht, key);
+   if (entry)
+      variant = entry->data;
 
    if (variant) {
       move_to_head(&lp->setup_variants_list, &variant->list_item_global);
@@ -964,6 +984,7 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
       variant = generate_setup_variant(key, lp);
       if (variant) {
          insert_at_head(&lp->setup_variants_list, &variant->list_item_global);
+         _mesa_hash_table_insert(lp->setup_variants_ht, &variant->key, variant);
          lp->nr_setup_variants++;
       }
    }
@@ -971,6 +992,34 @@ llvmpipe_update_setup(struct llvmpipe_context *lp)
    lp_setup_set_setup_variant(lp->setup, variant);
 }
 
+static uint32_t
+setup_variant_key_hash(const void *key)
+{
+   const struct lp_setup_variant_key *k = key;
+
+   return _mesa_hash_data(k, k->size);
+}
+
+
+static bool
+setup_variant_key_equal(const void *a, const void *b)
+{
+   const struct lp_setup_variant_key *ka = a;
+   const struct lp_setup_variant_key *kb = b;
+
+   return ka->size == kb->size && memcmp(ka, kb, ka->size) == 0;
+}
+
+
+boolean
+lp_init_setup_variants(struct llvmpipe_context *lp)
+{
+   lp->setup_variants_ht = _mesa_hash_table_create(NULL,
+                                                   setup_variant_key_hash,
+                                                   setup_variant_key_equal);
+   return lp->setup_variants_ht != NULL;
+}
+
 void
 lp_delete_setup_variants(struct llvmpipe_context *lp)
 {
@@ -981,6 +1030,8 @@ lp_delete_setup_variants(struct llvmpipe_context *lp)
       remove_setup_variant(lp, li->base);
       li = next;
    }
+   _mesa_hash_table_destroy(lp->setup_variants_ht, NULL);
+   lp->setup_variants_ht = NULL;
 }
 
 void
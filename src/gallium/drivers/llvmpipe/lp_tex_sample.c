@@ -324,3 +324,168 @@ lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state)
    return &sampler->base;
 }
 
+
+/**
+ * Bridge between the images in lp_jit_cs_context and the image code
+ * generator.
+ */
+struct llvmpipe_image_dynamic_state
+{
+   struct lp_sampler_dynamic_state base;
+
+   /* The TGSI translator is given a pointer to the lp_jit_context embedded
+    * at the start of lp_jit_cs_context.
+    */
+   LLVMTypeRef cs_context_ptr_type;
+};
+
+
+struct lp_llvm_image_soa
+{
+   struct lp_build_image_soa base;
+
+   struct llvmpipe_image_dynamic_state dynamic_state;
+
+   const struct lp_static_texture_state *static_state;
+};
+
+
+/**
+ * Fetch the specified member of the lp_jit_texture structure of an image.
+ * \param emit_load  if TRUE, emit the LLVM load instruction to actually
+ *                   fetch the field's value.  Otherwise, just emit the
+ *                   GEP code to address the field.
+ */
+static LLVMValueRef
+lp_llvm_image_member(const struct lp_sampler_dynamic_state *base,
+                     struct gallivm_state *gallivm,
+                     LLVMValueRef context_ptr,
+                     unsigned image_unit,
+                     unsigned member_index,
+                     const char *member_name,
+                     boolean emit_load)
+{
+   const struct llvmpipe_image_dynamic_state *state =
+      (const struct llvmpipe_image_dynamic_state *)base;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef indices[4];
+   LLVMValueRef ptr;
+   LLVMValueRef res;
+
+   assert(image_unit < LP_MAX_TGSI_SHADER_IMAGES);
+
+   context_ptr = LLVMBuildBitCast(builder, context_ptr,
+                                  state->cs_context_ptr_type, "");
+
+   /* context[0] */
+   indices[0] = lp_build_const_int32(gallivm, 0);
+   /* context[0].images */
+   indices[1] = lp_build_const_int32(gallivm, LP_JIT_CS_CTX_IMAGES);
+   /* context[0].images[unit] */
+   indices[2] = lp_build_const_int32(gallivm, image_unit);
+   /* context[0].images[unit].member */
+   indices[3] = lp_build_const_int32(gallivm, member_index);
+
+   ptr = LLVMBuildGEP(builder, context_ptr, indices, ARRAY_SIZE(indices), "");
+
+   if (emit_load)
+      res = LLVMBuildLoad(builder, ptr, "");
+   else
+      res = ptr;
+
+   lp_build_name(res, "context.image%u.%s", image_unit, member_name);
+
+   return res;
+}
+
+
+#define LP_LLVM_IMAGE_MEMBER(_name, _index, _emit_load)  \
+   static LLVMValueRef \
+   lp_llvm_image_##_name( const struct lp_sampler_dynamic_state *base, \
+                          struct gallivm_state *gallivm, \
+                          LLVMValueRef context_ptr, \
+                          unsigned image_unit) \
+   { \
+      return lp_llvm_image_member(base, gallivm, context_ptr, \
+                                  image_unit, _index, #_name, _emit_load ); \
+   }
+
+
+LP_LLVM_IMAGE_MEMBER(width,      LP_JIT_TEXTURE_WIDTH, TRUE)
+LP_LLVM_IMAGE_MEMBER(height,     LP_JIT_TEXTURE_HEIGHT, TRUE)
+LP_LLVM_IMAGE_MEMBER(depth,      LP_JIT_TEXTURE_DEPTH, TRUE)
+LP_LLVM_IMAGE_MEMBER(first_level, LP_JIT_TEXTURE_FIRST_LEVEL, TRUE)
+LP_LLVM_IMAGE_MEMBER(last_level, LP_JIT_TEXTURE_LAST_LEVEL, TRUE)
+LP_LLVM_IMAGE_MEMBER(base_ptr,   LP_JIT_TEXTURE_BASE, TRUE)
+LP_LLVM_IMAGE_MEMBER(row_stride, LP_JIT_TEXTURE_ROW_STRIDE, FALSE)
+LP_LLVM_IMAGE_MEMBER(img_stride, LP_JIT_TEXTURE_IMG_STRIDE, FALSE)
+LP_LLVM_IMAGE_MEMBER(mip_offsets, LP_JIT_TEXTURE_MIP_OFFSETS, FALSE)
+
+
+static void
+lp_llvm_image_soa_destroy(struct lp_build_image_soa *image)
+{
+   FREE(image);
+}
+
+
+static void
+lp_llvm_image_soa_emit_op(const struct lp_build_image_soa *base,
+                          struct gallivm_state *gallivm,
+                          const struct lp_img_params *params)
+{
+   struct lp_llvm_image_soa *image = (struct lp_llvm_image_soa *)base;
+
+   assert(params->image_index < LP_MAX_TGSI_SHADER_IMAGES);
+
+   lp_build_img_op_soa(&image->static_state[params->image_index],
+                       &image->dynamic_state.base,
+                       gallivm, params);
+}
+
+
+static void
+lp_llvm_image_soa_emit_size_query(const struct lp_build_image_soa *base,
+                                  struct gallivm_state *gallivm,
+                                  const struct lp_sampler_size_query_params *params)
+{
+   struct lp_llvm_image_soa *image = (struct lp_llvm_image_soa *)base;
+
+   assert(params->texture_unit < LP_MAX_TGSI_SHADER_IMAGES);
+
+   lp_build_size_query_soa(gallivm,
+                           &image->static_state[params->texture_unit],
+                           &image->dynamic_state.base,
+                           params);
+}
+
+
+struct lp_build_image_soa *
+lp_llvm_image_soa_create(const struct lp_static_texture_state *static_state,
+                         LLVMTypeRef cs_context_ptr_type)
+{
+   struct lp_llvm_image_soa *image;
+
+   image = CALLOC_STRUCT(lp_llvm_image_soa);
+   if (!image)
+      return NULL;
+
+   image->base.destroy = lp_llvm_image_soa_destroy;
+   image->base.emit_op = lp_llvm_image_soa_emit_op;
+   image->base.emit_size_query = lp_llvm_image_soa_emit_size_query;
+   image->dynamic_state.base.width = lp_llvm_image_width;
+   image->dynamic_state.base.height = lp_llvm_image_height;
+   image->dynamic_state.base.depth = lp_llvm_image_depth;
+   image->dynamic_state.base.first_level = lp_llvm_image_first_level;
+   image->dynamic_state.base.last_level = lp_llvm_image_last_level;
+   image->dynamic_state.base.base_ptr = lp_llvm_image_base_ptr;
+   image->dynamic_state.base.row_stride = lp_llvm_image_row_stride;
+   image->dynamic_state.base.img_stride = lp_llvm_image_img_stride;
+   image->dynamic_state.base.mip_offsets = lp_llvm_image_mip_offsets;
+   image->dynamic_state.cs_context_ptr_type = cs_context_ptr_type;
+
+   image->static_state = static_state;
+
+   return &image->base;
+}
+
@@ -0,0 +1,415 @@
+/**************************************************************************
+ *
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Compositor-like 2D throughput.
+ *
+ * Draws frames made of a stack of overlapping window quads, the way a
+ * desktop compositor does: pixel aligned unblended copies, premultiplied
+ * alpha blending of scaled windows with bilinear filtering, and solid
+ * color fills.  Reports the frame time and fill rate of each.
+ *
+ * Compare against LP_PERF=no_rast_linear to measure llvmpipe's linear
+ * rasterizer.
+ *
+ * Usage: composite-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* pipe_*_state structs */
+#include "pipe/p_state.h"
+/* pipe_context */
+#include "pipe/p_context.h"
+/* pipe_screen */
+#include "pipe/p_screen.h"
+/* PIPE_* */
+#include "pipe/p_defines.h"
+/* TGSI_SEMANTIC_{POSITION|GENERIC} */
+#include "pipe/p_shader_tokens.h"
+/* pipe_buffer_* helpers */
+#include "util/u_inlines.h"
+
+/* constant state object helper */
+#include "cso_cache/cso_context.h"
+
+/* u_box_origin_2d */
+#include "util/u_box.h"
+/* u_sampler_view_default_template */
+#include "util/u_sampler.h"
+/* util_draw_vertex_buffer helper */
+#include "util/u_draw_quad.h"
+/* FREE & CALLOC_STRUCT */
+#include "util/u_memory.h"
+/* util_make_[fragment|vertex]_passthrough_shader */
+#include "util/u_simple_shaders.h"
+/* os_time_get_nano */
+#include "util/os_time.h"
+/* to get a hardware pipe driver */
+#include "pipe-loader/pipe_loader.h"
+
+#define WIDTH 1280
+#define HEIGHT 800
+#define TEX_SIZE 256
+#define NUM_WINDOWS 16
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct pipe_vertex_element velem[2];
+
+	void *vs;
+	void *fs_tex;
+	void *fs_color;
+
+	struct pipe_resource *target;
+	struct pipe_resource *tex;
+	struct pipe_sampler_view *view;
+};
+
+struct test
+{
+	const char *name;
+	boolean textured;
+	boolean blend;
+	unsigned filter;
+	/* window size in pixels */
+	unsigned size;
+};
+
+static const struct test tests[] = {
+	{ "copy",       TRUE,  FALSE, PIPE_TEX_FILTER_NEAREST, TEX_SIZE },
+	{ "over",       TRUE,  TRUE,  PIPE_TEX_FILTER_NEAREST, TEX_SIZE },
+	{ "over-scale", TRUE,  TRUE,  PIPE_TEX_FILTER_LINEAR,  TEX_SIZE * 3 / 2 },
+	{ "fill",       FALSE, FALSE, PIPE_TEX_FILTER_NEAREST, TEX_SIZE },
+	{ "fill-over",  FALSE, TRUE,  PIPE_TEX_FILTER_NEAREST, TEX_SIZE },
+};
+
+static void init_prog(struct program *p)
+{
+	struct pipe_surface surf_tmpl;
+	int ret;
+
+	/* find a hardware device */
+	ret = pipe_loader_probe(&p->dev, 1);
+	assert(ret);
+
+	/* init a pipe screen */
+	p->screen = pipe_loader_create_screen(p->dev);
+	assert(p->screen);
+
+	/* create the pipe driver context and cso context */
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* window contents, premultiplied, with translucent borders */
+	{
+		uint32_t *ptr;
+		struct pipe_transfer *t;
+		struct pipe_resource t_tmplt;
+		struct pipe_sampler_view v_tmplt;
+		struct pipe_box box;
+		unsigned x, y;
+
+		memset(&t_tmplt, 0, sizeof(t_tmplt));
+		t_tmplt.target = PIPE_TEXTURE_2D;
+		t_tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+		t_tmplt.width0 = TEX_SIZE;
+		t_tmplt.height0 = TEX_SIZE;
+		t_tmplt.depth0 = 1;
+		t_tmplt.array_size = 1;
+		t_tmplt.last_level = 0;
+		t_tmplt.bind = PIPE_BIND_SAMPLER_VIEW;
+
+		p->tex = p->screen->resource_create(p->screen, &t_tmplt);
+
+		u_box_origin_2d(TEX_SIZE, TEX_SIZE, &box);
+
+		ptr = p->pipe->transfer_map(p->pipe, p->tex, 0, PIPE_TRANSFER_WRITE, &box, &t);
+		for (y = 0; y < TEX_SIZE; y++) {
+			uint32_t *row = (uint32_t *)((uint8_t *)ptr + y * t->stride);
+			for (x = 0; x < TEX_SIZE; x++) {
+				unsigned border = MIN2(MIN2(x, TEX_SIZE - 1 - x),
+						       MIN2(y, TEX_SIZE - 1 - y));
+				unsigned a = border < 8 ? 0x20 * border : 0xff;
+				unsigned r = x * a / TEX_SIZE;
+				unsigned g = y * a / TEX_SIZE;
+				unsigned b = a / 2;
+				row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+			}
+		}
+		p->pipe->transfer_unmap(p->pipe, t);
+
+		u_sampler_view_default_template(&v_tmplt, p->tex, p->tex->format);
+
+		p->view = p->pipe->create_sampler_view(p->pipe, p->tex, &v_tmplt);
+	}
+
+	/* no-op depth/stencil/alpha */
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	/* rasterizer */
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	/* drawing destination */
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	/* viewport mapping window coordinates 1:1 */
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+
+	/* vertex elements state */
+	memset(p->velem, 0, sizeof(p->velem));
+	p->velem[0].src_offset = 0 * 4 * sizeof(float); /* offset 0, first element */
+	p->velem[0].instance_divisor = 0;
+	p->velem[0].vertex_buffer_index = 0;
+	p->velem[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	p->velem[1].src_offset = 1 * 4 * sizeof(float); /* offset 16, second element */
+	p->velem[1].instance_divisor = 0;
+	p->velem[1].vertex_buffer_index = 0;
+	p->velem[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	/* vertex shader */
+	{
+		const enum tgsi_semantic semantic_names[] =
+                   { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	/* fragment shaders */
+	p->fs_tex = util_make_fragment_tex_shader(p->pipe, TGSI_TEXTURE_2D,
+	                                          TGSI_INTERPOLATE_PERSPECTIVE,
+	                                          TGSI_RETURN_TYPE_FLOAT,
+	                                          TGSI_RETURN_TYPE_FLOAT, false,
+	                                          false);
+	p->fs_color = util_make_fragment_passthrough_shader(p->pipe,
+	                                                    TGSI_SEMANTIC_GENERIC,
+	                                                    TGSI_INTERPOLATE_PERSPECTIVE,
+	                                                    FALSE);
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs_tex);
+	p->pipe->delete_fs_state(p->pipe, p->fs_color);
+
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_sampler_view_reference(&p->view, NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->tex, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+
+	FREE(p);
+}
+
+/*
+ * Windows cascading from the top left corner, at integer pixel positions.
+ * Returns the number of pixels covered by all of them.
+ */
+static uint64_t make_windows(const struct test *test, float (*v)[2][4])
+{
+	uint64_t pixels = 0;
+	unsigned i, k;
+
+	for (i = 0; i < NUM_WINDOWS; i++) {
+		float x0 = (float)((i * 61) % (WIDTH - test->size));
+		float y0 = (float)((i * 37) % (HEIGHT - test->size));
+		float x1 = x0 + test->size;
+		float y1 = y0 + test->size;
+		const float pos[4][2] = {
+			{ x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 }
+		};
+		const float st[4][2] = {
+			{ 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f }
+		};
+
+		for (k = 0; k < 4; k++) {
+			float (*vert)[4] = v[i * 4 + k];
+
+			vert[0][0] = pos[k][0] / WIDTH * 2.0f - 1.0f;
+			vert[0][1] = pos[k][1] / HEIGHT * 2.0f - 1.0f;
+			vert[0][2] = 0.0f;
+			vert[0][3] = 1.0f;
+
+			if (test->textured) {
+				vert[1][0] = st[k][0];
+				vert[1][1] = st[k][1];
+				vert[1][2] = 0.0f;
+				vert[1][3] = 1.0f;
+			} else {
+				/* premultiplied translucent color */
+				vert[1][0] = 0.1f * (i % 4);
+				vert[1][1] = 0.2f;
+				vert[1][2] = 0.4f;
+				vert[1][3] = test->blend ? 0.5f : 1.0f;
+			}
+		}
+
+		pixels += test->size * test->size;
+	}
+
+	return pixels;
+}
+
+static void run(struct program *p, const struct test *test,
+		unsigned iterations)
+{
+	static float vertices[NUM_WINDOWS * 4][2][4];
+	const union pipe_color_union clear_color = { .f = { 0.2, 0.2, 0.3, 1.0 } };
+	const struct pipe_sampler_state *samplers[1];
+	struct pipe_sampler_state sampler;
+	struct pipe_blend_state blend;
+	struct pipe_resource *vbuf;
+	struct pipe_fence_handle *fence = NULL;
+	uint64_t pixels, start = 0, end;
+	unsigned i;
+
+	pixels = make_windows(test, vertices);
+	vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+				  PIPE_USAGE_DEFAULT, sizeof(vertices));
+	pipe_buffer_write(p->pipe, vbuf, 0, sizeof(vertices), vertices);
+
+	memset(&blend, 0, sizeof(blend));
+	blend.rt[0].colormask = PIPE_MASK_RGBA;
+	if (test->blend) {
+		blend.rt[0].blend_enable = 1;
+		blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+		blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+		blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+		blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+		blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+		blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+	}
+
+	memset(&sampler, 0, sizeof(sampler));
+	sampler.wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+	sampler.wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+	sampler.wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE;
+	sampler.min_mip_filter = PIPE_TEX_MIPFILTER_NONE;
+	sampler.min_img_filter = test->filter;
+	sampler.mag_img_filter = test->filter;
+	sampler.normalized_coords = 1;
+	samplers[0] = &sampler;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	cso_set_blend(p->cso, &blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_samplers(p->cso, PIPE_SHADER_FRAGMENT, 1, samplers);
+	cso_set_sampler_views(p->cso, PIPE_SHADER_FRAGMENT, 1, &p->view);
+	cso_set_fragment_shader_handle(p->cso, test->textured ? p->fs_tex : p->fs_color);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, 2, p->velem);
+
+	/* the first frame compiles the shaders, and isn't timed */
+	for (i = 0; i <= iterations; i++) {
+		if (i == 1)
+			start = os_time_get_nano();
+
+		p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+		util_draw_vertex_buffer(p->pipe, p->cso,
+					vbuf, 0, 0,
+					PIPE_PRIM_QUADS,
+					NUM_WINDOWS * 4, /* verts */
+					2); /* attribs/vert */
+
+		p->pipe->flush(p->pipe, &fence, 0);
+		p->screen->fence_finish(p->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+		p->screen->fence_reference(p->screen, &fence, NULL);
+	}
+	end = os_time_get_nano();
+
+	printf("%-12s %8.3f ms/frame %10.1f Mpixels/s\n", test->name,
+	       (end - start) / 1e6 / iterations,
+	       (double)pixels * iterations / ((end - start) / 1e3));
+
+	pipe_resource_reference(&vbuf, NULL);
+}
+
+int main(int argc, char** argv)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	unsigned iterations = argc > 1 ? atoi(argv[1]) : 100;
+	unsigned i;
+
+	init_prog(p);
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		run(p, &tests[i], MAX2(iterations, 1));
+	close_prog(p);
+
+	return 0;
+}
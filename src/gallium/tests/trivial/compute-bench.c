@@ -0,0 +1,253 @@
+/**************************************************************************
+ *
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Compute shader throughput.
+ *
+ * Runs a streaming kernel over a shader storage buffer, and a kernel which
+ * exchanges values through shared memory around a barrier, and reports the
+ * invocations per second.  The results of the last launch are checked.
+ *
+ * Usage: compute-bench [num-workgroups [iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/* pipe_*_state structs */
+#include "pipe/p_state.h"
+/* pipe_context */
+#include "pipe/p_context.h"
+/* pipe_screen */
+#include "pipe/p_screen.h"
+/* PIPE_* */
+#include "pipe/p_defines.h"
+/* pipe_buffer_* helpers */
+#include "util/u_inlines.h"
+/* FREE & CALLOC_STRUCT */
+#include "util/u_memory.h"
+/* os_time_get_nano */
+#include "util/os_time.h"
+/* tgsi_text_translate */
+#include "tgsi/tgsi_text.h"
+/* to get a hardware pipe driver */
+#include "pipe-loader/pipe_loader.h"
+
+#define BLOCK_SIZE 64
+
+/* buf[i] = buf[i] * 2 + 1, one vec4 per invocation */
+static const char stream_text[] =
+	"COMP\n"
+	"PROPERTY CS_FIXED_BLOCK_WIDTH 64\n"
+	"PROPERTY CS_FIXED_BLOCK_HEIGHT 1\n"
+	"PROPERTY CS_FIXED_BLOCK_DEPTH 1\n"
+	"DCL SV[0], THREAD_ID\n"
+	"DCL SV[1], BLOCK_ID\n"
+	"DCL BUFFER[0]\n"
+	"DCL TEMP[0..1]\n"
+	"IMM[0] UINT32 {64, 4, 0, 0}\n"
+	"IMM[1] FLT32 {2.0, 1.0, 0.0, 0.0}\n"
+	"  0: UMAD TEMP[0].x, SV[1].xxxx, IMM[0].xxxx, SV[0].xxxx\n"
+	"  1: SHL TEMP[0].x, TEMP[0].xxxx, IMM[0].yyyy\n"
+	"  2: LOAD TEMP[1], BUFFER[0], TEMP[0].xxxx\n"
+	"  3: MAD TEMP[1], TEMP[1], IMM[1].xxxx, IMM[1].yyyy\n"
+	"  4: STORE BUFFER[0].xyzw, TEMP[0].xxxx, TEMP[1]\n"
+	"  5: END\n";
+
+/* buf[i] = i of the neighbour, exchanged through shared memory */
+static const char barrier_text[] =
+	"COMP\n"
+	"PROPERTY CS_FIXED_BLOCK_WIDTH 64\n"
+	"PROPERTY CS_FIXED_BLOCK_HEIGHT 1\n"
+	"PROPERTY CS_FIXED_BLOCK_DEPTH 1\n"
+	"DCL SV[0], THREAD_ID\n"
+	"DCL SV[1], BLOCK_ID\n"
+	"DCL BUFFER[0]\n"
+	"DCL MEMORY[0], SHARED\n"
+	"DCL TEMP[0..2]\n"
+	"IMM[0] UINT32 {64, 2, 1, 63}\n"
+	"  0: UMAD TEMP[0].x, SV[1].xxxx, IMM[0].xxxx, SV[0].xxxx\n"
+	"  1: SHL TEMP[1].x, SV[0].xxxx, IMM[0].yyyy\n"
+	"  2: STORE MEMORY[0].x, TEMP[1].xxxx, TEMP[0].xxxx\n"
+	"  3: BARRIER\n"
+	"  4: UADD TEMP[1].x, SV[0].xxxx, IMM[0].zzzz\n"
+	"  5: AND TEMP[1].x, TEMP[1].xxxx, IMM[0].wwww\n"
+	"  6: SHL TEMP[1].x, TEMP[1].xxxx, IMM[0].yyyy\n"
+	"  7: LOAD TEMP[2].x, MEMORY[0], TEMP[1].xxxx\n"
+	"  8: SHL TEMP[0].x, TEMP[0].xxxx, IMM[0].yyyy\n"
+	"  9: STORE BUFFER[0].x, TEMP[0].xxxx, TEMP[2].xxxx\n"
+	" 10: END\n";
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+
+	struct pipe_resource *buf;
+	unsigned num_blocks;
+	unsigned iterations;
+};
+
+static void *create_cs(struct program *p, const char *text,
+		       unsigned shared_size)
+{
+	struct tgsi_token tokens[1024];
+	struct pipe_compute_state state;
+
+	if (!tgsi_text_translate(text, tokens, ARRAY_SIZE(tokens))) {
+		fprintf(stderr, "failed to translate the shader\n");
+		exit(1);
+	}
+
+	memset(&state, 0, sizeof(state));
+	state.ir_type = PIPE_SHADER_IR_TGSI;
+	state.prog = tokens;
+	state.req_local_mem = shared_size;
+
+	return p->pipe->create_compute_state(p->pipe, &state);
+}
+
+static void run(struct program *p, const char *name, void *cs,
+		unsigned elem_size)
+{
+	struct pipe_shader_buffer sb;
+	struct pipe_grid_info info;
+	uint64_t start, end;
+	double invocations;
+	unsigned i;
+
+	memset(&sb, 0, sizeof(sb));
+	sb.buffer = p->buf;
+	sb.buffer_size = p->num_blocks * BLOCK_SIZE * elem_size;
+
+	memset(&info, 0, sizeof(info));
+	info.work_dim = 1;
+	info.block[0] = BLOCK_SIZE;
+	info.block[1] = 1;
+	info.block[2] = 1;
+	info.grid[0] = p->num_blocks;
+	info.grid[1] = 1;
+	info.grid[2] = 1;
+
+	p->pipe->bind_compute_state(p->pipe, cs);
+	p->pipe->set_shader_buffers(p->pipe, PIPE_SHADER_COMPUTE, 0, 1, &sb);
+
+	/* warm up, which also compiles the shader */
+	p->pipe->launch_grid(p->pipe, &info);
+	p->pipe->flush(p->pipe, NULL, 0);
+
+	start = os_time_get_nano();
+	for (i = 0; i < p->iterations; i++)
+		p->pipe->launch_grid(p->pipe, &info);
+	p->pipe->flush(p->pipe, NULL, 0);
+	end = os_time_get_nano();
+
+	p->pipe->set_shader_buffers(p->pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL);
+	p->pipe->bind_compute_state(p->pipe, NULL);
+
+	invocations = (double)p->num_blocks * BLOCK_SIZE * p->iterations;
+	printf("%-8s %10.3f ms/launch %12.1f Minvocations/s\n", name,
+	       (end - start) / 1e6 / p->iterations,
+	       invocations / ((end - start) / 1e3));
+}
+
+static int check_barrier(struct program *p)
+{
+	struct pipe_transfer *transfer;
+	const uint32_t *data;
+	unsigned i, n = p->num_blocks * BLOCK_SIZE;
+	int errors = 0;
+
+	data = pipe_buffer_map(p->pipe, p->buf, PIPE_TRANSFER_READ, &transfer);
+	for (i = 0; i < n; i++) {
+		uint32_t expected = (i & ~(BLOCK_SIZE - 1)) |
+				    ((i + 1) & (BLOCK_SIZE - 1));
+		if (data[i] != expected) {
+			if (errors++ < 8)
+				fprintf(stderr, "buf[%u] = %u, expected %u\n",
+					i, data[i], expected);
+		}
+	}
+	pipe_buffer_unmap(p->pipe, transfer);
+
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	void *stream_cs, *barrier_cs;
+	unsigned size;
+	int ret;
+
+	p->num_blocks = argc > 1 ? atoi(argv[1]) : 4096;
+	p->iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+	/* find a hardware device */
+	ret = pipe_loader_probe(&p->dev, 1);
+	assert(ret);
+
+	/* init a pipe screen */
+	p->screen = pipe_loader_create_screen(p->dev);
+	assert(p->screen);
+
+	if (!p->screen->get_param(p->screen, PIPE_CAP_COMPUTE)) {
+		fprintf(stderr, "compute shaders not supported\n");
+		return 1;
+	}
+
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+
+	size = p->num_blocks * BLOCK_SIZE * 16;
+	p->buf = pipe_buffer_create(p->screen, PIPE_BIND_SHADER_BUFFER,
+				    PIPE_USAGE_DEFAULT, size);
+	{
+		float *data = MALLOC(size);
+		memset(data, 0, size);
+		pipe_buffer_write(p->pipe, p->buf, 0, size, data);
+		FREE(data);
+	}
+
+	stream_cs = create_cs(p, stream_text, 0);
+	barrier_cs = create_cs(p, barrier_text, BLOCK_SIZE * 4);
+
+	run(p, "stream", stream_cs, 16);
+	run(p, "barrier", barrier_cs, 4);
+
+	ret = check_barrier(p) ? 1 : 0;
+
+	p->pipe->delete_compute_state(p->pipe, stream_cs);
+	p->pipe->delete_compute_state(p->pipe, barrier_cs);
+	pipe_resource_reference(&p->buf, NULL);
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+	FREE(p);
+
+	return ret;
+}
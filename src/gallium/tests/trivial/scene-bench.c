@@ -0,0 +1,349 @@
+/**************************************************************************
+ *
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Scene pipelining throughput.
+ *
+ * Draws frames of many small blended triangles, so that both binning on the
+ * application thread and rasterization on the worker threads take a good
+ * share of the frame.  Each frame is drawn twice: once waiting for its fence
+ * before starting the next one, which serializes setup and rasterization,
+ * and once only flushing, which lets the driver bin the next frame while
+ * the previous one is still rasterizing.  Reports the frame time of both
+ * and the speedup of the pipelined run.
+ *
+ * Usage: scene-bench [iterations [triangles per frame]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* pipe_*_state structs */
+#include "pipe/p_state.h"
+/* pipe_context */
+#include "pipe/p_context.h"
+/* pipe_screen */
+#include "pipe/p_screen.h"
+/* PIPE_* */
+#include "pipe/p_defines.h"
+/* TGSI_SEMANTIC_{POSITION|GENERIC} */
+#include "pipe/p_shader_tokens.h"
+/* pipe_buffer_* helpers */
+#include "util/u_inlines.h"
+
+/* constant state object helper */
+#include "cso_cache/cso_context.h"
+
+/* util_draw_vertex_buffer helper */
+#include "util/u_draw_quad.h"
+/* FREE & CALLOC_STRUCT */
+#include "util/u_memory.h"
+/* util_make_[fragment|vertex]_passthrough_shader */
+#include "util/u_simple_shaders.h"
+/* os_time_get_nano */
+#include "util/os_time.h"
+/* to get a hardware pipe driver */
+#include "pipe-loader/pipe_loader.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define NUM_FRAMES_IN_FLIGHT 8
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend;
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct pipe_vertex_element velem[2];
+
+	void *vs;
+	void *fs;
+
+	struct pipe_resource *target;
+	struct pipe_resource *vbuf;
+	unsigned num_verts;
+};
+
+static void init_prog(struct program *p, unsigned num_tris)
+{
+	struct pipe_surface surf_tmpl;
+	float (*vertices)[2][4];
+	unsigned grid_w, grid_h, x, y, n;
+	int ret;
+
+	/* find a hardware device */
+	ret = pipe_loader_probe(&p->dev, 1);
+	assert(ret);
+
+	/* init a pipe screen */
+	p->screen = pipe_loader_create_screen(p->dev);
+	assert(p->screen);
+
+	/* create the pipe driver context and cso context */
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* additive blending, so every triangle reads the target */
+	memset(&p->blend, 0, sizeof(p->blend));
+	p->blend.rt[0].colormask = PIPE_MASK_RGBA;
+	p->blend.rt[0].blend_enable = 1;
+	p->blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_SRC_ALPHA;
+	p->blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_ONE;
+	p->blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+	p->blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_ONE;
+
+	/* no-op depth/stencil/alpha */
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	/* rasterizer */
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	/* drawing destination */
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	/* viewport mapping window coordinates 1:1 */
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+
+	/* vertex elements state */
+	memset(p->velem, 0, sizeof(p->velem));
+	p->velem[0].src_offset = 0 * 4 * sizeof(float); /* offset 0, first element */
+	p->velem[0].instance_divisor = 0;
+	p->velem[0].vertex_buffer_index = 0;
+	p->velem[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	p->velem[1].src_offset = 1 * 4 * sizeof(float); /* offset 16, second element */
+	p->velem[1].instance_divisor = 0;
+	p->velem[1].vertex_buffer_index = 0;
+	p->velem[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	/*
+	 * A grid of quads covering the screen four times over, each quad
+	 * split in two triangles, so that the triangle count sets the
+	 * binning cost while the fill stays the same.
+	 */
+	grid_w = 1;
+	while (grid_w * grid_w * 9 / 16 * 2 * 4 < num_tris)
+		grid_w++;
+	grid_h = MAX2(grid_w * 9 / 16, 1);
+
+	p->num_verts = grid_w * grid_h * 4 * 6;
+	vertices = MALLOC(p->num_verts * sizeof(*vertices));
+
+	n = 0;
+	for (unsigned layer = 0; layer < 4; layer++) {
+		for (y = 0; y < grid_h; y++) {
+			for (x = 0; x < grid_w; x++) {
+				static const unsigned corners[6][2] = {
+					{ 0, 0 }, { 1, 0 }, { 0, 1 },
+					{ 1, 0 }, { 1, 1 }, { 0, 1 }
+				};
+
+				for (unsigned k = 0; k < 6; k++) {
+					float (*vert)[4] = vertices[n++];
+
+					vert[0][0] = (x + corners[k][0]) * 2.0f / grid_w - 1.0f;
+					vert[0][1] = (y + corners[k][1]) * 2.0f / grid_h - 1.0f;
+					vert[0][2] = 0.0f;
+					vert[0][3] = 1.0f;
+
+					vert[1][0] = (float)x / grid_w;
+					vert[1][1] = (float)y / grid_h;
+					vert[1][2] = layer / 4.0f;
+					vert[1][3] = 0.25f;
+				}
+			}
+		}
+	}
+
+	p->vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+				     PIPE_USAGE_DEFAULT,
+				     p->num_verts * sizeof(*vertices));
+	pipe_buffer_write(p->pipe, p->vbuf, 0, p->num_verts * sizeof(*vertices),
+			  vertices);
+	FREE(vertices);
+
+	/* vertex shader */
+	{
+		const enum tgsi_semantic semantic_names[] =
+			{ TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	/* fragment shader */
+	p->fs = util_make_fragment_passthrough_shader(p->pipe,
+                    TGSI_SEMANTIC_COLOR, TGSI_INTERPOLATE_PERSPECTIVE, TRUE);
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->vbuf, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+}
+
+static void draw_frame(struct program *p)
+{
+	const union pipe_color_union clear_color = { .f = { 0.0, 0.0, 0.0, 1.0 } };
+
+	p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+	util_draw_vertex_buffer(p->pipe, p->cso,
+				p->vbuf, 0, 0,
+				PIPE_PRIM_TRIANGLES,
+				p->num_verts, /* verts */
+				2); /* attribs/vert */
+}
+
+/*
+ * Draw iterations frames, and return the average frame time in ms.
+ *
+ * When pipelined, up to NUM_FRAMES_IN_FLIGHT frames are queued before
+ * waiting for the oldest one, like a swap chain would.
+ */
+static double run(struct program *p, unsigned iterations, bool pipelined)
+{
+	struct pipe_fence_handle *fences[NUM_FRAMES_IN_FLIGHT] = { NULL };
+	unsigned depth = pipelined ? NUM_FRAMES_IN_FLIGHT : 1;
+	uint64_t start, end;
+	unsigned i;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	cso_set_blend(p->cso, &p->blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, 2, p->velem);
+
+	/* compile the shaders outside of the timed loop */
+	draw_frame(p);
+	p->pipe->flush(p->pipe, &fences[0], 0);
+	p->screen->fence_finish(p->screen, NULL, fences[0], PIPE_TIMEOUT_INFINITE);
+	p->screen->fence_reference(p->screen, &fences[0], NULL);
+
+	start = os_time_get_nano();
+	for (i = 0; i < iterations; i++) {
+		struct pipe_fence_handle **fence = &fences[i % depth];
+
+		if (*fence) {
+			p->screen->fence_finish(p->screen, NULL, *fence, PIPE_TIMEOUT_INFINITE);
+			p->screen->fence_reference(p->screen, fence, NULL);
+		}
+
+		draw_frame(p);
+		p->pipe->flush(p->pipe, fence, 0);
+	}
+
+	for (i = 0; i < depth; i++) {
+		if (fences[i]) {
+			p->screen->fence_finish(p->screen, NULL, fences[i], PIPE_TIMEOUT_INFINITE);
+			p->screen->fence_reference(p->screen, &fences[i], NULL);
+		}
+	}
+	end = os_time_get_nano();
+
+	return (end - start) / 1e6 / iterations;
+}
+
+int main(int argc, char** argv)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	unsigned iterations = argc > 1 ? atoi(argv[1]) : 100;
+	unsigned num_tris = argc > 2 ? atoi(argv[2]) : 100000;
+	double serialized, pipelined;
+
+	iterations = MAX2(iterations, 1);
+
+	init_prog(p, MAX2(num_tris, 1));
+
+	serialized = run(p, iterations, false);
+	pipelined = run(p, iterations, true);
+
+	printf("%u triangles/frame\n", p->num_verts / 3);
+	printf("%-12s %8.3f ms/frame %8.1f frames/s\n", "serialized",
+	       serialized, 1000.0 / serialized);
+	printf("%-12s %8.3f ms/frame %8.1f frames/s\n", "pipelined",
+	       pipelined, 1000.0 / pipelined);
+	printf("speedup %.2fx\n", serialized / pipelined);
+
+	close_prog(p);
+	FREE(p);
+
+	return 0;
+}
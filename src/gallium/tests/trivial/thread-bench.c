@@ -0,0 +1,389 @@
+/**************************************************************************
+ *
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Rasterizer thread scaling.
+ *
+ * Draws fill-bound frames of full screen textured, blended quads with
+ * LP_NUM_THREADS set to 1, 2, 4, ... up to the number of CPUs, once with
+ * the rasterizer threads grouped per L3 cache / socket and once with
+ * LP_NO_THREAD_GROUPS=1.  Reports the fill rate of each, and the speedup
+ * over a single thread.
+ *
+ * Usage: GALLIUM_DRIVER=llvmpipe thread-bench [iterations [max threads]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* pipe_*_state structs */
+#include "pipe/p_state.h"
+/* pipe_context */
+#include "pipe/p_context.h"
+/* pipe_screen */
+#include "pipe/p_screen.h"
+/* PIPE_* */
+#include "pipe/p_defines.h"
+/* TGSI_SEMANTIC_{POSITION|GENERIC} */
+#include "pipe/p_shader_tokens.h"
+/* pipe_buffer_* helpers */
+#include "util/u_inlines.h"
+
+/* constant state object helper */
+#include "cso_cache/cso_context.h"
+
+/* u_box_origin_2d */
+#include "util/u_box.h"
+/* u_sampler_view_default_template */
+#include "util/u_sampler.h"
+/* util_draw_vertex_buffer helper */
+#include "util/u_draw_quad.h"
+/* FREE & CALLOC_STRUCT */
+#include "util/u_memory.h"
+/* util_make_[fragment|vertex]_passthrough_shader */
+#include "util/u_simple_shaders.h"
+/* util_cpu_caps */
+#include "util/u_cpu_detect.h"
+/* os_time_get_nano */
+#include "util/os_time.h"
+/* to get a hardware pipe driver */
+#include "pipe-loader/pipe_loader.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define TEX_SIZE 512
+#define NUM_LAYERS 8
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend;
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_sampler_state sampler;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct pipe_vertex_element velem[2];
+
+	void *vs;
+	void *fs;
+
+	struct pipe_resource *target;
+	struct pipe_resource *tex;
+	struct pipe_sampler_view *view;
+	struct pipe_resource *vbuf;
+};
+
+static void init_prog(struct program *p)
+{
+	static float vertices[NUM_LAYERS * 4][2][4];
+	struct pipe_surface surf_tmpl;
+	unsigned i, k;
+	int ret;
+
+	/* find a hardware device */
+	ret = pipe_loader_probe(&p->dev, 1);
+	assert(ret);
+
+	/* init a pipe screen, which starts LP_NUM_THREADS threads */
+	p->screen = pipe_loader_create_screen(p->dev);
+	assert(p->screen);
+
+	/* create the pipe driver context and cso context */
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	/* render target texture */
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	/* translucent checkerboard */
+	{
+		uint32_t *ptr;
+		struct pipe_transfer *t;
+		struct pipe_resource t_tmplt;
+		struct pipe_sampler_view v_tmplt;
+		struct pipe_box box;
+		unsigned x, y;
+
+		memset(&t_tmplt, 0, sizeof(t_tmplt));
+		t_tmplt.target = PIPE_TEXTURE_2D;
+		t_tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+		t_tmplt.width0 = TEX_SIZE;
+		t_tmplt.height0 = TEX_SIZE;
+		t_tmplt.depth0 = 1;
+		t_tmplt.array_size = 1;
+		t_tmplt.last_level = 0;
+		t_tmplt.bind = PIPE_BIND_SAMPLER_VIEW;
+
+		p->tex = p->screen->resource_create(p->screen, &t_tmplt);
+
+		u_box_origin_2d(TEX_SIZE, TEX_SIZE, &box);
+
+		ptr = p->pipe->transfer_map(p->pipe, p->tex, 0, PIPE_TRANSFER_WRITE, &box, &t);
+		for (y = 0; y < TEX_SIZE; y++) {
+			uint32_t *row = (uint32_t *)((uint8_t *)ptr + y * t->stride);
+			for (x = 0; x < TEX_SIZE; x++)
+				row[x] = ((x ^ y) & 32) ? 0x80804020 : 0x40204080;
+		}
+		p->pipe->transfer_unmap(p->pipe, t);
+
+		u_sampler_view_default_template(&v_tmplt, p->tex, p->tex->format);
+
+		p->view = p->pipe->create_sampler_view(p->pipe, p->tex, &v_tmplt);
+	}
+
+	/* premultiplied alpha blending, so every layer reads the target */
+	memset(&p->blend, 0, sizeof(p->blend));
+	p->blend.rt[0].colormask = PIPE_MASK_RGBA;
+	p->blend.rt[0].blend_enable = 1;
+	p->blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+	p->blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+	p->blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+	p->blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+	p->blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+
+	/* no-op depth/stencil/alpha */
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	/* rasterizer */
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	/* bilinear, repeating */
+	memset(&p->sampler, 0, sizeof(p->sampler));
+	p->sampler.wrap_s = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.wrap_t = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.wrap_r = PIPE_TEX_WRAP_REPEAT;
+	p->sampler.min_mip_filter = PIPE_TEX_MIPFILTER_NONE;
+	p->sampler.min_img_filter = PIPE_TEX_FILTER_LINEAR;
+	p->sampler.mag_img_filter = PIPE_TEX_FILTER_LINEAR;
+	p->sampler.normalized_coords = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM; /* All drivers support this */
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+	/* drawing destination */
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	/* viewport mapping window coordinates 1:1 */
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+
+	/* vertex elements state */
+	memset(p->velem, 0, sizeof(p->velem));
+	p->velem[0].src_offset = 0 * 4 * sizeof(float); /* offset 0, first element */
+	p->velem[0].instance_divisor = 0;
+	p->velem[0].vertex_buffer_index = 0;
+	p->velem[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	p->velem[1].src_offset = 1 * 4 * sizeof(float); /* offset 16, second element */
+	p->velem[1].instance_divisor = 0;
+	p->velem[1].vertex_buffer_index = 0;
+	p->velem[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+	/* full screen quads, each with its own texture scale */
+	for (i = 0; i < NUM_LAYERS; i++) {
+		const float pos[4][2] = {
+			{ -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f }
+		};
+		float scale = 1.0f + i * 0.75f;
+
+		for (k = 0; k < 4; k++) {
+			float (*vert)[4] = vertices[i * 4 + k];
+
+			vert[0][0] = pos[k][0];
+			vert[0][1] = pos[k][1];
+			vert[0][2] = 0.0f;
+			vert[0][3] = 1.0f;
+
+			vert[1][0] = (pos[k][0] + 1.0f) * scale;
+			vert[1][1] = (pos[k][1] + 1.0f) * scale;
+			vert[1][2] = 0.0f;
+			vert[1][3] = 1.0f;
+		}
+	}
+
+	p->vbuf = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+				     PIPE_USAGE_DEFAULT, sizeof(vertices));
+	pipe_buffer_write(p->pipe, p->vbuf, 0, sizeof(vertices), vertices);
+
+	/* vertex shader */
+	{
+		const enum tgsi_semantic semantic_names[] =
+                   { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_GENERIC };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, FALSE);
+	}
+
+	/* fragment shader */
+	p->fs = util_make_fragment_tex_shader(p->pipe, TGSI_TEXTURE_2D,
+	                                      TGSI_INTERPOLATE_PERSPECTIVE,
+	                                      TGSI_RETURN_TYPE_FLOAT,
+	                                      TGSI_RETURN_TYPE_FLOAT, false,
+	                                      false);
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_sampler_view_reference(&p->view, NULL);
+	pipe_resource_reference(&p->target, NULL);
+	pipe_resource_reference(&p->tex, NULL);
+	pipe_resource_reference(&p->vbuf, NULL);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+}
+
+/*
+ * Draw iterations frames, and return the fill rate in Mpixels/s.
+ */
+static double run(struct program *p, unsigned iterations)
+{
+	const union pipe_color_union clear_color = { .f = { 0.2, 0.2, 0.3, 1.0 } };
+	const struct pipe_sampler_state *samplers[1] = { &p->sampler };
+	struct pipe_fence_handle *fence = NULL;
+	uint64_t start = 0, end;
+	unsigned i;
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	cso_set_blend(p->cso, &p->blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_samplers(p->cso, PIPE_SHADER_FRAGMENT, 1, samplers);
+	cso_set_sampler_views(p->cso, PIPE_SHADER_FRAGMENT, 1, &p->view);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, 2, p->velem);
+
+	/* the first frame compiles the shaders, and isn't timed */
+	for (i = 0; i <= iterations; i++) {
+		if (i == 1)
+			start = os_time_get_nano();
+
+		p->pipe->clear(p->pipe, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+		util_draw_vertex_buffer(p->pipe, p->cso,
+					p->vbuf, 0, 0,
+					PIPE_PRIM_QUADS,
+					NUM_LAYERS * 4, /* verts */
+					2); /* attribs/vert */
+
+		p->pipe->flush(p->pipe, &fence, 0);
+		p->screen->fence_finish(p->screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+		p->screen->fence_reference(p->screen, &fence, NULL);
+	}
+	end = os_time_get_nano();
+
+	return (double)WIDTH * HEIGHT * NUM_LAYERS * iterations /
+	       ((end - start) / 1e3);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned iterations = argc > 1 ? atoi(argv[1]) : 50;
+	unsigned max_threads;
+	double base[2] = { 0.0, 0.0 };
+	unsigned threads, grouped;
+
+	util_cpu_detect();
+	max_threads = argc > 2 ? atoi(argv[2]) : util_cpu_caps.nr_cpus;
+	max_threads = MAX2(max_threads, 1);
+	iterations = MAX2(iterations, 1);
+
+	printf("threads %22s %22s\n", "grouped", "ungrouped");
+
+	/* 1, 2, 4, ... and finally max_threads itself */
+	for (threads = 1; threads <= max_threads;
+	     threads = threads == max_threads ? threads + 1 :
+	                                        MIN2(threads * 2, max_threads)) {
+		char num[16];
+
+		snprintf(num, sizeof(num), "%u", threads);
+		setenv("LP_NUM_THREADS", num, 1);
+		printf("%7u", threads);
+
+		for (grouped = 0; grouped < 2; grouped++) {
+			struct program *p = CALLOC_STRUCT(program);
+			double rate;
+
+			if (grouped == 0)
+				unsetenv("LP_NO_THREAD_GROUPS");
+			else
+				setenv("LP_NO_THREAD_GROUPS", "1", 1);
+
+			init_prog(p);
+			rate = run(p, iterations);
+			close_prog(p);
+			FREE(p);
+
+			if (threads == 1)
+				base[grouped] = rate;
+			printf(" %9.1f Mpix/s %5.2fx", rate, rate / base[grouped]);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -51,8 +51,7 @@ _mesa_NewHashTable(void)
    struct _mesa_HashTable *table = CALLOC_STRUCT(_mesa_HashTable);
 
    if (table) {
-      table->ht = _mesa_hash_table_create(NULL, uint_key_hash,
-                                          uint_key_compare);
+      table->ht = _mesa_int_key_hash_table_create(NULL);
       if (table->ht == NULL) {
          free(table);
          _mesa_error_no_memory(__func__);
@@ -35,6 +35,7 @@
 #include "glheader.h"
 #include "imports.h"
 #include "c11/threads.h"
+#include "util/hash_table.h"
 
 /**
  * Magic GLuint object name that gets stored outside of the struct hash_table.
@@ -50,46 +51,23 @@
 #define DELETED_KEY_VALUE 1
 
 /** @{
- * Mapping from our use of GLuint as both the key and the hash value to the
- * hash_table.h API
+ * Mapping from GLuint object names to the hash_table.h API.
  *
- * There exist many integer hash functions, designed to avoid collisions when
- * the integers are spread across key space with some patterns.  In GL, the
- * pattern (in the case of glGen*()ed object IDs) is that the keys are unique
- * contiguous integers starting from 1.  Because of that, we just use the key
- * as the hash value, to minimize the cost of the hash function.  If objects
- * are never deleted, we will never see a collision in the table, because the
- * table resizes itself when it approaches full, and thus key % table_size ==
- * key.
- *
- * The case where we could have collisions for genned objects would be
- * something like: glGenBuffers(&a, 100); glDeleteBuffers(&a + 50, 50);
- * glGenBuffers(&b, 100), because objects 1-50 and 101-200 are allocated at
- * the end of that sequence, instead of 1-150.  So far it doesn't appear to be
- * a problem.
+ * Names are stored directly in the key pointers and hashed with
+ * _mesa_hash_int_key().  glGen*()ed names are contiguous integers starting
+ * from 1, and the table takes both the group to probe and each entry's
+ * control byte from the hash, so all of the key's bits need to be mixed.
  */
-static inline bool
-uint_key_compare(const void *a, const void *b)
+static inline void *
+uint_key(GLuint id)
 {
-   return a == b;
+   return (void *)(uintptr_t) id;
 }
 
 static inline uint32_t
 uint_hash(GLuint id)
 {
-   return id;
-}
-
-static inline uint32_t
-uint_key_hash(const void *key)
-{
-   return uint_hash((uintptr_t)key);
-}
-
-static inline void *
-uint_key(GLuint id)
-{
-   return (void *)(uintptr_t) id;
+   return _mesa_hash_int_key(uint_key(id));
 }
 /** @} */
 
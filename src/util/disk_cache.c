@@ -37,8 +37,6 @@
 #include <pwd.h>
 #include <errno.h>
 #include <dirent.h>
-#include "zlib.h"
-
 #include "util/crc32.h"
 #include "util/debug.h"
 #include "util/rand_xor.h"
@@ -50,6 +48,9 @@
 #include "main/errors.h"
 
 #include "disk_cache.h"
+#include "disk_cache_archive.h"
+#include "disk_cache_codec.h"
+#include "disk_cache_db.h"
 
 /* Number of bits to mask off from a cache key to get an index. */
 #define CACHE_INDEX_KEY_BITS 16
@@ -72,7 +73,7 @@
  * - There is no strict requirement that cache versions be backwards
  *   compatible but effort should be taken to limit disruption where possible.
  */
-#define CACHE_VERSION 1
+#define CACHE_VERSION 2
 
 struct disk_cache {
    /* The path to the cache directory. */
@@ -82,6 +83,17 @@ struct disk_cache {
    /* Thread queue for compressing and writing cache entries to disk */
    struct util_queue cache_queue;
 
+   /* Thread queue for disk_cache_get_batch(), created on first use.  It is
+    * separate from cache_queue, as reads are waited on by the application
+    * and shouldn't run at minimum priority or wait for pending writes.
+    */
+   struct util_queue read_queue;
+   bool read_queue_initialized;
+   mtx_t read_queue_mutex;
+
+   /* Codec new items are compressed with. */
+   enum disk_cache_codec codec;
+
    /* Seed for rand, which is used to pick a random directory */
    uint64_t seed_xorshift128plus[2];
 
@@ -98,6 +110,12 @@ struct disk_cache {
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
+   /* Packed storage, used instead of one file per item when non-NULL. */
+   struct disk_cache_db *db;
+
+   /* Read-only archive of precompiled items, looked up first. */
+   struct disk_cache_archive *archive;
+
    /* Driver cache keys. */
    uint8_t *driver_keys_blob;
    size_t driver_keys_blob_size;
@@ -370,16 +388,36 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
 
    cache->max_size = max_size;
 
+   /* The packed database avoids the inode and directory overhead of the
+    * default of one file per item.  Fall back to the latter if it can't be
+    * opened.
+    */
+   if (env_var_as_boolean("MESA_DISK_CACHE_DATABASE", false))
+      cache->db = disk_cache_db_open(cache->path, max_size);
+
+   /* An archive shipped with the application lets it start with a warm
+    * cache.  It doesn't count towards max_size.
+    */
+   const char *archive_path = getenv("MESA_DISK_CACHE_ARCHIVE");
+   if (archive_path)
+      cache->archive = disk_cache_archive_open(archive_path);
+
    /* 1 thread was chosen because we don't really care about getting things
     * to disk quickly just that it's not blocking other tasks.
     *
     * The queue will resize automatically when it's full, so adding new jobs
-    * doesn't stall.
+    * doesn't stall.  The jobs only do file I/O, so they can share the
+    * threads of the process-wide job pool.
     */
    util_queue_init(&cache->cache_queue, "disk$", 32, 1,
                    UTIL_QUEUE_INIT_RESIZE_IF_FULL |
                    UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY |
-                   UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY);
+                   UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY |
+                   UTIL_QUEUE_INIT_SHARED_POOL);
+
+   mtx_init(&cache->read_queue_mutex, mtx_plain);
+
+   cache->codec = disk_cache_codec_from_env();
 
    cache->path_init_failed = false;
 
@@ -437,12 +475,24 @@ disk_cache_destroy(struct disk_cache *cache)
 {
    if (cache && !cache->path_init_failed) {
       util_queue_destroy(&cache->cache_queue);
+      if (cache->read_queue_initialized)
+         util_queue_destroy(&cache->read_queue);
+      mtx_destroy(&cache->read_queue_mutex);
+      disk_cache_db_close(cache->db);
+      disk_cache_archive_close(cache->archive);
       munmap(cache->index_mmap, cache->index_mmap_size);
    }
 
    ralloc_free(cache);
 }
 
+void
+disk_cache_wait_for_idle(struct disk_cache *cache)
+{
+   if (cache && !cache->path_init_failed)
+      util_queue_finish(&cache->cache_queue);
+}
+
 /* Return a filename within the cache's directory corresponding to 'key'. The
  * returned filename is ralloced with 'cache' as the parent context.
  *
@@ -672,6 +722,11 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    struct stat sb;
 
+   if (cache->db) {
+      disk_cache_db_remove(cache->db, key);
+      return;
+   }
+
    char *filename = get_cache_file(cache, key);
    if (filename == NULL) {
       return;
@@ -719,75 +774,6 @@ write_all(int fd, const void *buf, size_t count)
    return done;
 }
 
-/* From the zlib docs:
- *    "If the memory is available, buffers sizes on the order of 128K or 256K
- *    bytes should be used."
- */
-#define BUFSIZE 256 * 1024
-
-/**
- * Compresses cache entry in memory and writes it to disk. Returns the size
- * of the data written to disk.
- */
-static size_t
-deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
-                          const char *filename)
-{
-   unsigned char out[BUFSIZE];
-
-   /* allocate deflate state */
-   z_stream strm;
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = (uint8_t *) in_data;
-   strm.avail_in = in_data_size;
-
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
-   if (ret != Z_OK)
-       return 0;
-
-   /* compress until end of in_data */
-   size_t compressed_size = 0;
-   int flush;
-   do {
-      int remaining = in_data_size - BUFSIZE;
-      flush = remaining > 0 ? Z_NO_FLUSH : Z_FINISH;
-      in_data_size -= BUFSIZE;
-
-      /* Run deflate() on input until the output buffer is not full (which
-       * means there is no more data to deflate).
-       */
-      do {
-         strm.avail_out = BUFSIZE;
-         strm.next_out = out;
-
-         ret = deflate(&strm, flush);    /* no bad return value */
-         assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-
-         size_t have = BUFSIZE - strm.avail_out;
-         compressed_size += have;
-
-         ssize_t written = write_all(dest, out, have);
-         if (written == -1) {
-            (void)deflateEnd(&strm);
-            return 0;
-         }
-      } while (strm.avail_out == 0);
-
-      /* all input should be used */
-      assert(strm.avail_in == 0);
-
-   } while (flush != Z_FINISH);
-
-   /* stream should be complete */
-   assert(ret == Z_STREAM_END);
-
-   /* clean up and return */
-   (void)deflateEnd(&strm);
-   return compressed_size;
-}
-
 static struct disk_cache_put_job *
 create_put_job(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -847,8 +833,154 @@ destroy_put_job(void *job, int thread_index)
 struct cache_entry_file_data {
    uint32_t crc32;
    uint32_t uncompressed_size;
+   uint32_t codec;
 };
 
+/**
+ * Builds the contents of a cache item in memory, laid out like the files
+ * written by cache_put(), and returns it malloc'ed.
+ */
+static uint8_t *
+create_cache_item(struct disk_cache_put_job *dc_job, size_t *item_size)
+{
+   struct disk_cache *cache = dc_job->cache;
+   struct cache_item_metadata *md = &dc_job->cache_item_metadata;
+   struct cache_entry_file_data cf_data;
+   size_t header_size;
+   size_t compressed_size;
+   uint8_t *item, *p;
+
+   header_size = cache->driver_keys_blob_size + sizeof(uint32_t) +
+                 sizeof(cf_data);
+   if (md->type == CACHE_ITEM_TYPE_GLSL)
+      header_size += sizeof(uint32_t) + md->num_keys * sizeof(cache_key);
+
+   compressed_size = disk_cache_codec_bound(cache->codec, dc_job->size);
+   item = malloc(header_size + compressed_size);
+   if (!item)
+      return NULL;
+
+   p = item;
+   memcpy(p, cache->driver_keys_blob, cache->driver_keys_blob_size);
+   p += cache->driver_keys_blob_size;
+   memcpy(p, &md->type, sizeof(uint32_t));
+   p += sizeof(uint32_t);
+   if (md->type == CACHE_ITEM_TYPE_GLSL) {
+      memcpy(p, &md->num_keys, sizeof(uint32_t));
+      p += sizeof(uint32_t);
+      memcpy(p, md->keys, md->num_keys * sizeof(cache_key));
+      p += md->num_keys * sizeof(cache_key);
+   }
+
+   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
+   cf_data.uncompressed_size = dc_job->size;
+   cf_data.codec = cache->codec;
+   memcpy(p, &cf_data, sizeof(cf_data));
+   p += sizeof(cf_data);
+
+   compressed_size = disk_cache_codec_compress(cache->codec,
+                                               dc_job->data, dc_job->size,
+                                               p, compressed_size);
+   if (compressed_size == 0 && dc_job->size != 0) {
+      free(item);
+      return NULL;
+   }
+
+   *item_size = header_size + compressed_size;
+   return item;
+}
+
+/**
+ * Checks a cache item read back from disk and returns its decompressed
+ * data, malloc'ed, or NULL if the item is not valid.
+ */
+static uint8_t *
+parse_cache_item(struct disk_cache *cache, const uint8_t *item,
+                 size_t item_size, size_t *size)
+{
+   const uint8_t *p = item, *end = item + item_size;
+   size_t ck_size = cache->driver_keys_blob_size;
+   struct cache_entry_file_data cf_data;
+   uint8_t *uncompressed_data;
+   uint32_t md_type;
+
+   if (item_size < ck_size)
+      return NULL;
+
+   /* Check for extremely unlikely hash collisions */
+   if (memcmp(cache->driver_keys_blob, p, ck_size) != 0) {
+      assert(!"Mesa cache keys mismatch!");
+      return NULL;
+   }
+   p += ck_size;
+
+   if (end - p < sizeof(md_type))
+      return NULL;
+   memcpy(&md_type, p, sizeof(md_type));
+   p += sizeof(md_type);
+
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      uint32_t num_keys;
+
+      if (end - p < sizeof(num_keys))
+         return NULL;
+      memcpy(&num_keys, p, sizeof(num_keys));
+      p += sizeof(num_keys);
+
+      /* The cache item metadata is currently just used for distributing
+       * precompiled shaders, they are not used by Mesa so just skip them for
+       * now.
+       * TODO: pass the metadata back to the caller and do some basic
+       * validation.
+       */
+      if ((end - p) / sizeof(cache_key) < num_keys)
+         return NULL;
+      p += num_keys * sizeof(cache_key);
+   }
+
+   /* Load the CRC that was created when the item was written. */
+   if (end - p < sizeof(cf_data))
+      return NULL;
+   memcpy(&cf_data, p, sizeof(cf_data));
+   p += sizeof(cf_data);
+
+   /* Uncompress the cache data */
+   uncompressed_data = malloc(cf_data.uncompressed_size);
+   if (!uncompressed_data)
+      return NULL;
+
+   if (!disk_cache_codec_decompress(cf_data.codec, p, end - p,
+                                    uncompressed_data,
+                                    cf_data.uncompressed_size))
+      goto fail;
+
+   /* Check the data for corruption */
+   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
+                                        cf_data.uncompressed_size))
+      goto fail;
+
+   if (size)
+      *size = cf_data.uncompressed_size;
+
+   return uncompressed_data;
+
+ fail:
+   free(uncompressed_data);
+   return NULL;
+}
+
+static void
+cache_put_db(struct disk_cache_put_job *dc_job)
+{
+   size_t item_size;
+   uint8_t *item = create_cache_item(dc_job, &item_size);
+
+   if (item) {
+      disk_cache_db_put(dc_job->cache->db, dc_job->key, item, item_size);
+      free(item);
+   }
+}
+
 static void
 cache_put(void *job, int thread_index)
 {
@@ -857,8 +989,15 @@ cache_put(void *job, int thread_index)
    int fd = -1, fd_final = -1, err, ret;
    unsigned i = 0;
    char *filename = NULL, *filename_tmp = NULL;
+   uint8_t *item = NULL;
+   size_t item_size;
    struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
 
+   if (dc_job->cache->db) {
+      cache_put_db(dc_job);
+      return;
+   }
+
    filename = get_cache_file(dc_job->cache, dc_job->key);
    if (filename == NULL)
       goto done;
@@ -915,57 +1054,16 @@ cache_put(void *job, int thread_index)
    /* OK, we're now on the hook to write out a file that we know is
     * not in the cache, and is also not being written out to the cache
     * by some other process.
+    *
+    * The item starts with the driver_keys_blob, this can be used find
+    * information about the mesa version that produced the entry or deal with
+    * hash collisions, should that ever become a real problem.  It is
+    * followed by the cache item metadata, also useful to deal with
+    * collisions and to 3rd party tools reading the cache files, the CRC of
+    * the data and the data itself.
     */
-
-   /* Write the driver_keys_blob, this can be used find information about the
-    * mesa version that produced the entry or deal with hash collisions,
-    * should that ever become a real problem.
-    */
-   ret = write_all(fd, dc_job->cache->driver_keys_blob,
-                   dc_job->cache->driver_keys_blob_size);
-   if (ret == -1) {
-      unlink(filename_tmp);
-      goto done;
-   }
-
-   /* Write the cache item metadata. This data can be used to deal with
-    * hash collisions, as well as providing useful information to 3rd party
-    * tools reading the cache files.
-    */
-   ret = write_all(fd, &dc_job->cache_item_metadata.type,
-                   sizeof(uint32_t));
-   if (ret == -1) {
-      unlink(filename_tmp);
-      goto done;
-   }
-
-   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
-      ret = write_all(fd, &dc_job->cache_item_metadata.num_keys,
-                      sizeof(uint32_t));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-
-      ret = write_all(fd, dc_job->cache_item_metadata.keys[0],
-                      dc_job->cache_item_metadata.num_keys *
-                      sizeof(cache_key));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-   }
-
-   /* Create CRC of the data. We will read this when restoring the cache and
-    * use it to check for corruption.
-    */
-   struct cache_entry_file_data cf_data;
-   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
-   cf_data.uncompressed_size = dc_job->size;
-
-   size_t cf_data_size = sizeof(cf_data);
-   ret = write_all(fd, &cf_data, cf_data_size);
-   if (ret == -1) {
+   item = create_cache_item(dc_job, &item_size);
+   if (item == NULL) {
       unlink(filename_tmp);
       goto done;
    }
@@ -974,9 +1072,8 @@ cache_put(void *job, int thread_index)
     * rename them atomically to the destination filename, and also
     * perform an atomic increment of the total cache size.
     */
-   size_t file_size = deflate_and_write_to_disk(dc_job->data, dc_job->size,
-                                                fd, filename_tmp);
-   if (file_size == 0) {
+   ret = write_all(fd, item, item_size);
+   if (ret == -1) {
       unlink(filename_tmp);
       goto done;
    }
@@ -1003,6 +1100,7 @@ cache_put(void *job, int thread_index)
     */
    if (fd != -1)
       close(fd);
+   free(item);
    free(filename_tmp);
    free(filename);
 }
@@ -1020,6 +1118,11 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    if (cache->path_init_failed)
       return;
 
+   /* Don't duplicate precompiled items in the user's cache. */
+   if (cache->archive &&
+       disk_cache_archive_lookup(cache->archive, key, NULL))
+      return;
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, data, size, cache_item_metadata);
 
@@ -1030,45 +1133,6 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    }
 }
 
-/**
- * Decompresses cache entry, returns true if successful.
- */
-static bool
-inflate_cache_data(uint8_t *in_data, size_t in_data_size,
-                   uint8_t *out_data, size_t out_data_size)
-{
-   z_stream strm;
-
-   /* allocate inflate state */
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = in_data;
-   strm.avail_in = in_data_size;
-   strm.next_out = out_data;
-   strm.avail_out = out_data_size;
-
-   int ret = inflateInit(&strm);
-   if (ret != Z_OK)
-      return false;
-
-   ret = inflate(&strm, Z_NO_FLUSH);
-   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-
-   /* Unless there was an error we should have decompressed everything in one
-    * go as we know the uncompressed file size.
-    */
-   if (ret != Z_STREAM_END) {
-      (void)inflateEnd(&strm);
-      return false;
-   }
-   assert(strm.avail_out == 0);
-
-   /* clean up and return */
-   (void)inflateEnd(&strm);
-   return true;
-}
-
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
@@ -1077,7 +1141,7 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    char *filename = NULL;
    uint8_t *data = NULL;
    uint8_t *uncompressed_data = NULL;
-   uint8_t *file_header = NULL;
+   size_t item_size;
 
    if (size)
       *size = 0;
@@ -1104,6 +1168,26 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
+   if (cache->archive) {
+      const void *item = disk_cache_archive_lookup(cache->archive, key,
+                                                   &item_size);
+      if (item) {
+         uncompressed_data = parse_cache_item(cache, item, item_size, size);
+         if (uncompressed_data)
+            return uncompressed_data;
+      }
+   }
+
+   if (cache->db) {
+      data = disk_cache_db_get(cache->db, key, &item_size);
+      if (data == NULL)
+         return NULL;
+
+      uncompressed_data = parse_cache_item(cache, data, item_size, size);
+      free(data);
+      return uncompressed_data;
+   }
+
    filename = get_cache_file(cache, key);
    if (filename == NULL)
       goto fail;
@@ -1119,97 +1203,88 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    if (data == NULL)
       goto fail;
 
-   size_t ck_size = cache->driver_keys_blob_size;
-   file_header = malloc(ck_size);
-   if (!file_header)
-      goto fail;
-
-   if (sb.st_size < ck_size)
-      goto fail;
-
-   ret = read_all(fd, file_header, ck_size);
+   ret = read_all(fd, data, sb.st_size);
    if (ret == -1)
       goto fail;
 
-   /* Check for extremely unlikely hash collisions */
-   if (memcmp(cache->driver_keys_blob, file_header, ck_size) != 0) {
-      assert(!"Mesa cache keys mismatch!");
-      goto fail;
-   }
+   uncompressed_data = parse_cache_item(cache, data, sb.st_size, size);
 
-   size_t cache_item_md_size = sizeof(uint32_t);
-   uint32_t md_type;
-   ret = read_all(fd, &md_type, cache_item_md_size);
-   if (ret == -1)
-      goto fail;
+ fail:
+   free(data);
+   free(filename);
+   if (fd != -1)
+      close(fd);
 
-   if (md_type == CACHE_ITEM_TYPE_GLSL) {
-      uint32_t num_keys;
-      cache_item_md_size += sizeof(uint32_t);
-      ret = read_all(fd, &num_keys, sizeof(uint32_t));
-      if (ret == -1)
-         goto fail;
+   return uncompressed_data;
+}
 
-      /* The cache item metadata is currently just used for distributing
-       * precompiled shaders, they are not used by Mesa so just skip them for
-       * now.
-       * TODO: pass the metadata back to the caller and do some basic
-       * validation.
-       */
-      cache_item_md_size += num_keys * sizeof(cache_key);
-      ret = lseek(fd, num_keys * sizeof(cache_key), SEEK_CUR);
-      if (ret == -1)
-         goto fail;
-   }
+struct disk_cache_read_job {
+   struct disk_cache *cache;
+   struct disk_cache_batch_entry *entries;
+   unsigned count;
+};
 
-   /* Load the CRC that was created when the file was written. */
-   struct cache_entry_file_data cf_data;
-   size_t cf_data_size = sizeof(cf_data);
-   ret = read_all(fd, &cf_data, cf_data_size);
-   if (ret == -1)
-      goto fail;
+static void
+cache_read(void *job, int thread_index)
+{
+   struct disk_cache_read_job *dc_job = (struct disk_cache_read_job *) job;
 
-   /* Load the actual cache data. */
-   size_t cache_data_size =
-      sb.st_size - cf_data_size - ck_size - cache_item_md_size;
-   ret = read_all(fd, data, cache_data_size);
-   if (ret == -1)
-      goto fail;
+   for (unsigned i = 0; i < dc_job->count; i++) {
+      struct disk_cache_batch_entry *entry = &dc_job->entries[i];
 
-   /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data.uncompressed_size);
-   if (!inflate_cache_data(data, cache_data_size, uncompressed_data,
-                           cf_data.uncompressed_size))
-      goto fail;
+      entry->data = disk_cache_get(dc_job->cache, entry->key, &entry->size);
+   }
+}
 
-   /* Check the data for corruption */
-   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
-                                        cf_data.uncompressed_size))
-      goto fail;
+static void
+destroy_read_job(void *job, int thread_index)
+{
+   free(job);
+}
 
-   free(data);
-   free(filename);
-   free(file_header);
-   close(fd);
+void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_batch_entry *entries, unsigned count,
+                     struct util_queue_fence *fence)
+{
+   struct disk_cache_read_job *dc_job;
 
-   if (size)
-      *size = cf_data.uncompressed_size;
+   /* The Android blob cache is an in-memory lookup, there is nothing to gain
+    * from doing it on another thread.
+    */
+   if (cache->blob_get_cb || cache->path_init_failed) {
+      for (unsigned i = 0; i < count; i++) {
+         entries[i].data = disk_cache_get(cache, entries[i].key,
+                                          &entries[i].size);
+      }
+      return;
+   }
 
-   return uncompressed_data;
+   mtx_lock(&cache->read_queue_mutex);
+   if (!cache->read_queue_initialized) {
+      cache->read_queue_initialized =
+         util_queue_init(&cache->read_queue, "disk$read", 32, 1,
+                         UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                         UTIL_QUEUE_INIT_SHARED_POOL);
+   }
+   mtx_unlock(&cache->read_queue_mutex);
+
+   dc_job = malloc(sizeof(*dc_job));
+   if (!cache->read_queue_initialized || !dc_job) {
+      free(dc_job);
+      for (unsigned i = 0; i < count; i++) {
+         entries[i].data = disk_cache_get(cache, entries[i].key,
+                                          &entries[i].size);
+      }
+      return;
+   }
 
- fail:
-   if (data)
-      free(data);
-   if (uncompressed_data)
-      free(uncompressed_data);
-   if (filename)
-      free(filename);
-   if (file_header)
-      free(file_header);
-   if (fd != -1)
-      close(fd);
+   dc_job->cache = cache;
+   dc_job->entries = entries;
+   dc_job->count = count;
 
-   return NULL;
+   util_queue_add_job(&cache->read_queue, dc_job, fence,
+                      cache_read, destroy_read_job);
 }
 
 void
@@ -75,6 +75,22 @@ struct cache_item_metadata {
 };
 
 struct disk_cache;
+struct util_queue_fence;
+
+/**
+ * An item requested with disk_cache_get_batch().
+ */
+struct disk_cache_batch_entry {
+   /** Name of the item, set by the caller. */
+   cache_key key;
+
+   /**
+    * The item as returned by disk_cache_get(), malloc'ed, or NULL if it is
+    * not in the cache.
+    */
+   void *data;
+   size_t size;
+};
 
 static inline char *
 disk_cache_format_hex_id(char *buf, const uint8_t *hex_id, unsigned size)
@@ -174,6 +190,12 @@ disk_cache_create(const char *gpu_name, const char *timestamp,
 void
 disk_cache_destroy(struct disk_cache *cache);
 
+/**
+ * Wait until all items handed to disk_cache_put() have been written out.
+ */
+void
+disk_cache_wait_for_idle(struct disk_cache *cache);
+
 /**
  * Remove the item in the cache under the name \key.
  */
@@ -210,6 +232,20 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Retrieve \count items at once, the way disk_cache_get() does for each of
+ * them, but asynchronously: the items are read and decompressed on a cache
+ * thread, and \fence is signalled once the data and size of every entry
+ * have been filled in.
+ *
+ * \fence must be initialized and signalled, and \entries must stay valid
+ * until it is signalled again.  It may be signalled before returning.
+ */
+void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_batch_entry *entries, unsigned count,
+                     struct util_queue_fence *fence);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -260,6 +296,12 @@ disk_cache_destroy(struct disk_cache *cache) {
    return;
 }
 
+static inline void
+disk_cache_wait_for_idle(struct disk_cache *cache)
+{
+   return;
+}
+
 static inline void
 disk_cache_put(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -280,6 +322,17 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_get_batch(struct disk_cache *cache,
+                     struct disk_cache_batch_entry *entries, unsigned count,
+                     struct util_queue_fence *fence)
+{
+   for (unsigned i = 0; i < count; i++) {
+      entries[i].data = NULL;
+      entries[i].size = 0;
+   }
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -0,0 +1,271 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef ENABLE_SHADER_CACHE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util/macros.h"
+
+#include "disk_cache_archive.h"
+
+#define ARCHIVE_VERSION 1
+
+static const char archive_magic[8] = "MESAARC";
+
+struct archive_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t count;
+};
+
+/* Entries follow the header, sorted by key, and the items follow them. */
+struct archive_entry {
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t size;
+   uint64_t offset;
+};
+
+struct disk_cache_archive {
+   const uint8_t *map;
+   size_t map_size;
+
+   const struct archive_entry *entries;
+   uint32_t count;
+};
+
+static int
+archive_entry_compare(const void *key, const void *entry)
+{
+   return memcmp(key, ((const struct archive_entry *) entry)->key,
+                 CACHE_KEY_SIZE);
+}
+
+struct disk_cache_archive *
+disk_cache_archive_open(const char *filename)
+{
+   struct disk_cache_archive *archive;
+   const struct archive_header *header;
+   struct stat sb;
+   void *map;
+   int fd;
+
+   fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (fstat(fd, &sb) == -1 || sb.st_size < sizeof(*header)) {
+      close(fd);
+      return NULL;
+   }
+
+   map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return NULL;
+
+   header = map;
+   if (memcmp(header->magic, archive_magic, sizeof(archive_magic)) != 0 ||
+       header->version != ARCHIVE_VERSION ||
+       (sb.st_size - sizeof(*header)) / sizeof(struct archive_entry) <
+       header->count)
+      goto fail;
+
+   archive = calloc(1, sizeof(*archive));
+   if (!archive)
+      goto fail;
+
+   archive->map = map;
+   archive->map_size = sb.st_size;
+   archive->entries = (const struct archive_entry *) (header + 1);
+   archive->count = header->count;
+
+   return archive;
+
+ fail:
+   munmap(map, sb.st_size);
+   return NULL;
+}
+
+void
+disk_cache_archive_close(struct disk_cache_archive *archive)
+{
+   if (!archive)
+      return;
+
+   munmap((void *) archive->map, archive->map_size);
+   free(archive);
+}
+
+static const void *
+archive_entry_data(const struct disk_cache_archive *archive,
+                   const struct archive_entry *entry)
+{
+   if (entry->offset > archive->map_size ||
+       archive->map_size - entry->offset < entry->size)
+      return NULL;
+
+   return archive->map + entry->offset;
+}
+
+const void *
+disk_cache_archive_lookup(const struct disk_cache_archive *archive,
+                          const cache_key key, size_t *size)
+{
+   const struct archive_entry *entry;
+   const void *data;
+
+   entry = bsearch(key, archive->entries, archive->count,
+                   sizeof(*entry), archive_entry_compare);
+   if (!entry)
+      return NULL;
+
+   data = archive_entry_data(archive, entry);
+   if (data && size)
+      *size = entry->size;
+
+   return data;
+}
+
+unsigned
+disk_cache_archive_count(const struct disk_cache_archive *archive)
+{
+   return archive->count;
+}
+
+bool
+disk_cache_archive_item(const struct disk_cache_archive *archive,
+                        unsigned index, struct disk_cache_archive_item *item)
+{
+   const struct archive_entry *entry = &archive->entries[index];
+
+   assert(index < archive->count);
+
+   memcpy(item->key, entry->key, CACHE_KEY_SIZE);
+   item->data = archive_entry_data(archive, entry);
+   item->size = entry->size;
+
+   return item->data != NULL;
+}
+
+static int
+archive_item_compare(const void *a, const void *b)
+{
+   const struct disk_cache_archive_item *ia = a, *ib = b;
+
+   return memcmp(ia->key, ib->key, CACHE_KEY_SIZE);
+}
+
+static bool
+write_all(FILE *f, const void *data, size_t size)
+{
+   return fwrite(data, 1, size, f) == size;
+}
+
+bool
+disk_cache_archive_write(const char *filename,
+                         struct disk_cache_archive_item *items,
+                         unsigned count)
+{
+   struct archive_header header;
+   struct archive_entry entry;
+   char *filename_tmp;
+   unsigned i, unique = 0;
+   uint64_t offset;
+   FILE *f;
+
+   /* Items with the same key were produced from the same inputs by the
+    * same Mesa build, so which of the duplicates is kept doesn't matter.
+    */
+   qsort(items, count, sizeof(*items), archive_item_compare);
+   for (i = 0; i < count; i++) {
+      if (unique > 0 &&
+          memcmp(items[unique - 1].key, items[i].key, CACHE_KEY_SIZE) == 0)
+         continue;
+      items[unique++] = items[i];
+   }
+
+   if (asprintf(&filename_tmp, "%s.tmp", filename) == -1)
+      return false;
+
+   f = fopen(filename_tmp, "wb");
+   if (!f) {
+      free(filename_tmp);
+      return false;
+   }
+
+   memcpy(header.magic, archive_magic, sizeof(archive_magic));
+   header.version = ARCHIVE_VERSION;
+   header.count = unique;
+   if (!write_all(f, &header, sizeof(header)))
+      goto fail;
+
+   offset = sizeof(header) + (uint64_t) unique * sizeof(entry);
+   memset(&entry, 0, sizeof(entry));
+   for (i = 0; i < unique; i++) {
+      memcpy(entry.key, items[i].key, CACHE_KEY_SIZE);
+      entry.size = items[i].size;
+      entry.offset = offset;
+      if (!write_all(f, &entry, sizeof(entry)))
+         goto fail;
+      offset += items[i].size;
+   }
+
+   for (i = 0; i < unique; i++) {
+      if (!write_all(f, items[i].data, items[i].size))
+         goto fail;
+   }
+
+   if (fclose(f) != 0) {
+      f = NULL;
+      goto fail;
+   }
+
+   /* Replace any previous archive atomically, it may be mapped by running
+    * applications.
+    */
+   if (rename(filename_tmp, filename) == -1) {
+      f = NULL;
+      goto fail;
+   }
+
+   free(filename_tmp);
+   return true;
+
+ fail:
+   if (f)
+      fclose(f);
+   unlink(filename_tmp);
+   free(filename_tmp);
+   return false;
+}
+
+#endif /* ENABLE_SHADER_CACHE */
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef DISK_CACHE_ARCHIVE_H
+#define DISK_CACHE_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/disk_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Read-only, precompiled shader cache archive.
+ *
+ * An archive is a single file holding cache items, in the same format as
+ * the per-user cache stores them, behind a table of their keys sorted so
+ * that it can be binary searched.  It is mmapped and never modified, so it
+ * can be shipped with an application and shared by all of its users.
+ * Archives are produced by the mesa_cache_merge tool.
+ */
+struct disk_cache_archive;
+
+struct disk_cache_archive_item {
+   cache_key key;
+   const void *data;
+   size_t size;
+};
+
+/**
+ * \return NULL if \filename can't be mapped or is not a valid archive.
+ */
+struct disk_cache_archive *
+disk_cache_archive_open(const char *filename);
+
+void
+disk_cache_archive_close(struct disk_cache_archive *archive);
+
+/**
+ * \return a pointer to the item stored under \key within the mapping, or
+ * NULL.
+ */
+const void *
+disk_cache_archive_lookup(const struct disk_cache_archive *archive,
+                          const cache_key key, size_t *size);
+
+/**
+ * Returns the number of items in \archive, and the \index'th one of them.
+ * Items are sorted by key.
+ */
+unsigned
+disk_cache_archive_count(const struct disk_cache_archive *archive);
+
+bool
+disk_cache_archive_item(const struct disk_cache_archive *archive,
+                        unsigned index, struct disk_cache_archive_item *item);
+
+/**
+ * Write \count items to a new archive \filename, replacing any existing
+ * one.  \items is sorted in place and only one item is kept per key.
+ */
+bool
+disk_cache_archive_write(const char *filename,
+                         struct disk_cache_archive_item *items,
+                         unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_ARCHIVE_H */
@@ -0,0 +1,215 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
+#include "util/macros.h"
+
+#include "disk_cache_codec.h"
+
+/* The shader cache favours speed over ratio: items are small, written on a
+ * background thread, but read back on the application's startup path.
+ */
+#define ZLIB_LEVEL Z_BEST_SPEED
+#define ZSTD_LEVEL 1
+
+struct codec_funcs {
+   const char *name;
+   size_t (*bound)(size_t in_size);
+   size_t (*compress)(const void *in, size_t in_size,
+                      void *out, size_t out_size);
+   bool (*decompress)(const void *in, size_t in_size,
+                      void *out, size_t out_size);
+};
+
+static size_t
+none_bound(size_t in_size)
+{
+   return in_size;
+}
+
+static size_t
+none_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   if (out_size < in_size)
+      return 0;
+
+   memcpy(out, in, in_size);
+   return in_size;
+}
+
+static bool
+none_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   if (in_size != out_size)
+      return false;
+
+   memcpy(out, in, in_size);
+   return true;
+}
+
+static size_t
+zlib_bound(size_t in_size)
+{
+   return compressBound(in_size);
+}
+
+static size_t
+zlib_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   uLongf compressed_size = out_size;
+
+   if (compress2(out, &compressed_size, in, in_size, ZLIB_LEVEL) != Z_OK)
+      return 0;
+
+   return compressed_size;
+}
+
+static bool
+zlib_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   z_stream strm;
+
+   strm.zalloc = Z_NULL;
+   strm.zfree = Z_NULL;
+   strm.opaque = Z_NULL;
+   strm.next_in = (Bytef *) in;
+   strm.avail_in = in_size;
+   strm.next_out = out;
+   strm.avail_out = out_size;
+
+   if (inflateInit(&strm) != Z_OK)
+      return false;
+
+   /* We know the uncompressed size, so unless there is an error everything
+    * is decompressed in one go.
+    */
+   int ret = inflate(&strm, Z_FINISH);
+   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+
+   (void)inflateEnd(&strm);
+   return ret == Z_STREAM_END && strm.avail_out == 0;
+}
+
+#ifdef HAVE_ZSTD
+static size_t
+zstd_bound(size_t in_size)
+{
+   return ZSTD_compressBound(in_size);
+}
+
+static size_t
+zstd_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   size_t ret = ZSTD_compress(out, out_size, in, in_size, ZSTD_LEVEL);
+
+   return ZSTD_isError(ret) ? 0 : ret;
+}
+
+static bool
+zstd_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+
+   return !ZSTD_isError(ret) && ret == out_size;
+}
+#endif
+
+static const struct codec_funcs codecs[DISK_CACHE_CODEC_COUNT] = {
+   [DISK_CACHE_CODEC_NONE] = {
+      "none", none_bound, none_compress, none_decompress
+   },
+   [DISK_CACHE_CODEC_ZLIB] = {
+      "zlib", zlib_bound, zlib_compress, zlib_decompress
+   },
+#ifdef HAVE_ZSTD
+   [DISK_CACHE_CODEC_ZSTD] = {
+      "zstd", zstd_bound, zstd_compress, zstd_decompress
+   },
+#endif
+};
+
+bool
+disk_cache_codec_supported(enum disk_cache_codec codec)
+{
+   return codec < DISK_CACHE_CODEC_COUNT && codecs[codec].name;
+}
+
+enum disk_cache_codec
+disk_cache_codec_from_env(void)
+{
+   const char *name = getenv("MESA_DISK_CACHE_CODEC");
+
+   if (name) {
+      for (unsigned i = 0; i < ARRAY_SIZE(codecs); i++) {
+         if (codecs[i].name && strcmp(codecs[i].name, name) == 0)
+            return i;
+      }
+   }
+
+#ifdef HAVE_ZSTD
+   return DISK_CACHE_CODEC_ZSTD;
+#else
+   return DISK_CACHE_CODEC_ZLIB;
+#endif
+}
+
+const char *
+disk_cache_codec_name(enum disk_cache_codec codec)
+{
+   return disk_cache_codec_supported(codec) ? codecs[codec].name : "unknown";
+}
+
+size_t
+disk_cache_codec_bound(enum disk_cache_codec codec, size_t in_size)
+{
+   assert(disk_cache_codec_supported(codec));
+   return codecs[codec].bound(in_size);
+}
+
+size_t
+disk_cache_codec_compress(enum disk_cache_codec codec,
+                          const void *in, size_t in_size,
+                          void *out, size_t out_size)
+{
+   assert(disk_cache_codec_supported(codec));
+   return codecs[codec].compress(in, in_size, out, out_size);
+}
+
+bool
+disk_cache_codec_decompress(enum disk_cache_codec codec,
+                            const void *in, size_t in_size,
+                            void *out, size_t out_size)
+{
+   if (!disk_cache_codec_supported(codec))
+      return false;
+
+   return codecs[codec].decompress(in, in_size, out, out_size);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef DISK_CACHE_CODEC_H
+#define DISK_CACHE_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Compression codecs for shader cache items.
+ *
+ * The codec an item was compressed with is recorded in its header, so items
+ * written with any supported codec can be read back regardless of the codec
+ * currently selected for writing.  The values are stored on disk and must
+ * not change.
+ */
+enum disk_cache_codec {
+   DISK_CACHE_CODEC_NONE = 0,
+   DISK_CACHE_CODEC_ZLIB = 1,
+   DISK_CACHE_CODEC_ZSTD = 2,
+   DISK_CACHE_CODEC_COUNT
+};
+
+bool
+disk_cache_codec_supported(enum disk_cache_codec codec);
+
+/**
+ * Returns the codec selected by MESA_DISK_CACHE_CODEC, or the fastest
+ * supported one if the variable is unset or names an unsupported codec.
+ */
+enum disk_cache_codec
+disk_cache_codec_from_env(void);
+
+const char *
+disk_cache_codec_name(enum disk_cache_codec codec);
+
+/**
+ * Upper bound of the compressed size of \in_size bytes.
+ */
+size_t
+disk_cache_codec_bound(enum disk_cache_codec codec, size_t in_size);
+
+/**
+ * Compresses \in_size bytes of \in into \out, which must hold at least
+ * disk_cache_codec_bound() bytes.
+ *
+ * \return the compressed size, or 0 on failure.
+ */
+size_t
+disk_cache_codec_compress(enum disk_cache_codec codec,
+                          const void *in, size_t in_size,
+                          void *out, size_t out_size);
+
+/**
+ * Decompresses \in_size bytes of \in into exactly \out_size bytes of \out.
+ */
+bool
+disk_cache_codec_decompress(enum disk_cache_codec codec,
+                            const void *in, size_t in_size,
+                            void *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_CODEC_H */
@@ -0,0 +1,697 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef ENABLE_SHADER_CACHE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "c11/threads.h"
+#include "util/bitscan.h"
+#include "util/crc32.h"
+#include "util/macros.h"
+#include "util/u_atomic.h"
+
+#include "disk_cache_db.h"
+
+#define DB_INDEX_FILE_NAME "packed.idx"
+#define DB_DATA_FILE_NAME  "packed.data"
+
+/* Bump whenever the layout of either file changes.  Files of any other
+ * version are discarded on open.
+ */
+#define DB_VERSION 1
+
+/* Number of index slots a new database starts with. */
+#define DB_MIN_CAPACITY 1024
+
+/* Marks the slot of a removed entry, so that probing continues past it. */
+#define DB_OFFSET_DELETED UINT64_MAX
+
+static const char db_index_magic[8] = "MESAIDX";
+static const char db_data_magic[8] = "MESADAT";
+
+struct db_index_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t capacity;      /* number of slots, a power of two */
+   uint32_t count;         /* live entries */
+   uint32_t deleted;       /* slots holding DB_OFFSET_DELETED */
+   uint64_t data_size;     /* end of the used part of the data file */
+   uint64_t live_size;     /* bytes of the records of live entries */
+   uint64_t clock;         /* source of the last_used timestamps */
+};
+
+struct db_index_entry {
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t size;          /* size of the data, without record header */
+   uint64_t offset;        /* of the record in the data file, 0 if free */
+   uint64_t last_used;
+};
+
+struct db_data_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t pad;
+};
+
+/* Precedes each entry's data in the data file, so that a stale or corrupt
+ * index entry is detected on read.
+ */
+struct db_record_header {
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t size;
+   uint32_t crc32;
+};
+
+struct disk_cache_db {
+   /* flock() is per open file, so it doesn't exclude our own threads */
+   mtx_t mutex;
+
+   int index_fd;
+   int data_fd;
+
+   /* The mmapped index file. */
+   struct db_index_header *header;
+   struct db_index_entry *entries;
+   size_t map_size;
+
+   uint64_t max_size;
+};
+
+static inline size_t
+db_index_size(uint32_t capacity)
+{
+   return sizeof(struct db_index_header) +
+          (size_t)capacity * sizeof(struct db_index_entry);
+}
+
+static inline uint64_t
+db_record_size(uint32_t size)
+{
+   return sizeof(struct db_record_header) + size;
+}
+
+/* Map the index file as large as it currently is. */
+static bool
+db_map_index(struct disk_cache_db *db)
+{
+   struct stat sb;
+   void *map;
+
+   if (fstat(db->index_fd, &sb) == -1 ||
+       sb.st_size < sizeof(struct db_index_header))
+      return false;
+
+   if (db->header) {
+      munmap(db->header, db->map_size);
+      db->header = NULL;
+      db->entries = NULL;
+      db->map_size = 0;
+   }
+
+   map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              db->index_fd, 0);
+   if (map == MAP_FAILED)
+      return false;
+
+   db->header = map;
+   db->entries = (struct db_index_entry *)(db->header + 1);
+   db->map_size = sb.st_size;
+   return true;
+}
+
+static bool
+db_lock(struct disk_cache_db *db, int operation)
+{
+   mtx_lock(&db->mutex);
+
+   if (flock(db->index_fd, operation) == -1) {
+      mtx_unlock(&db->mutex);
+      return false;
+   }
+
+   /* Another process may have grown the index. */
+   if (db_index_size(db->header->capacity) > db->map_size &&
+       !db_map_index(db)) {
+      flock(db->index_fd, LOCK_UN);
+      mtx_unlock(&db->mutex);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+db_unlock(struct disk_cache_db *db)
+{
+   flock(db->index_fd, LOCK_UN);
+   mtx_unlock(&db->mutex);
+}
+
+static bool
+db_is_valid(struct disk_cache_db *db)
+{
+   const struct db_index_header *header = db->header;
+   struct stat sb;
+
+   if (memcmp(header->magic, db_index_magic, sizeof(db_index_magic)) ||
+       header->version != DB_VERSION ||
+       !util_is_power_of_two_nonzero(header->capacity) ||
+       db_index_size(header->capacity) > db->map_size ||
+       header->count + header->deleted > header->capacity)
+      return false;
+
+   if (fstat(db->data_fd, &sb) == -1 ||
+       header->data_size < sizeof(struct db_data_header) ||
+       header->data_size > sb.st_size)
+      return false;
+
+   return true;
+}
+
+/* Start over with an empty database.
+ *
+ * The index file is never shrunk, since other processes may have it
+ * mapped.  The data file is truncated, which is harmless: readers check
+ * each record against the index.
+ */
+static bool
+db_reset(struct disk_cache_db *db)
+{
+   struct db_data_header data_header;
+   uint32_t capacity = DB_MIN_CAPACITY;
+
+   if (db->map_size < db_index_size(capacity)) {
+      if (ftruncate(db->index_fd, db_index_size(capacity)) == -1 ||
+          !db_map_index(db))
+         return false;
+   }
+
+   while (db_index_size(capacity * 2) <= db->map_size)
+      capacity *= 2;
+
+   memset(db->header, 0, db_index_size(capacity));
+   memcpy(db->header->magic, db_index_magic, sizeof(db_index_magic));
+   db->header->version = DB_VERSION;
+   db->header->capacity = capacity;
+   db->header->data_size = sizeof(data_header);
+
+   memset(&data_header, 0, sizeof(data_header));
+   memcpy(data_header.magic, db_data_magic, sizeof(db_data_magic));
+   data_header.version = DB_VERSION;
+
+   if (ftruncate(db->data_fd, 0) == -1 ||
+       pwrite(db->data_fd, &data_header, sizeof(data_header), 0) !=
+       sizeof(data_header))
+      return false;
+
+   return true;
+}
+
+/* Find the slot of \key, or the slot it would be inserted in. */
+static uint32_t
+db_find(const struct disk_cache_db *db, const cache_key key, bool *found)
+{
+   const uint32_t mask = db->header->capacity - 1;
+   uint32_t hash, i, n, insert = UINT32_MAX;
+
+   /* The keys are cryptographic hashes already. */
+   memcpy(&hash, key, sizeof(hash));
+
+   for (i = hash & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+      const struct db_index_entry *entry = &db->entries[i];
+
+      if (entry->offset == 0)
+         break;
+
+      if (entry->offset == DB_OFFSET_DELETED) {
+         if (insert == UINT32_MAX)
+            insert = i;
+      } else if (memcmp(entry->key, key, CACHE_KEY_SIZE) == 0) {
+         *found = true;
+         return i;
+      }
+   }
+
+   *found = false;
+   return insert != UINT32_MAX ? insert : i;
+}
+
+static void
+db_remove_entry(struct disk_cache_db *db, struct db_index_entry *entry)
+{
+   db->header->live_size -= db_record_size(entry->size);
+   db->header->count--;
+   db->header->deleted++;
+   entry->offset = DB_OFFSET_DELETED;
+}
+
+struct db_sort_item {
+   uint64_t value;
+   uint32_t slot;
+};
+
+static int
+db_sort_item_compare(const void *a, const void *b)
+{
+   const struct db_sort_item *ia = a, *ib = b;
+
+   return ia->value < ib->value ? -1 : ia->value > ib->value;
+}
+
+/* Return the live slots sorted by last_used, or by offset. */
+static struct db_sort_item *
+db_sorted_entries(struct disk_cache_db *db, bool by_offset)
+{
+   struct db_sort_item *items;
+   uint32_t i, n = 0;
+
+   items = malloc(MAX2(db->header->count, 1) * sizeof(*items));
+   if (!items)
+      return NULL;
+
+   for (i = 0; i < db->header->capacity && n < db->header->count; i++) {
+      const struct db_index_entry *entry = &db->entries[i];
+
+      if (entry->offset == 0 || entry->offset == DB_OFFSET_DELETED)
+         continue;
+
+      items[n].value = by_offset ? entry->offset : entry->last_used;
+      items[n].slot = i;
+      n++;
+   }
+
+   qsort(items, n, sizeof(*items), db_sort_item_compare);
+   return items;
+}
+
+/* Evict least recently used entries until \needed more bytes fit.
+ *
+ * A tenth of the maximum size is freed on top of that, so that the sort is
+ * not repeated for every new entry of a full cache.
+ */
+static void
+db_evict_lru(struct disk_cache_db *db, uint64_t needed)
+{
+   uint64_t target = db->max_size - needed;
+   struct db_sort_item *items;
+   uint32_t i, count = db->header->count;
+
+   target = MIN2(target, db->max_size - db->max_size / 10);
+
+   items = db_sorted_entries(db, false);
+   if (!items)
+      return;
+
+   for (i = 0; i < count && db->header->live_size > target; i++)
+      db_remove_entry(db, &db->entries[items[i].slot]);
+
+   free(items);
+}
+
+/* Move the records of live entries to the front of the data file, in their
+ * current order, and truncate it.
+ */
+static void
+db_compact(struct disk_cache_db *db)
+{
+   uint64_t pos = sizeof(struct db_data_header);
+   struct db_sort_item *items;
+   void *buf = NULL;
+   size_t buf_size = 0;
+   uint32_t i, count = db->header->count;
+
+   items = db_sorted_entries(db, true);
+   if (!items)
+      return;
+
+   for (i = 0; i < count; i++) {
+      struct db_index_entry *entry = &db->entries[items[i].slot];
+      uint64_t size = db_record_size(entry->size);
+
+      if (entry->offset != pos) {
+         if (size > buf_size) {
+            void *new_buf = realloc(buf, size);
+            if (!new_buf) {
+               db_remove_entry(db, entry);
+               continue;
+            }
+            buf = new_buf;
+            buf_size = size;
+         }
+
+         /* Records only ever move backwards, so this never overwrites one
+          * which is still to be moved.
+          */
+         if (pread(db->data_fd, buf, size, entry->offset) != size ||
+             pwrite(db->data_fd, buf, size, pos) != size) {
+            db_remove_entry(db, entry);
+            continue;
+         }
+         entry->offset = pos;
+      }
+      pos += size;
+   }
+
+   free(buf);
+   free(items);
+
+   /* Should truncation fail, the tail is still reused by the next put. */
+   db->header->data_size = pos;
+   if (ftruncate(db->data_fd, pos) == -1)
+      return;
+}
+
+/* Rehash into a table at most half full, dropping the deleted slots. */
+static bool
+db_resize(struct disk_cache_db *db)
+{
+   struct db_index_entry *live;
+   uint32_t capacity = db->header->capacity;
+   uint32_t i, n = 0;
+
+   while (capacity < (db->header->count + 1) * 2)
+      capacity *= 2;
+
+   live = malloc(MAX2(db->header->count, 1) * sizeof(*live));
+   if (!live)
+      return false;
+
+   for (i = 0; i < db->header->capacity; i++) {
+      const struct db_index_entry *entry = &db->entries[i];
+
+      if (entry->offset != 0 && entry->offset != DB_OFFSET_DELETED)
+         live[n++] = *entry;
+   }
+
+   if (db_index_size(capacity) > db->map_size) {
+      if (ftruncate(db->index_fd, db_index_size(capacity)) == -1 ||
+          !db_map_index(db)) {
+         free(live);
+         return false;
+      }
+   }
+
+   memset(db->entries, 0, capacity * sizeof(*live));
+   db->header->capacity = capacity;
+   db->header->deleted = 0;
+
+   for (i = 0; i < n; i++) {
+      bool found;
+      uint32_t slot = db_find(db, live[i].key, &found);
+
+      db->entries[slot] = live[i];
+   }
+
+   free(live);
+   return true;
+}
+
+struct disk_cache_db *
+disk_cache_db_open(const char *path, uint64_t max_size)
+{
+   struct disk_cache_db *db;
+   char *filename;
+   bool ok;
+
+   db = calloc(1, sizeof(*db));
+   if (!db)
+      return NULL;
+
+   db->index_fd = -1;
+   db->data_fd = -1;
+   db->max_size = max_size;
+
+   if (asprintf(&filename, "%s/%s", path, DB_INDEX_FILE_NAME) == -1)
+      goto fail;
+   db->index_fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   free(filename);
+   if (db->index_fd == -1)
+      goto fail;
+
+   if (asprintf(&filename, "%s/%s", path, DB_DATA_FILE_NAME) == -1)
+      goto fail;
+   db->data_fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   free(filename);
+   if (db->data_fd == -1)
+      goto fail;
+
+   if (flock(db->index_fd, LOCK_EX) == -1)
+      goto fail;
+
+   if (db_map_index(db) && db_is_valid(db)) {
+      ok = true;
+   } else {
+      ok = db_reset(db);
+   }
+
+   flock(db->index_fd, LOCK_UN);
+
+   if (!ok)
+      goto fail;
+
+   mtx_init(&db->mutex, mtx_plain);
+
+   return db;
+
+ fail:
+   if (db->header)
+      munmap(db->header, db->map_size);
+   if (db->index_fd != -1)
+      close(db->index_fd);
+   if (db->data_fd != -1)
+      close(db->data_fd);
+   free(db);
+
+   return NULL;
+}
+
+void
+disk_cache_db_close(struct disk_cache_db *db)
+{
+   if (!db)
+      return;
+
+   munmap(db->header, db->map_size);
+   close(db->index_fd);
+   close(db->data_fd);
+   mtx_destroy(&db->mutex);
+   free(db);
+}
+
+bool
+disk_cache_db_put(struct disk_cache_db *db, const cache_key key,
+                  const void *data, size_t size)
+{
+   const uint64_t record_size = db_record_size(size);
+   struct db_record_header record;
+   struct db_index_entry *entry;
+   uint64_t offset;
+   uint32_t slot;
+   bool found;
+
+   if (record_size > db->max_size || size > UINT32_MAX)
+      return false;
+
+   memcpy(record.key, key, CACHE_KEY_SIZE);
+   record.size = size;
+   record.crc32 = util_hash_crc32(data, size);
+
+   if (!db_lock(db, LOCK_EX))
+      return false;
+
+   slot = db_find(db, key, &found);
+   if (found) {
+      db->entries[slot].last_used = p_atomic_inc_return(&db->header->clock);
+      db_unlock(db);
+      return true;
+   }
+
+   if (db->header->live_size + record_size > db->max_size)
+      db_evict_lru(db, record_size);
+
+   if (db->header->data_size - sizeof(struct db_data_header) >
+       2 * db->header->live_size)
+      db_compact(db);
+
+   if ((db->header->count + db->header->deleted + 1) * 4 >
+       db->header->capacity * 3 && !db_resize(db)) {
+      db_unlock(db);
+      return false;
+   }
+
+   /* Write the data before the index entry pointing at it. */
+   offset = db->header->data_size;
+   if (pwrite(db->data_fd, &record, sizeof(record), offset) !=
+       sizeof(record) ||
+       pwrite(db->data_fd, data, size, offset + sizeof(record)) != size) {
+      db_unlock(db);
+      return false;
+   }
+
+   slot = db_find(db, key, &found);
+   entry = &db->entries[slot];
+   if (entry->offset == DB_OFFSET_DELETED)
+      db->header->deleted--;
+
+   memcpy(entry->key, key, CACHE_KEY_SIZE);
+   entry->size = size;
+   entry->last_used = p_atomic_inc_return(&db->header->clock);
+   entry->offset = offset;
+
+   db->header->data_size += record_size;
+   db->header->live_size += record_size;
+   db->header->count++;
+
+   db_unlock(db);
+   return true;
+}
+
+void *
+disk_cache_db_get(struct disk_cache_db *db, const cache_key key,
+                  size_t *size)
+{
+   struct db_record_header record;
+   struct db_index_entry *entry;
+   void *data = NULL;
+   uint32_t slot;
+   bool found;
+
+   if (!db_lock(db, LOCK_SH))
+      return NULL;
+
+   slot = db_find(db, key, &found);
+   if (!found)
+      goto out;
+
+   entry = &db->entries[slot];
+
+   /* Benign race with other readers: any of the timestamps will do. */
+   entry->last_used = p_atomic_inc_return(&db->header->clock);
+
+   if (pread(db->data_fd, &record, sizeof(record), entry->offset) !=
+       sizeof(record) ||
+       memcmp(record.key, key, CACHE_KEY_SIZE) != 0 ||
+       record.size != entry->size)
+      goto out;
+
+   data = malloc(record.size);
+   if (!data)
+      goto out;
+
+   if (pread(db->data_fd, data, record.size,
+             entry->offset + sizeof(record)) != record.size) {
+      free(data);
+      data = NULL;
+      goto out;
+   }
+
+ out:
+   db_unlock(db);
+
+   if (data && util_hash_crc32(data, record.size) != record.crc32) {
+      free(data);
+      data = NULL;
+   }
+
+   if (data && size)
+      *size = record.size;
+
+   return data;
+}
+
+void
+disk_cache_db_remove(struct disk_cache_db *db, const cache_key key)
+{
+   uint32_t slot;
+   bool found;
+
+   if (!db_lock(db, LOCK_EX))
+      return;
+
+   slot = db_find(db, key, &found);
+   if (found)
+      db_remove_entry(db, &db->entries[slot]);
+
+   db_unlock(db);
+}
+
+void
+disk_cache_db_foreach(struct disk_cache_db *db,
+                      disk_cache_db_foreach_cb callback, void *data)
+{
+   struct db_sort_item *items;
+   uint32_t i, count;
+   void *buf = NULL;
+   size_t buf_size = 0;
+
+   if (!db_lock(db, LOCK_SH))
+      return;
+
+   /* Visit the records in file order, to read the data file sequentially. */
+   count = db->header->count;
+   items = db_sorted_entries(db, true);
+   if (!items)
+      goto out;
+
+   for (i = 0; i < count; i++) {
+      const struct db_index_entry *entry = &db->entries[items[i].slot];
+      struct db_record_header record;
+
+      if (pread(db->data_fd, &record, sizeof(record), entry->offset) !=
+          sizeof(record) ||
+          record.size != entry->size)
+         continue;
+
+      if (record.size > buf_size) {
+         void *new_buf = realloc(buf, record.size);
+         if (!new_buf)
+            break;
+         buf = new_buf;
+         buf_size = record.size;
+      }
+
+      if (pread(db->data_fd, buf, record.size,
+                entry->offset + sizeof(record)) != record.size ||
+          util_hash_crc32(buf, record.size) != record.crc32)
+         continue;
+
+      callback(data, record.key, buf, record.size);
+   }
+
+   free(buf);
+   free(items);
+
+ out:
+   db_unlock(db);
+}
+
+#endif /* ENABLE_SHADER_CACHE */
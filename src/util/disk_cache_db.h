@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef DISK_CACHE_DB_H
+#define DISK_CACHE_DB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/disk_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Packed storage for the shader cache.
+ *
+ * Instead of one file per entry, all entries are appended to a single data
+ * file, and located through an open-addressing hash table of cache keys
+ * kept in a second, mmapped, index file.  The index records when each entry
+ * was last used, so eviction is true LRU, and the space of evicted entries
+ * is reclaimed by compacting the data file once it makes up half of it.
+ *
+ * Both files may be shared by several processes.  Every operation holds an
+ * flock() on the index file for its duration.
+ */
+struct disk_cache_db;
+
+/**
+ * Open (or create) the database in the directory \path, keeping the total
+ * size of the stored entries under \max_size bytes.
+ *
+ * \return NULL on failure.
+ */
+struct disk_cache_db *
+disk_cache_db_open(const char *path, uint64_t max_size);
+
+void
+disk_cache_db_close(struct disk_cache_db *db);
+
+/**
+ * Store \size bytes of \data under \key, evicting the least recently used
+ * entries as needed.  Nothing is done if \key is already present.
+ */
+bool
+disk_cache_db_put(struct disk_cache_db *db, const cache_key key,
+                  const void *data, size_t size);
+
+/**
+ * \return a malloc'ed copy of the data stored under \key, or NULL.
+ */
+void *
+disk_cache_db_get(struct disk_cache_db *db, const cache_key key,
+                  size_t *size);
+
+void
+disk_cache_db_remove(struct disk_cache_db *db, const cache_key key);
+
+typedef void (*disk_cache_db_foreach_cb)(void *data, const cache_key key,
+                                         const void *item, size_t size);
+
+/**
+ * Call \callback for every entry of the database.  The database is locked
+ * for the whole walk, \callback must not call back into it.
+ */
+void
+disk_cache_db_foreach(struct disk_cache_db *db,
+                      disk_cache_db_foreach_cb callback, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_DB_H */
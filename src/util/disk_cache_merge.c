@@ -0,0 +1,327 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Merges shader caches into a read-only archive, which applications can
+ * use through MESA_DISK_CACHE_ARCHIVE.
+ *
+ * Usage: mesa_cache_merge -o ARCHIVE INPUT...
+ *
+ * Each input is either a cache directory (such as
+ * ~/.cache/mesa_shader_cache), using one file per item or the packed
+ * database layout, or a previously merged archive.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/disk_cache.h"
+#include "util/disk_cache_archive.h"
+#include "util/disk_cache_db.h"
+#include "util/macros.h"
+
+struct merge_state {
+   struct disk_cache_archive_item *items;
+   unsigned count;
+   unsigned capacity;
+};
+
+static bool
+add_item(struct merge_state *state, const cache_key key,
+         const void *data, size_t size)
+{
+   struct disk_cache_archive_item *item;
+   void *copy;
+
+   if (state->count == state->capacity) {
+      unsigned capacity = state->capacity ? state->capacity * 2 : 1024;
+      void *items = realloc(state->items, capacity * sizeof(*state->items));
+
+      if (!items)
+         return false;
+
+      state->items = items;
+      state->capacity = capacity;
+   }
+
+   copy = malloc(size);
+   if (!copy)
+      return false;
+   memcpy(copy, data, size);
+
+   item = &state->items[state->count++];
+   memcpy(item->key, key, CACHE_KEY_SIZE);
+   item->data = copy;
+   item->size = size;
+
+   return true;
+}
+
+static int
+hex_digit(char c)
+{
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+/* Parse the lowercase hex string \hex, of 2 * \size characters. */
+static bool
+parse_hex(const char *hex, uint8_t *out, unsigned size)
+{
+   if (strlen(hex) != size * 2)
+      return false;
+
+   for (unsigned i = 0; i < size; i++) {
+      int hi = hex_digit(hex[2 * i]), lo = hex_digit(hex[2 * i + 1]);
+
+      if (hi < 0 || lo < 0)
+         return false;
+      out[i] = hi << 4 | lo;
+   }
+
+   return true;
+}
+
+static void *
+read_file(const char *filename, size_t *size)
+{
+   struct stat sb;
+   void *data;
+   FILE *f;
+
+   f = fopen(filename, "rb");
+   if (!f)
+      return NULL;
+
+   if (fstat(fileno(f), &sb) == -1 || !S_ISREG(sb.st_mode)) {
+      fclose(f);
+      return NULL;
+   }
+
+   data = malloc(MAX2(sb.st_size, 1));
+   if (data && fread(data, 1, sb.st_size, f) != sb.st_size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+
+   *size = sb.st_size;
+   return data;
+}
+
+/* Items of the one file per item layout live in <path>/<xx>/<yyyy...>,
+ * where xx are the first two hex digits of the key.
+ */
+static unsigned
+merge_cache_files(struct merge_state *state, const char *path)
+{
+   unsigned count = 0;
+   struct dirent *d, *e;
+   DIR *dir, *subdir;
+
+   dir = opendir(path);
+   if (!dir)
+      return 0;
+
+   while ((d = readdir(dir))) {
+      cache_key key;
+      char *subpath;
+
+      if (!parse_hex(d->d_name, key, 1))
+         continue;
+
+      if (asprintf(&subpath, "%s/%s", path, d->d_name) == -1)
+         continue;
+
+      subdir = opendir(subpath);
+      while (subdir && (e = readdir(subdir))) {
+         char *filename;
+         size_t size;
+         void *data;
+
+         /* This also skips the temporary files of items being written. */
+         if (!parse_hex(e->d_name, key + 1, CACHE_KEY_SIZE - 1))
+            continue;
+
+         if (asprintf(&filename, "%s/%s", subpath, e->d_name) == -1)
+            continue;
+
+         data = read_file(filename, &size);
+         if (data && add_item(state, key, data, size))
+            count++;
+
+         free(data);
+         free(filename);
+      }
+
+      if (subdir)
+         closedir(subdir);
+      free(subpath);
+   }
+
+   closedir(dir);
+   return count;
+}
+
+struct db_merge {
+   struct merge_state *state;
+   unsigned count;
+};
+
+static void
+merge_db_item(void *data, const cache_key key, const void *item, size_t size)
+{
+   struct db_merge *merge = data;
+
+   if (add_item(merge->state, key, item, size))
+      merge->count++;
+}
+
+static unsigned
+merge_cache_db(struct merge_state *state, const char *path)
+{
+   struct db_merge merge = { state, 0 };
+   struct disk_cache_db *db;
+   char *filename;
+   bool exists;
+
+   /* disk_cache_db_open() would create an empty database. */
+   if (asprintf(&filename, "%s/packed.idx", path) == -1)
+      return 0;
+   exists = access(filename, R_OK) == 0;
+   free(filename);
+   if (!exists)
+      return 0;
+
+   db = disk_cache_db_open(path, UINT64_MAX);
+   if (!db)
+      return 0;
+
+   disk_cache_db_foreach(db, merge_db_item, &merge);
+   disk_cache_db_close(db);
+
+   return merge.count;
+}
+
+static int
+merge_archive(struct merge_state *state, const char *filename)
+{
+   struct disk_cache_archive *archive;
+   unsigned i, count = 0;
+
+   archive = disk_cache_archive_open(filename);
+   if (!archive)
+      return -1;
+
+   for (i = 0; i < disk_cache_archive_count(archive); i++) {
+      struct disk_cache_archive_item item;
+
+      if (disk_cache_archive_item(archive, i, &item) &&
+          add_item(state, item.key, item.data, item.size))
+         count++;
+   }
+
+   disk_cache_archive_close(archive);
+   return count;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s -o ARCHIVE INPUT...\n"
+           "\n"
+           "Merges shader cache directories and archives into ARCHIVE.\n",
+           name);
+}
+
+int
+main(int argc, char **argv)
+{
+   struct merge_state state = { 0 };
+   const char *output = NULL;
+   unsigned i;
+   int opt, ret = 0;
+
+   while ((opt = getopt(argc, argv, "o:h")) != -1) {
+      switch (opt) {
+      case 'o':
+         output = optarg;
+         break;
+      default:
+         usage(argv[0]);
+         return opt == 'h' ? 0 : 1;
+      }
+   }
+
+   if (!output || optind == argc) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   for (i = optind; i < argc; i++) {
+      struct stat sb;
+      int count;
+
+      if (stat(argv[i], &sb) == -1) {
+         fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+         ret = 1;
+         continue;
+      }
+
+      if (S_ISDIR(sb.st_mode)) {
+         count = merge_cache_files(&state, argv[i]) +
+                 merge_cache_db(&state, argv[i]);
+      } else {
+         count = merge_archive(&state, argv[i]);
+      }
+
+      if (count < 0) {
+         fprintf(stderr, "%s: not a shader cache archive\n", argv[i]);
+         ret = 1;
+         continue;
+      }
+
+      printf("%s: %d items\n", argv[i], count);
+   }
+
+   if (!disk_cache_archive_write(output, state.items, state.count)) {
+      fprintf(stderr, "%s: failed to write archive\n", output);
+      ret = 1;
+   }
+
+   for (i = 0; i < state.count; i++)
+      free((void *) state.items[i].data);
+   free(state.items);
+
+   return ret;
+}
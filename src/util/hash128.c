@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* MurmurHash3 was written by Austin Appleby, and placed in the public
+ * domain.  This is the x64_128 variant, made incremental.
+ */
+
+#include <string.h>
+
+#include "hash128.h"
+#include "u_math.h"
+
+#define C1 0x87c37b91114253d5ull
+#define C2 0x4cf5ad432745937full
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k)
+{
+   k ^= k >> 33;
+   k *= 0xff51afd7ed558ccdull;
+   k ^= k >> 33;
+   k *= 0xc4ceb9fe1a85ec53ull;
+   k ^= k >> 33;
+   return k;
+}
+
+static inline uint64_t
+load_le64(const uint8_t *p)
+{
+   uint64_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return util_le64_to_cpu(v);
+}
+
+static inline void
+mix_k1(struct mesa_hash128 *ctx, uint64_t k1)
+{
+   k1 *= C1;
+   k1 = rotl64(k1, 31);
+   k1 *= C2;
+   ctx->h1 ^= k1;
+}
+
+static inline void
+mix_k2(struct mesa_hash128 *ctx, uint64_t k2)
+{
+   k2 *= C2;
+   k2 = rotl64(k2, 33);
+   k2 *= C1;
+   ctx->h2 ^= k2;
+}
+
+static void
+hash_blocks(struct mesa_hash128 *ctx, const uint8_t *data, size_t nblocks)
+{
+   uint64_t h1 = ctx->h1, h2 = ctx->h2;
+
+   for (; nblocks > 0; nblocks--, data += 16) {
+      uint64_t k1 = load_le64(data);
+      uint64_t k2 = load_le64(data + 8);
+
+      k1 *= C1;
+      k1 = rotl64(k1, 31);
+      k1 *= C2;
+      h1 ^= k1;
+
+      h1 = rotl64(h1, 27);
+      h1 += h2;
+      h1 = h1 * 5 + 0x52dce729;
+
+      k2 *= C2;
+      k2 = rotl64(k2, 33);
+      k2 *= C1;
+      h2 ^= k2;
+
+      h2 = rotl64(h2, 31);
+      h2 += h1;
+      h2 = h2 * 5 + 0x38495ab5;
+   }
+
+   ctx->h1 = h1;
+   ctx->h2 = h2;
+}
+
+void
+_mesa_hash128_init(struct mesa_hash128 *ctx, uint64_t seed)
+{
+   ctx->h1 = seed;
+   ctx->h2 = seed;
+   ctx->size = 0;
+}
+
+void
+_mesa_hash128_update(struct mesa_hash128 *ctx, const void *data, size_t size)
+{
+   const uint8_t *p = data;
+   unsigned buffered = ctx->size % 16;
+
+   ctx->size += size;
+
+   if (buffered) {
+      unsigned n = MIN2(size, 16 - buffered);
+
+      memcpy(ctx->buffer + buffered, p, n);
+      p += n;
+      size -= n;
+      if (buffered + n < 16)
+         return;
+      hash_blocks(ctx, ctx->buffer, 1);
+   }
+
+   hash_blocks(ctx, p, size / 16);
+   memcpy(ctx->buffer, p + (size & ~(size_t)15), size % 16);
+}
+
+void
+_mesa_hash128_final(struct mesa_hash128 *ctx, unsigned char result[16])
+{
+   const uint8_t *tail = ctx->buffer;
+   uint64_t k1 = 0, k2 = 0;
+   uint64_t h1, h2;
+   unsigned i, n = ctx->size % 16;
+
+   for (i = n; i > 8; i--)
+      k2 |= (uint64_t)tail[i - 1] << (8 * (i - 9));
+   if (n > 8)
+      mix_k2(ctx, k2);
+
+   for (i = MIN2(n, 8); i > 0; i--)
+      k1 |= (uint64_t)tail[i - 1] << (8 * (i - 1));
+   if (n > 0)
+      mix_k1(ctx, k1);
+
+   h1 = ctx->h1 ^ ctx->size;
+   h2 = ctx->h2 ^ ctx->size;
+
+   h1 += h2;
+   h2 += h1;
+
+   h1 = fmix64(h1);
+   h2 = fmix64(h2);
+
+   h1 += h2;
+   h2 += h1;
+
+   h1 = util_cpu_to_le64(h1);
+   h2 = util_cpu_to_le64(h2);
+   memcpy(result, &h1, 8);
+   memcpy(result + 8, &h2, 8);
+}
+
+void
+_mesa_hash128_compute(const void *data, size_t size, unsigned char result[16])
+{
+   struct mesa_hash128 ctx;
+
+   _mesa_hash128_init(&ctx, 0);
+   _mesa_hash128_update(&ctx, data, size);
+   _mesa_hash128_final(&ctx, result);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Fast 128-bit non-cryptographic hash (MurmurHash3_x64_128).
+ *
+ * This is several times faster than SHA-1, and with 128 bits accidental
+ * collisions are as unlikely, but it is trivial to build collisions on
+ * purpose.  Use it for keys that never leave the process, like in-memory
+ * caches, and keep using _mesa_sha1_*() for anything that ends up on disk or
+ * may be fed by an application.
+ *
+ * The API mirrors mesa-sha1.h.  The result doesn't depend on how the data is
+ * split across _mesa_hash128_update() calls, nor on the host endianness.
+ */
+
+#ifndef HASH128_H
+#define HASH128_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mesa_hash128 {
+   uint64_t h1, h2;
+   uint64_t size;
+   uint8_t buffer[16];
+};
+
+void
+_mesa_hash128_init(struct mesa_hash128 *ctx, uint64_t seed);
+
+void
+_mesa_hash128_update(struct mesa_hash128 *ctx, const void *data, size_t size);
+
+void
+_mesa_hash128_final(struct mesa_hash128 *ctx, unsigned char result[16]);
+
+void
+_mesa_hash128_compute(const void *data, size_t size, unsigned char result[16]);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hash128.h"
+
+static void
+hash_seeded(const void *data, size_t size, uint64_t seed,
+            unsigned char result[16])
+{
+   struct mesa_hash128 ctx;
+
+   _mesa_hash128_init(&ctx, seed);
+   _mesa_hash128_update(&ctx, data, size);
+   _mesa_hash128_final(&ctx, result);
+}
+
+/* The SMHasher verification value of MurmurHash3_x64_128: hash keys
+ * {}, {0}, {0, 1}, ... with seeds 256, 255, ..., then hash the results.
+ */
+static void
+test_verification(void)
+{
+   uint8_t key[256], hashes[16 * 256], final[16];
+
+   for (unsigned i = 0; i < 256; i++) {
+      key[i] = i;
+      hash_seeded(key, i, 256 - i, &hashes[16 * i]);
+   }
+   hash_seeded(hashes, sizeof(hashes), 0, final);
+
+   assert((final[0] | final[1] << 8 | final[2] << 16 |
+           (uint32_t)final[3] << 24) == 0x6384ba69);
+}
+
+/* The result doesn't depend on how the data is split. */
+static void
+test_pieces(void)
+{
+   uint8_t data[300], expected[16], result[16];
+
+   for (unsigned i = 0; i < sizeof(data); i++)
+      data[i] = i * 13 + 5;
+
+   for (unsigned n = 0; n <= sizeof(data); n += 7) {
+      _mesa_hash128_compute(data, n, expected);
+
+      for (unsigned piece = 1; piece <= 33; piece += 4) {
+         struct mesa_hash128 ctx;
+
+         _mesa_hash128_init(&ctx, 0);
+         for (unsigned i = 0; i < n; i += piece)
+            _mesa_hash128_update(&ctx, data + i,
+                                 piece < n - i ? piece : n - i);
+         _mesa_hash128_final(&ctx, result);
+
+         assert(memcmp(expected, result, 16) == 0);
+      }
+   }
+}
+
+int
+main(int argc, char **argv)
+{
+   test_verification();
+   test_pieces();
+
+   return 0;
+}
@@ -33,81 +33,142 @@
  */
 
 /**
- * Implements an open-addressing, linear-reprobing hash table.
+ * Implements an open-addressing hash table, in the style of Abseil's
+ * "Swiss tables".
+ *
+ * Next to the entries, the table keeps one control byte per entry, which
+ * tells whether the entry is empty, deleted, or holds a key, in which case it
+ * also stores 7 bits of the key's hash.  Entries are probed in aligned groups
+ * of HT_GROUP_SIZE: one SIMD compare of a group's control bytes finds the
+ * candidates for a key, so the entries themselves and the key comparison
+ * function are only touched for (almost always) real matches.  The table
+ * size is a power of two, and the groups are visited in triangular order,
+ * which covers all of them.
  *
  * For more information, see:
  *
- * http://cgit.freedesktop.org/~anholt/hash_table/tree/README
+ * https://abseil.io/about/design/swisstables
  */
 
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "hash_table.h"
 #include "ralloc.h"
 #include "macros.h"
+#include "bitscan.h"
 #include "main/hash.h"
 
 static const uint32_t deleted_key_value;
 
-/**
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
+#define HT_GROUP_SIZE 16
+#define HT_MIN_SIZE_LOG2 4
+
+/* Control bytes.  Both special values have the top bit set, the others hold
+ * the 7 low bits of an entry's hash.
  */
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-   { 2,			5,		3	  },
-   { 4,			7,		5	  },
-   { 8,			13,		11	  },
-   { 16,		19,		17	  },
-   { 32,		43,		41        },
-   { 64,		73,		71        },
-   { 128,		151,		149       },
-   { 256,		283,		281       },
-   { 512,		571,		569       },
-   { 1024,		1153,		1151      },
-   { 2048,		2269,		2267      },
-   { 4096,		4519,		4517      },
-   { 8192,		9013,		9011      },
-   { 16384,		18043,		18041     },
-   { 32768,		36109,		36107     },
-   { 65536,		72091,		72089     },
-   { 131072,		144409,		144407    },
-   { 262144,		288361,		288359    },
-   { 524288,		576883,		576881    },
-   { 1048576,		1153459,	1153457   },
-   { 2097152,		2307163,	2307161   },
-   { 4194304,		4613893,	4613891   },
-   { 8388608,		9227641,	9227639   },
-   { 16777216,		18455029,	18455027  },
-   { 33554432,		36911011,	36911009  },
-   { 67108864,		73819861,	73819859  },
-   { 134217728,		147639589,	147639587 },
-   { 268435456,		295279081,	295279079 },
-   { 536870912,		590559793,	590559791 },
-   { 1073741824,	1181116273,	1181116271},
-   { 2147483648ul,	2362232233ul,	2362232231ul}
-};
+#define HT_CTRL_EMPTY   ((uint8_t) 0x80)
+#define HT_CTRL_DELETED ((uint8_t) 0xfe)
+
+static inline uint8_t
+hash_h2(uint32_t hash)
+{
+   return hash & 0x7f;
+}
+
+/* Index of the first group to probe.  The hash is mixed first, many of the
+ * hash functions used with the table leave the high bits mostly unused.
+ */
+static inline uint32_t
+hash_first_group(const struct hash_table *ht, uint32_t hash)
+{
+   uint32_t group_bits = ht->size_index - HT_MIN_SIZE_LOG2;
+
+   if (group_bits == 0)
+      return 0;
+
+   return (hash * 0x9e3779b1u) >> (32 - group_bits);
+}
+
+#if defined(__SSE2__)
 
-static int
-entry_is_free(const struct hash_entry *entry)
+static inline unsigned
+group_match(const uint8_t *ctrl, uint8_t value)
 {
-   return entry->key == NULL;
+   __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
 }
 
-static int
-entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
+static inline unsigned
+group_match_free(const uint8_t *ctrl)
+{
+   /* Empty and deleted entries are the ones with the top bit set. */
+   return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+
+#else
+
+static inline unsigned
+group_match(const uint8_t *ctrl, uint8_t value)
+{
+   unsigned mask = 0;
+
+   for (unsigned i = 0; i < HT_GROUP_SIZE; i++)
+      mask |= (unsigned) (ctrl[i] == value) << i;
+
+   return mask;
+}
+
+static inline unsigned
+group_match_free(const uint8_t *ctrl)
+{
+   unsigned mask = 0;
+
+   for (unsigned i = 0; i < HT_GROUP_SIZE; i++)
+      mask |= (unsigned) (ctrl[i] >> 7) << i;
+
+   return mask;
+}
+
+#endif
+
+static inline bool
+entry_is_present(const struct hash_table *ht, const struct hash_entry *entry)
 {
-   return entry->key == ht->deleted_key;
+   return !(ht->ctrl[entry - ht->table] & 0x80);
 }
 
-static int
-entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
+/* Allocates the entries and control bytes of a table of 2^size_log2 entries
+ * as one block, children of mem_ctx.
+ */
+static bool
+hash_table_alloc(struct hash_table *ht, void *mem_ctx, unsigned size_log2)
 {
-   return entry->key != NULL && entry->key != ht->deleted_key;
+   uint32_t size = 1u << size_log2;
+   struct hash_entry *table;
+
+   table = ralloc_size(mem_ctx, size * (sizeof(struct hash_entry) + 1));
+   if (table == NULL)
+      return false;
+
+   ht->table = table;
+   ht->ctrl = (uint8_t *) (table + size);
+   ht->size = size;
+   ht->size_index = size_log2;
+   /* Keep a load factor of at most 7/8, so that probe sequences stay
+    * short and searches for missing keys find empty entries quickly.
+    */
+   ht->max_entries = size - size / 8;
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+   memset(ht->ctrl, HT_CTRL_EMPTY, size);
+
+   return true;
 }
 
 bool
@@ -117,18 +178,11 @@ _mesa_hash_table_init(struct hash_table *ht,
                       bool (*key_equals_function)(const void *a,
                                                   const void *b))
 {
-   ht->size_index = 0;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
-   ht->entries = 0;
-   ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
 
-   return ht->table != NULL;
+   return hash_table_alloc(ht, mem_ctx, HT_MIN_SIZE_LOG2);
 }
 
 struct hash_table *
@@ -165,13 +219,15 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   ht->table = ralloc_size(ht, ht->size * (sizeof(struct hash_entry) + 1));
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
+   ht->ctrl = (uint8_t *) (ht->table + ht->size);
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table,
+          ht->size * (sizeof(struct hash_entry) + 1));
 
    return ht;
 }
@@ -207,31 +263,23 @@ void
 _mesa_hash_table_clear(struct hash_table *ht,
                        void (*delete_function)(struct hash_entry *entry))
 {
-   struct hash_entry *entry;
-
-   for (entry = ht->table; entry != ht->table + ht->size; entry++) {
-      if (entry->key == NULL)
-         continue;
-
-      if (delete_function != NULL && entry->key != ht->deleted_key)
+   if (delete_function) {
+      hash_table_foreach(ht, entry) {
          delete_function(entry);
-
-      entry->key = NULL;
+      }
    }
 
+   memset(ht->ctrl, HT_CTRL_EMPTY, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 }
 
 /** Sets the value of the key pointer used for deleted entries in the table.
  *
- * The assumption is that usually keys are actual pointers, so we use a
- * default value of a pointer to an arbitrary piece of storage in the library.
- * But in some cases a consumer wants to store some other sort of value in the
- * table, like a uint32_t, in which case that pointer may conflict with one of
- * their valid keys.  This lets that user select a safe value.
- *
- * This must be called before any keys are actually deleted from the table.
+ * Deleted entries are tracked in the control bytes, so any key may be
+ * stored in the table.  This only remains for users that want to know which
+ * key value they should avoid for their own bookkeeping, like
+ * hash_table_u64.
  */
 void
 _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
@@ -239,33 +287,50 @@ _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
    ht->deleted_key = deleted_key;
 }
 
-static struct hash_entry *
-hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
+/* The probe loop, specialized for tables of pointer keys, so that comparing
+ * keys doesn't take an indirect call.
+ */
+static inline struct hash_entry *
+hash_table_search_keys(struct hash_table *ht, uint32_t hash, const void *key,
+                       bool pointer_keys)
 {
-   uint32_t start_hash_address = hash % ht->size;
-   uint32_t hash_address = start_hash_address;
+   uint32_t group_mask = (ht->size / HT_GROUP_SIZE) - 1;
+   uint32_t group = hash_first_group(ht, hash);
+   uint8_t h2 = hash_h2(hash);
 
-   do {
-      uint32_t double_hash;
+   for (uint32_t step = 1; step <= group_mask + 1; step++) {
+      const uint8_t *ctrl = ht->ctrl + group * HT_GROUP_SIZE;
+      unsigned match = group_match(ctrl, h2);
 
-      struct hash_entry *entry = ht->table + hash_address;
+      while (match) {
+         struct hash_entry *entry =
+            ht->table + group * HT_GROUP_SIZE + u_bit_scan(&match);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(ht, entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+         if (entry->hash == hash &&
+             (pointer_keys ? entry->key == key :
+                             ht->key_equals_function(key, entry->key)))
             return entry;
-         }
       }
 
-      double_hash = 1 + hash % ht->rehash;
+      /* An empty entry ends every probe sequence that reached the group. */
+      if (group_match(ctrl, HT_CTRL_EMPTY))
+         return NULL;
 
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != start_hash_address);
+      group = (group + step) & group_mask;
+   }
 
    return NULL;
 }
 
+static struct hash_entry *
+hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
+{
+   if (ht->key_equals_function == _mesa_key_pointer_equal)
+      return hash_table_search_keys(ht, hash, key, true);
+   else
+      return hash_table_search_keys(ht, hash, key, false);
+}
+
 /**
  * Finds a hash table entry with the given key and hash of that key.
  *
@@ -287,36 +352,62 @@ _mesa_hash_table_search_pre_hashed(struct hash_table *ht, uint32_t hash,
    return hash_table_search(ht, hash, key);
 }
 
+/* Returns the first free entry of the probe sequence of hash. */
 static struct hash_entry *
-hash_table_insert(struct hash_table *ht, uint32_t hash,
-                  const void *key, void *data);
+hash_table_find_free(struct hash_table *ht, uint32_t hash)
+{
+   uint32_t group_mask = (ht->size / HT_GROUP_SIZE) - 1;
+   uint32_t group = hash_first_group(ht, hash);
+
+   for (uint32_t step = 1; step <= group_mask + 1; step++) {
+      unsigned match = group_match_free(ht->ctrl + group * HT_GROUP_SIZE);
+
+      if (match)
+         return ht->table + group * HT_GROUP_SIZE + ffs(match) - 1;
+
+      group = (group + step) & group_mask;
+   }
+
+   return NULL;
+}
+
+static void
+hash_table_set_entry(struct hash_table *ht, struct hash_entry *entry,
+                     uint32_t hash, const void *key, void *data)
+{
+   uint8_t *ctrl = &ht->ctrl[entry - ht->table];
+
+   if (*ctrl == HT_CTRL_DELETED)
+      ht->deleted_entries--;
+   *ctrl = hash_h2(hash);
+
+   entry->hash = hash;
+   entry->key = key;
+   entry->data = data;
+   ht->entries++;
+}
 
 static void
 _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
 {
    struct hash_table old_ht;
-   struct hash_entry *table;
-
-   if (new_size_index >= ARRAY_SIZE(hash_sizes))
-      return;
 
-   table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
-                         hash_sizes[new_size_index].size);
-   if (table == NULL)
+   if (new_size_index >= 32)
       return;
 
    old_ht = *ht;
 
-   ht->table = table;
-   ht->size_index = new_size_index;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->entries = 0;
-   ht->deleted_entries = 0;
+   if (!hash_table_alloc(ht, ralloc_parent(old_ht.table), new_size_index)) {
+      *ht = old_ht;
+      return;
+   }
 
+   /* The keys are known to be distinct, so they don't need to be compared
+    * while reinserting them.
+    */
    hash_table_foreach(&old_ht, entry) {
-      hash_table_insert(ht, entry->hash, entry->key, entry->data);
+      hash_table_set_entry(ht, hash_table_find_free(ht, entry->hash),
+                           entry->hash, entry->key, entry->data);
    }
 
    ralloc_free(old_ht.table);
@@ -326,8 +417,7 @@ static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
                   const void *key, void *data)
 {
-   uint32_t start_hash_address, hash_address;
-   struct hash_entry *available_entry = NULL;
+   struct hash_entry *entry;
 
    assert(key != NULL);
 
@@ -337,59 +427,33 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
       _mesa_hash_table_rehash(ht, ht->size_index);
    }
 
-   start_hash_address = hash % ht->size;
-   hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-      uint32_t double_hash;
-
-      if (!entry_is_present(ht, entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
-      }
-
-      /* Implement replacement when another insert happens
-       * with a matching key.  This is a relatively common
-       * feature of hash tables, with the alternative
-       * generally being "insert the new value as well, and
-       * return it first when the key is searched for".
-       *
-       * Note that the hash table doesn't have a delete
-       * callback.  If freeing of old data pointers is
-       * required to avoid memory leaks, perform a search
-       * before inserting.
-       */
-      if (!entry_is_deleted(ht, entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         entry->key = key;
-         entry->data = data;
-         return entry;
-      }
-
-
-      double_hash = 1 + hash % ht->rehash;
-
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != start_hash_address);
-
-   if (available_entry) {
-      if (entry_is_deleted(ht, available_entry))
-         ht->deleted_entries--;
-      available_entry->hash = hash;
-      available_entry->key = key;
-      available_entry->data = data;
-      ht->entries++;
-      return available_entry;
+   /* Implement replacement when another insert happens
+    * with a matching key.  This is a relatively common
+    * feature of hash tables, with the alternative
+    * generally being "insert the new value as well, and
+    * return it first when the key is searched for".
+    *
+    * Note that the hash table doesn't have a delete
+    * callback.  If freeing of old data pointers is
+    * required to avoid memory leaks, perform a search
+    * before inserting.
+    */
+   entry = hash_table_search(ht, hash, key);
+   if (entry) {
+      entry->key = key;
+      entry->data = data;
+      return entry;
    }
 
-   /* We could hit here if a required resize failed. An unchecked-malloc
+   /* We could fail here if a required resize failed. An unchecked-malloc
     * application could ignore this result.
     */
-   return NULL;
+   entry = hash_table_find_free(ht, hash);
+   if (entry == NULL)
+      return NULL;
+
+   hash_table_set_entry(ht, entry, hash, key, data);
+   return entry;
 }
 
 /**
@@ -423,12 +487,26 @@ void
 _mesa_hash_table_remove(struct hash_table *ht,
                         struct hash_entry *entry)
 {
+   uint32_t index;
+
    if (!entry)
       return;
 
-   entry->key = ht->deleted_key;
+   index = entry - ht->table;
+   assert(entry_is_present(ht, entry));
+
+   /* Probing stops at the first group with an empty entry, so if the
+    * entry's group still has one, no probe sequence goes past it and the
+    * entry can be made empty rather than deleted.
+    */
+   if (group_match(ht->ctrl + (index & ~(HT_GROUP_SIZE - 1)),
+                   HT_CTRL_EMPTY)) {
+      ht->ctrl[index] = HT_CTRL_EMPTY;
+   } else {
+      ht->ctrl[index] = HT_CTRL_DELETED;
+      ht->deleted_entries++;
+   }
    ht->entries--;
-   ht->deleted_entries++;
 }
 
 /**
@@ -444,21 +522,26 @@ void _mesa_hash_table_remove_key(struct hash_table *ht,
  * This function is an iterator over the hash table.
  *
  * Pass in NULL for the first entry, as in the start of a for loop.  Note that
- * an iteration over the table is O(table_size) not O(entries).
+ * an iteration over the table is O(table_size) not O(entries), although
+ * whole groups of free entries are skipped at once.
  */
 struct hash_entry *
 _mesa_hash_table_next_entry(struct hash_table *ht,
                             struct hash_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t index = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry)) {
-         return entry;
+   for (; index < ht->size; index++) {
+      if ((index & (HT_GROUP_SIZE - 1)) == 0) {
+         while (group_match_free(ht->ctrl + index) == 0xffff) {
+            index += HT_GROUP_SIZE;
+            if (index == ht->size)
+               return NULL;
+         }
       }
+
+      if (!(ht->ctrl[index] & 0x80))
+         return ht->table + index;
    }
 
    return NULL;
@@ -557,6 +640,16 @@ _mesa_pointer_hash_table_create(void *mem_ctx)
                                   _mesa_key_pointer_equal);
 }
 
+/**
+ * Helper to create a hash table with integer keys, stored as pointers.
+ */
+struct hash_table *
+_mesa_int_key_hash_table_create(void *mem_ctx)
+{
+   return _mesa_hash_table_create(mem_ctx, _mesa_hash_int_key,
+                                  _mesa_key_pointer_equal);
+}
+
 /**
  * Hash table wrapper which supports 64-bit keys.
  *
@@ -592,8 +685,7 @@ _mesa_hash_table_u64_create(void *mem_ctx)
       return NULL;
 
    if (sizeof(void *) == 8) {
-      ht->table = _mesa_hash_table_create(mem_ctx, _mesa_hash_pointer,
-                                          _mesa_key_pointer_equal);
+      ht->table = _mesa_int_key_hash_table_create(mem_ctx);
    } else {
       ht->table = _mesa_hash_table_create(mem_ctx, key_u64_hash,
                                           key_u64_equals);
@@ -46,12 +46,14 @@ struct hash_entry {
 
 struct hash_table {
    struct hash_entry *table;
+   /* One control byte per entry, see hash_table.c. */
+   uint8_t *ctrl;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    const void *deleted_key;
    uint32_t size;
-   uint32_t rehash;
    uint32_t max_entries;
+   /* log2 of size */
    uint32_t size_index;
    uint32_t entries;
    uint32_t deleted_entries;
@@ -121,8 +123,28 @@ static inline uint32_t _mesa_hash_pointer(const void *pointer)
    return (uint32_t) ((num >> 2) ^ (num >> 6) ^ (num >> 10) ^ (num >> 14));
 }
 
+/**
+ * Hash function for integers stored in the key pointer.  Unlike
+ * _mesa_hash_pointer(), which expects aligned pointers, it mixes all of the
+ * bits of the key.
+ */
+static inline uint32_t _mesa_hash_int_key(const void *key)
+{
+   uint64_t num = (uintptr_t) key;
+
+   num ^= num >> 33;
+   num *= 0xff51afd7ed558ccdull;
+   num ^= num >> 33;
+   return (uint32_t) num;
+}
+
+/* Both compare keys with _mesa_key_pointer_equal(), which the table
+ * recognizes and inlines.  Integer keys must not be 0.
+ */
 struct hash_table *
 _mesa_pointer_hash_table_create(void *mem_ctx);
+struct hash_table *
+_mesa_int_key_hash_table_create(void *mem_ctx);
 
 enum {
    _mesa_fnv32_1a_offset_bias = 2166136261u,
@@ -146,9 +168,9 @@ _mesa_fnv32_1a_accumulate_block(uint32_t hash, const void *data, size_t size)
    _mesa_fnv32_1a_accumulate_block(hash, &(expr), sizeof(expr))
 
 /**
- * This foreach function is safe against deletion (which just replaces
- * an entry's data with the deleted marker), but not against insertion
- * (which may rehash the table, making entry a dangling pointer).
+ * This foreach function is safe against deletion (which just marks the
+ * entry as free), but not against insertion (which may rehash the table,
+ * making entry a dangling pointer).
  */
 #define hash_table_foreach(ht, entry)                                      \
    for (struct hash_entry *entry = _mesa_hash_table_next_entry(ht, NULL);  \
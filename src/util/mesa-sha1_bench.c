@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Measures the throughput of each SHA-1 implementation this CPU supports,
+ * and of the 128-bit non-cryptographic hash, for a few message sizes.
+ *
+ * Usage: mesa-sha1_bench [megabytes per measurement]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash128.h"
+#include "mesa-sha1.h"
+#include "os_time.h"
+#include "u_cpu_detect.h"
+
+static const size_t sizes[] = { 64, 1024, 64 * 1024, 1024 * 1024 };
+
+static unsigned char *data;
+static size_t total;
+
+static void
+bench_sha1(const char *impl)
+{
+   printf("SHA-1 (%s):", impl);
+
+   for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      unsigned char result[20];
+      int64_t start = os_time_get_nano();
+
+      for (size_t done = 0; done < total; done += sizes[i])
+         _mesa_sha1_compute(data, sizes[i], result);
+
+      printf(" %7zu B: %7.1f MB/s", sizes[i],
+             total / 1e6 / ((os_time_get_nano() - start) / 1e9));
+   }
+   printf("\n");
+}
+
+static void
+bench_hash128(void)
+{
+   printf("hash128:");
+
+   for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      unsigned char result[16];
+      int64_t start = os_time_get_nano();
+
+      for (size_t done = 0; done < total; done += sizes[i])
+         _mesa_hash128_compute(data, sizes[i], result);
+
+      printf(" %7zu B: %7.1f MB/s", sizes[i],
+             total / 1e6 / ((os_time_get_nano() - start) / 1e9));
+   }
+   printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+   total = (argc > 1 ? atoi(argv[1]) : 256) * 1024 * 1024;
+   data = malloc(sizes[3]);
+   for (size_t i = 0; i < sizes[3]; i++)
+      data[i] = i * 7;
+
+   util_cpu_detect();
+   if (util_cpu_caps.has_sha && util_cpu_caps.has_sse4_1) {
+      bench_sha1("SHA extensions");
+      util_cpu_caps.has_sha = 0;
+   }
+   bench_sha1("C");
+   bench_hash128();
+
+   free(data);
+   return 0;
+}
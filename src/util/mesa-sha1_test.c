@@ -27,9 +27,84 @@
 
 #include "macros.h"
 #include "mesa-sha1.h"
+#include "u_cpu_detect.h"
 
 #define SHA1_LENGTH 40
 
+static bool
+check_sha1(const char *name, const unsigned char sha1[20], const char *expected)
+{
+   char buf[41];
+
+   _mesa_sha1_format(buf, sha1);
+   if (memcmp(expected, buf, SHA1_LENGTH) != 0) {
+      printf("%s:\n\tExpected: %s\n\t     Got: %s\n", name, expected, buf);
+      return false;
+   }
+   return true;
+}
+
+/* Hashes the digests of all prefixes of a 1000 byte buffer, each fed in
+ * pieces of the given size, to go through the block transforms with every
+ * possible alignment and count of blocks.
+ */
+static bool
+test_prefixes(const char *impl, size_t piece)
+{
+   unsigned char data[1000], sha1[20];
+   struct mesa_sha1 outer;
+   char name[64];
+
+   for (unsigned i = 0; i < sizeof(data); i++)
+      data[i] = i * 7 + (i >> 8);
+
+   _mesa_sha1_init(&outer);
+   for (size_t n = 0; n <= sizeof(data); n++) {
+      struct mesa_sha1 ctx;
+
+      _mesa_sha1_init(&ctx);
+      for (size_t i = 0; i < n; i += piece)
+         _mesa_sha1_update(&ctx, data + i, MIN2(piece, n - i));
+      _mesa_sha1_final(&ctx, sha1);
+      _mesa_sha1_update(&outer, sha1, sizeof(sha1));
+   }
+   _mesa_sha1_final(&outer, sha1);
+
+   snprintf(name, sizeof(name), "%s, prefixes in pieces of %zu", impl, piece);
+   return check_sha1(name, sha1, "d8428f99d67a3e3f237e6698c419552517f9a8f3");
+}
+
+static bool
+test_million_a(const char *impl)
+{
+   static unsigned char a[999];
+   unsigned char sha1[20];
+   struct mesa_sha1 ctx;
+   size_t left = 1000000;
+
+   memset(a, 'a', sizeof(a));
+
+   _mesa_sha1_init(&ctx);
+   for (; left > sizeof(a); left -= sizeof(a))
+      _mesa_sha1_update(&ctx, a, sizeof(a));
+   _mesa_sha1_update(&ctx, a, left);
+   _mesa_sha1_final(&ctx, sha1);
+
+   return check_sha1(impl, sha1, "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+static bool
+test_impl(const char *impl)
+{
+   static const size_t pieces[] = { 1, 3, 64, 100, 1000 };
+   bool ok = test_million_a(impl);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(pieces); i++)
+      ok = test_prefixes(impl, pieces[i]) && ok;
+
+   return ok;
+}
+
 int main(int argc, char *argv[])
 {
    static const struct {
@@ -39,6 +114,9 @@ int main(int argc, char *argv[])
       {"Mesa Rocks! 273", "7fb99737373d65a73f049cdabc01e73aa6bc60f3"},
       {"Mesa Rocks! 300", "b2180263e37d3bed6a4be0afe41b1a82ebbcf4c3"},
       {"Mesa Rocks! 583", "7fb9734108a62503e8a149c1051facd7fb112d05"},
+      {"abc", "a9993e364706816aba3e25717850c26c9cd0d89d"},
+      {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+       "84983e441c3bd26ebaae4aa1f95129e5e54670f1"},
    };
 
    bool failed = false;
@@ -49,17 +127,19 @@ int main(int argc, char *argv[])
       _mesa_sha1_compute(test_data[i].string, strlen(test_data[i].string),
                          sha1);
 
-      char buf[41];
-      _mesa_sha1_format(buf, sha1);
-
-      if (memcmp(test_data[i].sha1, buf, SHA1_LENGTH) != 0) {
-         printf("For string \"%s\", length %zu:\n"
-                "\tExpected: %s\n\t     Got: %s\n",
-                test_data[i].string, strlen(test_data[i].string),
-                test_data[i].sha1, buf);
+      if (!check_sha1(test_data[i].string, sha1, test_data[i].sha1))
          failed = true;
-      }
    }
 
+   /* Go through each of the implementations this CPU supports, by turning
+    * off the features they need one after the other.
+    */
+   util_cpu_detect();
+   if (util_cpu_caps.has_sha && util_cpu_caps.has_sse4_1) {
+      failed |= !test_impl("SHA extensions");
+      util_cpu_caps.has_sha = 0;
+   }
+   failed |= !test_impl("C");
+
    return failed;
 }
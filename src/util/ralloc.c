@@ -66,6 +66,9 @@ struct
    unsigned canary;
 #endif
 
+   /* RALLOC_FLAG_* bits */
+   unsigned flags;
+
    struct ralloc_header *parent;
 
    /* The first child (head of a linked list) */
@@ -83,6 +86,59 @@ typedef struct ralloc_header ralloc_header;
 static void unlink_block(ralloc_header *info);
 static void unsafe_free(ralloc_header *info);
 
+/* The node is an arena context, see ralloc_arena_context(). */
+#define RALLOC_FLAG_ARENA        (1 << 0)
+/* The node was carved out of an arena chunk and must never be free()d. */
+#define RALLOC_FLAG_ARENA_BACKED (1 << 1)
+
+#if defined(HAVE_POSIX_MEMALIGN) || defined(_WIN32)
+#define HAVE_RALLOC_ARENA 1
+#endif
+
+/* Arena chunks are aligned to their size, so that the chunk holding any
+ * arena-backed node is found by masking the node's address.  Allocations
+ * that are too big to share a chunk get a dedicated one, which is aligned
+ * the same way and holds a single node right after the chunk header.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_BIG_ALLOC  (ARENA_CHUNK_SIZE / 4)
+#define ARENA_ALIGN      16
+#define ARENA_ALIGN_SIZE(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct ralloc_arena;
+
+struct arena_chunk
+{
+   struct ralloc_arena *arena;
+   struct arena_chunk *next;
+
+   /* Bump pointer and end of the chunk */
+   char *top;
+   char *end;
+
+   /* Most recent allocation, which can be resized in place */
+   struct ralloc_header *last;
+};
+
+#define ARENA_CHUNK_HEADER_SIZE ARENA_ALIGN_SIZE(sizeof(struct arena_chunk))
+
+/* The payload of an arena context node. */
+struct ralloc_arena
+{
+   /* Chunk new allocations are bumped from */
+   struct arena_chunk *current;
+
+   /* All chunks, including dedicated ones */
+   struct arena_chunk *chunks;
+
+   /* Whether freeing must walk the tree of arena-backed nodes, because some
+    * of them have a destructor, or because nodes not backed by this arena
+    * were stolen into it.
+    */
+   bool has_destructors;
+   bool has_foreign;
+};
+
 static ralloc_header *
 get_header(const void *ptr)
 {
@@ -94,6 +150,156 @@ get_header(const void *ptr)
 
 #define PTR_FROM_HEADER(info) (((char *) info) + sizeof(ralloc_header))
 
+static struct arena_chunk *
+get_chunk(const ralloc_header *info)
+{
+   return (struct arena_chunk *)
+      ((uintptr_t) info & ~(uintptr_t) (ARENA_CHUNK_SIZE - 1));
+}
+
+/* Return the arena \p info allocates from, if any. */
+static struct ralloc_arena *
+get_arena(const ralloc_header *info)
+{
+   if (likely(!(info->flags & (RALLOC_FLAG_ARENA | RALLOC_FLAG_ARENA_BACKED))))
+      return NULL;
+
+   if (info->flags & RALLOC_FLAG_ARENA)
+      return (struct ralloc_arena *) PTR_FROM_HEADER(info);
+
+   return get_chunk(info)->arena;
+}
+
+static struct arena_chunk *
+arena_chunk_create(struct ralloc_arena *arena, size_t size)
+{
+#ifdef HAVE_RALLOC_ARENA
+   struct arena_chunk *chunk;
+
+   if (size > SIZE_MAX - ARENA_CHUNK_HEADER_SIZE)
+      return NULL;
+   size += ARENA_CHUNK_HEADER_SIZE;
+
+#ifdef _WIN32
+   chunk = _aligned_malloc(size, ARENA_CHUNK_SIZE);
+#else
+   if (posix_memalign((void **) &chunk, ARENA_CHUNK_SIZE, size) != 0)
+      chunk = NULL;
+#endif
+   if (unlikely(chunk == NULL))
+      return NULL;
+
+   chunk->arena = arena;
+   chunk->next = arena->chunks;
+   chunk->top = (char *) chunk + ARENA_CHUNK_HEADER_SIZE;
+   chunk->end = (char *) chunk + size;
+   chunk->last = NULL;
+   arena->chunks = chunk;
+
+   return chunk;
+#else
+   return NULL;
+#endif
+}
+
+static void
+arena_free_chunks(struct ralloc_arena *arena)
+{
+   struct arena_chunk *chunk, *next;
+
+   for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+      next = chunk->next;
+#ifdef _WIN32
+      _aligned_free(chunk);
+#else
+      free(chunk);
+#endif
+   }
+   arena->chunks = NULL;
+   arena->current = NULL;
+}
+
+/* Bump-allocate \p size bytes, header included, out of the arena. */
+static ralloc_header *
+arena_alloc(struct ralloc_arena *arena, size_t size)
+{
+   struct arena_chunk *chunk = arena->current;
+   ralloc_header *info;
+
+   if (unlikely(size > SIZE_MAX - ARENA_ALIGN))
+      return NULL;
+   size = ARENA_ALIGN_SIZE(size);
+
+   if (unlikely(chunk == NULL || (size_t) (chunk->end - chunk->top) < size)) {
+      if (size > ARENA_BIG_ALLOC) {
+         chunk = arena_chunk_create(arena, size);
+      } else {
+         chunk = arena_chunk_create(arena, ARENA_CHUNK_SIZE -
+                                           ARENA_CHUNK_HEADER_SIZE);
+         arena->current = chunk;
+      }
+
+      if (unlikely(chunk == NULL))
+         return NULL;
+   }
+
+   info = (ralloc_header *) chunk->top;
+   chunk->top += size;
+   chunk->last = info;
+
+   return info;
+}
+
+/* Resize an arena-backed node.  The most recent allocation of a chunk is
+ * grown or shrunk in place, anything else is copied to a new node and the
+ * old storage is only reclaimed along with the arena.
+ */
+static ralloc_header *
+arena_realloc(ralloc_header *old, size_t size)
+{
+   struct arena_chunk *chunk = get_chunk(old);
+   size_t avail = chunk->end - (char *) old;
+   ralloc_header *info;
+
+   if (unlikely(size > SIZE_MAX - ARENA_ALIGN))
+      return NULL;
+
+   if (chunk->last == old && avail >= ARENA_ALIGN_SIZE(size)) {
+      chunk->top = (char *) old + ARENA_ALIGN_SIZE(size);
+      return old;
+   }
+
+   info = arena_alloc(chunk->arena, size);
+   if (unlikely(info == NULL))
+      return NULL;
+
+   /* The old node's size isn't recorded, but it can't extend past the end
+    * of its chunk, nor past the new node if that was bumped from the same
+    * chunk.
+    */
+   if (get_chunk(info) == chunk)
+      avail = (char *) info - (char *) old;
+
+   memcpy(info, old, MIN2(size, avail));
+   return info;
+}
+
+/* Called whenever \p info is (re)parented to \p parent by something other
+ * than an allocation out of \p parent.
+ */
+static void
+note_new_child(ralloc_header *parent, ralloc_header *info)
+{
+   struct ralloc_arena *arena;
+
+   if (parent == NULL)
+      return;
+
+   arena = get_arena(parent);
+   if (unlikely(arena != NULL) && get_arena(info) != arena)
+      arena->has_foreign = true;
+}
+
 static void
 add_child(ralloc_header *parent, ralloc_header *info)
 {
@@ -113,17 +319,53 @@ ralloc_context(const void *ctx)
    return ralloc_size(ctx, 0);
 }
 
+void *
+ralloc_arena_context(const void *ctx)
+{
+#ifdef HAVE_RALLOC_ARENA
+   struct ralloc_arena *arena = ralloc_size(NULL, sizeof(struct ralloc_arena));
+
+   if (unlikely(arena == NULL))
+      return NULL;
+
+   get_header(arena)->flags = RALLOC_FLAG_ARENA;
+   arena->current = NULL;
+   arena->chunks = NULL;
+   arena->has_destructors = false;
+   arena->has_foreign = false;
+
+   ralloc_steal(ctx, arena);
+
+   return arena;
+#else
+   return ralloc_context(ctx);
+#endif
+}
+
 void *
 ralloc_size(const void *ctx, size_t size)
 {
-   void *block = malloc(size + sizeof(ralloc_header));
    ralloc_header *info;
    ralloc_header *parent;
+   struct ralloc_arena *arena;
 
-   if (unlikely(block == NULL))
-      return NULL;
+   parent = ctx != NULL ? get_header(ctx) : NULL;
+   arena = parent != NULL ? get_arena(parent) : NULL;
+
+   if (arena != NULL) {
+      info = arena_alloc(arena, size + sizeof(ralloc_header));
+      if (unlikely(info == NULL))
+         return NULL;
+
+      info->flags = RALLOC_FLAG_ARENA_BACKED;
+   } else {
+      info = malloc(size + sizeof(ralloc_header));
+      if (unlikely(info == NULL))
+         return NULL;
+
+      info->flags = 0;
+   }
 
-   info = (ralloc_header *) block;
    /* measurements have shown that calloc is slower (because of
     * the multiplication overflow checking?), so clear things
     * manually
@@ -134,8 +376,6 @@ ralloc_size(const void *ctx, size_t size)
    info->next = NULL;
    info->destructor = NULL;
 
-   parent = ctx != NULL ? get_header(ctx) : NULL;
-
    add_child(parent, info);
 
 #ifndef NDEBUG
@@ -163,7 +403,10 @@ resize(void *ptr, size_t size)
    ralloc_header *child, *old, *info;
 
    old = get_header(ptr);
-   info = realloc(old, size + sizeof(ralloc_header));
+   if (old->flags & RALLOC_FLAG_ARENA_BACKED)
+      info = arena_realloc(old, size + sizeof(ralloc_header));
+   else
+      info = realloc(old, size + sizeof(ralloc_header));
 
    if (info == NULL)
       return NULL;
@@ -259,19 +502,32 @@ unlink_block(ralloc_header *info)
 static void
 unsafe_free(ralloc_header *info)
 {
-   /* Recursively free any children...don't waste time unlinking them. */
-   ralloc_header *temp;
-   while (info->child != NULL) {
-      temp = info->child;
-      info->child = temp->next;
-      unsafe_free(temp);
+   struct ralloc_arena *arena = get_arena(info);
+
+   /* Recursively free any children...don't waste time unlinking them.
+    *
+    * Arena-backed children are reclaimed along with their arena, so unless
+    * there are destructors to run or foreign nodes to free, they can be
+    * skipped entirely.
+    */
+   if (arena == NULL || arena->has_destructors || arena->has_foreign) {
+      ralloc_header *temp;
+      while (info->child != NULL) {
+         temp = info->child;
+         info->child = temp->next;
+         unsafe_free(temp);
+      }
    }
 
    /* Free the block itself.  Call the destructor first, if any. */
    if (info->destructor != NULL)
       info->destructor(PTR_FROM_HEADER(info));
 
-   free(info);
+   if (info->flags & RALLOC_FLAG_ARENA)
+      arena_free_chunks(arena);
+
+   if (!(info->flags & RALLOC_FLAG_ARENA_BACKED))
+      free(info);
 }
 
 void
@@ -288,6 +544,7 @@ ralloc_steal(const void *new_ctx, void *ptr)
    unlink_block(info);
 
    add_child(parent, info);
+   note_new_child(parent, info);
 }
 
 void
@@ -308,8 +565,10 @@ ralloc_adopt(const void *new_ctx, void *old_ctx)
    /* Set all the children's parent to new_ctx; get a pointer to the last child. */
    for (child = old_info->child; child->next != NULL; child = child->next) {
       child->parent = new_info;
+      note_new_child(new_info, child);
    }
    child->parent = new_info;
+   note_new_child(new_info, child);
 
    /* Connect the two lists together; parent them to new_ctx; make old_ctx empty. */
    child->next = new_info->child;
@@ -336,6 +595,9 @@ ralloc_set_destructor(const void *ptr, void(*destructor)(void *))
 {
    ralloc_header *info = get_header(ptr);
    info->destructor = destructor;
+
+   if (destructor != NULL && (info->flags & RALLOC_FLAG_ARENA_BACKED))
+      get_chunk(info)->arena->has_destructors = true;
 }
 
 char *
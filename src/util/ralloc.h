@@ -91,6 +91,27 @@ extern "C" {
  */
 void *ralloc_context(const void *ctx);
 
+/**
+ * Allocate a new ralloc arena context.
+ *
+ * An arena context can be used like any other context, but everything
+ * allocated out of it, or out of any of its arena-allocated descendants, is
+ * bump-allocated from large chunks instead of going through \c malloc.
+ * Freeing an individual node only runs the destructors in its subtree; the
+ * memory itself is only released, all at once, when the arena context is
+ * freed.  As long as no destructor was set on any node and nothing was
+ * stolen into the arena, freeing it doesn't even walk the tree.
+ *
+ * This makes it a good fit for contexts holding lots of small, short-lived
+ * allocations, like the scratch data of a compiler pass.  Since memory is
+ * never reused before the arena is freed, it's a poor fit for long-lived
+ * contexts whose contents are routinely freed or resized.
+ *
+ * Nodes may be stolen out of the arena, but the arena context must outlive
+ * every node allocated out of it.
+ */
+void *ralloc_arena_context(const void *ctx);
+
 /**
  * Allocate memory chained off of the given context.
  *
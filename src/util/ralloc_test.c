@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ralloc.h"
+
+static unsigned destroyed;
+
+static void
+count_destructor(void *ptr)
+{
+   destroyed++;
+}
+
+static void
+fill(uint32_t *data, unsigned count, uint32_t seed)
+{
+   for (unsigned i = 0; i < count; i++)
+      data[i] = seed * 7919 + i;
+}
+
+static void
+check(const uint32_t *data, unsigned count, uint32_t seed)
+{
+   for (unsigned i = 0; i < count; i++)
+      assert(data[i] == seed * 7919 + i);
+}
+
+/* Lots of small allocations, with a few big ones in the middle. */
+static void
+test_alloc(void)
+{
+   void *arena = ralloc_arena_context(NULL);
+   uint32_t *nodes[2000];
+   unsigned i;
+
+   for (i = 0; i < 2000; i++) {
+      unsigned count = (i % 100 == 0) ? 10000 : 1 + i % 13;
+
+      nodes[i] = ralloc_array(i % 2 ? nodes[i - 1] : arena, uint32_t, count);
+      assert(nodes[i] != NULL);
+      assert((uintptr_t) nodes[i] % sizeof(void *) == 0);
+      fill(nodes[i], count, i);
+   }
+
+   for (i = 0; i < 2000; i++) {
+      unsigned count = (i % 100 == 0) ? 10000 : 1 + i % 13;
+
+      check(nodes[i], count, i);
+      assert(ralloc_parent(nodes[i]) == (i % 2 ? nodes[i - 1] : arena));
+   }
+
+   /* Freeing single nodes is fine, and doesn't disturb the others. */
+   for (i = 0; i < 2000; i += 4)
+      ralloc_free(nodes[i]);
+   for (i = 2; i < 2000; i += 4)
+      check(nodes[i], (i % 100 == 0) ? 10000 : 1 + i % 13, i);
+
+   ralloc_free(arena);
+}
+
+static void
+test_realloc(void)
+{
+   void *arena = ralloc_arena_context(NULL);
+   uint32_t *a = ralloc_array(arena, uint32_t, 4);
+   uint32_t *b, *c;
+   unsigned i;
+
+   fill(a, 4, 1);
+
+   /* Growing the last allocation of a chunk happens in place. */
+   b = reralloc(arena, a, uint32_t, 64);
+   assert(b == a);
+   check(b, 4, 1);
+
+   /* Anything else is copied. */
+   c = ralloc_array(b, uint32_t, 8);
+   fill(c, 8, 2);
+   fill(b, 64, 3);
+   a = reralloc(arena, b, uint32_t, 1024);
+   assert(a != b);
+   check(a, 64, 3);
+   assert(ralloc_parent(c) == a);
+
+   /* Up to dedicated chunks and back. */
+   for (i = 0; i < 8; i++) {
+      a = reralloc(arena, a, uint32_t, 64 << (2 * i));
+      check(a, 64, 3);
+   }
+   a = reralloc(arena, a, uint32_t, 16);
+   check(a, 16, 3);
+   check(c, 8, 2);
+
+   ralloc_free(arena);
+}
+
+static void
+test_destructors(void)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *ctx = ralloc_context(arena);
+   void *node;
+
+   destroyed = 0;
+
+   /* Destructors run when a node is freed... */
+   node = ralloc_size(ctx, 16);
+   ralloc_set_destructor(node, count_destructor);
+   ralloc_free(node);
+   assert(destroyed == 1);
+
+   /* ...or along with the arena, at any depth. */
+   node = ralloc_size(ralloc_size(ctx, 8), 8);
+   ralloc_set_destructor(node, count_destructor);
+   node = ralloc_size(arena, 8);
+   ralloc_set_destructor(node, count_destructor);
+   ralloc_set_destructor(arena, count_destructor);
+
+   ralloc_free(arena);
+   assert(destroyed == 4);
+}
+
+static void
+test_steal(void)
+{
+   void *outside = ralloc_context(NULL);
+   void *arena = ralloc_arena_context(outside);
+   void *nested = ralloc_arena_context(arena);
+   char *str, *node;
+
+   destroyed = 0;
+
+   /* malloc'ed nodes stolen into the arena are freed along with it. */
+   node = ralloc_size(NULL, 32);
+   ralloc_set_destructor(node, count_destructor);
+   ralloc_steal(ralloc_size(arena, 4), node);
+
+   /* So are nested arenas and whatever is in them. */
+   node = ralloc_size(nested, 32);
+   ralloc_set_destructor(node, count_destructor);
+
+   /* Arena nodes can be stolen out, as long as the arena outlives them. */
+   str = ralloc_strdup(arena, "mesa");
+   ralloc_asprintf_append(&str, " %d", 3);
+   ralloc_steal(outside, str);
+   assert(strcmp(str, "mesa 3") == 0);
+   ralloc_free(str);
+
+   /* Nodes adopted from another context also belong to the arena. */
+   node = ralloc_context(NULL);
+   ralloc_set_destructor(ralloc_size(node, 4), count_destructor);
+   ralloc_adopt(arena, node);
+   ralloc_free(node);
+   assert(destroyed == 0);
+
+   ralloc_free(outside);
+   assert(destroyed == 3);
+}
+
+static void
+test_linear(void)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *lin = linear_alloc_parent(arena, 0);
+   char *str = linear_strdup(lin, "linear");
+
+   for (unsigned i = 0; i < 10000; i++)
+      assert(linear_alloc_child(lin, 24) != NULL);
+   linear_strcat(lin, &str, " in arena");
+   assert(strcmp(str, "linear in arena") == 0);
+
+   ralloc_free(arena);
+}
+
+int
+main(int argc, char **argv)
+{
+   test_alloc();
+   test_realloc();
+   test_destructors();
+   test_steal();
+   test_linear();
+
+   return 0;
+}
@@ -76,6 +76,7 @@
 #include "main/imports.h"
 #include "main/macros.h"
 #include "util/bitset.h"
+#include "util/u_math.h"
 #include "register_allocate.h"
 
 #define NO_REG ~0U
@@ -126,7 +127,6 @@ struct ra_node {
     * List of which nodes this node interferes with.  This should be
     * symmetric with the other node.
     */
-   BITSET_WORD *adjacency;
    unsigned int *adjacency_list;
    unsigned int adjacency_list_size;
    unsigned int adjacency_count;
@@ -165,6 +165,24 @@ struct ra_graph {
    struct ra_node *nodes;
    unsigned int count; /**< count of nodes. */
 
+   /** @{
+    *
+    * Set of edges already added to the graph, so that
+    * ra_add_node_interference() doesn't add duplicates to the adjacency
+    * lists.
+    *
+    * Small graphs use a dense count x count bit matrix.  That is O(n^2)
+    * memory though, so bigger graphs start with an open-addressing hash set
+    * of node pairs instead, which is proportional to the number of edges,
+    * and only switch to the matrix if they turn out to be dense enough for
+    * it to be smaller.
+    */
+   BITSET_WORD *adjacency;
+   uint64_t *edges;
+   unsigned int edges_size;
+   unsigned int edge_count;
+   /** @} */
+
    unsigned int *stack;
    unsigned int stack_count;
 
@@ -390,11 +408,108 @@ ra_set_finalize(struct ra_regs *regs, unsigned int **q_values)
    }
 }
 
+/* Graphs with more nodes than this start tracking their edges in a hash set
+ * instead of a bit matrix.  4096 nodes is a 2MB matrix.
+ */
+#define RA_DENSE_MAX_NODES 4096
+
+static uint64_t
+ra_edge_key(unsigned int n1, unsigned int n2)
+{
+   /* n1 != n2, so a key is never 0, which marks empty slots. */
+   return n1 < n2 ? ((uint64_t)n1 << 32) | n2 : ((uint64_t)n2 << 32) | n1;
+}
+
+static unsigned int
+ra_edge_hash(struct ra_graph *g, uint64_t key)
+{
+   return (key * 0x9e3779b97f4a7c15ull) >> 32 & (g->edges_size - 1);
+}
+
 static void
-ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
+ra_edge_set_grow(struct ra_graph *g)
 {
-   BITSET_SET(g->nodes[n1].adjacency, n2);
+   uint64_t *old = g->edges;
+   unsigned int old_size = g->edges_size;
+   unsigned int words = BITSET_WORDS(g->count);
+
+   /* Once the graph is dense enough that the hash set would take more
+    * memory than the bit matrix, switch to the matrix.
+    */
+   if ((uint64_t)old_size * 2 * sizeof(uint64_t) >=
+       (uint64_t)g->count * words * sizeof(BITSET_WORD)) {
+      g->adjacency = rzalloc_array(g, BITSET_WORD, (size_t)g->count * words);
+
+      for (unsigned int i = 0; i < old_size; i++) {
+         if (old[i]) {
+            unsigned int n1 = old[i] >> 32, n2 = old[i] & 0xffffffff;
 
+            BITSET_SET(&g->adjacency[(size_t)n1 * words], n2);
+            BITSET_SET(&g->adjacency[(size_t)n2 * words], n1);
+         }
+      }
+
+      g->edges = NULL;
+      g->edges_size = 0;
+      ralloc_free(old);
+      return;
+   }
+
+   g->edges_size *= 2;
+   g->edges = rzalloc_array(g, uint64_t, g->edges_size);
+
+   for (unsigned int i = 0; i < old_size; i++) {
+      if (old[i]) {
+         unsigned int h = ra_edge_hash(g, old[i]);
+
+         while (g->edges[h])
+            h = (h + 1) & (g->edges_size - 1);
+         g->edges[h] = old[i];
+      }
+   }
+
+   ralloc_free(old);
+}
+
+/**
+ * Records the edge between n1 and n2, returning false if it was already
+ * there.
+ */
+static bool
+ra_edge_set_add(struct ra_graph *g, unsigned int n1, unsigned int n2)
+{
+   if (g->adjacency) {
+      unsigned int words = BITSET_WORDS(g->count);
+
+      if (BITSET_TEST(&g->adjacency[(size_t)n1 * words], n2))
+         return false;
+
+      BITSET_SET(&g->adjacency[(size_t)n1 * words], n2);
+      BITSET_SET(&g->adjacency[(size_t)n2 * words], n1);
+      return true;
+   }
+
+   uint64_t key = ra_edge_key(n1, n2);
+   unsigned int h = ra_edge_hash(g, key);
+
+   while (g->edges[h]) {
+      if (g->edges[h] == key)
+         return false;
+      h = (h + 1) & (g->edges_size - 1);
+   }
+
+   g->edges[h] = key;
+
+   /* Keep the load factor under 1/2. */
+   if (++g->edge_count * 2 > g->edges_size)
+      ra_edge_set_grow(g);
+
+   return true;
+}
+
+static void
+ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
+{
    assert(n1 != n2);
 
    int n1_class = g->nodes[n1].class;
@@ -426,10 +541,15 @@ ra_alloc_interference_graph(struct ra_regs *regs, unsigned int count)
 
    g->stack = rzalloc_array(g, unsigned int, count);
 
-   for (i = 0; i < count; i++) {
-      int bitset_count = BITSET_WORDS(count);
-      g->nodes[i].adjacency = rzalloc_array(g, BITSET_WORD, bitset_count);
+   if (count <= RA_DENSE_MAX_NODES) {
+      g->adjacency = rzalloc_array(g, BITSET_WORD,
+                                   (size_t)count * BITSET_WORDS(count));
+   } else {
+      g->edges_size = util_next_power_of_two(count * 4);
+      g->edges = rzalloc_array(g, uint64_t, g->edges_size);
+   }
 
+   for (i = 0; i < count; i++) {
       g->nodes[i].adjacency_list_size = 4;
       g->nodes[i].adjacency_list =
          ralloc_array(g, unsigned int, g->nodes[i].adjacency_list_size);
@@ -463,7 +583,7 @@ void
 ra_add_node_interference(struct ra_graph *g,
                          unsigned int n1, unsigned int n2)
 {
-   if (n1 != n2 && !BITSET_TEST(g->nodes[n1].adjacency, n2)) {
+   if (n1 != n2 && ra_edge_set_add(g, n1, n2)) {
       ra_add_node_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n2, n1);
    }
@@ -477,20 +597,91 @@ pq_test(struct ra_graph *g, unsigned int n)
    return g->nodes[n].q_total < g->regs->classes[n_class]->p;
 }
 
+/**
+ * Temporary state for ra_simplify().
+ *
+ * Nodes that pass the pq test wait in a worklist to be pushed on the stack.
+ * The others are kept in buckets by q_total, doubly linked through next and
+ * prev, so that the optimistic choice is the first node of the lowest
+ * non-empty bucket.
+ */
+struct ra_simplify_state {
+   unsigned int *worklist;
+   unsigned int worklist_count;
+
+   unsigned int *buckets;
+   unsigned int num_buckets;
+   unsigned int min_bucket;
+   unsigned int *next;
+   unsigned int *prev;
+};
+
+#define NO_NODE ~0U
+
+static void
+bucket_insert(struct ra_simplify_state *s, struct ra_graph *g, unsigned int n)
+{
+   unsigned int q = g->nodes[n].q_total;
+
+   assert(q < s->num_buckets);
+   s->prev[n] = NO_NODE;
+   s->next[n] = s->buckets[q];
+   if (s->buckets[q] != NO_NODE)
+      s->prev[s->buckets[q]] = n;
+   s->buckets[q] = n;
+   s->min_bucket = MIN2(s->min_bucket, q);
+}
+
+static void
+bucket_remove(struct ra_simplify_state *s, struct ra_graph *g, unsigned int n)
+{
+   if (s->prev[n] != NO_NODE)
+      s->next[s->prev[n]] = s->next[n];
+   else
+      s->buckets[g->nodes[n].q_total] = s->next[n];
+
+   if (s->next[n] != NO_NODE)
+      s->prev[s->next[n]] = s->prev[n];
+}
+
+/**
+ * Pushes n on the stack, removing its edges from the graph, which moves its
+ * neighbors to lower buckets or to the worklist.
+ */
 static void
-decrement_q(struct ra_graph *g, unsigned int n)
+push_node(struct ra_simplify_state *s, struct ra_graph *g, unsigned int n)
 {
    unsigned int i;
    int n_class = g->nodes[n].class;
 
+   g->stack[g->stack_count++] = n;
+   g->nodes[n].in_stack = true;
+
    for (i = 0; i < g->nodes[n].adjacency_count; i++) {
       unsigned int n2 = g->nodes[n].adjacency_list[i];
       unsigned int n2_class = g->nodes[n2].class;
+      unsigned int q = g->regs->classes[n2_class]->q[n_class];
 
-      if (!g->nodes[n2].in_stack) {
-         assert(g->nodes[n2].q_total >= g->regs->classes[n2_class]->q[n_class]);
-         g->nodes[n2].q_total -= g->regs->classes[n2_class]->q[n_class];
+      if (g->nodes[n2].in_stack)
+         continue;
+
+      assert(g->nodes[n2].q_total >= q);
+
+      /* Nodes with a fixed register are neither in the worklist nor in the
+       * buckets, and neither are the ones that already pass the pq test.
+       */
+      if (g->nodes[n2].reg != NO_REG || pq_test(g, n2)) {
+         g->nodes[n2].q_total -= q;
+         continue;
       }
+
+      bucket_remove(s, g, n2);
+      g->nodes[n2].q_total -= q;
+
+      if (pq_test(g, n2))
+         s->worklist[s->worklist_count++] = n2;
+      else
+         bucket_insert(s, g, n2);
    }
 }
 
@@ -503,69 +694,75 @@ decrement_q(struct ra_graph *g, unsigned int n)
  * we optimistically choose a node and push it on the stack. We heuristically
  * push the node with the lowest total q value, since it has the fewest
  * neighbors and therefore is most likely to be allocated.
+ *
+ * Each node is pushed once and each edge visited once when its first node
+ * is pushed, so this is linear in the size of the graph plus the range of
+ * q_total values the optimistic search has to step over.
  */
 static void
 ra_simplify(struct ra_graph *g)
 {
-   bool progress = true;
+   struct ra_simplify_state s;
    unsigned int stack_optimistic_start = UINT_MAX;
+   unsigned int max_q_total = 0;
    int i;
 
-   while (progress) {
-      unsigned int best_optimistic_node = ~0;
-      unsigned int lowest_q_total = ~0;
-
-      progress = false;
-
-      for (i = g->count - 1; i >= 0; i--) {
-	 if (g->nodes[i].in_stack || g->nodes[i].reg != NO_REG)
-	    continue;
-
-	 if (pq_test(g, i)) {
-	    decrement_q(g, i);
-	    g->stack[g->stack_count] = i;
-	    g->stack_count++;
-	    g->nodes[i].in_stack = true;
-	    progress = true;
-	 } else {
-	    unsigned int new_q_total = g->nodes[i].q_total;
-	    if (new_q_total < lowest_q_total) {
-	       best_optimistic_node = i;
-	       lowest_q_total = new_q_total;
-	    }
-	 }
-      }
+   for (i = 0; i < g->count; i++) {
+      if (g->nodes[i].reg == NO_REG)
+         max_q_total = MAX2(max_q_total, g->nodes[i].q_total);
+   }
 
-      if (!progress && best_optimistic_node != ~0U) {
-         if (stack_optimistic_start == UINT_MAX)
-            stack_optimistic_start = g->stack_count;
+   s.worklist = malloc(g->count * sizeof(unsigned int));
+   s.worklist_count = 0;
+   s.num_buckets = max_q_total + 1;
+   s.buckets = malloc(s.num_buckets * sizeof(unsigned int));
+   s.min_bucket = s.num_buckets;
+   s.next = malloc(g->count * sizeof(unsigned int));
+   s.prev = malloc(g->count * sizeof(unsigned int));
+   memset(s.buckets, 0xff, s.num_buckets * sizeof(unsigned int));
+
+   /* Walk the nodes backwards, and fill the worklist so that the lowest
+    * numbered nodes get pushed last, like the pass-based search this
+    * replaces.
+    */
+   for (i = g->count - 1; i >= 0; i--) {
+      if (g->nodes[i].in_stack || g->nodes[i].reg != NO_REG)
+         continue;
 
-	 decrement_q(g, best_optimistic_node);
-	 g->stack[g->stack_count] = best_optimistic_node;
-	 g->stack_count++;
-	 g->nodes[best_optimistic_node].in_stack = true;
-	 progress = true;
-      }
+      if (pq_test(g, i))
+         s.worklist[s.worklist_count++] = i;
+      else
+         bucket_insert(&s, g, i);
    }
 
-   g->stack_optimistic_start = stack_optimistic_start;
-}
+   while (true) {
+      if (s.worklist_count > 0) {
+         push_node(&s, g, s.worklist[--s.worklist_count]);
+         continue;
+      }
 
-static bool
-ra_any_neighbors_conflict(struct ra_graph *g, unsigned int n, unsigned int r)
-{
-   unsigned int i;
+      while (s.min_bucket < s.num_buckets &&
+             s.buckets[s.min_bucket] == NO_NODE)
+         s.min_bucket++;
 
-   for (i = 0; i < g->nodes[n].adjacency_count; i++) {
-      unsigned int n2 = g->nodes[n].adjacency_list[i];
+      if (s.min_bucket == s.num_buckets)
+         break;
 
-      if (!g->nodes[n2].in_stack &&
-          BITSET_TEST(g->regs->regs[r].conflicts, g->nodes[n2].reg)) {
-         return true;
-      }
+      unsigned int best_optimistic_node = s.buckets[s.min_bucket];
+
+      if (stack_optimistic_start == UINT_MAX)
+         stack_optimistic_start = g->stack_count;
+
+      bucket_remove(&s, g, best_optimistic_node);
+      push_node(&s, g, best_optimistic_node);
    }
 
-   return false;
+   g->stack_optimistic_start = stack_optimistic_start;
+
+   free(s.worklist);
+   free(s.buckets);
+   free(s.next);
+   free(s.prev);
 }
 
 /* Computes a bitfield of what regs are available for a given register
@@ -603,6 +800,34 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
    return false;
 }
 
+/**
+ * Returns the first register set in regs, starting the search at start and
+ * wrapping around, or NO_REG if there are none.
+ */
+static unsigned int
+ra_find_reg_from(struct ra_graph *g, const BITSET_WORD *regs,
+                 unsigned int start)
+{
+   unsigned int words = BITSET_WORDS(g->regs->count);
+   unsigned int w = BITSET_BITWORD(start);
+   BITSET_WORD mask = ~(BITSET_BIT(start) - 1);
+
+   /* Words past the last register are all zero, so we can scan whole words.
+    * Visit the first word twice, for the bits below start.
+    */
+   for (unsigned int i = 0; i <= words; i++) {
+      BITSET_WORD bits = regs[w] & mask;
+
+      if (bits)
+         return w * BITSET_WORDBITS + ffs(bits) - 1;
+
+      w = (w + 1) % words;
+      mask = i + 1 == words ? BITSET_BIT(start) - 1 : ~(BITSET_WORD)0;
+   }
+
+   return NO_REG;
+}
+
 /**
  * Pops nodes from the stack back into the graph, coloring them with
  * registers as they go.
@@ -614,44 +839,30 @@ static bool
 ra_select(struct ra_graph *g)
 {
    int start_search_reg = 0;
-   BITSET_WORD *select_regs = NULL;
-
-   if (g->select_reg_callback)
-      select_regs = malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
+   BITSET_WORD *select_regs =
+      malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
 
    while (g->stack_count != 0) {
-      unsigned int ri;
-      unsigned int r = -1;
+      unsigned int r;
       int n = g->stack[g->stack_count - 1];
-      struct ra_class *c = g->regs->classes[g->nodes[n].class];
 
       /* set this to false even if we return here so that
        * ra_get_best_spill_node() considers this node later.
        */
       g->nodes[n].in_stack = false;
 
-      if (g->select_reg_callback) {
-         if (!ra_compute_available_regs(g, n, select_regs)) {
-            free(select_regs);
-            return false;
-         }
+      if (!ra_compute_available_regs(g, n, select_regs)) {
+         free(select_regs);
+         return false;
+      }
 
+      if (g->select_reg_callback) {
          r = g->select_reg_callback(g, select_regs, g->select_reg_callback_data);
       } else {
          /* Find the lowest-numbered reg which is not used by a member
           * of the graph adjacent to us.
           */
-         for (ri = 0; ri < g->regs->count; ri++) {
-            r = (start_search_reg + ri) % g->regs->count;
-            if (!reg_belongs_to_class(r, c))
-               continue;
-
-            if (!ra_any_neighbors_conflict(g, n, r))
-               break;
-         }
-
-         if (ri >= g->regs->count)
-            return false;
+         r = ra_find_reg_from(g, select_regs, start_search_reg);
       }
 
       g->nodes[n].reg = r;
@@ -668,7 +879,7 @@ ra_select(struct ra_graph *g)
        */
       if (g->regs->round_robin &&
           g->stack_count - 1 <= g->stack_optimistic_start)
-         start_search_reg = r + 1;
+         start_search_reg = (r + 1) % g->regs->count;
    }
 
    free(select_regs);
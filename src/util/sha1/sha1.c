@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "u_endian.h"
+#include "util/u_cpu_detect.h"
 #include "sha1.h"
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -101,6 +102,14 @@ SHA1Transform(uint32_t state[5], const uint8_t buffer[SHA1_BLOCK_LENGTH])
 }
 
 
+static void
+SHA1TransformC(uint32_t state[5], const uint8_t *data, size_t nblocks)
+{
+	for (; nblocks > 0; nblocks--, data += SHA1_BLOCK_LENGTH)
+		SHA1Transform(state, data);
+}
+
+
 /*
  * SHA1Init - Initialize new context
  */
@@ -108,6 +117,14 @@ void
 SHA1Init(SHA1_CTX *context)
 {
 
+	/* Pick the fastest block transform this CPU supports */
+	context->transform = SHA1TransformC;
+#ifdef USE_SHA_NI
+	util_cpu_detect();
+	if (util_cpu_caps.has_sha && util_cpu_caps.has_sse4_1)
+		context->transform = SHA1TransformSHANI;
+#endif
+
 	/* SHA1 initialization constants */
 	context->count = 0;
 	context->state[0] = 0x67452301;
@@ -130,9 +147,12 @@ SHA1Update(SHA1_CTX *context, const uint8_t *data, size_t len)
 	context->count += (len << 3);
 	if ((j + len) > 63) {
 		(void)memcpy(&context->buffer[j], data, (i = 64-j));
-		SHA1Transform(context->state, context->buffer);
-		for ( ; i + 63 < len; i += 64)
-			SHA1Transform(context->state, (uint8_t *)&data[i]);
+		context->transform(context->state, context->buffer, 1);
+		if (i + 63 < len) {
+			context->transform(context->state, &data[i],
+			    (len - i) / SHA1_BLOCK_LENGTH);
+			i += (len - i) & ~(size_t)(SHA1_BLOCK_LENGTH - 1);
+		}
 		j = 0;
 	} else {
 		i = 0;
@@ -147,6 +167,7 @@ SHA1Update(SHA1_CTX *context, const uint8_t *data, size_t len)
 void
 SHA1Pad(SHA1_CTX *context)
 {
+	static const uint8_t padding[SHA1_BLOCK_LENGTH] = { 0x80 };
 	uint8_t finalcount[8];
 	uint32_t i;
 
@@ -154,9 +175,9 @@ SHA1Pad(SHA1_CTX *context)
 		finalcount[i] = (uint8_t)((context->count >>
 		    ((7 - (i & 7)) * 8)) & 255);	/* Endian independent */
 	}
-	SHA1Update(context, (uint8_t *)"\200", 1);
-	while ((context->count & 504) != 448)
-		SHA1Update(context, (uint8_t *)"\0", 1);
+	/* 0x80 then zeroes up to 56 bytes mod 64 */
+	SHA1Update(context, padding,
+	    1 + ((119 - ((context->count >> 3) & 63)) & 63));
 	SHA1Update(context, finalcount, 8); /* Should cause a SHA1Transform() */
 }
 
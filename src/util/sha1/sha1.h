@@ -24,6 +24,7 @@ typedef struct _SHA1_CTX {
     uint32_t state[5];
     uint64_t count;
     uint8_t buffer[SHA1_BLOCK_LENGTH];
+    void (*transform)(uint32_t [5], const uint8_t *, size_t);
 } SHA1_CTX;
 
 void SHA1Init(SHA1_CTX *);
@@ -32,6 +33,11 @@ void SHA1Transform(uint32_t [5], const uint8_t [SHA1_BLOCK_LENGTH]);
 void SHA1Update(SHA1_CTX *, const uint8_t *, size_t);
 void SHA1Final(uint8_t [SHA1_DIGEST_LENGTH], SHA1_CTX *);
 
+/* Transform of consecutive blocks with the x86 SHA extensions, see
+ * sha1_ni.c.
+ */
+void SHA1TransformSHANI(uint32_t [5], const uint8_t *, size_t);
+
 #define HTONDIGEST(x) do {                                              \
         x[0] = htonl(x[0]);                                             \
         x[1] = htonl(x[1]);                                             \
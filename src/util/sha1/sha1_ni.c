@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * SHA-1 block transform using the x86 SHA extensions.
+ *
+ * This file is built with -msse4.1 -msha, and must only be called when
+ * util_cpu_caps.has_sha and has_sse4_1 are set.
+ */
+
+#include <immintrin.h>
+
+#include "sha1.h"
+
+/*
+ * Four rounds, with the message schedule for the rounds to come interleaved
+ * as in the Intel SHA extensions white paper.  msg[i % 4] holds words
+ * 4i..4i+3 of the schedule by the time round group i needs them:
+ * sha1msg1 starts group i + 3 at group i, the xor adds group i + 2 and
+ * sha1msg2 finishes group i + 1.
+ */
+#define SHA1_NI_ROUNDS(i, e_cur, e_next)                                   \
+   do {                                                                    \
+      if ((i) < 4) {                                                       \
+         msg[(i) % 4] = _mm_loadu_si128((const __m128i *)(data + 16 * (i)));\
+         msg[(i) % 4] = _mm_shuffle_epi8(msg[(i) % 4], bswap);             \
+      }                                                                    \
+      if ((i) == 0)                                                        \
+         e_cur = _mm_add_epi32(e_cur, msg[0]);                             \
+      else                                                                 \
+         e_cur = _mm_sha1nexte_epu32(e_cur, msg[(i) % 4]);                 \
+      e_next = abcd;                                                       \
+      if ((i) >= 3 && (i) <= 18)                                           \
+         msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4],       \
+                                                 msg[(i) % 4]);            \
+      abcd = _mm_sha1rnds4_epu32(abcd, e_cur, (i) / 5);                    \
+      if ((i) >= 1 && (i) <= 16)                                           \
+         msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4],       \
+                                                 msg[(i) % 4]);            \
+      if ((i) >= 2 && (i) <= 17)                                           \
+         msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4],            \
+                                            msg[(i) % 4]);                 \
+   } while (0)
+
+void
+SHA1TransformSHANI(uint32_t state[5], const uint8_t *data, size_t nblocks)
+{
+   const __m128i bswap = _mm_set_epi64x(0x0001020304050607ull,
+                                        0x08090a0b0c0d0e0full);
+   __m128i abcd, abcd_save, e0, e0_save, e1;
+   __m128i msg[4];
+
+   /* The instructions want a in the top lane and e in the top lane of its
+    * own register.
+    */
+   abcd = _mm_loadu_si128((const __m128i *)state);
+   abcd = _mm_shuffle_epi32(abcd, 0x1b);
+   e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+   for (; nblocks > 0; nblocks--, data += SHA1_BLOCK_LENGTH) {
+      abcd_save = abcd;
+      e0_save = e0;
+
+      SHA1_NI_ROUNDS(0, e0, e1);
+      SHA1_NI_ROUNDS(1, e1, e0);
+      SHA1_NI_ROUNDS(2, e0, e1);
+      SHA1_NI_ROUNDS(3, e1, e0);
+      SHA1_NI_ROUNDS(4, e0, e1);
+      SHA1_NI_ROUNDS(5, e1, e0);
+      SHA1_NI_ROUNDS(6, e0, e1);
+      SHA1_NI_ROUNDS(7, e1, e0);
+      SHA1_NI_ROUNDS(8, e0, e1);
+      SHA1_NI_ROUNDS(9, e1, e0);
+      SHA1_NI_ROUNDS(10, e0, e1);
+      SHA1_NI_ROUNDS(11, e1, e0);
+      SHA1_NI_ROUNDS(12, e0, e1);
+      SHA1_NI_ROUNDS(13, e1, e0);
+      SHA1_NI_ROUNDS(14, e0, e1);
+      SHA1_NI_ROUNDS(15, e1, e0);
+      SHA1_NI_ROUNDS(16, e0, e1);
+      SHA1_NI_ROUNDS(17, e1, e0);
+      SHA1_NI_ROUNDS(18, e0, e1);
+      SHA1_NI_ROUNDS(19, e1, e0);
+
+      /* e0 holds a from before the last four rounds, rotated into the new
+       * e by sha1nexte.
+       */
+      e0 = _mm_sha1nexte_epu32(e0, e0_save);
+      abcd = _mm_add_epi32(abcd, abcd_save);
+   }
+
+   abcd = _mm_shuffle_epi32(abcd, 0x1b);
+   _mm_storeu_si128((__m128i *)state, abcd);
+   state[4] = _mm_extract_epi32(e0, 3);
+}
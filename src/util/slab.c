@@ -26,8 +26,18 @@
 #include "u_atomic.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(HAVE_POSIX_MEMALIGN) && defined(__linux__)
+#include <sys/mman.h>
+#ifdef MADV_HUGEPAGE
+#define SLAB_HAVE_HUGE_PAGES
+#endif
+#endif
+
+#define SLAB_HUGE_REGION_SIZE (2 * 1024 * 1024)
+
 #define SLAB_MAGIC_ALLOCATED 0xcafe4321
 #define SLAB_MAGIC_FREE 0x7ee01234
 
@@ -65,12 +75,29 @@ struct slab_page_header {
       /* Number of remaining, non-freed elements (for orphaned pages). */
       unsigned num_remaining;
    } u;
+
+   /* The huge page region the page was carved from, or NULL if it was
+    * allocated with malloc.
+    */
+   struct slab_huge_region *region;
+
    /* Memory after the last member is dedicated to the page itself.
     * The allocated size is always larger than this structure.
     */
 };
 
 
+/* A 2MB block of memory that pages are carved from, with this header at the
+ * start.
+ */
+struct slab_huge_region {
+   /* Number of pages carved from the region that haven't been freed, plus
+    * one while the parent pool may still carve new pages from it.
+    */
+   unsigned refcount;
+};
+
+
 static struct slab_element_header *
 slab_get_element(struct slab_parent_pool *parent,
                  struct slab_page_header *page, unsigned index)
@@ -79,6 +106,74 @@ slab_get_element(struct slab_parent_pool *parent,
           ((uint8_t*)&page[1] + (parent->element_size * index));
 }
 
+static void
+slab_huge_region_unref(struct slab_huge_region *region)
+{
+   if (p_atomic_dec_zero(&region->refcount))
+      free(region);
+}
+
+static void
+slab_free_page(struct slab_page_header *page)
+{
+   if (page->region)
+      slab_huge_region_unref(page->region);
+   else
+      free(page);
+}
+
+/* Carve a page out of the current huge page region of the parent, starting
+ * a new region when it's full. Return NULL if that fails, or if the system
+ * has no huge pages.
+ */
+static struct slab_page_header *
+slab_alloc_huge_page(struct slab_parent_pool *parent, size_t size)
+{
+#ifdef SLAB_HAVE_HUGE_PAGES
+   struct slab_page_header *page;
+   struct slab_huge_region *region;
+   void *ptr;
+
+   size = ALIGN_POT(size, 64);
+   if (size > SLAB_HUGE_REGION_SIZE / 8)
+      return NULL;
+
+   mtx_lock(&parent->mutex);
+
+   if (!parent->huge_region ||
+       parent->huge_offset + size > SLAB_HUGE_REGION_SIZE) {
+      if (posix_memalign(&ptr, SLAB_HUGE_REGION_SIZE,
+                         SLAB_HUGE_REGION_SIZE) != 0) {
+         mtx_unlock(&parent->mutex);
+         return NULL;
+      }
+
+      /* This is only a hint, the region works the same without it. */
+      madvise(ptr, SLAB_HUGE_REGION_SIZE, MADV_HUGEPAGE);
+
+      if (parent->huge_region)
+         slab_huge_region_unref(parent->huge_region);
+
+      region = ptr;
+      region->refcount = 1;
+      parent->huge_region = region;
+      parent->huge_offset = ALIGN_POT(sizeof(*region), 64);
+   }
+
+   region = parent->huge_region;
+   page = (struct slab_page_header *)((uint8_t *)region + parent->huge_offset);
+   page->region = region;
+   parent->huge_offset += size;
+   p_atomic_inc(&region->refcount);
+
+   mtx_unlock(&parent->mutex);
+
+   return page;
+#else
+   return NULL;
+#endif
+}
+
 /* The given object/element belongs to an orphaned page (i.e. the owning child
  * pool has been destroyed). Mark the element as freed and free the whole page
  * when no elements are left in it.
@@ -92,7 +187,36 @@ slab_free_orphaned(struct slab_element_header *elt)
 
    page = (struct slab_page_header *)(elt->owner & ~(intptr_t)1);
    if (!p_atomic_dec_return(&page->u.num_remaining))
-      free(page);
+      slab_free_page(page);
+}
+
+/* Hand the elements collected in the foreign list back to their owners, or
+ * free them if their page has been orphaned in the meantime. The caller must
+ * hold the parent mutex.
+ */
+static void
+slab_flush_foreign_locked(struct slab_child_pool *pool)
+{
+   while (pool->foreign) {
+      struct slab_element_header *elt = pool->foreign;
+      /* Note: we _must_ re-read elt->owner here because the owning child
+       * pool may have been destroyed by another thread in the meantime.
+       */
+      intptr_t owner_int = p_atomic_read(&elt->owner);
+
+      pool->foreign = elt->next;
+
+      if (!(owner_int & 1)) {
+         struct slab_child_pool *owner = (struct slab_child_pool *)owner_int;
+         elt->next = owner->migrated;
+         /* The owner peeks at this without the mutex in slab_alloc. */
+         p_atomic_set(&owner->migrated, elt);
+      } else {
+         slab_free_orphaned(elt);
+      }
+   }
+
+   pool->num_foreign = 0;
 }
 
 /**
@@ -100,21 +224,44 @@ slab_free_orphaned(struct slab_element_header *elt)
  *
  * \param item_size     Size of one object.
  * \param num_items     Number of objects to allocate at once.
+ * \param flags         A combination of slab_parent_flags.
  */
 void
-slab_create_parent(struct slab_parent_pool *parent,
-                   unsigned item_size,
-                   unsigned num_items)
+slab_create_parent_flags(struct slab_parent_pool *parent,
+                         unsigned item_size,
+                         unsigned num_items,
+                         unsigned flags)
 {
    mtx_init(&parent->mutex, mtx_plain);
    parent->element_size = ALIGN_POT(sizeof(struct slab_element_header) + item_size,
                                     sizeof(intptr_t));
    parent->num_elements = num_items;
+   parent->flags = flags;
+   parent->huge_region = NULL;
+   parent->huge_offset = 0;
+}
+
+/**
+ * Create a parent pool for the allocation of same-sized objects.
+ *
+ * \param item_size     Size of one object.
+ * \param num_items     Number of objects to allocate at once.
+ */
+void
+slab_create_parent(struct slab_parent_pool *parent,
+                   unsigned item_size,
+                   unsigned num_items)
+{
+   slab_create_parent_flags(parent, item_size, num_items, 0);
 }
 
 void
 slab_destroy_parent(struct slab_parent_pool *parent)
 {
+   /* Pages carved from the region may still be in use in orphaned pages. */
+   if (parent->huge_region)
+      slab_huge_region_unref(parent->huge_region);
+
    mtx_destroy(&parent->mutex);
 }
 
@@ -128,6 +275,8 @@ void slab_create_child(struct slab_child_pool *pool,
    pool->pages = NULL;
    pool->free = NULL;
    pool->migrated = NULL;
+   pool->foreign = NULL;
+   pool->num_foreign = 0;
 }
 
 /**
@@ -143,6 +292,8 @@ void slab_destroy_child(struct slab_child_pool *pool)
 
    mtx_lock(&pool->parent->mutex);
 
+   slab_flush_foreign_locked(pool);
+
    while (pool->pages) {
       struct slab_page_header *page = pool->pages;
       pool->pages = page->u.next;
@@ -175,11 +326,19 @@ void slab_destroy_child(struct slab_child_pool *pool)
 static bool
 slab_add_new_page(struct slab_child_pool *pool)
 {
-   struct slab_page_header *page = malloc(sizeof(struct slab_page_header) +
-      pool->parent->num_elements * pool->parent->element_size);
-
-   if (!page)
-      return false;
+   size_t size = sizeof(struct slab_page_header) +
+                 pool->parent->num_elements * pool->parent->element_size;
+   struct slab_page_header *page = NULL;
+
+   if (pool->parent->flags & SLAB_HUGE_PAGES)
+      page = slab_alloc_huge_page(pool->parent, size);
+
+   if (!page) {
+      page = malloc(size);
+      if (!page)
+         return false;
+      page->region = NULL;
+   }
 
    for (unsigned i = 0; i < pool->parent->num_elements; ++i) {
       struct slab_element_header *elt = slab_get_element(pool->parent, page, i);
@@ -209,12 +368,15 @@ slab_alloc(struct slab_child_pool *pool)
 
    if (!pool->free) {
       /* First, collect elements that belong to us but were freed from a
-       * different child pool.
+       * different child pool. Don't bother taking the mutex when there are
+       * none; missing some that are being migrated right now is harmless.
        */
-      mtx_lock(&pool->parent->mutex);
-      pool->free = pool->migrated;
-      pool->migrated = NULL;
-      mtx_unlock(&pool->parent->mutex);
+      if (p_atomic_read(&pool->migrated)) {
+         mtx_lock(&pool->parent->mutex);
+         pool->free = pool->migrated;
+         pool->migrated = NULL;
+         mtx_unlock(&pool->parent->mutex);
+      }
 
       /* Now allocate a new page. */
       if (!pool->free && !slab_add_new_page(pool))
@@ -237,7 +399,9 @@ slab_alloc(struct slab_child_pool *pool)
  *
  * Freeing an object in a different child pool from the one where it was
  * allocated is allowed, as long the pool belong to the same parent. No
- * additional locking is required in this case.
+ * additional locking is required in this case. Such objects are collected in
+ * the pool and handed back to their owners in batches of SLAB_MAGAZINE_SIZE,
+ * or when the pool is destroyed.
  */
 void slab_free(struct slab_child_pool *pool, void *ptr)
 {
@@ -256,23 +420,23 @@ void slab_free(struct slab_child_pool *pool, void *ptr)
       return;
    }
 
-   /* The slow case: migration or an orphaned page. */
-   mtx_lock(&pool->parent->mutex);
+   /* Pages never stop being orphaned, so this needs no locking. */
+   owner_int = p_atomic_read(&elt->owner);
+   if (owner_int & 1) {
+      slab_free_orphaned(elt);
+      return;
+   }
 
-   /* Note: we _must_ re-read elt->owner here because the owning child pool
-    * may have been destroyed by another thread in the meantime.
+   /* The slow case: migration. Keep the element until there is a full batch
+    * of them to move under the mutex.
     */
-   owner_int = p_atomic_read(&elt->owner);
+   elt->next = pool->foreign;
+   pool->foreign = elt;
 
-   if (!(owner_int & 1)) {
-      struct slab_child_pool *owner = (struct slab_child_pool *)owner_int;
-      elt->next = owner->migrated;
-      owner->migrated = elt;
-      mtx_unlock(&pool->parent->mutex);
-   } else {
+   if (++pool->num_foreign >= SLAB_MAGAZINE_SIZE) {
+      mtx_lock(&pool->parent->mutex);
+      slab_flush_foreign_locked(pool);
       mtx_unlock(&pool->parent->mutex);
-
-      slab_free_orphaned(elt);
    }
 }
 
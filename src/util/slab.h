@@ -33,7 +33,9 @@
  * Allocations obtained from one child pool should usually be freed in the
  * same child pool. Freeing an allocation in a different child pool associated
  * to the same parent is allowed (and requires no locking by the caller), but
- * it is discouraged because it implies a performance penalty.
+ * it is discouraged because it implies a performance penalty. Such frees are
+ * batched per child pool and handed back to their owners SLAB_MAGAZINE_SIZE
+ * at a time, so the parent mutex isn't taken on every one of them.
  *
  * For convenience and to ease the transition, there is also a set of wrapper
  * functions around a single parent-child pair.
@@ -46,11 +48,32 @@
 
 struct slab_element_header;
 struct slab_page_header;
+struct slab_huge_region;
+
+/* Number of elements owned by other child pools that a child pool collects
+ * in slab_free before handing them back under the parent mutex.
+ */
+#define SLAB_MAGAZINE_SIZE 32
+
+enum slab_parent_flags {
+   /* Carve pages out of 2MB regions backed by transparent huge pages, when
+    * the OS supports it. This saves TLB misses on hot objects, at the cost
+    * of keeping at least one 2MB region around per parent.
+    */
+   SLAB_HUGE_PAGES = 1 << 0,
+};
 
 struct slab_parent_pool {
    mtx_t mutex;
    unsigned element_size;
    unsigned num_elements;
+   unsigned flags;
+
+   /* The huge page region that new pages are carved from, and the offset of
+    * its first unused byte. Protected by the mutex.
+    */
+   struct slab_huge_region *huge_region;
+   size_t huge_offset;
 };
 
 struct slab_child_pool {
@@ -67,11 +90,22 @@ struct slab_child_pool {
     * This list is protected by the parent mutex.
     */
    struct slab_element_header *migrated;
+
+   /* Elements owned by other child pools that were freed with this pool as
+    * the argument to slab_free, waiting to be moved to the migrated lists of
+    * their owners in one batch.
+    */
+   struct slab_element_header *foreign;
+   unsigned num_foreign;
 };
 
 void slab_create_parent(struct slab_parent_pool *parent,
                         unsigned item_size,
                         unsigned num_items);
+void slab_create_parent_flags(struct slab_parent_pool *parent,
+                              unsigned item_size,
+                              unsigned num_items,
+                              unsigned flags);
 void slab_destroy_parent(struct slab_parent_pool *parent);
 void slab_create_child(struct slab_child_pool *pool,
                        struct slab_parent_pool *parent);
@@ -0,0 +1,161 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Compares the put and get latency of the one file per item shader cache
+ * with the packed database enabled by MESA_DISK_CACHE_DATABASE.
+ *
+ * Usage: disk_cache_bench [entries...]
+ *
+ * The default is to run with 10k, 100k and 1M entries.  The caches are
+ * created in $TMPDIR (or /tmp) and removed afterwards.
+ */
+
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/disk_cache.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+
+#define ITEM_SIZE 512
+
+#ifdef ENABLE_SHADER_CACHE
+
+static int
+remove_entry(const char *path, const struct stat *sb, int typeflag,
+             struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+static void
+fill_item(uint8_t *data, unsigned n)
+{
+   uint32_t x = n * 2654435761u + 1;
+
+   for (unsigned i = 0; i < ITEM_SIZE; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      data[i] = x;
+   }
+}
+
+static void
+run(const char *name, bool database, unsigned entries)
+{
+   const char *tmpdir = getenv("TMPDIR");
+   char path[4096];
+   uint8_t data[ITEM_SIZE];
+   cache_key key;
+   unsigned hits = 0;
+   int64_t start, put_time, get_time;
+
+   snprintf(path, sizeof(path), "%s/disk_cache_bench.XXXXXX",
+            tmpdir ? tmpdir : "/tmp");
+   if (!mkdtemp(path)) {
+      perror("mkdtemp");
+      exit(1);
+   }
+
+   setenv("MESA_GLSL_CACHE_DIR", path, 1);
+   setenv("MESA_DISK_CACHE_DATABASE", database ? "true" : "false", 1);
+
+   struct disk_cache *cache = disk_cache_create("bench", "disk_cache_bench", 0);
+   if (!cache) {
+      fprintf(stderr, "failed to create cache in %s\n", path);
+      exit(1);
+   }
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < entries; i++) {
+      fill_item(data, i);
+      disk_cache_compute_key(cache, &i, sizeof(i), key);
+      disk_cache_put(cache, key, data, sizeof(data), NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+   put_time = os_time_get_nano() - start;
+
+   /* Look items up in a different order than they were written in. */
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < entries; i++) {
+      unsigned n = (i * 2654435761u) % entries;
+      size_t size;
+      void *item;
+
+      disk_cache_compute_key(cache, &n, sizeof(n), key);
+      item = disk_cache_get(cache, key, &size);
+      if (item && size == ITEM_SIZE)
+         hits++;
+      free(item);
+   }
+   get_time = os_time_get_nano() - start;
+
+   disk_cache_destroy(cache);
+   nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+
+   printf("%-8s %8u entries: put %8.2f us, get %8.2f us, %u hits\n",
+          name, entries, put_time / 1000.0 / entries,
+          get_time / 1000.0 / entries, hits);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned default_entries[] = { 10000, 100000, 1000000 };
+
+   /* Large enough that nothing is evicted. */
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "16G", 1);
+
+   if (argc > 1) {
+      for (int i = 1; i < argc; i++) {
+         unsigned entries = strtoul(argv[i], NULL, 0);
+         run("files", false, entries);
+         run("database", true, entries);
+      }
+   } else {
+      for (unsigned i = 0; i < ARRAY_SIZE(default_entries); i++) {
+         run("files", false, default_entries[i]);
+         run("database", true, default_entries[i]);
+      }
+   }
+
+   return 0;
+}
+
+#else
+
+int
+main(void)
+{
+   printf("shader cache disabled, nothing to measure\n");
+   return 0;
+}
+
+#endif /* ENABLE_SHADER_CACHE */
@@ -0,0 +1,161 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures the time of the basic hash table operations, with pointer,
+ * integer and string keys.
+ *
+ * Usage: hash_table_bench [entries...]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "hash_table.h"
+#include "os_time.h"
+
+enum key_type {
+   KEY_POINTER,
+   KEY_INT,
+   KEY_STRING,
+};
+
+static const char *key_type_names[] = { "pointer", "int", "string" };
+
+static struct hash_table *
+create_table(enum key_type type)
+{
+   switch (type) {
+   case KEY_POINTER:
+      return _mesa_pointer_hash_table_create(NULL);
+   case KEY_INT:
+      return _mesa_int_key_hash_table_create(NULL);
+   default:
+      return _mesa_hash_table_create(NULL, _mesa_key_hash_string,
+                                     _mesa_key_string_equal);
+   }
+}
+
+/* Keys 0..count-1 are inserted, count..2*count-1 are used for misses. */
+static const void **
+create_keys(enum key_type type, unsigned count, void **storage)
+{
+   const void **keys = malloc(2 * count * sizeof(*keys));
+   char *strings = NULL;
+   uint64_t *objects = NULL;
+
+   if (type == KEY_STRING)
+      strings = malloc(2 * count * 16);
+   else if (type == KEY_POINTER)
+      objects = malloc(2 * count * sizeof(*objects));
+
+   for (unsigned i = 0; i < 2 * count; i++) {
+      /* Shuffle the keys a bit, so that they aren't inserted in order. */
+      unsigned n = (uint64_t) i * 2654435761u % (2 * count);
+
+      switch (type) {
+      case KEY_POINTER:
+         keys[i] = &objects[n];
+         break;
+      case KEY_INT:
+         keys[i] = (const void *) (uintptr_t) (n + 1);
+         break;
+      case KEY_STRING:
+         snprintf(strings + 16 * i, 16, "var_%u", n);
+         keys[i] = strings + 16 * i;
+         break;
+      }
+   }
+
+   *storage = strings ? (void *) strings : (void *) objects;
+   return keys;
+}
+
+static double
+ns_per_op(int64_t start, unsigned count)
+{
+   return (double) (os_time_get_nano() - start) / count;
+}
+
+static void
+run(enum key_type type, unsigned count)
+{
+   struct hash_table *ht = create_table(type);
+   void *storage;
+   const void **keys = create_keys(type, count, &storage);
+   unsigned found = 0;
+   double insert, hit, miss, iterate, remove;
+   int64_t start;
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < count; i++)
+      _mesa_hash_table_insert(ht, keys[i], NULL);
+   insert = ns_per_op(start, count);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < count; i++)
+      found += _mesa_hash_table_search(ht, keys[i]) != NULL;
+   hit = ns_per_op(start, count);
+
+   start = os_time_get_nano();
+   for (unsigned i = count; i < 2 * count; i++)
+      found += _mesa_hash_table_search(ht, keys[i]) != NULL;
+   miss = ns_per_op(start, count);
+
+   start = os_time_get_nano();
+   hash_table_foreach(ht, entry)
+      found++;
+   iterate = ns_per_op(start, count);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < count; i++)
+      _mesa_hash_table_remove_key(ht, keys[i]);
+   remove = ns_per_op(start, count);
+
+   printf("%-8s %8u: insert %6.1f ns, hit %6.1f ns, miss %6.1f ns, "
+          "iterate %6.1f ns, remove %6.1f ns%s\n",
+          key_type_names[type], count, insert, hit, miss, iterate, remove,
+          found == 2 * count ? "" : " (wrong results)");
+
+   _mesa_hash_table_destroy(ht, NULL);
+   free(keys);
+   free(storage);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned default_counts[] = { 100, 10000, 1000000 };
+
+   for (unsigned t = KEY_POINTER; t <= KEY_STRING; t++) {
+      if (argc > 1) {
+         for (int i = 1; i < argc; i++)
+            run(t, strtoul(argv[i], NULL, 0));
+      } else {
+         for (unsigned i = 0; i < ARRAY_SIZE(default_counts); i++)
+            run(t, default_counts[i]);
+      }
+   }
+
+   return 0;
+}
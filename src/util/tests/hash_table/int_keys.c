@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "hash_table.h"
+
+#define KEY(i) ((void *) (uintptr_t) (i))
+
+/* Integer keys, including consecutive ones, removals and reinsertions. */
+int
+main(int argc, char **argv)
+{
+   struct hash_table *ht;
+   struct hash_entry *entry;
+   uint32_t i, size = 10000, count;
+
+   (void) argc;
+   (void) argv;
+
+   ht = _mesa_int_key_hash_table_create(NULL);
+
+   for (i = 1; i <= size; i++)
+      _mesa_hash_table_insert(ht, KEY(i), KEY(i * 2));
+   assert(ht->entries == size);
+
+   for (i = 1; i <= size; i++) {
+      entry = _mesa_hash_table_search(ht, KEY(i));
+      assert(entry && entry->data == KEY(i * 2));
+   }
+   assert(!_mesa_hash_table_search(ht, KEY(size + 1)));
+
+   /* Remove the odd keys, while iterating. */
+   hash_table_foreach(ht, entry) {
+      if ((uintptr_t) entry->key & 1)
+         _mesa_hash_table_remove(ht, entry);
+   }
+   assert(ht->entries == size / 2);
+
+   for (i = 1; i <= size; i++) {
+      entry = _mesa_hash_table_search(ht, KEY(i));
+      assert((entry != NULL) == !(i & 1));
+   }
+
+   /* Reinsert them, and replace the even ones. */
+   for (i = 1; i <= size; i++)
+      _mesa_hash_table_insert(ht, KEY(i), KEY(i * 3));
+   assert(ht->entries == size);
+
+   count = 0;
+   hash_table_foreach(ht, entry) {
+      assert(entry->data == KEY((uintptr_t) entry->key * 3));
+      count++;
+   }
+   assert(count == size);
+
+   _mesa_hash_table_destroy(ht, NULL);
+
+   return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_job.h"
+
+#define NUM_NODES 500
+#define MAX_DEPS 4
+
+struct node {
+   struct util_job job;
+   struct util_queue_fence fence;
+   unsigned num_deps;
+   struct node *deps[MAX_DEPS];
+   int done;
+   int cleaned_up;
+};
+
+static struct node nodes[NUM_NODES];
+
+static void
+node_execute(void *data, int thread_index)
+{
+   struct node *node = data;
+
+   assert(thread_index >= 0 &&
+          thread_index < (int)MAX2(util_job_pool_num_threads(), 1));
+
+   for (unsigned i = 0; i < node->num_deps; i++)
+      assert(p_atomic_read(&node->deps[i]->done));
+
+   p_atomic_set(&node->done, 1);
+}
+
+static void
+node_cleanup(void *data, int thread_index)
+{
+   struct node *node = data;
+
+   /* The fence is signalled first. */
+   assert(util_queue_fence_is_signalled(&node->fence));
+   p_atomic_set(&node->cleaned_up, 1);
+}
+
+/* A random graph, where every node depends on up to MAX_DEPS earlier ones,
+ * submitted in a random order.
+ */
+static void
+test_graph(unsigned seed)
+{
+   unsigned order[NUM_NODES];
+
+   srand(seed);
+   memset(nodes, 0, sizeof(nodes));
+
+   for (unsigned i = 0; i < NUM_NODES; i++) {
+      struct node *node = &nodes[i];
+
+      util_queue_fence_init(&node->fence);
+      util_job_init(&node->job, "node", node, &node->fence, node_execute,
+                    node_cleanup, rand() % UTIL_QUEUE_NUM_PRIORITIES);
+
+      node->num_deps = i ? rand() % (MAX_DEPS + 1) : 0;
+      for (unsigned j = 0; j < node->num_deps; j++) {
+         node->deps[j] = &nodes[rand() % i];
+         util_job_add_dependency(&node->job, &node->deps[j]->job);
+      }
+      order[i] = i;
+   }
+
+   for (unsigned i = NUM_NODES - 1; i > 0; i--) {
+      unsigned j = rand() % (i + 1), tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+   }
+
+   for (unsigned i = 0; i < NUM_NODES; i++)
+      util_job_submit(&nodes[order[i]].job);
+
+   for (unsigned i = 0; i < NUM_NODES; i++) {
+      util_queue_fence_wait(&nodes[i].fence);
+      assert(nodes[i].done);
+   }
+
+   /* Depending on jobs which have completed already is fine. */
+   for (unsigned i = 0; i < NUM_NODES; i++) {
+      struct node *node = &nodes[i];
+
+      while (!p_atomic_read(&node->cleaned_up))
+         thrd_yield();
+      util_job_init(&node->job, "again", node, &node->fence, node_execute,
+                    NULL, UTIL_QUEUE_PRIORITY_NORMAL);
+      node->num_deps = 1;
+      node->deps[0] = &nodes[NUM_NODES - 1 - i];
+      util_job_add_dependency(&node->job, &nodes[NUM_NODES - 1 - i].job);
+      util_job_submit(&node->job);
+      util_queue_fence_wait(&node->fence);
+   }
+
+   for (unsigned i = 0; i < NUM_NODES; i++)
+      util_queue_fence_destroy(&nodes[i].fence);
+}
+
+#define NUM_LOW_JOBS 16
+
+static int num_low_running, max_low_running;
+
+static void
+low_execute(void *data, int thread_index)
+{
+   int n = p_atomic_inc_return(&num_low_running);
+   int max = p_atomic_read(&max_low_running);
+
+   while (n > max && p_atomic_cmpxchg(&max_low_running, max, n) != max)
+      max = p_atomic_read(&max_low_running);
+
+   os_time_sleep(2000);
+   p_atomic_dec(&num_low_running);
+}
+
+/* Low priority jobs only get half of the threads. */
+static void
+test_low_priority(void)
+{
+   struct util_job jobs[NUM_LOW_JOBS];
+   struct util_queue_fence fences[NUM_LOW_JOBS];
+   unsigned num_threads = util_job_pool_num_threads();
+
+   for (unsigned i = 0; i < NUM_LOW_JOBS; i++) {
+      util_queue_fence_init(&fences[i]);
+      util_job_init(&jobs[i], "low", NULL, &fences[i], low_execute, NULL,
+                    UTIL_QUEUE_PRIORITY_LOW);
+      util_job_submit(&jobs[i]);
+   }
+
+   for (unsigned i = 0; i < NUM_LOW_JOBS; i++) {
+      util_queue_fence_wait(&fences[i]);
+      util_queue_fence_destroy(&fences[i]);
+   }
+
+   assert(max_low_running >= 1);
+   assert(max_low_running <= (int)MAX2(num_threads / 2, 1));
+}
+
+static unsigned num_events;
+static unsigned num_queue_events;
+
+static void
+trace_callback(const struct util_job_trace_event *event, void *data)
+{
+   assert(data == &num_events);
+   assert(event->ready_time <= event->start_time);
+   assert(event->start_time <= event->end_time);
+
+   if (!strcmp(event->name, "node"))
+      p_atomic_inc(&num_events);
+   else if (strstr(event->name, "trace"))
+      p_atomic_inc(&num_queue_events);
+}
+
+static void
+nop_execute(void *data, int thread_index)
+{
+}
+
+/* Every job is reported, including those of util_queues. */
+static void
+test_trace(void)
+{
+   struct util_queue queue;
+   struct util_queue_fence fences[2];
+
+   util_job_set_trace_callback(trace_callback, &num_events);
+   assert(util_job_trace_enabled());
+
+   test_graph(1);
+   assert(num_events == NUM_NODES);
+
+   for (unsigned shared = 0; shared < 2; shared++) {
+      assert(util_queue_init(&queue, "trace", 8, 1,
+                             shared ? UTIL_QUEUE_INIT_SHARED_POOL : 0));
+      util_queue_fence_init(&fences[shared]);
+      util_queue_add_job(&queue, NULL, &fences[shared], nop_execute, NULL);
+      /* Jobs are reported before their fence is signalled. */
+      util_queue_fence_wait(&fences[shared]);
+      util_queue_destroy(&queue);
+      util_queue_fence_destroy(&fences[shared]);
+   }
+   assert(num_queue_events == 2);
+
+   util_job_set_trace_callback(NULL, NULL);
+   assert(!util_job_trace_enabled());
+}
+
+int
+main(int argc, char **argv)
+{
+   setenv("MESA_JOB_THREADS", "4", 0);
+
+   for (unsigned seed = 0; seed < 10; seed++)
+      test_graph(seed);
+   test_low_priority();
+   test_trace();
+
+   return 0;
+}
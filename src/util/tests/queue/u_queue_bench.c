@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Measures util_queue throughput with 1 to 64 producer threads adding small
+ * jobs to a queue with one thread per CPU.
+ *
+ * Usage: u_queue_bench [jobs per producer] [work per job] [threads] [shared]
+ *
+ * With "shared", the queue runs on the shared job pool, sized after the
+ * number of CPUs or MESA_JOB_THREADS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+/* Jobs in flight per producer. */
+#define WINDOW 64
+
+struct bench_job {
+   struct util_queue_fence fence;
+   unsigned work;
+   unsigned result;
+};
+
+struct producer {
+   struct util_queue *queue;
+   unsigned num_jobs;
+   unsigned work;
+   struct bench_job jobs[WINDOW];
+};
+
+static void
+bench_execute(void *data, int thread_index)
+{
+   struct bench_job *job = data;
+   unsigned x = job->work;
+
+   for (unsigned i = 0; i < job->work; i++)
+      x = x * 1103515245 + 12345;
+   job->result = x;
+}
+
+static int
+producer_thread(void *data)
+{
+   struct producer *p = data;
+
+   for (unsigned i = 0; i < WINDOW; i++)
+      util_queue_fence_init(&p->jobs[i].fence);
+
+   for (unsigned i = 0; i < p->num_jobs; i++) {
+      struct bench_job *job = &p->jobs[i % WINDOW];
+
+      util_queue_fence_wait(&job->fence);
+      job->work = p->work;
+      util_queue_add_job(p->queue, job, &job->fence, bench_execute, NULL);
+   }
+
+   for (unsigned i = 0; i < WINDOW; i++)
+      util_queue_fence_wait(&p->jobs[i].fence);
+
+   return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned num_jobs = argc > 1 ? atoi(argv[1]) : 100000;
+   unsigned work = argc > 2 ? atoi(argv[2]) : 0;
+   unsigned num_threads, flags;
+   struct producer *producers = calloc(64, sizeof(*producers));
+   thrd_t threads[64];
+   struct util_queue queue;
+
+   util_cpu_detect();
+   num_threads = argc > 3 ? atoi(argv[3]) : util_cpu_caps.nr_cpus;
+
+   flags = argc > 4 && !strcmp(argv[4], "shared") ?
+           UTIL_QUEUE_INIT_SHARED_POOL : 0;
+
+   if (!util_queue_init(&queue, "bench", 256, num_threads, flags))
+      return 1;
+
+   printf("%u threads%s, %u jobs per producer, %u work per job\n",
+          num_threads, flags ? " on the shared pool" : "", num_jobs, work);
+
+   for (unsigned num_producers = 1; num_producers <= 64; num_producers *= 2) {
+      int64_t start = os_time_get_nano();
+
+      for (unsigned i = 0; i < num_producers; i++) {
+         producers[i].queue = &queue;
+         producers[i].num_jobs = num_jobs;
+         producers[i].work = work;
+         threads[i] = u_thread_create(producer_thread, &producers[i]);
+      }
+      for (unsigned i = 0; i < num_producers; i++)
+         thrd_join(threads[i], NULL);
+
+      double secs = (os_time_get_nano() - start) / 1e9;
+      printf("%2u producers: %10.0f jobs/s\n", num_producers,
+             num_producers * num_jobs / secs);
+   }
+
+   util_queue_destroy(&queue);
+   free(producers);
+   return 0;
+}
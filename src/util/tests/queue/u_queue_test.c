@@ -0,0 +1,418 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/u_queue.h"
+
+#define NUM_JOBS 1000
+
+struct test_job {
+   struct util_queue_fence fence;
+   unsigned id;
+   bool cleaned_up;
+};
+
+static struct test_job jobs[NUM_JOBS];
+static unsigned order[NUM_JOBS];
+static unsigned num_executed;
+static struct util_queue_fence gate;
+static int gate_reached;
+
+static void
+record_execute(void *data, int thread_index)
+{
+   struct test_job *job = data;
+
+   order[p_atomic_inc_return(&num_executed) - 1] = job->id;
+}
+
+static void
+gate_execute(void *data, int thread_index)
+{
+   p_atomic_set(&gate_reached, 1);
+   util_queue_fence_wait(&gate);
+}
+
+static void
+mark_cleanup(void *data, int thread_index)
+{
+   struct test_job *job = data;
+
+   job->cleaned_up = thread_index == -1;
+}
+
+static void
+reset_jobs(void)
+{
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      util_queue_fence_init(&jobs[i].fence);
+      jobs[i].id = i;
+      jobs[i].cleaned_up = false;
+   }
+   num_executed = 0;
+}
+
+/* Block the only thread of \p queue until gate is signalled. */
+static void
+block_queue(struct util_queue *queue, struct util_queue_fence *fence)
+{
+   util_queue_fence_init(&gate);
+   util_queue_fence_reset(&gate);
+   util_queue_fence_init(fence);
+   gate_reached = 0;
+   util_queue_add_job(queue, NULL, fence, gate_execute, NULL);
+
+   while (!p_atomic_read(&gate_reached))
+      thrd_yield();
+}
+
+/* A single thread runs jobs in order, whether the queue blocks or grows
+ * when full.
+ */
+static void
+test_fifo(unsigned flags)
+{
+   struct util_queue queue;
+   struct util_queue_fence blocker;
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 4, 1, flags));
+
+   if (flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL)
+      block_queue(&queue, &blocker);
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, record_execute, NULL);
+
+   if (flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL)
+      util_queue_fence_signal(&gate);
+
+   util_queue_finish(&queue);
+
+   assert(num_executed == NUM_JOBS);
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      assert(util_queue_fence_is_signalled(&jobs[i].fence));
+      assert(order[i] == i);
+   }
+
+   util_queue_destroy(&queue);
+}
+
+static void
+test_priorities(unsigned flags)
+{
+   static const enum util_queue_priority prio[3] = {
+      UTIL_QUEUE_PRIORITY_LOW,
+      UTIL_QUEUE_PRIORITY_NORMAL,
+      UTIL_QUEUE_PRIORITY_HIGH,
+   };
+   struct util_queue queue;
+   struct util_queue_fence blocker;
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 32, 1, flags));
+
+   block_queue(&queue, &blocker);
+   for (unsigned i = 0; i < 30; i++) {
+      util_queue_add_job_with_priority(&queue, &jobs[i], &jobs[i].fence,
+                                       record_execute, NULL, prio[i % 3]);
+   }
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+
+   /* High first, then normal, then low, each in order. */
+   assert(num_executed == 30);
+   for (unsigned i = 0; i < 30; i++)
+      assert(order[i] == 3 * (i % 10) + 2 - i / 10);
+
+   util_queue_destroy(&queue);
+}
+
+static void
+test_drop(unsigned flags)
+{
+   struct util_queue queue;
+   struct util_queue_fence blocker;
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 8, 1,
+                          flags | UTIL_QUEUE_INIT_RESIZE_IF_FULL));
+
+   /* Half of the jobs end up in the overflow list. */
+   block_queue(&queue, &blocker);
+   for (unsigned i = 0; i < 16; i++) {
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, record_execute,
+                         mark_cleanup);
+   }
+
+   for (unsigned i = 0; i < 16; i += 3) {
+      util_queue_drop_job(&queue, &jobs[i].fence);
+      assert(util_queue_fence_is_signalled(&jobs[i].fence));
+      assert(jobs[i].cleaned_up);
+   }
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+
+   assert(num_executed == 10);
+   for (unsigned i = 0; i < 16; i++)
+      assert(jobs[i].cleaned_up == (i % 3 == 0));
+
+   /* Dropping a job that ran already just returns. */
+   util_queue_drop_job(&queue, &jobs[1].fence);
+
+   util_queue_destroy(&queue);
+}
+
+struct own_job {
+   struct util_queue *queue;
+   struct util_queue_fence fence;
+};
+
+static void
+own_execute(void *data, int thread_index)
+{
+   struct own_job *job = data;
+
+   for (unsigned i = 0; i < 100; i++) {
+      util_queue_add_job(job->queue, &jobs[i], &jobs[i].fence,
+                         record_execute, NULL);
+   }
+}
+
+/* Jobs added by a thread of the queue run in order too. */
+static void
+test_own_jobs(unsigned flags)
+{
+   struct util_queue queue;
+   struct util_queue_fence blocker;
+   struct own_job root = {
+      .queue = &queue,
+   };
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 8, 2, flags));
+
+   /* Keep the other thread from stealing the jobs. */
+   block_queue(&queue, &blocker);
+
+   util_queue_fence_init(&root.fence);
+   util_queue_add_job(&queue, &root, &root.fence, own_execute, NULL);
+   util_queue_fence_wait(&root.fence);
+   for (unsigned i = 0; i < 100; i++)
+      util_queue_fence_wait(&jobs[i].fence);
+
+   for (unsigned i = 0; i < 100; i++)
+      assert(order[i] == i);
+
+   util_queue_fence_signal(&gate);
+   util_queue_destroy(&queue);
+}
+
+struct tree_job {
+   struct util_queue *queue;
+   struct util_queue_fence fence;
+   unsigned depth;
+};
+
+static unsigned num_tree_jobs;
+
+static void
+tree_cleanup(void *data, int thread_index)
+{
+   free(data);
+}
+
+static void
+tree_execute(void *data, int thread_index)
+{
+   struct tree_job *job = data;
+
+   p_atomic_inc(&num_tree_jobs);
+
+   if (job->depth == 0)
+      return;
+
+   /* Jobs added from the queue's threads go to their own lists. */
+   for (unsigned i = 0; i < 3; i++) {
+      struct tree_job *child = calloc(1, sizeof(*child));
+
+      child->queue = job->queue;
+      child->depth = job->depth - 1;
+      util_queue_fence_init(&child->fence);
+      util_queue_add_job(job->queue, child, &child->fence, tree_execute,
+                         tree_cleanup);
+   }
+}
+
+static void
+test_nested(unsigned flags)
+{
+   struct util_queue queue;
+   struct tree_job root = {
+      .queue = &queue,
+      .depth = 7,
+   };
+
+   assert(util_queue_init(&queue, "test", 8, 4, flags));
+
+   num_tree_jobs = 0;
+   util_queue_fence_init(&root.fence);
+   util_queue_add_job(&queue, &root, &root.fence, tree_execute, NULL);
+   util_queue_finish(&queue);
+
+   /* 1 + 3 + ... + 3^7 */
+   assert(num_tree_jobs == 3280);
+
+   util_queue_destroy(&queue);
+}
+
+struct producer {
+   struct util_queue *queue;
+   struct test_job *jobs;
+};
+
+static int
+producer_thread(void *data)
+{
+   struct producer *p = data;
+
+   for (unsigned i = 0; i < NUM_JOBS / 10; i++) {
+      util_queue_add_job(p->queue, &p->jobs[i], &p->jobs[i].fence,
+                         record_execute, NULL);
+   }
+   return 0;
+}
+
+struct endless_producer {
+   struct util_queue *queue;
+   struct util_queue_fence fences[64];
+   int stop;
+};
+
+static void
+nop_execute(void *data, int thread_index)
+{
+}
+
+static int
+endless_producer_thread(void *data)
+{
+   struct endless_producer *p = data;
+
+   for (unsigned i = 0; !p_atomic_read(&p->stop); i = (i + 1) % 64) {
+      util_queue_fence_wait(&p->fences[i]);
+      util_queue_add_job(p->queue, NULL, &p->fences[i], nop_execute, NULL);
+   }
+   return 0;
+}
+
+/* util_queue_finish returns although another thread keeps adding jobs. */
+static void
+test_finish_while_adding(unsigned flags)
+{
+   struct util_queue queue;
+   struct endless_producer *p = calloc(1, sizeof(*p));
+   thrd_t thread;
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 16, 2, flags));
+
+   p->queue = &queue;
+   for (unsigned i = 0; i < 64; i++)
+      util_queue_fence_init(&p->fences[i]);
+   thread = u_thread_create(endless_producer_thread, p);
+
+   for (unsigned i = 0; i < 10; i++) {
+      for (unsigned j = 0; j < 100; j++) {
+         unsigned n = i * 100 + j;
+
+         util_queue_add_job_with_priority(&queue, &jobs[n], &jobs[n].fence,
+                                          record_execute, NULL,
+                                          j % 2 ? UTIL_QUEUE_PRIORITY_LOW :
+                                                  UTIL_QUEUE_PRIORITY_NORMAL);
+      }
+      util_queue_finish(&queue);
+
+      for (unsigned j = 0; j < (i + 1) * 100; j++)
+         assert(util_queue_fence_is_signalled(&jobs[j].fence));
+   }
+
+   p_atomic_set(&p->stop, 1);
+   thrd_join(thread, NULL);
+   util_queue_destroy(&queue);
+   free(p);
+}
+
+/* Several producers racing with several threads on a small queue. */
+static void
+test_producers(unsigned flags)
+{
+   struct util_queue queue;
+   struct producer producers[10];
+   thrd_t threads[10];
+
+   reset_jobs();
+   assert(util_queue_init(&queue, "test", 4, 3, flags));
+
+   for (unsigned i = 0; i < 10; i++) {
+      producers[i].queue = &queue;
+      producers[i].jobs = &jobs[i * NUM_JOBS / 10];
+      threads[i] = u_thread_create(producer_thread, &producers[i]);
+   }
+   for (unsigned i = 0; i < 10; i++)
+      thrd_join(threads[i], NULL);
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      util_queue_fence_wait(&jobs[i].fence);
+   assert(num_executed == NUM_JOBS);
+
+   util_queue_destroy(&queue);
+}
+
+int
+main(int argc, char **argv)
+{
+   /* Make sure the shared pool has several threads. */
+   setenv("MESA_JOB_THREADS", "4", 0);
+
+   for (unsigned shared = 0; shared < 2; shared++) {
+      unsigned flags = shared ? UTIL_QUEUE_INIT_SHARED_POOL : 0;
+
+      test_fifo(flags);
+      test_fifo(flags | UTIL_QUEUE_INIT_RESIZE_IF_FULL);
+      test_priorities(flags);
+      test_drop(flags);
+      test_own_jobs(flags);
+      test_nested(flags);
+      test_finish_while_adding(flags);
+      test_producers(flags);
+   }
+
+   return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Measures graph construction and allocation time for interval graphs of
+ * growing size, shaped roughly like the live ranges of a big shader, along
+ * with the peak resident memory of the process so far.
+ *
+ * Usage: ra_bench [nodes] [average live ranges]
+ *
+ * Without a node count, runs 1000 to 64000 nodes in increasing order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/register_allocate.h"
+
+#define NUM_REGS 128
+
+static struct ra_regs *regs;
+static unsigned single_class, pair_class;
+
+static void
+setup_regs(void *mem_ctx)
+{
+   regs = ra_alloc_reg_set(mem_ctx, NUM_REGS + NUM_REGS / 2, true);
+   single_class = ra_alloc_reg_class(regs);
+   pair_class = ra_alloc_reg_class(regs);
+
+   for (unsigned i = 0; i < NUM_REGS; i++)
+      ra_class_add_reg(regs, single_class, i);
+
+   for (unsigned i = 0; i < NUM_REGS / 2; i++) {
+      ra_class_add_reg(regs, pair_class, NUM_REGS + i);
+      ra_add_transitive_reg_conflict(regs, 2 * i, NUM_REGS + i);
+      ra_add_transitive_reg_conflict(regs, 2 * i + 1, NUM_REGS + i);
+   }
+
+   ra_set_finalize(regs, NULL);
+}
+
+static long
+peak_rss_kb(void)
+{
+#ifndef _WIN32
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+#else
+   return 0;
+#endif
+}
+
+static void
+run(unsigned count, unsigned live)
+{
+   unsigned *end = malloc(count * sizeof(unsigned));
+   unsigned edges = 0;
+   int64_t start = os_time_get_nano();
+   struct ra_graph *g = ra_alloc_interference_graph(regs, count);
+
+   srand(count);
+
+   for (unsigned i = 0; i < count; i++) {
+      end[i] = i + 1 + rand() % (2 * live);
+      ra_set_node_class(g, i, i % 4 == 0 ? pair_class : single_class);
+      ra_set_node_spill_cost(g, i, 1.0f);
+   }
+
+   for (unsigned i = 0; i < count; i++) {
+      for (unsigned j = i + 1; j < count && j < end[i]; j++) {
+         ra_add_node_interference(g, i, j);
+         edges++;
+      }
+   }
+
+   int64_t built = os_time_get_nano();
+   bool ok = ra_allocate(g);
+   int64_t done = os_time_get_nano();
+
+   printf("%6u nodes %9u edges: build %8.2f ms, allocate %8.2f ms, %s, "
+          "peak RSS %7ld KB\n", count, edges, (built - start) / 1e6,
+          (done - built) / 1e6, ok ? "colored" : "spill", peak_rss_kb());
+
+   ralloc_free(g);
+   free(end);
+}
+
+int
+main(int argc, char **argv)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   unsigned live = argc > 2 ? atoi(argv[2]) : 64;
+
+   setup_regs(mem_ctx);
+
+   if (argc > 1) {
+      run(atoi(argv[1]), live);
+   } else {
+      for (unsigned count = 1000; count <= 64000; count *= 2)
+         run(count, live);
+   }
+
+   ralloc_free(mem_ctx);
+   return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/ralloc.h"
+#include "util/register_allocate.h"
+
+#define NUM_REGS 32
+
+/* Registers 0..31 are single registers, 32..47 are aligned pairs of them. */
+#define PAIR_REG(i) (NUM_REGS + (i))
+#define NUM_PAIRS (NUM_REGS / 2)
+
+struct test_regs {
+   struct ra_regs *regs;
+   unsigned single_class;
+   unsigned pair_class;
+};
+
+static void
+setup_regs(struct test_regs *t, void *mem_ctx, bool round_robin)
+{
+   t->regs = ra_alloc_reg_set(mem_ctx, NUM_REGS + NUM_PAIRS, true);
+   if (round_robin)
+      ra_set_allocate_round_robin(t->regs);
+
+   t->single_class = ra_alloc_reg_class(t->regs);
+   t->pair_class = ra_alloc_reg_class(t->regs);
+
+   for (unsigned i = 0; i < NUM_REGS; i++)
+      ra_class_add_reg(t->regs, t->single_class, i);
+
+   for (unsigned i = 0; i < NUM_PAIRS; i++) {
+      ra_class_add_reg(t->regs, t->pair_class, PAIR_REG(i));
+      ra_add_transitive_reg_conflict(t->regs, 2 * i, PAIR_REG(i));
+      ra_add_transitive_reg_conflict(t->regs, 2 * i + 1, PAIR_REG(i));
+   }
+
+   ra_set_finalize(t->regs, NULL);
+}
+
+static bool
+regs_conflict(unsigned r1, unsigned r2)
+{
+   unsigned lo1 = r1 < NUM_REGS ? r1 : 2 * (r1 - NUM_REGS);
+   unsigned hi1 = r1 < NUM_REGS ? r1 : lo1 + 1;
+   unsigned lo2 = r2 < NUM_REGS ? r2 : 2 * (r2 - NUM_REGS);
+   unsigned hi2 = r2 < NUM_REGS ? r2 : lo2 + 1;
+
+   return lo1 <= hi2 && lo2 <= hi1;
+}
+
+struct interval {
+   unsigned start, end;
+};
+
+/* Builds an interference graph out of random live intervals, allocates it
+ * and checks the result.
+ */
+static void
+test_intervals(struct test_regs *t, unsigned count, unsigned max_len,
+               unsigned num_fixed, unsigned seed)
+{
+   struct interval *iv = malloc(count * sizeof(*iv));
+   unsigned *fixed_reg = calloc(count, sizeof(unsigned));
+   struct ra_graph *g = ra_alloc_interference_graph(t->regs, count);
+
+   srand(seed);
+
+   for (unsigned i = 0; i < count; i++) {
+      iv[i].start = i;
+      iv[i].end = i + 1 + rand() % max_len;
+      ra_set_node_class(g, i, i % 3 == 0 ? t->pair_class : t->single_class);
+      ra_set_node_spill_cost(g, i, 1.0f);
+   }
+
+   /* Some nodes with fixed registers, far enough apart not to conflict. */
+   for (unsigned i = 0; i < num_fixed; i++) {
+      unsigned n = 1 + i * (count / num_fixed);
+
+      iv[n].end = MIN2(iv[n].end, n + count / num_fixed);
+      fixed_reg[n] = 1 + i % NUM_REGS;
+      ra_set_node_reg(g, n, fixed_reg[n] - 1);
+   }
+
+   for (unsigned i = 0; i < count; i++) {
+      for (unsigned j = i + 1; j < count && iv[j].start < iv[i].end; j++) {
+         ra_add_node_interference(g, i, j);
+         /* Duplicates are ignored. */
+         if (j % 5 == 0)
+            ra_add_node_interference(g, j, i);
+      }
+   }
+
+   if (ra_allocate(g)) {
+      for (unsigned i = 0; i < count; i++) {
+         unsigned r = ra_get_node_reg(g, i);
+
+         if (fixed_reg[i])
+            assert(r == fixed_reg[i] - 1);
+         else if (i % 3 == 0)
+            assert(r >= NUM_REGS && r < NUM_REGS + NUM_PAIRS);
+         else
+            assert(r < NUM_REGS);
+
+         for (unsigned j = i + 1; j < count && iv[j].start < iv[i].end; j++)
+            assert(!regs_conflict(r, ra_get_node_reg(g, j)));
+      }
+   } else {
+      /* Only check that there is something to spill. */
+      assert(max_len > NUM_REGS / 2);
+      assert(ra_get_best_spill_node(g) >= 0);
+   }
+
+   ralloc_free(g);
+   free(fixed_reg);
+   free(iv);
+}
+
+int
+main(int argc, char **argv)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   struct test_regs t, rr;
+
+   setup_regs(&t, mem_ctx, false);
+   setup_regs(&rr, mem_ctx, true);
+
+   /* Graphs small enough to use the bit matrix, big enough for the hash set,
+    * and big but dense enough to switch from the hash set to the matrix, some
+    * of them needing optimistic coloring or spilling.
+    */
+   for (unsigned seed = 0; seed < 10; seed++) {
+      test_intervals(&t, 100, 8, 0, seed);
+      test_intervals(&rr, 100, 16, 4, seed);
+      test_intervals(&t, 1000, 40, 10, seed);
+      test_intervals(&t, 6000, 12, 0, seed);
+      test_intervals(&rr, 6000, 20, 50, seed);
+      test_intervals(&t, 6000, 60, 50, seed);
+      test_intervals(&t, 6000, 100, 50, seed);
+   }
+
+   ralloc_free(mem_ctx);
+
+   return 0;
+}
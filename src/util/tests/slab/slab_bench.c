@@ -0,0 +1,149 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Multi-threaded slab allocator benchmark.
+ *
+ * Every thread has its own child pool. In the "local" pattern each thread
+ * frees what it allocated, in the "cross" pattern each batch of objects is
+ * freed by the next thread, like transfers allocated by a threaded context
+ * and freed by the driver thread.
+ *
+ * Usage: slab_bench [threads]
+ *
+ * Without a thread count, runs 1 to 8 threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/slab.h"
+#include "util/u_thread.h"
+
+#define BATCH 4096
+#define ROUNDS 200
+#define MAX_THREADS 8
+
+struct thread_data {
+   struct slab_parent_pool *parent;
+   util_barrier *barrier;
+   void **slots;
+   unsigned index;
+   unsigned num_threads;
+   bool cross;
+};
+
+static int
+thread_func(void *data)
+{
+   struct thread_data *td = data;
+   struct slab_child_pool pool;
+
+   slab_create_child(&pool, td->parent);
+
+   for (unsigned round = 0; round < ROUNDS; round++) {
+      void **mine = &td->slots[td->index * BATCH];
+      void **next = td->cross ?
+         &td->slots[((td->index + 1) % td->num_threads) * BATCH] : mine;
+
+      for (unsigned i = 0; i < BATCH; i++) {
+         mine[i] = slab_alloc(&pool);
+         *(unsigned *)mine[i] = i;
+      }
+
+      if (td->cross)
+         util_barrier_wait(td->barrier);
+
+      for (unsigned i = 0; i < BATCH; i++)
+         slab_free(&pool, next[i]);
+
+      if (td->cross)
+         util_barrier_wait(td->barrier);
+   }
+
+   slab_destroy_child(&pool);
+   return 0;
+}
+
+static void
+run(unsigned num_threads, bool cross, unsigned flags)
+{
+   struct slab_parent_pool parent;
+   struct thread_data td[MAX_THREADS];
+   thrd_t threads[MAX_THREADS];
+   void **slots = malloc(num_threads * BATCH * sizeof(*slots));
+   util_barrier barrier;
+
+   slab_create_parent_flags(&parent, 128, 64, flags);
+   util_barrier_init(&barrier, num_threads);
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_threads; i++) {
+      td[i].parent = &parent;
+      td[i].barrier = &barrier;
+      td[i].slots = slots;
+      td[i].index = i;
+      td[i].num_threads = num_threads;
+      td[i].cross = cross;
+      threads[i] = u_thread_create(thread_func, &td[i]);
+   }
+
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_join(threads[i], NULL);
+
+   int64_t end = os_time_get_nano();
+   double ops = 2.0 * num_threads * ROUNDS * BATCH;
+
+   printf("%u threads, %-5s%s: %8.2f ms, %7.2f Mops/s\n", num_threads,
+          cross ? "cross" : "local", flags & SLAB_HUGE_PAGES ? ", huge" : "",
+          (end - start) / 1e6, ops / ((end - start) / 1e3));
+
+   util_barrier_destroy(&barrier);
+   slab_destroy_parent(&parent);
+   free(slots);
+}
+
+static void
+run_all(unsigned num_threads)
+{
+   run(num_threads, false, 0);
+   run(num_threads, false, SLAB_HUGE_PAGES);
+   run(num_threads, true, 0);
+   run(num_threads, true, SLAB_HUGE_PAGES);
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc > 1) {
+      run_all(CLAMP(atoi(argv[1]), 1, MAX_THREADS));
+   } else {
+      for (unsigned n = 1; n <= MAX_THREADS; n *= 2)
+         run_all(n);
+   }
+
+   return 0;
+}
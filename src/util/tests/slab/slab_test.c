@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "util/slab.h"
+#include "util/u_thread.h"
+
+#define NUM_ITEMS 64
+
+struct item {
+   uintptr_t tag;
+   char pad[40];
+};
+
+static int
+cmp_ptr(const void *a, const void *b)
+{
+   uintptr_t pa = (uintptr_t)*(void *const *)a;
+   uintptr_t pb = (uintptr_t)*(void *const *)b;
+
+   return pa < pb ? -1 : pa > pb;
+}
+
+static bool
+same_set(void **a, void **b, unsigned count)
+{
+   qsort(a, count, sizeof(void *), cmp_ptr);
+   qsort(b, count, sizeof(void *), cmp_ptr);
+
+   for (unsigned i = 0; i < count; i++) {
+      if (a[i] != b[i])
+         return false;
+   }
+   return true;
+}
+
+/* Objects freed in another child pool only go back to their owner once a
+ * full magazine of them has been collected, or the freeing pool goes away.
+ */
+static void
+test_migrate(unsigned flags)
+{
+   struct slab_parent_pool parent;
+   struct slab_child_pool a, b;
+   void *first[NUM_ITEMS], *again[NUM_ITEMS];
+
+   slab_create_parent_flags(&parent, sizeof(struct item), NUM_ITEMS, flags);
+   slab_create_child(&a, &parent);
+   slab_create_child(&b, &parent);
+
+   /* Exactly one page. */
+   for (unsigned i = 0; i < NUM_ITEMS; i++)
+      first[i] = slab_alloc(&a);
+
+   /* Full magazines make it back to a without a new page. */
+   for (unsigned i = 0; i < NUM_ITEMS; i++)
+      slab_free(&b, first[i]);
+   assert(b.num_foreign == NUM_ITEMS % SLAB_MAGAZINE_SIZE);
+
+   for (unsigned i = 0; i < NUM_ITEMS; i++)
+      again[i] = slab_alloc(&a);
+   assert(same_set(first, again, NUM_ITEMS));
+
+   /* A partial magazine is flushed when the freeing pool is destroyed. */
+   for (unsigned i = 0; i < SLAB_MAGAZINE_SIZE - 1; i++)
+      slab_free(&b, again[i]);
+   assert(a.migrated == NULL);
+   slab_destroy_child(&b);
+   assert(a.migrated != NULL);
+
+   for (unsigned i = 0; i < SLAB_MAGAZINE_SIZE - 1; i++)
+      again[i] = slab_alloc(&a);
+   assert(same_set(first, again, NUM_ITEMS));
+
+   /* Objects of a destroyed pool, sitting in the magazine of another one or
+    * freed after the fact, free the orphaned page. Leaks show up with
+    * valgrind or ASan.
+    */
+   slab_create_child(&b, &parent);
+   for (unsigned i = 0; i < NUM_ITEMS / 2; i++)
+      slab_free(&b, again[i]);
+   slab_destroy_child(&a);
+   for (unsigned i = NUM_ITEMS / 2; i < NUM_ITEMS; i++)
+      slab_free(&b, again[i]);
+   slab_destroy_child(&b);
+
+   slab_destroy_parent(&parent);
+}
+
+#define NUM_THREADS 4
+#define BATCH 1000
+#define ROUNDS 50
+
+struct thread_data {
+   struct slab_parent_pool *parent;
+   util_barrier *barrier;
+   struct item **slots;
+   unsigned index;
+};
+
+/* Each round, every thread allocates a batch of objects and frees the batch
+ * allocated by the next thread, checking that nobody else touched it.
+ */
+static int
+thread_func(void *data)
+{
+   struct thread_data *td = data;
+   struct slab_child_pool pool;
+
+   slab_create_child(&pool, td->parent);
+
+   for (unsigned round = 0; round < ROUNDS; round++) {
+      struct item **mine = &td->slots[td->index * BATCH];
+      struct item **next =
+         &td->slots[((td->index + 1 + round) % NUM_THREADS) * BATCH];
+
+      for (unsigned i = 0; i < BATCH; i++) {
+         mine[i] = slab_alloc(&pool);
+         mine[i]->tag = (uintptr_t)mine[i] ^ (round * NUM_THREADS + td->index);
+      }
+
+      util_barrier_wait(td->barrier);
+
+      for (unsigned i = 0; i < BATCH; i++) {
+         unsigned owner = (td->index + 1 + round) % NUM_THREADS;
+         assert(next[i]->tag ==
+                ((uintptr_t)next[i] ^ (round * NUM_THREADS + owner)));
+         slab_free(&pool, next[i]);
+      }
+
+      util_barrier_wait(td->barrier);
+   }
+
+   /* Leave some objects behind, to be freed after the pool is gone. */
+   for (unsigned i = 0; i < BATCH; i++)
+      td->slots[td->index * BATCH + i] = slab_alloc(&pool);
+
+   util_barrier_wait(td->barrier);
+   slab_destroy_child(&pool);
+
+   return 0;
+}
+
+static void
+test_threads(unsigned flags)
+{
+   struct slab_parent_pool parent;
+   struct slab_child_pool pool;
+   struct thread_data td[NUM_THREADS];
+   struct item **slots = malloc(NUM_THREADS * BATCH * sizeof(*slots));
+   thrd_t threads[NUM_THREADS];
+   util_barrier barrier;
+
+   slab_create_parent_flags(&parent, sizeof(struct item), NUM_ITEMS, flags);
+   util_barrier_init(&barrier, NUM_THREADS);
+
+   for (unsigned i = 0; i < NUM_THREADS; i++) {
+      td[i].parent = &parent;
+      td[i].barrier = &barrier;
+      td[i].slots = slots;
+      td[i].index = i;
+      threads[i] = u_thread_create(thread_func, &td[i]);
+   }
+
+   for (unsigned i = 0; i < NUM_THREADS; i++)
+      thrd_join(threads[i], NULL);
+
+   slab_create_child(&pool, &parent);
+   for (unsigned i = 0; i < NUM_THREADS * BATCH; i++)
+      slab_free(&pool, slots[i]);
+   slab_destroy_child(&pool);
+
+   util_barrier_destroy(&barrier);
+   slab_destroy_parent(&parent);
+   free(slots);
+}
+
+int
+main(int argc, char **argv)
+{
+   test_migrate(0);
+   test_migrate(SLAB_HUGE_PAGES);
+   test_threads(0);
+   test_threads(SLAB_HUGE_PAGES);
+
+   return 0;
+}
@@ -68,6 +68,7 @@ struct util_cpu_caps {
    unsigned has_avx2:1;
    unsigned has_f16c:1;
    unsigned has_fma:1;
+   unsigned has_sha:1;
    unsigned has_3dnow:1;
    unsigned has_3dnow_ext:1;
    unsigned has_xop:1;
@@ -0,0 +1,483 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "u_job.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/debug.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_string.h"
+#include "util/u_thread.h"
+
+/* The dependents list of a completed job. */
+#define UTIL_JOB_COMPLETED ((struct util_job_edge *)(uintptr_t)1)
+
+struct util_job_edge {
+   struct util_job *job;
+   struct util_job_edge *next;
+};
+
+struct util_job_list {
+   struct util_job *head, *tail;
+};
+
+static struct {
+   mtx_t lock;
+   cnd_t cond;
+   thrd_t *threads;
+   unsigned num_threads;
+
+   /* Everything below is protected by lock. */
+   struct util_job_list ready[UTIL_QUEUE_NUM_PRIORITIES];
+   unsigned num_low_running;
+   unsigned max_low_running;
+   bool kill_threads;
+   bool dropping;
+} pool;
+
+static once_flag pool_once_flag = ONCE_FLAG_INIT;
+
+/****************************************************************************
+ * Tracing
+ */
+
+static once_flag trace_once_flag = ONCE_FLAG_INIT;
+static util_job_trace_func trace_func;
+static void *trace_data;
+
+static void
+trace_print(const struct util_job_trace_event *event, void *data)
+{
+   fprintf(stderr, "job %s: priority %u, thread %i, "
+           "latency %" PRId64 " us, run %" PRId64 " us\n",
+           event->name, event->priority,
+           event->thread_index,
+           (event->start_time - event->ready_time) / 1000,
+           (event->end_time - event->start_time) / 1000);
+}
+
+static void
+trace_init(void)
+{
+   if (env_var_as_boolean("MESA_JOB_TRACE", false))
+      trace_func = trace_print;
+}
+
+/**
+ * Set a function to call after every job, with its timings.  NULL turns
+ * tracing off.  Jobs which are already running may still be reported to the
+ * previous function.
+ */
+void
+util_job_set_trace_callback(util_job_trace_func func, void *data)
+{
+   call_once(&trace_once_flag, trace_init);
+
+   p_atomic_set(&trace_func, NULL);
+   p_atomic_set(&trace_data, data);
+   p_atomic_set(&trace_func, func);
+}
+
+bool
+util_job_trace_enabled(void)
+{
+   call_once(&trace_once_flag, trace_init);
+
+   return p_atomic_read(&trace_func) != NULL;
+}
+
+void
+util_job_trace(const struct util_job_trace_event *event)
+{
+   util_job_trace_func func = p_atomic_read(&trace_func);
+
+   if (func)
+      func(event, p_atomic_read(&trace_data));
+}
+
+/****************************************************************************
+ * Worker pool
+ */
+
+static void
+list_append(struct util_job_list *list, struct util_job *job)
+{
+   job->next = NULL;
+   if (list->tail)
+      list->tail->next = job;
+   else
+      list->head = job;
+   list->tail = job;
+}
+
+static struct util_job *
+list_pop(struct util_job_list *list)
+{
+   struct util_job *job = list->head;
+
+   if (job) {
+      list->head = job->next;
+      if (!list->head)
+         list->tail = NULL;
+   }
+   return job;
+}
+
+/* Take the next job to run, if any.  The caller must hold the pool lock. */
+static struct util_job *
+pool_pick_job(void)
+{
+   struct util_job *job;
+
+   job = list_pop(&pool.ready[UTIL_QUEUE_PRIORITY_HIGH]);
+   if (!job)
+      job = list_pop(&pool.ready[UTIL_QUEUE_PRIORITY_NORMAL]);
+   if (!job && pool.num_low_running < pool.max_low_running) {
+      job = list_pop(&pool.ready[UTIL_QUEUE_PRIORITY_LOW]);
+      if (job)
+         pool.num_low_running++;
+   }
+   return job;
+}
+
+static void util_job_make_ready(struct util_job *job);
+
+/* Release the dependents of the job, then signal its fence.  The job isn't
+ * touched afterwards, since the fence may be what its owner waits for to
+ * free it.
+ */
+static void
+util_job_complete(struct util_job *job)
+{
+   struct util_job_edge *edge = p_atomic_xchg(&job->dependents,
+                                              UTIL_JOB_COMPLETED);
+   struct util_queue_fence *fence = job->fence;
+
+   assert(edge != UTIL_JOB_COMPLETED);
+
+   while (edge) {
+      struct util_job_edge *next = edge->next;
+
+      if (p_atomic_dec_zero(&edge->job->num_pending))
+         util_job_make_ready(edge->job);
+      free(edge);
+      edge = next;
+   }
+
+   if (fence)
+      util_queue_fence_signal(fence);
+}
+
+static void
+util_job_run(struct util_job *job, int thread_index)
+{
+   util_queue_execute_func cleanup = job->cleanup;
+   void *data = job->data;
+
+   if (job->name && util_job_trace_enabled()) {
+      struct util_job_trace_event event;
+
+      event.name = job->name;
+      event.priority = job->priority;
+      event.thread_index = thread_index;
+      event.ready_time = job->ready_time;
+      event.start_time = os_time_get_nano();
+      if (!event.ready_time)
+         event.ready_time = event.start_time;
+
+      job->execute(data, thread_index);
+
+      event.end_time = os_time_get_nano();
+      util_job_trace(&event);
+   } else {
+      job->execute(data, thread_index);
+   }
+
+   util_job_complete(job);
+
+   if (cleanup)
+      cleanup(data, thread_index);
+}
+
+/* Complete a job without running it, like util_queue_drop_job does. */
+static void
+util_job_drop(struct util_job *job)
+{
+   util_queue_execute_func cleanup = job->cleanup;
+   void *data = job->data;
+
+   util_job_complete(job);
+
+   if (cleanup)
+      cleanup(data, -1);
+}
+
+/* Drop everything that is ready, including jobs that become ready in the
+ * process, once the threads are gone.  The caller must hold the pool lock.
+ */
+static void
+pool_drop_ready_jobs(void)
+{
+   struct util_job *job;
+
+   if (pool.dropping)
+      return; /* our caller will get to the new jobs */
+
+   pool.dropping = true;
+   while (1) {
+      job = NULL;
+      for (unsigned i = 0; i < UTIL_QUEUE_NUM_PRIORITIES && !job; i++)
+         job = list_pop(&pool.ready[i]);
+      if (!job)
+         break;
+
+      mtx_unlock(&pool.lock);
+      util_job_drop(job);
+      mtx_lock(&pool.lock);
+   }
+   pool.dropping = false;
+}
+
+static void
+util_job_make_ready(struct util_job *job)
+{
+   if (job->name && util_job_trace_enabled())
+      job->ready_time = os_time_get_nano();
+
+   if (pool.num_threads == 0) {
+      util_job_run(job, 0);
+      return;
+   }
+
+   mtx_lock(&pool.lock);
+   list_append(&pool.ready[job->priority], job);
+   if (pool.kill_threads)
+      pool_drop_ready_jobs();
+   else
+      cnd_signal(&pool.cond);
+   mtx_unlock(&pool.lock);
+}
+
+static int
+pool_thread_func(void *input)
+{
+   int thread_index = (intptr_t)input;
+   char name[16];
+
+#ifdef HAVE_PTHREAD_SETAFFINITY
+   /* Don't inherit the thread affinity from whoever started the pool. */
+   cpu_set_t cpuset;
+   CPU_ZERO(&cpuset);
+   for (unsigned i = 0; i < CPU_SETSIZE; i++)
+      CPU_SET(i, &cpuset);
+
+   pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#endif
+
+   util_snprintf(name, sizeof(name), "mesa:job%i", thread_index);
+   u_thread_setname(name);
+
+   mtx_lock(&pool.lock);
+   while (!pool.kill_threads) {
+      struct util_job *job = pool_pick_job();
+
+      if (!job) {
+         cnd_wait(&pool.cond, &pool.lock);
+         continue;
+      }
+
+      /* The job may be freed by the time it returns. */
+      bool low = job->priority == UTIL_QUEUE_PRIORITY_LOW;
+
+      mtx_unlock(&pool.lock);
+      util_job_run(job, thread_index);
+      mtx_lock(&pool.lock);
+
+      if (low)
+         pool.num_low_running--;
+   }
+   mtx_unlock(&pool.lock);
+
+   return 0;
+}
+
+static void
+pool_atexit_handler(void)
+{
+   /* Like util_queue, stop the threads before static destructors run. */
+   mtx_lock(&pool.lock);
+   pool.kill_threads = true;
+   cnd_broadcast(&pool.cond);
+   mtx_unlock(&pool.lock);
+
+   for (unsigned i = 0; i < pool.num_threads; i++)
+      thrd_join(pool.threads[i], NULL);
+
+   mtx_lock(&pool.lock);
+   pool_drop_ready_jobs();
+   mtx_unlock(&pool.lock);
+}
+
+static void
+pool_init(void)
+{
+   unsigned num_threads;
+
+   util_cpu_detect();
+   num_threads = env_var_as_unsigned("MESA_JOB_THREADS",
+                                     MAX2(util_cpu_caps.nr_cpus, 1));
+
+   (void) mtx_init(&pool.lock, mtx_plain);
+   cnd_init(&pool.cond);
+   pool.max_low_running = MAX2(num_threads / 2, 1);
+
+   if (num_threads)
+      pool.threads = (thrd_t *) calloc(num_threads, sizeof(thrd_t));
+   if (!pool.threads)
+      return;
+
+   for (unsigned i = 0; i < num_threads; i++) {
+      pool.threads[i] = u_thread_create(pool_thread_func,
+                                        (void *)(intptr_t)i);
+      if (!pool.threads[i])
+         break;
+      pool.num_threads++;
+   }
+
+   /* Without threads, jobs run synchronously. */
+   if (pool.num_threads)
+      atexit(pool_atexit_handler);
+}
+
+/**
+ * Return the number of threads of the pool, 0 if jobs run synchronously.
+ */
+unsigned
+util_job_pool_num_threads(void)
+{
+   call_once(&pool_once_flag, pool_init);
+   return pool.num_threads;
+}
+
+/****************************************************************************
+ * Jobs
+ */
+
+/**
+ * Initialize a job.  It won't run before util_job_submit() is called, after
+ * any dependencies are added.
+ *
+ * \param name     a name for tracing, which must outlive the job, or NULL
+ *                 to leave the job out of traces
+ * \param fence    optional, reset now and signalled after execute
+ * \param cleanup  optional, called after the fence is signalled, or with
+ *                 thread_index -1 if the job is dropped because the process
+ *                 is exiting
+ */
+void
+util_job_init(struct util_job *job,
+              const char *name,
+              void *data,
+              struct util_queue_fence *fence,
+              util_queue_execute_func execute,
+              util_queue_execute_func cleanup,
+              enum util_queue_priority priority)
+{
+   job->name = name;
+   job->data = data;
+   job->fence = fence;
+   job->execute = execute;
+   job->cleanup = cleanup;
+   job->priority = priority;
+   job->num_pending = 1;
+   job->dependents = NULL;
+   job->next = NULL;
+   job->ready_time = 0;
+
+   if (fence)
+      util_queue_fence_reset(fence);
+}
+
+/**
+ * Make \p job wait for \p dependency to complete before running.
+ *
+ * \p job must not have been submitted yet.  \p dependency may be in any
+ * state, as long as it's still allocated, but it must eventually be
+ * submitted.
+ */
+void
+util_job_add_dependency(struct util_job *job, struct util_job *dependency)
+{
+   struct util_job_edge *edge, *head;
+
+   assert(p_atomic_read(&job->num_pending) > 0);
+
+   if (p_atomic_read(&dependency->dependents) == UTIL_JOB_COMPLETED)
+      return;
+
+   edge = (struct util_job_edge *) malloc(sizeof(*edge));
+   if (!edge) {
+      /* No good option, but the dependency can't be ignored.  This
+       * deadlocks if it hasn't been submitted yet.
+       */
+      if (dependency->fence)
+         util_queue_fence_wait(dependency->fence);
+      return;
+   }
+
+   edge->job = job;
+   p_atomic_inc(&job->num_pending);
+
+   head = p_atomic_read(&dependency->dependents);
+   while (1) {
+      struct util_job_edge *old;
+
+      if (head == UTIL_JOB_COMPLETED) {
+         p_atomic_dec(&job->num_pending);
+         free(edge);
+         return;
+      }
+
+      edge->next = head;
+      old = p_atomic_cmpxchg(&dependency->dependents, head, edge);
+      if (old == head)
+         return;
+      head = old;
+   }
+}
+
+/**
+ * Submit a job, which runs as soon as its dependencies have completed.
+ */
+void
+util_job_submit(struct util_job *job)
+{
+   call_once(&pool_once_flag, pool_init);
+
+   if (p_atomic_dec_zero(&job->num_pending))
+      util_job_make_ready(job);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2019 The Mesa Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Process-wide job system.
+ *
+ * Jobs run on one pool of threads shared by everything in the process,
+ * sized after the number of CPUs, instead of each subsystem spawning its
+ * own.  A job can depend on other jobs, and only becomes ready to run once
+ * they have all completed, which allows submitting whole graphs of work at
+ * once without any thread blocking on intermediate results.
+ *
+ * Ready jobs run by priority: high priority jobs first, and low priority
+ * jobs on at most half of the threads, so that long background work like
+ * shader compilation leaves room for the rest.
+ *
+ * util_queue can run its jobs on this pool too, see
+ * UTIL_QUEUE_INIT_SHARED_POOL.
+ *
+ * Jobs must not wait for other jobs of the pool, because all threads could
+ * end up waiting: express that with dependencies instead.
+ *
+ * The thread count can be overridden with MESA_JOB_THREADS, 0 meaning that
+ * jobs run synchronously when they become ready.  MESA_JOB_TRACE=true prints
+ * the latency and run time of every job to stderr, and
+ * util_job_set_trace_callback() lets a tool collect them instead.
+ */
+
+#ifndef U_JOB_H
+#define U_JOB_H
+
+#include <stdint.h>
+
+#include "util/u_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct util_job_edge;
+
+/* Put this into your job structure, and don't touch its members. */
+struct util_job {
+   const char *name;
+   void *data;
+   struct util_queue_fence *fence;
+   util_queue_execute_func execute;
+   util_queue_execute_func cleanup;
+   enum util_queue_priority priority;
+
+   /* Dependencies which haven't completed, plus one until submitted. */
+   int num_pending;
+   /* Jobs depending on this one, or UTIL_JOB_COMPLETED. */
+   struct util_job_edge *dependents;
+   /* Next job in the ready list of the pool. */
+   struct util_job *next;
+   /* When the job became ready, if tracing. */
+   int64_t ready_time;
+};
+
+void util_job_init(struct util_job *job,
+                   const char *name,
+                   void *data,
+                   struct util_queue_fence *fence,
+                   util_queue_execute_func execute,
+                   util_queue_execute_func cleanup,
+                   enum util_queue_priority priority);
+void util_job_add_dependency(struct util_job *job,
+                             struct util_job *dependency);
+void util_job_submit(struct util_job *job);
+
+unsigned util_job_pool_num_threads(void);
+
+struct util_job_trace_event {
+   const char *name; /* the job name, or the name of its util_queue */
+   enum util_queue_priority priority;
+   int thread_index;
+   int64_t ready_time; /* when it was added and its dependencies were done */
+   int64_t start_time;
+   int64_t end_time;
+};
+
+typedef void (*util_job_trace_func)(const struct util_job_trace_event *event,
+                                    void *data);
+
+void util_job_set_trace_callback(util_job_trace_func func, void *data);
+bool util_job_trace_enabled(void);
+void util_job_trace(const struct util_job_trace_event *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
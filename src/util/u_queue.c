@@ -29,6 +29,8 @@
 #include <time.h>
 
 #include "util/os_time.h"
+#include "util/u_job.h"
+#include "util/u_math.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
 #include "u_process.h"
@@ -222,22 +224,469 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
 }
 #endif
 
+
 /****************************************************************************
  * util_queue implementation
+ *
+ * Jobs are kept in one lane per priority.  Each lane is a bounded lock-free
+ * ring for any number of producers and consumers (after Dmitry Vyukov's
+ * bounded MPMC queue): every cell carries a sequence number which tells
+ * whether it is free or filled for the current lap, so that producers and
+ * consumers only ever race on a compare-and-swap of their own index.
+ *
+ * The rings rely on p_atomic_set and p_atomic_read being release stores and
+ * acquire loads, which they are only with the GCC atomic builtins.  Without
+ * them, all jobs go to the lock-protected overflow lists instead.
+ *
+ * Jobs added by one of the queue's own threads go to that thread's own
+ * list instead.  The owner runs them in order, and idle threads steal them
+ * the same way.
+ *
+ * util_queue_finish waits for the jobs of the current generation to finish.
+ * Jobs added by a job belong to its generation, others to the one current
+ * when they are added.  There are two counters of unfinished jobs, one for
+ * the generation that util_queue_finish waits for and one for later jobs.
+ *
+ * queue->lock is only taken to put threads to sleep and wake them up, and
+ * for the overflow lists.
+ *
+ * With UTIL_QUEUE_INIT_SHARED_POOL, the queue has no threads.  Instead, up
+ * to num_threads "pump" jobs on the shared pool of u_job.h take their
+ * place, each with the thread index of one of the workers.
  */
 
-struct thread_input {
+#define UTIL_QUEUE_CACHE_LINE 64
+
+#ifdef USE_GCC_ATOMIC_BUILTINS
+#define UTIL_QUEUE_LOCK_FREE_LANES 1
+#else
+#define UTIL_QUEUE_LOCK_FREE_LANES 0
+#endif
+
+struct util_queue_cell {
+   unsigned seq;
+   struct util_queue_job job;
+};
+
+struct util_queue_lane {
+   /* Producers and consumers each get their own cache line. */
+   unsigned tail;
+   char pad0[UTIL_QUEUE_CACHE_LINE - sizeof(unsigned)];
+   unsigned head;
+   char pad1[UTIL_QUEUE_CACHE_LINE - sizeof(unsigned)];
+
+   struct util_queue_cell *cells;
+   unsigned mask;
+
+   /* Jobs which didn't fit in the ring, or all jobs without lock-free
+    * lanes.  While there are any, new jobs are appended here too, so that
+    * the lane stays FIFO.  Protected by util_queue::lock, but num_overflow
+    * may be read without it.
+    */
+   int num_overflow;
+   unsigned overflow_read;
+   unsigned overflow_size;
+   struct util_queue_job *overflow;
+};
+
+struct util_queue_worker {
    struct util_queue *queue;
    int thread_index;
+
+   /* Ring of jobs added by this thread, protected by lock.  Jobs are
+    * taken from the front, by the owner or by other threads alike.
+    * num_jobs may be read without the lock.
+    */
+   mtx_t lock;
+   int num_jobs;
+   unsigned front;
+   unsigned size;
+   struct util_queue_job *jobs;
+
+   /* Generation of the job being run, for the jobs it adds. */
+   unsigned generation;
+
+   /* For UTIL_QUEUE_INIT_SHARED_POOL: whether pump is running the queue
+    * as this worker.
+    */
+   int busy;
+   struct util_job pump;
 };
 
+static once_flag worker_key_once_flag = ONCE_FLAG_INIT;
+static tss_t worker_key;
+
+static void
+worker_key_init(void)
+{
+   tss_create(&worker_key, NULL);
+}
+
+/* Read a counter with a full barrier.  This pairs an update of one counter
+ * with a check of another (e.g. num_queued and num_sleeping) so that at
+ * least one of the two threads involved sees the other's update.
+ */
+static inline int
+read_counter(int *counter)
+{
+   return p_atomic_cmpxchg(counter, 0, 0);
+}
+
+/* Take ownership of a queued job, racing with util_queue_drop_job.
+ *
+ * \return the fence of the job, or NULL if it was dropped.
+ */
+static struct util_queue_fence *
+claim_job(struct util_queue_job *job)
+{
+   struct util_queue_fence *fence = p_atomic_read(&job->fence);
+
+   if (fence != NULL && p_atomic_cmpxchg(&job->fence, fence, NULL) != fence)
+      return NULL;
+
+   return fence;
+}
+
+static bool
+lane_init(struct util_queue_lane *lane, unsigned max_jobs)
+{
+   unsigned size = util_next_power_of_two(MAX2(max_jobs, 2));
+
+   if (!UTIL_QUEUE_LOCK_FREE_LANES)
+      return true;
+
+   lane->cells = (struct util_queue_cell *)
+                 calloc(size, sizeof(struct util_queue_cell));
+   if (!lane->cells)
+      return false;
+
+   for (unsigned i = 0; i < size; i++)
+      lane->cells[i].seq = i;
+   lane->mask = size - 1;
+
+   return true;
+}
+
+#if UTIL_QUEUE_LOCK_FREE_LANES
+static bool
+lane_push(struct util_queue_lane *lane, const struct util_queue_job *job)
+{
+   unsigned pos = p_atomic_read(&lane->tail);
+   struct util_queue_cell *cell;
+
+   while (1) {
+      cell = &lane->cells[pos & lane->mask];
+      int dif = (int)(p_atomic_read(&cell->seq) - pos);
+
+      if (dif == 0) {
+         unsigned old = p_atomic_cmpxchg(&lane->tail, pos, pos + 1);
+         if (old == pos)
+            break;
+         pos = old;
+      } else if (dif < 0) {
+         return false; /* full */
+      } else {
+         pos = p_atomic_read(&lane->tail);
+      }
+   }
+
+   cell->job.job = job->job;
+   cell->job.execute = job->execute;
+   cell->job.cleanup = job->cleanup;
+   cell->job.priority = job->priority;
+   cell->job.generation = job->generation;
+   cell->job.add_time = job->add_time;
+   /* util_queue_drop_job expects the fence to be written last. */
+   p_atomic_set(&cell->job.fence, job->fence);
+   p_atomic_set(&cell->seq, pos + 1);
+   return true;
+}
+
+static bool
+lane_pop(struct util_queue_lane *lane, struct util_queue_job *job)
+{
+   unsigned pos = p_atomic_read(&lane->head);
+   struct util_queue_cell *cell;
+
+   while (1) {
+      cell = &lane->cells[pos & lane->mask];
+      int dif = (int)(p_atomic_read(&cell->seq) - (pos + 1));
+
+      if (dif == 0) {
+         unsigned old = p_atomic_cmpxchg(&lane->head, pos, pos + 1);
+         if (old == pos)
+            break;
+         pos = old;
+      } else if (dif < 0) {
+         return false; /* empty */
+      } else {
+         pos = p_atomic_read(&lane->head);
+      }
+   }
+
+   job->job = cell->job.job;
+   job->execute = cell->job.execute;
+   job->cleanup = cell->job.cleanup;
+   job->priority = cell->job.priority;
+   job->generation = cell->job.generation;
+   job->add_time = cell->job.add_time;
+   job->fence = claim_job(&cell->job);
+   p_atomic_set(&cell->seq, pos + lane->mask + 1);
+   return true;
+}
+#else
+static inline bool
+lane_push(struct util_queue_lane *lane, const struct util_queue_job *job)
+{
+   return false;
+}
+
+static inline bool
+lane_pop(struct util_queue_lane *lane, struct util_queue_job *job)
+{
+   return false;
+}
+#endif
+
+static void
+overflow_push(struct util_queue *queue, struct util_queue_lane *lane,
+              const struct util_queue_job *job)
+{
+   mtx_lock(&queue->lock);
+
+   if (lane->num_overflow == lane->overflow_size) {
+      /* If the list is full, make it larger. */
+      unsigned new_size = MAX2(lane->overflow_size * 2, 8);
+      struct util_queue_job *jobs =
+         (struct util_queue_job*)calloc(new_size,
+                                        sizeof(struct util_queue_job));
+      assert(jobs);
+
+      for (unsigned i = 0; i < lane->num_overflow; i++) {
+         jobs[i] = lane->overflow[(lane->overflow_read + i) %
+                                  lane->overflow_size];
+      }
+
+      free(lane->overflow);
+      lane->overflow = jobs;
+      lane->overflow_read = 0;
+      lane->overflow_size = new_size;
+   }
+
+   lane->overflow[(lane->overflow_read + lane->num_overflow) %
+                  lane->overflow_size] = *job;
+   p_atomic_inc(&lane->num_overflow);
+
+   mtx_unlock(&queue->lock);
+}
+
+static bool
+lane_get(struct util_queue *queue, struct util_queue_lane *lane,
+         struct util_queue_job *job)
+{
+   bool found = false;
+
+   if (lane_pop(lane, job))
+      return true;
+
+   if (likely(p_atomic_read(&lane->num_overflow) == 0))
+      return false;
+
+   mtx_lock(&queue->lock);
+   if (lane->num_overflow) {
+      *job = lane->overflow[lane->overflow_read];
+      lane->overflow_read = (lane->overflow_read + 1) % lane->overflow_size;
+      p_atomic_dec(&lane->num_overflow);
+      found = true;
+   }
+   mtx_unlock(&queue->lock);
+
+   return found;
+}
+
+static void
+worker_push(struct util_queue_worker *worker, const struct util_queue_job *job)
+{
+   mtx_lock(&worker->lock);
+
+   if (worker->num_jobs == worker->size) {
+      unsigned new_size = MAX2(worker->size * 2, 16);
+      struct util_queue_job *jobs =
+         (struct util_queue_job*)calloc(new_size,
+                                        sizeof(struct util_queue_job));
+      assert(jobs);
+
+      for (unsigned i = 0; i < worker->num_jobs; i++)
+         jobs[i] = worker->jobs[(worker->front + i) & (worker->size - 1)];
+
+      free(worker->jobs);
+      worker->jobs = jobs;
+      worker->front = 0;
+      worker->size = new_size;
+   }
+
+   worker->jobs[(worker->front + worker->num_jobs) & (worker->size - 1)] =
+      *job;
+   p_atomic_inc(&worker->num_jobs);
+
+   mtx_unlock(&worker->lock);
+}
+
+static bool
+worker_pop(struct util_queue_worker *worker, struct util_queue_job *job)
+{
+   bool found = false;
+
+   if (p_atomic_read(&worker->num_jobs) == 0)
+      return false;
+
+   mtx_lock(&worker->lock);
+   if (worker->num_jobs) {
+      *job = worker->jobs[worker->front];
+      worker->front = (worker->front + 1) & (worker->size - 1);
+      p_atomic_dec(&worker->num_jobs);
+      found = true;
+   }
+   mtx_unlock(&worker->lock);
+
+   return found;
+}
+
+/* Dequeue the next job for \p worker (or for nobody, if NULL).  Jobs that
+ * were dropped come out with a NULL fence.
+ */
+static bool
+util_queue_get_job(struct util_queue *queue, struct util_queue_worker *worker,
+                   struct util_queue_job *job)
+{
+   struct util_queue_lane *lanes = queue->lanes;
+
+   if (p_atomic_read(&queue->num_queued) == 0)
+      return false;
+
+   if (lane_get(queue, &lanes[UTIL_QUEUE_PRIORITY_HIGH], job))
+      return true;
+
+   if (worker && worker_pop(worker, job))
+      return true;
+
+   if (lane_get(queue, &lanes[UTIL_QUEUE_PRIORITY_NORMAL], job))
+      return true;
+
+   for (unsigned i = 0; i < queue->num_threads; i++) {
+      if (&queue->workers[i] != worker &&
+          worker_pop(&queue->workers[i], job))
+         return true;
+   }
+
+   return lane_get(queue, &lanes[UTIL_QUEUE_PRIORITY_LOW], job);
+}
+
+/* Account for a job that was taken out of the queue. */
+static void
+util_queue_job_taken(struct util_queue *queue)
+{
+   p_atomic_dec(&queue->num_queued);
+
+   if (unlikely(read_counter(&queue->num_waiting))) {
+      mtx_lock(&queue->lock);
+      cnd_broadcast(&queue->has_space_cond);
+      mtx_unlock(&queue->lock);
+   }
+}
+
+/* Account for a job that has run or was dropped, for util_queue_finish. */
+static void
+util_queue_job_finished(struct util_queue *queue, unsigned generation)
+{
+   if (p_atomic_dec_zero(&queue->num_unfinished[generation]) &&
+       unlikely(read_counter(&queue->num_finishing))) {
+      mtx_lock(&queue->lock);
+      cnd_broadcast(&queue->finished_cond);
+      mtx_unlock(&queue->lock);
+   }
+}
+
+/* Account for a new job, for util_queue_finish.
+ *
+ * \return the generation of the job.
+ */
+static unsigned
+util_queue_job_added(struct util_queue *queue, struct util_queue_worker *worker)
+{
+   unsigned generation;
+
+   /* util_queue_finish waits for the jobs added by the jobs it waits for.
+    * Their generation can't drain before they are counted, since the job
+    * adding them is still running.
+    */
+   if (worker) {
+      p_atomic_inc(&queue->num_unfinished[worker->generation]);
+      return worker->generation;
+   }
+
+   /* util_queue_finish may flip the generation and find its counter empty
+    * between reading the generation and incrementing the counter.  So read
+    * the generation again, with a full barrier like read_counter: if it is
+    * unchanged, util_queue_finish will see the increment.
+    */
+   while (1) {
+      generation = p_atomic_read(&queue->generation) & 1;
+      p_atomic_inc(&queue->num_unfinished[generation]);
+
+      if ((p_atomic_cmpxchg(&queue->generation, 0, 0) & 1) == generation)
+         return generation;
+
+      util_queue_job_finished(queue, generation);
+   }
+}
+
+/* Run a job that was taken out of the queue. */
+static void
+util_queue_run_job(struct util_queue *queue, struct util_queue_worker *worker,
+                   struct util_queue_job *job)
+{
+   int thread_index = worker->thread_index;
+   struct util_job_trace_event event;
+
+   if (!job->fence) {
+      /* dropped */
+      util_queue_job_finished(queue, job->generation);
+      return;
+   }
+
+   worker->generation = job->generation;
+
+   if (unlikely(job->add_time)) {
+      event.name = queue->name;
+      event.priority = job->priority;
+      event.thread_index = thread_index;
+      event.ready_time = job->add_time;
+      event.start_time = os_time_get_nano();
+   }
+
+   job->execute(job->job, thread_index);
+
+   if (unlikely(job->add_time)) {
+      event.end_time = os_time_get_nano();
+      util_job_trace(&event);
+   }
+
+   util_queue_fence_signal(job->fence);
+   if (job->cleanup)
+      job->cleanup(job->job, thread_index);
+
+   util_queue_job_finished(queue, job->generation);
+}
+
 static int
 util_queue_thread_func(void *input)
 {
-   struct util_queue *queue = ((struct thread_input*)input)->queue;
-   int thread_index = ((struct thread_input*)input)->thread_index;
+   struct util_queue_worker *worker = (struct util_queue_worker *)input;
+   struct util_queue *queue = worker->queue;
+   int thread_index = worker->thread_index;
 
-   free(input);
+   tss_set(worker_key, worker);
 
 #ifdef HAVE_PTHREAD_SETAFFINITY
    if (queue->flags & UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY) {
@@ -259,50 +708,140 @@ util_queue_thread_func(void *input)
       u_thread_setname(name);
    }
 
-   while (1) {
+   while (!p_atomic_read(&queue->kill_threads)) {
       struct util_queue_job job;
 
-      mtx_lock(&queue->lock);
-      assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
-
-      /* wait if the queue is empty */
-      while (!queue->kill_threads && queue->num_queued == 0)
-         cnd_wait(&queue->has_queued_cond, &queue->lock);
-
-      if (queue->kill_threads) {
+      if (!util_queue_get_job(queue, worker, &job)) {
+         /* Wait if the queue is empty.  Adding a job increments num_queued
+          * before checking num_sleeping, so either it wakes us up or we
+          * see the job.
+          */
+         mtx_lock(&queue->lock);
+         p_atomic_inc(&queue->num_sleeping);
+         while (!queue->kill_threads && read_counter(&queue->num_queued) == 0)
+            cnd_wait(&queue->has_queued_cond, &queue->lock);
+         p_atomic_dec(&queue->num_sleeping);
          mtx_unlock(&queue->lock);
-         break;
+         continue;
       }
 
-      job = queue->jobs[queue->read_idx];
-      memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
-      queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
+      util_queue_job_taken(queue);
+      util_queue_run_job(queue, worker, &job);
+   }
+
+   return 0;
+}
 
-      queue->num_queued--;
-      cnd_signal(&queue->has_space_cond);
-      mtx_unlock(&queue->lock);
+/* Number of jobs a pump runs before making way for other jobs of the
+ * shared pool.
+ */
+#define UTIL_QUEUE_PUMP_BATCH 16
 
-      if (job.job) {
-         job.execute(job.job, thread_index);
-         util_queue_fence_signal(job.fence);
-         if (job.cleanup)
-            job.cleanup(job.job, thread_index);
-      }
+static enum util_queue_priority
+util_queue_pump_priority(struct util_queue *queue,
+                         enum util_queue_priority priority)
+{
+   if (priority == UTIL_QUEUE_PRIORITY_HIGH)
+      return UTIL_QUEUE_PRIORITY_HIGH;
+
+   return queue->flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY ?
+          UTIL_QUEUE_PRIORITY_LOW : UTIL_QUEUE_PRIORITY_NORMAL;
+}
+
+/* Reserve a worker for a new pump.
+ *
+ * \return NULL if num_threads pumps are running already.  num_active was
+ *         then incremented for a moment, which the caller must tell
+ *         threads waiting for the queue to go idle about.
+ */
+static struct util_queue_worker *
+util_queue_claim_worker(struct util_queue *queue)
+{
+   if (p_atomic_inc_return(&queue->num_active) > (int)queue->num_threads) {
+      p_atomic_dec(&queue->num_active);
+      return NULL;
    }
 
-   /* signal remaining jobs before terminating */
-   mtx_lock(&queue->lock);
-   for (unsigned i = queue->read_idx; i != queue->write_idx;
-        i = (i + 1) % queue->max_jobs) {
-      if (queue->jobs[i].job) {
-         util_queue_fence_signal(queue->jobs[i].fence);
-         queue->jobs[i].job = NULL;
-      }
+   /* Workers are released before num_active is decremented, so one of them
+    * is free.
+    */
+   for (unsigned i = 0; i < queue->num_threads; i++) {
+      if (p_atomic_cmpxchg(&queue->workers[i].busy, 0, 1) == 0)
+         return &queue->workers[i];
    }
-   queue->read_idx = queue->write_idx;
-   queue->num_queued = 0;
+
+   unreachable("no free worker");
+   return NULL;
+}
+
+static void
+util_queue_pump_execute(void *data, int pool_thread_index)
+{
+   struct util_queue_worker *worker = (struct util_queue_worker *)data;
+   struct util_queue *queue = worker->queue;
+   struct util_queue_job job;
+
+   /* Like on threads of the queue, jobs added by the jobs go to the list
+    * of the worker, instead of possibly waiting for room in the queue.
+    */
+   tss_set(worker_key, worker);
+
+   for (unsigned i = 0; i < UTIL_QUEUE_PUMP_BATCH; i++) {
+      if (p_atomic_read(&queue->kill_threads) ||
+          !util_queue_get_job(queue, worker, &job))
+         break;
+
+      util_queue_job_taken(queue);
+      util_queue_run_job(queue, worker, &job);
+   }
+
+   tss_set(worker_key, NULL);
+}
+
+static void util_queue_pump_done(void *data, int pool_thread_index);
+
+static void
+util_queue_pump_submit(struct util_queue_worker *worker,
+                       enum util_queue_priority priority)
+{
+   /* The jobs run by the pump are traced instead of the pump. */
+   util_job_init(&worker->pump, NULL, worker, NULL,
+                 util_queue_pump_execute, util_queue_pump_done, priority);
+   util_job_submit(&worker->pump);
+}
+
+static void
+util_queue_pump_done(void *data, int pool_thread_index)
+{
+   struct util_queue_worker *worker = (struct util_queue_worker *)data;
+   struct util_queue *queue = worker->queue;
+   struct util_queue_worker *next = NULL;
+
+   /* This is under the lock that util_queue_destroy waits with, since the
+    * queue may be gone as soon as num_active drops to zero.
+    *
+    * Releasing the worker before checking num_queued pairs with adding a
+    * job before claiming a worker: either this sees the job, or the
+    * producer gets a worker.
+    */
+   mtx_lock(&queue->lock);
+   p_atomic_set(&worker->busy, 0);
+   p_atomic_dec(&queue->num_active);
+
+   /* A negative index means the shared pool is shutting down. */
+   if (pool_thread_index >= 0 && !queue->kill_threads &&
+       read_counter(&queue->num_queued))
+      next = util_queue_claim_worker(queue);
+
+   if (!next)
+      cnd_broadcast(&queue->has_queued_cond);
    mtx_unlock(&queue->lock);
-   return 0;
+
+   if (next) {
+      util_queue_pump_submit(next,
+                             util_queue_pump_priority(queue,
+                                                      UTIL_QUEUE_PRIORITY_NORMAL));
+   }
 }
 
 bool
@@ -342,41 +881,63 @@ util_queue_init(struct util_queue *queue,
       util_snprintf(queue->name, sizeof(queue->name), "%s", name);
    }
 
+   call_once(&worker_key_once_flag, worker_key_init);
+
+   /* Without threads in the pool, fall back to our own. */
+   if ((flags & UTIL_QUEUE_INIT_SHARED_POOL) && !util_job_pool_num_threads())
+      flags &= ~UTIL_QUEUE_INIT_SHARED_POOL;
+
    queue->flags = flags;
    queue->num_threads = num_threads;
    queue->max_jobs = max_jobs;
 
-   queue->jobs = (struct util_queue_job*)
-                 calloc(max_jobs, sizeof(struct util_queue_job));
-   if (!queue->jobs)
+   queue->lanes = (struct util_queue_lane*)
+                  calloc(UTIL_QUEUE_NUM_PRIORITIES,
+                         sizeof(struct util_queue_lane));
+   if (!queue->lanes)
       goto fail;
 
+   for (i = 0; i < UTIL_QUEUE_NUM_PRIORITIES; i++) {
+      if (!lane_init(&queue->lanes[i], max_jobs))
+         goto fail;
+   }
+
    (void) mtx_init(&queue->lock, mtx_plain);
    (void) mtx_init(&queue->finish_lock, mtx_plain);
 
    queue->num_queued = 0;
    cnd_init(&queue->has_queued_cond);
    cnd_init(&queue->has_space_cond);
+   cnd_init(&queue->finished_cond);
 
+   queue->workers = (struct util_queue_worker*)
+                    calloc(num_threads, sizeof(struct util_queue_worker));
    queue->threads = (thrd_t*) calloc(num_threads, sizeof(thrd_t));
-   if (!queue->threads)
-      goto fail;
+   if (!queue->workers || !queue->threads)
+      goto fail_threads;
 
-   /* start threads */
+   queue->num_workers = num_threads;
    for (i = 0; i < num_threads; i++) {
-      struct thread_input *input =
-         (struct thread_input *) malloc(sizeof(struct thread_input));
-      input->queue = queue;
-      input->thread_index = i;
+      queue->workers[i].queue = queue;
+      queue->workers[i].thread_index = i;
+      (void) mtx_init(&queue->workers[i].lock, mtx_plain);
+   }
 
-      queue->threads[i] = u_thread_create(util_queue_thread_func, input);
+   /* Pumps are started when jobs are added. */
+   if (flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      add_to_atexit_list(queue);
+      return true;
+   }
 
-      if (!queue->threads[i]) {
-         free(input);
+   /* start threads */
+   for (i = 0; i < num_threads; i++) {
+      queue->threads[i] = u_thread_create(util_queue_thread_func,
+                                          &queue->workers[i]);
 
+      if (!queue->threads[i]) {
          if (i == 0) {
             /* no threads created, fail */
-            goto fail;
+            goto fail_threads;
          } else {
             /* at least one thread created, so use it */
             queue->num_threads = i;
@@ -402,14 +963,25 @@ util_queue_init(struct util_queue *queue,
    add_to_atexit_list(queue);
    return true;
 
-fail:
+fail_threads:
+   if (queue->workers) {
+      for (i = 0; i < num_threads; i++)
+         mtx_destroy(&queue->workers[i].lock);
+   }
+   free(queue->workers);
    free(queue->threads);
 
-   if (queue->jobs) {
-      cnd_destroy(&queue->has_space_cond);
-      cnd_destroy(&queue->has_queued_cond);
-      mtx_destroy(&queue->lock);
-      free(queue->jobs);
+   cnd_destroy(&queue->finished_cond);
+   cnd_destroy(&queue->has_space_cond);
+   cnd_destroy(&queue->has_queued_cond);
+   mtx_destroy(&queue->finish_lock);
+   mtx_destroy(&queue->lock);
+
+fail:
+   if (queue->lanes) {
+      for (i = 0; i < UTIL_QUEUE_NUM_PRIORITIES; i++)
+         free(queue->lanes[i].cells);
+      free(queue->lanes);
    }
    /* also util_queue_is_initialized can be used to check for success */
    memset(queue, 0, sizeof(*queue));
@@ -419,45 +991,120 @@ fail:
 static void
 util_queue_killall_and_wait(struct util_queue *queue)
 {
+   struct util_queue_job job;
    unsigned i;
 
    /* Signal all threads to terminate. */
    mtx_lock(&queue->lock);
-   queue->kill_threads = 1;
+   p_atomic_set(&queue->kill_threads, 1);
    cnd_broadcast(&queue->has_queued_cond);
-   mtx_unlock(&queue->lock);
+   cnd_broadcast(&queue->has_space_cond);
+   cnd_broadcast(&queue->finished_cond);
+
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      /* Pumps stop at the next job. */
+      p_atomic_inc(&queue->num_sleeping);
+      while (read_counter(&queue->num_active))
+         cnd_wait(&queue->has_queued_cond, &queue->lock);
+      p_atomic_dec(&queue->num_sleeping);
+      mtx_unlock(&queue->lock);
+   } else {
+      mtx_unlock(&queue->lock);
 
-   for (i = 0; i < queue->num_threads; i++)
-      thrd_join(queue->threads[i], NULL);
+      for (i = 0; i < queue->num_threads; i++)
+         thrd_join(queue->threads[i], NULL);
+   }
    queue->num_threads = 0;
+
+   /* signal remaining jobs */
+   for (i = 0; i < UTIL_QUEUE_NUM_PRIORITIES; i++) {
+      while (lane_get(queue, &queue->lanes[i], &job)) {
+         if (job.fence)
+            util_queue_fence_signal(job.fence);
+      }
+   }
+   for (i = 0; i < queue->num_workers; i++) {
+      while (worker_pop(&queue->workers[i], &job)) {
+         if (job.fence)
+            util_queue_fence_signal(job.fence);
+      }
+   }
+   p_atomic_set(&queue->num_queued, 0);
 }
 
 void
 util_queue_destroy(struct util_queue *queue)
 {
+   unsigned i;
+
    util_queue_killall_and_wait(queue);
    remove_from_atexit_list(queue);
 
+   for (i = 0; i < queue->num_workers; i++) {
+      mtx_destroy(&queue->workers[i].lock);
+      free(queue->workers[i].jobs);
+   }
+   for (i = 0; i < UTIL_QUEUE_NUM_PRIORITIES; i++) {
+      free(queue->lanes[i].cells);
+      free(queue->lanes[i].overflow);
+   }
+
+   cnd_destroy(&queue->finished_cond);
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    mtx_destroy(&queue->finish_lock);
    mtx_destroy(&queue->lock);
-   free(queue->jobs);
+   free(queue->lanes);
+   free(queue->workers);
    free(queue->threads);
 }
 
-void
-util_queue_add_job(struct util_queue *queue,
-                   void *job,
-                   struct util_queue_fence *fence,
-                   util_queue_execute_func execute,
-                   util_queue_execute_func cleanup)
+/* Reserve a slot for a new job, waiting until there is one if needed.
+ *
+ * \return false if the queue is being destroyed.
+ */
+static bool
+util_queue_reserve(struct util_queue *queue)
 {
-   struct util_queue_job *ptr;
+   if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL) {
+      p_atomic_inc(&queue->num_queued);
+      return true;
+   }
 
-   mtx_lock(&queue->lock);
-   if (queue->kill_threads) {
+   while (p_atomic_inc_return(&queue->num_queued) > queue->max_jobs) {
+      p_atomic_dec(&queue->num_queued);
+
+      /* Wait until there is a free slot. */
+      mtx_lock(&queue->lock);
+      p_atomic_inc(&queue->num_waiting);
+      while (!queue->kill_threads &&
+             read_counter(&queue->num_queued) >= queue->max_jobs)
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+      p_atomic_dec(&queue->num_waiting);
+
+      /* Another producer may be waiting on our transient reservation. */
+      cnd_broadcast(&queue->has_space_cond);
       mtx_unlock(&queue->lock);
+
+      if (p_atomic_read(&queue->kill_threads))
+         return false;
+   }
+
+   return true;
+}
+
+void
+util_queue_add_job_with_priority(struct util_queue *queue,
+                                 void *job,
+                                 struct util_queue_fence *fence,
+                                 util_queue_execute_func execute,
+                                 util_queue_execute_func cleanup,
+                                 enum util_queue_priority priority)
+{
+   struct util_queue_worker *worker;
+   struct util_queue_job entry;
+
+   if (p_atomic_read(&queue->kill_threads)) {
       /* well no good option here, but any leaks will be
        * short-lived as things are shutting down..
        */
@@ -466,53 +1113,96 @@ util_queue_add_job(struct util_queue *queue,
 
    util_queue_fence_reset(fence);
 
-   assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
+   entry.job = job;
+   entry.fence = fence;
+   entry.execute = execute;
+   entry.cleanup = cleanup;
+   entry.priority = priority;
+   entry.add_time = util_job_trace_enabled() ? os_time_get_nano() : 0;
+
+   worker = (struct util_queue_worker *) tss_get(worker_key);
+   if (worker && worker->queue != queue)
+      worker = NULL;
+
+   entry.generation = util_queue_job_added(queue, worker);
+
+   if (worker && queue->num_threads > 1 &&
+       priority == UTIL_QUEUE_PRIORITY_NORMAL) {
+      /* Don't block here: the jobs that would make room may be waiting on
+       * this very thread.
+       */
+      p_atomic_inc(&queue->num_queued);
+      worker_push(worker, &entry);
+   } else {
+      struct util_queue_lane *lane = &queue->lanes[priority];
 
-   if (queue->num_queued == queue->max_jobs) {
-      if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL) {
-         /* If the queue is full, make it larger to avoid waiting for a free
-          * slot.
+      if (!util_queue_reserve(queue)) {
+         util_queue_job_finished(queue, entry.generation);
+         return;
+      }
+
+      if (p_atomic_read(&lane->num_overflow) || !lane_push(lane, &entry)) {
+         /* Reservations stop at max_jobs, which fits in the ring, but a
+          * consumer that took a job and hasn't released its cell yet can
+          * still make the ring look full after later jobs were taken.
           */
-         unsigned new_max_jobs = queue->max_jobs + 8;
-         struct util_queue_job *jobs =
-            (struct util_queue_job*)calloc(new_max_jobs,
-                                           sizeof(struct util_queue_job));
-         assert(jobs);
-
-         /* Copy all queued jobs into the new list. */
-         unsigned num_jobs = 0;
-         unsigned i = queue->read_idx;
-
-         do {
-            jobs[num_jobs++] = queue->jobs[i];
-            i = (i + 1) % queue->max_jobs;
-         } while (i != queue->write_idx);
-
-         assert(num_jobs == queue->num_queued);
-
-         free(queue->jobs);
-         queue->jobs = jobs;
-         queue->read_idx = 0;
-         queue->write_idx = num_jobs;
-         queue->max_jobs = new_max_jobs;
-      } else {
-         /* Wait until there is a free slot. */
-         while (queue->num_queued == queue->max_jobs)
-            cnd_wait(&queue->has_space_cond, &queue->lock);
+         overflow_push(queue, lane, &entry);
       }
    }
 
-   ptr = &queue->jobs[queue->write_idx];
-   assert(ptr->job == NULL);
-   ptr->job = job;
-   ptr->fence = fence;
-   ptr->execute = execute;
-   ptr->cleanup = cleanup;
-   queue->write_idx = (queue->write_idx + 1) % queue->max_jobs;
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      struct util_queue_worker *pump = util_queue_claim_worker(queue);
 
-   queue->num_queued++;
-   cnd_signal(&queue->has_queued_cond);
-   mtx_unlock(&queue->lock);
+      if (pump) {
+         util_queue_pump_submit(pump, util_queue_pump_priority(queue,
+                                                               priority));
+      } else if (unlikely(read_counter(&queue->num_sleeping))) {
+         /* Someone waiting for the queue to go idle may have seen the
+          * failed claim.
+          */
+         mtx_lock(&queue->lock);
+         cnd_broadcast(&queue->has_queued_cond);
+         mtx_unlock(&queue->lock);
+      }
+   } else if (read_counter(&queue->num_sleeping)) {
+      mtx_lock(&queue->lock);
+      cnd_signal(&queue->has_queued_cond);
+      mtx_unlock(&queue->lock);
+   }
+}
+
+void
+util_queue_add_job(struct util_queue *queue,
+                   void *job,
+                   struct util_queue_fence *fence,
+                   util_queue_execute_func execute,
+                   util_queue_execute_func cleanup)
+{
+   util_queue_add_job_with_priority(queue, job, fence, execute, cleanup,
+                                    UTIL_QUEUE_PRIORITY_NORMAL);
+}
+
+/* Drop the job of \p fence from \p jobs, if it's there.  The caller must
+ * hold the lock protecting \p jobs.
+ */
+static bool
+drop_locked_job(struct util_queue_job *jobs, unsigned first, unsigned count,
+                unsigned size, struct util_queue_fence *fence)
+{
+   for (unsigned i = 0; i < count; i++) {
+      struct util_queue_job *job = &jobs[(first + i) % size];
+
+      if (job->fence == fence) {
+         if (job->cleanup)
+            job->cleanup(job->job, -1);
+
+         /* Just clear it. The threads will treat as a no-op job. */
+         job->fence = NULL;
+         return true;
+      }
+   }
+
+   return false;
 }
 
 /**
@@ -533,20 +1223,49 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
-   mtx_lock(&queue->lock);
-   for (unsigned i = queue->read_idx; i != queue->write_idx;
-        i = (i + 1) % queue->max_jobs) {
-      if (queue->jobs[i].fence == fence) {
-         if (queue->jobs[i].cleanup)
-            queue->jobs[i].cleanup(queue->jobs[i].job, -1);
+   for (unsigned i = 0; i < UTIL_QUEUE_NUM_PRIORITIES && !removed; i++) {
+      struct util_queue_lane *lane = &queue->lanes[i];
 
-         /* Just clear it. The threads will treat as a no-op job. */
-         memset(&queue->jobs[i], 0, sizeof(queue->jobs[i]));
-         removed = true;
+      for (unsigned j = 0; lane->cells && j <= lane->mask; j++) {
+         struct util_queue_job *job = &lane->cells[j].job;
+
+         if (p_atomic_read(&job->fence) != fence)
+            continue;
+
+         /* The fence is written last, so the rest of the job is valid,
+          * unless the job was taken meanwhile.  Claiming it tells.
+          */
+         void *data = job->job;
+         util_queue_execute_func cleanup = job->cleanup;
+
+         if (p_atomic_cmpxchg(&job->fence, fence, NULL) == fence) {
+            if (cleanup)
+               cleanup(data, -1);
+            removed = true;
+         }
          break;
       }
+
+      if (!removed && p_atomic_read(&lane->num_overflow)) {
+         mtx_lock(&queue->lock);
+         removed = drop_locked_job(lane->overflow, lane->overflow_read,
+                                   lane->num_overflow, lane->overflow_size,
+                                   fence);
+         mtx_unlock(&queue->lock);
+      }
+   }
+
+   for (unsigned i = 0; i < queue->num_threads && !removed; i++) {
+      struct util_queue_worker *worker = &queue->workers[i];
+
+      if (p_atomic_read(&worker->num_jobs) == 0)
+         continue;
+
+      mtx_lock(&worker->lock);
+      removed = drop_locked_job(worker->jobs, worker->front, worker->num_jobs,
+                                worker->size, fence);
+      mtx_unlock(&worker->lock);
    }
-   mtx_unlock(&queue->lock);
 
    if (removed)
       util_queue_fence_signal(fence);
@@ -554,51 +1273,41 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
       util_queue_fence_wait(fence);
 }
 
-static void
-util_queue_finish_execute(void *data, int num_thread)
-{
-   util_barrier *barrier = data;
-   util_barrier_wait(barrier);
-}
-
 /**
- * Wait until all previously added jobs have completed.
+ * Wait until all previously added jobs have completed, as well as the jobs
+ * they add in turn.
  */
 void
 util_queue_finish(struct util_queue *queue)
 {
-   util_barrier barrier;
-   struct util_queue_fence *fences = malloc(queue->num_threads * sizeof(*fences));
-
-   util_barrier_init(&barrier, queue->num_threads);
+   unsigned generation;
 
-   /* If 2 threads were adding jobs for 2 different barries at the same time,
-    * a deadlock would happen, because 1 barrier requires that all threads
-    * wait for it exclusively.
-    */
+   /* Only one generation can be waited for at a time. */
    mtx_lock(&queue->finish_lock);
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_init(&fences[i]);
-      util_queue_add_job(queue, &barrier, &fences[i], util_queue_finish_execute, NULL);
-   }
+   /* Jobs added from now on go to the other counter. */
+   generation = (p_atomic_inc_return(&queue->generation) - 1) & 1;
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_wait(&fences[i]);
-      util_queue_fence_destroy(&fences[i]);
-   }
-   mtx_unlock(&queue->finish_lock);
-
-   util_barrier_destroy(&barrier);
+   /* Finishing a job decrements its counter before checking num_finishing,
+    * so either it wakes us up or we see the counter drop.
+    */
+   mtx_lock(&queue->lock);
+   p_atomic_inc(&queue->num_finishing);
+   while (!queue->kill_threads &&
+          read_counter(&queue->num_unfinished[generation]))
+      cnd_wait(&queue->finished_cond, &queue->lock);
+   p_atomic_dec(&queue->num_finishing);
+   mtx_unlock(&queue->lock);
 
-   free(fences);
+   mtx_unlock(&queue->finish_lock);
 }
 
 int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
    /* Allow some flexibility by not raising an error. */
-   if (thread_index >= queue->num_threads)
+   if (thread_index >= queue->num_threads ||
+       (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL))
       return 0;
 
    return u_thread_get_time_nano(queue->threads[thread_index]);
@@ -49,6 +49,14 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+/* Run the jobs on the process-wide pool of u_job.h instead of threads of
+ * the queue's own.  At most num_threads jobs of the queue run at the same
+ * time, and thread_index is still below num_threads.  The jobs mustn't wait
+ * for other jobs running on the pool, and the thread scheduling flags are
+ * ignored: UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY makes the queue use the low
+ * priority of the pool instead.
+ */
+#define UTIL_QUEUE_INIT_SHARED_POOL               (1 << 3)
 
 #if defined(__GNUC__) && defined(HAVE_LINUX_FUTEX_H)
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -191,28 +199,49 @@ util_queue_fence_wait_timeout(struct util_queue_fence *fence,
 
 typedef void (*util_queue_execute_func)(void *job, int thread_index);
 
+enum util_queue_priority {
+   UTIL_QUEUE_PRIORITY_HIGH,
+   UTIL_QUEUE_PRIORITY_NORMAL,
+   UTIL_QUEUE_PRIORITY_LOW,
+   UTIL_QUEUE_NUM_PRIORITIES,
+};
+
 struct util_queue_job {
    void *job;
    struct util_queue_fence *fence;
    util_queue_execute_func execute;
    util_queue_execute_func cleanup;
+   enum util_queue_priority priority;
+   unsigned generation; /* for util_queue_finish */
+   int64_t add_time; /* only set when tracing */
 };
 
+struct util_queue_lane;
+struct util_queue_worker;
+
 /* Put this into your context. */
 struct util_queue {
    char name[14]; /* 13 characters = the thread name without the index */
    mtx_t finish_lock; /* only for util_queue_finish */
-   mtx_t lock;
-   cnd_t has_queued_cond;
+   mtx_t lock; /* only for sleeping, waking up and overflow lists */
+   cnd_t has_queued_cond; /* or idle, for UTIL_QUEUE_INIT_SHARED_POOL */
    cnd_t has_space_cond;
+   cnd_t finished_cond; /* a generation of jobs finished */
    thrd_t *threads;
    unsigned flags;
-   int num_queued;
+   int num_queued; /* the following counters are updated atomically */
+   int num_sleeping; /* threads waiting for has_queued_cond */
+   int num_waiting; /* producers waiting for has_space_cond */
+   int num_active; /* jobs running the queue on the shared pool */
+   int num_finishing; /* threads in util_queue_finish */
+   int num_unfinished[2]; /* jobs of each generation, see u_queue.c */
+   unsigned generation; /* incremented by util_queue_finish */
    unsigned num_threads;
+   unsigned num_workers;
    int kill_threads;
    int max_jobs;
-   int write_idx, read_idx; /* ring buffer pointers */
-   struct util_queue_job *jobs;
+   struct util_queue_lane *lanes; /* one per priority */
+   struct util_queue_worker *workers; /* one per thread */
 
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
@@ -231,6 +260,19 @@ void util_queue_add_job(struct util_queue *queue,
                         struct util_queue_fence *fence,
                         util_queue_execute_func execute,
                         util_queue_execute_func cleanup);
+/* Like util_queue_add_job.  Threads run high priority jobs before anything
+ * else and low priority jobs only when nothing else is queued.  Jobs of the
+ * same priority run in order, except that normal priority jobs added by one
+ * of the queue's own threads are run by that thread (or stolen by another
+ * idle thread) ahead of the others.  These still run in the order they were
+ * added.
+ */
+void util_queue_add_job_with_priority(struct util_queue *queue,
+                                      void *job,
+                                      struct util_queue_fence *fence,
+                                      util_queue_execute_func execute,
+                                      util_queue_execute_func cleanup,
+                                      enum util_queue_priority priority);
 void util_queue_drop_job(struct util_queue *queue,
                          struct util_queue_fence *fence);
 
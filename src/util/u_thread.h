@@ -92,6 +92,30 @@ util_pin_thread_to_L3(thrd_t thread, unsigned L3_index, unsigned cores_per_L3)
 #endif
 }
 
+/**
+ * Pin a thread to an arbitrary set of CPUs, e.g. all the CPUs of a socket,
+ * which don't need to be numbered contiguously.
+ *
+ * \param thread         thread
+ * \param mask           bit mask of the CPUs the thread may run on
+ * \param num_mask_bits  number of bits in the mask
+ */
+static inline void
+util_set_thread_affinity(thrd_t thread, const uint32_t *mask,
+                         unsigned num_mask_bits)
+{
+#if defined(HAVE_PTHREAD_SETAFFINITY)
+   cpu_set_t cpuset;
+
+   CPU_ZERO(&cpuset);
+   for (unsigned i = 0; i < num_mask_bits && i < CPU_SETSIZE; i++) {
+      if (mask[i / 32] & (1u << (i % 32)))
+         CPU_SET(i, &cpuset);
+   }
+   pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
+#endif
+}
+
 /**
  * Return the index of L3 that the thread is pinned to. If the thread is
  * pinned to multiple L3 caches, return -1.